@@ -282,6 +282,22 @@ static const JSMallocFunctions trace_mf = {
 
 #define PROG_NAME "qjs"
 
+#ifdef CONFIG_PROFILE_OPCODES
+static void write_profile(JSRuntime *rt, const char *filename)
+{
+    FILE *f;
+
+    f = fopen(filename, "w");
+    if (!f) {
+        perror(filename);
+        return;
+    }
+    if (JS_DumpOpcodeProfile(rt, f) < 0)
+        fprintf(stderr, "qjs: could not write the opcode profile\n");
+    fclose(f);
+}
+#endif
+
 void help(void)
 {
     printf("QuickJS version " QUICKJS_VERSION "\n"
@@ -301,6 +317,12 @@ void help(void)
            "-d  --dump         dump the memory usage stats\n"
            "    --memory-limit n       limit the memory usage to 'n' bytes\n"
            "    --stack-size n         limit the stack size to 'n' bytes\n"
+#ifdef CONFIG_JIT
+           "    --jit n                compile the functions to native code after 'n' calls\n"
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+           "    --profile-out file     write the opcode profile to 'file'\n"
+#endif
            "    --unhandled-rejection  dump unhandled promise rejections\n"
            "-q  --quit         just instantiate the interpreter and quit\n");
     exit(1);
@@ -327,6 +349,12 @@ int main(int argc, char **argv)
     int load_jscalc;
 #endif
     size_t stack_size = 0;
+#ifdef CONFIG_JIT
+    int jit_threshold = 0;
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+    const char *profile_filename = NULL;
+#endif
     
 #ifdef CONFIG_BIGNUM
     /* load jscalc runtime if invoked as 'qjscalc' */
@@ -447,6 +475,31 @@ int main(int argc, char **argv)
                 stack_size = (size_t)strtod(argv[optind++], NULL);
                 continue;
             }
+#ifdef CONFIG_JIT
+            if (!strcmp(longopt, "jit")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting number of calls");
+                    exit(1);
+                }
+                jit_threshold = atoi(argv[optind++]);
+                continue;
+            }
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+            if (!strncmp(longopt, "profile-out", 11) &&
+                (longopt[11] == '\0' || longopt[11] == '=')) {
+                if (longopt[11] == '=') {
+                    profile_filename = longopt + 12;
+                } else {
+                    if (optind >= argc) {
+                        fprintf(stderr, "expecting filename");
+                        exit(1);
+                    }
+                    profile_filename = argv[optind++];
+                }
+                continue;
+            }
+#endif
             if (opt) {
                 fprintf(stderr, "qjs: unknown option '-%c'\n", opt);
             } else {
@@ -473,6 +526,9 @@ int main(int argc, char **argv)
         JS_SetMemoryLimit(rt, memory_limit);
     if (stack_size != 0)
         JS_SetMaxStackSize(rt, stack_size);
+#ifdef CONFIG_JIT
+    JS_SetJITThreshold(rt, jit_threshold);
+#endif
     js_std_set_worker_new_context_func(JS_NewCustomContext);
     js_std_init_handlers(rt);
     ctx = JS_NewCustomContext(rt);
@@ -535,6 +591,10 @@ int main(int argc, char **argv)
         JS_ComputeMemoryUsage(rt, &stats);
         JS_DumpMemoryUsage(stdout, &stats, rt);
     }
+#ifdef CONFIG_PROFILE_OPCODES
+    if (profile_filename)
+        write_profile(rt, profile_filename);
+#endif
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
     JS_FreeRuntime(rt);
@@ -565,6 +625,10 @@ int main(int argc, char **argv)
     }
     return 0;
  fail:
+#ifdef CONFIG_PROFILE_OPCODES
+    if (profile_filename)
+        write_profile(rt, profile_filename);
+#endif
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
     JS_FreeRuntime(rt);
@@ -443,6 +443,11 @@ static int output_executable(const char *out_filename, const char *cfilename,
        libraries */
     *arg++ = "-D";
     *arg++ = "_GNU_SOURCE";
+#ifdef JS_STRICT_NAN_BOXING
+    /* same JSValue layout as libquickjs (set by CONFIG_JIT) */
+    *arg++ = "-D";
+    *arg++ = "JS_STRICT_NAN_BOXING";
+#endif
     *arg++ = "-I";
     *arg++ = inc_dir;
     *arg++ = "-o";
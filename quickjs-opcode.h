@@ -53,6 +53,7 @@ FMT(atom_u16)
 FMT(atom_label_u8)
 FMT(atom_label_u16)
 FMT(label_u16)
+FMT(loc_i32_label)
 #undef FMT
 #endif /* FMT */
 
@@ -363,6 +364,13 @@ DEF(   is_undefined, 1, 1, 1, none)
 DEF(        is_null, 1, 1, 1, none)
 DEF(typeof_is_undefined, 1, 1, 1, none)
 DEF( typeof_is_function, 1, 1, 1, none)
+
+/* superinstructions: frequent sequences fused by resolve_labels() */
+DEF(  get_loc_field, 7, 0, 1, atom_u16) /* get_loc(idx) get_field(atom) */
+DEF(  get_arg_field, 7, 0, 1, atom_u16) /* get_arg(idx) get_field(atom) */
+DEF(get_field_call0, 5, 1, 1, atom) /* get_field2(atom) call_method(0) */
+DEF(    lt_if_false, 5, 2, 0, label) /* lt if_false(label) */
+DEF(get_loc_i32_lt_if_false, 11, 0, 0, loc_i32_label) /* get_loc(idx) push_i32(val) lt if_false(label) */
 #endif
 
 #undef DEF
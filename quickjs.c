@@ -80,6 +80,17 @@
 #define CONFIG_STACK_CHECK
 #endif
 
+/* the baseline compiler (CONFIG_JIT) generates x86-64 code and depends on
+   the layout of the NaN boxed values */
+#ifdef CONFIG_JIT
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "CONFIG_JIT is only supported on x86-64 Linux"
+#endif
+#ifndef JS_STRICT_NAN_BOXING
+#error "CONFIG_JIT requires JS_STRICT_NAN_BOXING"
+#endif
+#endif
+
 #ifndef PRId64
 #define PRId64       "lld"
 #endif
@@ -111,6 +122,9 @@
 //#define DUMP_OBJECTS    /* dump objects in JS_FreeContext */
 //#define DUMP_ATOMS      /* dump atoms in JS_FreeContext */
 //#define DUMP_SHAPES     /* dump shapes in JS_FreeContext */
+/* dump the most frequent pairs and triples of consecutive opcodes of the
+   compiled functions in JS_FreeRuntime */
+//#define DUMP_OPCODE_SEQUENCES
 //#define DUMP_MODULE_RESOLVE
 //#define DUMP_PROMISE
 //#define DUMP_READ_OBJECT
@@ -124,6 +138,10 @@
 #include <errno.h>
 #endif
 
+#ifdef CONFIG_JIT
+#include <sys/mman.h>
+#endif
+
 enum {
     /* classid tag        */    /* union usage   | properties */
     JS_CLASS_OBJECT = 1,        /* must be first */
@@ -288,6 +306,21 @@ struct JSRuntime {
 
     JSInterruptHandler *interrupt_handler;
     void *interrupt_opaque;
+#ifdef CONFIG_JIT
+    /* functions are compiled after this number of calls, 0 if disabled */
+    int jit_threshold;
+#endif
+#ifdef DUMP_OPCODE_SEQUENCES
+    /* hash table of the opcode pair and triple counts */
+    struct JSOpSeqCount *op_seq_tab;
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+    struct list_head profile_list; /* list of JSOpProfileFunc.link */
+    /* self cycles of the last executed instruction, NULL if no
+       bytecode function is running */
+    uint64_t *profile_cur;
+    uint64_t profile_time; /* start time of the last executed instruction */
+#endif
 
     JSHostPromiseRejectionTracker *host_promise_rejection_tracker;
     void *host_promise_rejection_tracker_opaque;
@@ -604,6 +637,49 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* Inline caches of get_field, get_field2 and put_field. An entry remembers
+   where the property was found for a given shape of the object: in its own
+   properties or in its direct prototype. Only hashed shapes are cached and
+   the cache keeps a reference to them, so they are never modified (a shared
+   hashed shape is cloned before modification) and their addresses are not
+   reused while they are cached. */
+#define JS_IC_MAX_ENTRIES 4  /* polymorphic sites */
+#define JS_IC_MAX_MISSES  64 /* megamorphic: the entries are no longer updated */
+
+typedef struct JSInlineCacheEntry {
+    JSShape *shape; /* shape of the object */
+    JSShape *proto_shape; /* shape of the prototype holding the property,
+                             NULL for own properties */
+    uint32_t prop_index;
+} JSInlineCacheEntry;
+
+typedef struct JSInlineCache {
+    JSAtom atom;
+    uint8_t count;
+    uint8_t misses;
+    JSInlineCacheEntry *entries; /* JS_IC_MAX_ENTRIES, allocated on first miss */
+} JSInlineCache;
+
+/* Caches of the global variable accesses (get_var, put_var...): the index
+   of the property in global_var_obj (let/const) or in the global object.
+   The index is checked at each access with the atom and flags of the shape
+   property at that index, so deleted, moved or reconfigured properties are
+   detected without invalidation. global_var_obj is internal and only grows:
+   its property count tells if a lexical variable now shadows a cached
+   property of the global object. */
+typedef enum {
+    JS_GLOBAL_CACHE_NONE,
+    JS_GLOBAL_CACHE_LEXICAL, /* property of global_var_obj */
+    JS_GLOBAL_CACHE_OBJECT,  /* own property of global_obj */
+} JSGlobalCacheKindEnum;
+
+typedef struct JSGlobalVarCache {
+    JSAtom atom;
+    uint8_t kind;
+    uint32_t prop_index;
+    uint32_t var_count; /* property count of global_var_obj */
+} JSGlobalVarCache;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -634,6 +710,24 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    /* if not NULL, the atom operands of get_field, get_field2,
+       put_field and of their superinstructions are replaced by indexes
+       in this array */
+    JSInlineCache *ic;
+    int ic_count;
+    /* same for check_var, get_var, get_var_undef, put_var and
+       put_var_strict */
+    JSGlobalVarCache *global_cache;
+    int global_cache_count;
+#ifdef CONFIG_JIT
+    /* number of calls before the compilation, -1 if it failed */
+    int jit_call_count;
+    void *jit_code; /* native code, NULL if not compiled */
+    size_t jit_size;
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+    struct JSOpProfileFunc *profile; /* NULL if not executed yet */
+#endif
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -891,16 +985,20 @@ struct JSShape {
 struct JSStorage;
 struct JSPersitentBlock {
   struct JSStorage* storage;
-  uint32_t oid; /* dybase object id */
+  JS_PERSISTENT_OID oid; /* dybase object id */
   JS_PERSISTENT_STATUS status;
+  uint32_t size : 31; /* estimated memory taken by the loaded data, maintained by the storage */
+  uint32_t accessed : 1; /* set on access, cleared by the storage when it looks for objects to unload */
 };
 
 int js_load_persistent_object(JSContext *ctx, JSValueConst obj);
+int js_modify_persistent_object(JSContext *ctx, JSValueConst obj);
 int js_free_persistent_object(JSRuntime *rt, JSValueConst obj);
 
+/* storage is notified only on transition to MODIFIED so it can put the object in its dirty set */
 #define MARK_MODIFIED_OBJ(p) \
-  if (p->persistent) \
-    p->persistent->status = JS_PERSISTENT_MODIFIED;
+  if (p->persistent && (p->persistent->status != JS_PERSISTENT_MODIFIED)) \
+    js_modify_persistent_object(ctx, JS_MKPTR(JS_TAG_OBJECT, p));
 
 #define MARK_MODIFIED_VALUE(obj) \
   if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) { \
@@ -908,9 +1006,17 @@ int js_free_persistent_object(JSRuntime *rt, JSValueConst obj);
     MARK_MODIFIED_OBJ(p); \
   }
 
+/* access of persistent object is recorded so the storage can unload objects which are not used recently */
+#define MARK_ACCESSED_OBJ(p) \
+  if (p->persistent) \
+    p->persistent->accessed = 1;
+
 #define PRELOAD_PERSISTENT_OBJ(p) \
-    if (p->persistent && (p->persistent->status == JS_PERSISTENT_DORMANT)) \
-      js_load_persistent_object(ctx, JS_MKPTR(JS_TAG_OBJECT, p));
+    if (p->persistent) { \
+      p->persistent->accessed = 1; \
+      if (p->persistent->status == JS_PERSISTENT_DORMANT) \
+        js_load_persistent_object(ctx, JS_MKPTR(JS_TAG_OBJECT, p)); \
+    }
 
 #define PRELOAD_PERSISTENT_VALUE(obj) \
   if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) { \
@@ -921,6 +1027,7 @@ int js_free_persistent_object(JSRuntime *rt, JSValueConst obj);
 #else 
 #define MARK_MODIFIED_OBJ(p);
 #define MARK_MODIFIED_VALUE(obj);
+#define MARK_ACCESSED_OBJ(p);
 #define PRELOAD_PERSISTENT_OBJ(p);
 #define PRELOAD_PERSISTENT_VALUE(p);
 #endif // CONFIG_STORAGE
@@ -1066,6 +1173,13 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+#ifdef DUMP_OPCODE_SEQUENCES
+static void js_dump_opcode_sequences(JSRuntime *rt);
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+static void js_profile_free_func(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_profile_free(JSRuntime *rt);
+#endif
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1695,6 +1809,9 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     init_list_head(&rt->gc_zero_ref_count_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
 
+#ifdef CONFIG_PROFILE_OPCODES
+    init_list_head(&rt->profile_list);
+#endif
 #ifdef DUMP_LEAKS
     init_list_head(&rt->string_list);
 #endif
@@ -1925,6 +2042,13 @@ void JS_SetCanBlock(JSRuntime *rt, BOOL can_block)
     rt->can_block = can_block;
 }
 
+void JS_SetJITThreshold(JSRuntime *rt, int threshold)
+{
+#ifdef CONFIG_JIT
+    rt->jit_threshold = max_int(threshold, 0);
+#endif
+}
+
 void JS_SetSharedArrayBufferFunctions(JSRuntime *rt,
                                       const JSSharedArrayBufferFunctions *sf)
 {
@@ -2073,6 +2197,12 @@ void JS_FreeRuntime(JSRuntime *rt)
 
     JS_RunGC(rt);
 
+#ifdef DUMP_OPCODE_SEQUENCES
+    js_dump_opcode_sequences(rt);
+#endif
+#ifdef CONFIG_PROFILE_OPCODES
+    js_profile_free(rt);
+#endif
 #ifdef DUMP_LEAKS
     /* leaking objects */
     {
@@ -5850,6 +5980,15 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             }
             if (b->realm)
                 mark_func(rt, &b->realm->header);
+            for(i = 0; i < b->ic_count; i++) {
+                JSInlineCache *ic = &b->ic[i];
+                int j;
+                for(j = 0; j < ic->count; j++) {
+                    mark_func(rt, &ic->entries[j].shape->header);
+                    if (ic->entries[j].proto_shape)
+                        mark_func(rt, &ic->entries[j].proto_shape->header);
+                }
+            }
         }
         break;
     case JS_GC_OBJ_TYPE_VAR_REF:
@@ -6078,6 +6217,20 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
+    if (b->global_cache) {
+        memory_used_count++;
+        js_func_size += b->global_cache_count * sizeof(*b->global_cache);
+    }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += b->ic_count * sizeof(*b->ic);
+        for (i = 0; i < b->ic_count; i++) {
+            if (b->ic[i].entries) {
+                memory_used_count++;
+                js_func_size += JS_IC_MAX_ENTRIES * sizeof(*b->ic[i].entries);
+            }
+        }
+    }
     if (b->has_debug) {
         js_func_size += sizeof(*b) - offsetof(JSFunctionBytecode, debug);
         if (b->debug.source) {
@@ -8090,6 +8243,7 @@ static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
         switch(p->class_id) {
         case JS_CLASS_ARRAY:
         case JS_CLASS_ARGUMENTS:
+            MARK_ACCESSED_OBJ(p);
             return JS_DupValue(ctx, p->u.array.u.values[idx]);
         case JS_CLASS_INT8_ARRAY:
             return JS_NewInt32(ctx, p->u.array.u.int8_ptr[idx]);
@@ -16521,6 +16675,234 @@ JS_BOOL JS_AreFunctionsOfSameOrigin(JSContext *ctx, JSValue f1, JSValue f2) {
   return p1->u.func.function_bytecode == p2->u.func.function_bytecode; /* what about native functions ? */
 }
 
+/* return the property of 'p' cached in 'ic' or NULL */
+static force_inline JSProperty *js_ic_find(JSInlineCache *ic, JSObject *p)
+{
+    JSShape *sh = p->shape;
+    JSInlineCacheEntry *e;
+    JSObject *proto;
+    int i;
+
+    for(i = 0; i < ic->count; i++) {
+        e = &ic->entries[i];
+        if (e->shape == sh) {
+            if (!e->proto_shape)
+                return &p->prop[e->prop_index];
+            proto = sh->proto;
+            if (proto->shape == e->proto_shape)
+                return &proto->prop[e->prop_index];
+        }
+    }
+    return NULL;
+}
+
+/* add an entry for the current shape of 'p' after a miss */
+static void js_ic_update(JSContext *ctx, JSInlineCache *ic, JSObject *p,
+                         BOOL is_put)
+{
+    JSShape *sh, *proto_sh;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSObject *proto;
+    JSInlineCacheEntry *e;
+
+    if (ic->misses >= JS_IC_MAX_MISSES)
+        return;
+    ic->misses++;
+    sh = p->shape;
+    if (!sh->is_hashed)
+        return;
+    proto_sh = NULL;
+    prs = find_own_property(&pr, p, ic->atom);
+    if (prs) {
+        if (is_put) {
+            if ((prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                               JS_PROP_LENGTH)) != JS_PROP_WRITABLE)
+                return;
+        } else {
+            if (prs->flags & JS_PROP_TMASK)
+                return;
+        }
+    } else {
+        /* exotic objects can have properties which are not in the shape */
+        proto = sh->proto;
+        if (is_put || p->is_exotic || !proto || !proto->shape->is_hashed)
+            return;
+        prs = find_own_property(&pr, proto, ic->atom);
+        if (!prs || (prs->flags & JS_PROP_TMASK))
+            return;
+        proto_sh = proto->shape;
+    }
+    if (!ic->entries) {
+        ic->entries = js_malloc_rt(ctx->rt, sizeof(ic->entries[0]) *
+                                   JS_IC_MAX_ENTRIES);
+        if (!ic->entries) {
+            ic->misses = JS_IC_MAX_MISSES;
+            return;
+        }
+    }
+    if (ic->count < JS_IC_MAX_ENTRIES) {
+        e = &ic->entries[ic->count++];
+    } else {
+        e = &ic->entries[ic->misses % JS_IC_MAX_ENTRIES];
+        js_free_shape(ctx->rt, e->shape);
+        js_free_shape_null(ctx->rt, e->proto_shape);
+    }
+    e->shape = js_dup_shape(sh);
+    e->proto_shape = proto_sh ? js_dup_shape(proto_sh) : NULL;
+    e->prop_index = prs - get_shape_prop(proto_sh ? proto_sh : sh);
+}
+
+static force_inline JSValue js_ic_get_field(JSContext *ctx, JSInlineCache *ic,
+                                            JSValueConst obj)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSValue val;
+
+    if (unlikely(JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT))
+        return JS_GetProperty(ctx, obj, ic->atom);
+    p = JS_VALUE_GET_OBJ(obj);
+    PRELOAD_PERSISTENT_OBJ(p);
+    pr = js_ic_find(ic, p);
+    if (likely(pr))
+        return JS_DupValue(ctx, pr->u.value);
+    val = JS_GetProperty(ctx, obj, ic->atom);
+    if (!JS_IsException(val))
+        js_ic_update(ctx, ic, p, FALSE);
+    return val;
+}
+
+/* 'val' is freed */
+static force_inline int js_ic_put_field(JSContext *ctx, JSInlineCache *ic,
+                                         JSValueConst obj, JSValue val)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSShape *sh;
+    int ret;
+
+    if (unlikely(JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT))
+        return JS_SetPropertyInternal(ctx, obj, ic->atom, val,
+                                      JS_PROP_THROW_STRICT);
+    p = JS_VALUE_GET_OBJ(obj);
+    MARK_MODIFIED_OBJ(p);
+    pr = js_ic_find(ic, p);
+    if (likely(pr)) {
+        set_value(ctx, &pr->u.value, val);
+        return TRUE;
+    }
+    sh = p->shape;
+    ret = JS_SetPropertyInternal(ctx, obj, ic->atom, val,
+                                 JS_PROP_THROW_STRICT);
+    /* a new property changes the shape: the previous one is not cached */
+    if (ret >= 0 && p->shape == sh)
+        js_ic_update(ctx, ic, p, TRUE);
+    return ret;
+}
+
+/* return the property of the global variable cached in 'gc' or NULL */
+static force_inline JSProperty *js_global_cache_find(JSContext *ctx,
+                                                     JSGlobalVarCache *gc,
+                                                     JSShapeProperty **pprs)
+{
+    JSObject *p;
+    JSShape *sh;
+    JSShapeProperty *prs;
+
+    p = JS_VALUE_GET_OBJ(ctx->global_var_obj);
+    if (gc->kind == JS_GLOBAL_CACHE_OBJECT) {
+        if (unlikely(p->shape->prop_count != gc->var_count))
+            return NULL;
+        p = JS_VALUE_GET_OBJ(ctx->global_obj);
+    } else if (gc->kind != JS_GLOBAL_CACHE_LEXICAL) {
+        return NULL;
+    }
+    sh = p->shape;
+    if (unlikely(gc->prop_index >= sh->prop_count))
+        return NULL;
+    prs = &get_shape_prop(sh)[gc->prop_index];
+    if (unlikely(prs->atom != gc->atom || (prs->flags & JS_PROP_TMASK)))
+        return NULL;
+    *pprs = prs;
+    return &p->prop[gc->prop_index];
+}
+
+/* find the global variable after a miss */
+static void js_global_cache_update(JSContext *ctx, JSGlobalVarCache *gc)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    gc->kind = JS_GLOBAL_CACHE_NONE;
+    p = JS_VALUE_GET_OBJ(ctx->global_var_obj);
+    prs = find_own_property(&pr, p, gc->atom);
+    if (prs) {
+        gc->kind = JS_GLOBAL_CACHE_LEXICAL;
+    } else {
+        gc->var_count = p->shape->prop_count;
+        p = JS_VALUE_GET_OBJ(ctx->global_obj);
+        prs = find_own_property(&pr, p, gc->atom);
+        if (!prs)
+            return;
+        gc->kind = JS_GLOBAL_CACHE_OBJECT;
+    }
+    gc->prop_index = prs - get_shape_prop(p->shape);
+}
+
+static force_inline JSValue js_global_cache_get(JSContext *ctx,
+                                                JSGlobalVarCache *gc,
+                                                BOOL throw_ref_error)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    JSValue val;
+
+    pr = js_global_cache_find(ctx, gc, &prs);
+    /* uninitialized lexical variables raise an exception */
+    if (likely(pr && !JS_IsUninitialized(pr->u.value)))
+        return JS_DupValue(ctx, pr->u.value);
+    val = JS_GetGlobalVar(ctx, gc->atom, throw_ref_error);
+    if (!JS_IsException(val))
+        js_global_cache_update(ctx, gc);
+    return val;
+}
+
+/* 'flag' is the one of JS_SetGlobalVar(), 0 or 2. 'val' is freed. */
+static force_inline int js_global_cache_put(JSContext *ctx,
+                                            JSGlobalVarCache *gc,
+                                            JSValue val, int flag)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    int ret;
+
+    pr = js_global_cache_find(ctx, gc, &prs);
+    if (likely(pr && (prs->flags & JS_PROP_WRITABLE) &&
+               !JS_IsUninitialized(pr->u.value))) {
+        set_value(ctx, &pr->u.value, val);
+        return 0;
+    }
+    ret = JS_SetGlobalVar(ctx, gc->atom, val, flag);
+    if (ret >= 0)
+        js_global_cache_update(ctx, gc);
+    return ret;
+}
+
+static int js_global_cache_check(JSContext *ctx, JSGlobalVarCache *gc)
+{
+    JSShapeProperty *prs;
+    int ret;
+
+    if (js_global_cache_find(ctx, gc, &prs))
+        return TRUE;
+    ret = JS_CheckGlobalVar(ctx, gc->atom);
+    if (ret > 0)
+        js_global_cache_update(ctx, gc);
+    return ret;
+}
+
 /* argument of OP_special_object */
 typedef enum {
     OP_SPECIAL_OBJECT_ARGUMENTS,
@@ -16536,6 +16918,141 @@ typedef enum {
 #define FUNC_RET_YIELD      1
 #define FUNC_RET_YIELD_STAR 2
 
+#ifdef CONFIG_JIT
+typedef enum {
+    JS_JIT_RETURN,    /* the function returned 'ret_val' */
+    JS_JIT_EXCEPTION, /* exception raised by the instruction at 'pos' */
+    JS_JIT_BAILOUT,   /* the interpreter continues at 'pos' */
+} JSJITStatusEnum;
+
+/* state of JS_CallInternal() given to the native code of the function */
+typedef struct JSJITState {
+    JSContext *ctx;
+    JSContext *caller_ctx;
+    JSFunctionBytecode *b;
+    JSStackFrame *sf;
+    JSValue *arg_buf;
+    JSValue *var_buf;
+    JSVarRef **var_refs;
+    JSValueConst this_obj;
+    JSValueConst new_target;
+    int argc;
+    JSValue *argv;
+    /* set by the native code */
+    JSValue ret_val;
+    JSValue *sp;
+    int pos;
+    /* set by the helpers of the fused comparisons and branches */
+    int cond;
+} JSJITState;
+
+/* return a JSJITStatusEnum */
+typedef int JSJITFunc(JSJITState *s, JSValue *sp);
+
+static int js_jit_compile(JSContext *ctx, JSFunctionBytecode *b);
+#endif
+
+#ifdef CONFIG_PROFILE_OPCODES
+/* Opcode profiler: the interpreter counts the executions of each
+   instruction of each function and, if the CPU has a cycle counter,
+   the cycles spent in it. The data of a function is kept when it is
+   freed so that JS_DumpOpcodeProfile() reports all the executed
+   code. */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define JS_PROFILE_CYCLES
+static inline uint64_t js_profile_get_cycles(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+#endif
+
+typedef struct JSOpProfileFunc {
+    struct list_head link; /* rt->profile_list */
+    JSFunctionBytecode *b; /* NULL when the function is freed */
+    JSAtom func_name;
+    JSAtom filename;
+    int line_num;
+    int byte_code_len;
+    /* copy of the byte code and line number of each executed
+       instruction, set when the function is freed */
+    uint8_t *byte_code;
+    int *pc_line;
+    /* totals, computed by JS_DumpOpcodeProfile() */
+    uint64_t total_count;
+    uint64_t total_cycles;
+    uint64_t *count; /* execution count of the instruction at each pc */
+    uint64_t *cycles; /* self cycles of the instruction at each pc */
+    uint64_t data[0];
+} JSOpProfileFunc;
+
+static no_inline JSOpProfileFunc *js_profile_new_func(JSRuntime *rt,
+                                                      JSFunctionBytecode *b)
+{
+    JSOpProfileFunc *pf;
+
+    pf = js_mallocz_rt(rt, sizeof(*pf) +
+                       sizeof(pf->data[0]) * 2 * b->byte_code_len);
+    if (!pf)
+        return NULL;
+    pf->b = b;
+    pf->func_name = JS_DupAtomRT(rt, b->func_name);
+    if (b->has_debug) {
+        pf->filename = JS_DupAtomRT(rt, b->debug.filename);
+        pf->line_num = b->debug.line_num;
+    } else {
+        pf->filename = JS_ATOM_NULL;
+    }
+    pf->byte_code_len = b->byte_code_len;
+    pf->count = pf->data;
+    pf->cycles = pf->data + b->byte_code_len;
+    list_add_tail(&pf->link, &rt->profile_list);
+    b->profile = pf;
+    return pf;
+}
+
+/* called before the execution of the instruction at 'pc'. The cycles
+   elapsed since the previous instruction are charged to it, so they
+   include the time spent in the C functions it calls but not the time
+   spent in the bytecode functions it calls. */
+static inline void js_profile_opcode(JSRuntime *rt, JSFunctionBytecode *b,
+                                     const uint8_t *pc)
+{
+    JSOpProfileFunc *pf = b->profile;
+    int pos;
+
+    if (unlikely(!pf)) {
+        pf = js_profile_new_func(rt, b);
+        if (!pf)
+            return;
+    }
+    pos = pc - b->byte_code_buf;
+    pf->count[pos]++;
+#ifdef JS_PROFILE_CYCLES
+    {
+        uint64_t t = js_profile_get_cycles();
+        if (rt->profile_cur)
+            *rt->profile_cur += t - rt->profile_time;
+        rt->profile_cur = &pf->cycles[pos];
+        rt->profile_time = t;
+    }
+#endif
+}
+
+/* called when the outermost bytecode function returns so that the time
+   spent outside of the interpreter is not charged to its last
+   instruction */
+static inline void js_profile_stop(JSRuntime *rt)
+{
+#ifdef JS_PROFILE_CYCLES
+    if (rt->profile_cur) {
+        *rt->profile_cur += js_profile_get_cycles() - rt->profile_time;
+        rt->profile_cur = NULL;
+    }
+#endif
+}
+#endif /* CONFIG_PROFILE_OPCODES */
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -16556,8 +17073,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     sf->pthis = &this_obj;
 #endif
 
+#ifdef CONFIG_PROFILE_OPCODES
+#define PROFILE_OPCODE(pc) js_profile_opcode(rt, b, pc)
+#else
+#define PROFILE_OPCODE(pc)
+#endif
+
 #if !DIRECT_DISPATCH
-#define SWITCH(pc)      switch (opcode = *pc++)
+#define SWITCH(pc)      PROFILE_OPCODE(pc); switch (opcode = *pc++)
 #define CASE(op)        case op
 #define DEFAULT         default
 #define BREAK           break
@@ -16572,7 +17095,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
-#define SWITCH(pc)      goto *dispatch_table[opcode = *pc++];
+#define SWITCH(pc)      PROFILE_OPCODE(pc); goto *dispatch_table[opcode = *pc++];
 #define CASE(op)        case_ ## op
 #define DEFAULT         case_default
 #define BREAK           SWITCH(pc)
@@ -16660,7 +17183,46 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     sf->prev_frame = rt->current_stack_frame;
     rt->current_stack_frame = sf;
     ctx = b->realm; /* set the current realm */
-    
+
+#if defined(CONFIG_JIT) && !defined(CONFIG_PROFILE_OPCODES)
+    /* the profiler only sees the interpreted code */
+    if (unlikely(rt->jit_threshold != 0) && b->func_kind == JS_FUNC_NORMAL) {
+        if (!b->jit_code && b->jit_call_count >= 0 &&
+            ++b->jit_call_count >= rt->jit_threshold) {
+            if (js_jit_compile(ctx, b) < 0)
+                b->jit_call_count = -1;
+        }
+        if (b->jit_code) {
+            JSJITState jit_s;
+            int status;
+
+            jit_s.ctx = ctx;
+            jit_s.caller_ctx = caller_ctx;
+            jit_s.b = b;
+            jit_s.sf = sf;
+            jit_s.arg_buf = arg_buf;
+            jit_s.var_buf = var_buf;
+            jit_s.var_refs = var_refs;
+            jit_s.this_obj = this_obj;
+            jit_s.new_target = new_target;
+            jit_s.argc = argc;
+            jit_s.argv = argv;
+            status = ((JSJITFunc *)b->jit_code)(&jit_s, sp);
+            sp = jit_s.sp;
+            if (status == JS_JIT_RETURN) {
+                ret_val = jit_s.ret_val;
+                goto done;
+            }
+            if (status == JS_JIT_EXCEPTION) {
+                /* the position is only used for the backtrace */
+                pc = b->byte_code_buf + jit_s.pos + 1;
+                goto exception;
+            }
+            pc = b->byte_code_buf + jit_s.pos;
+        }
+    }
+#endif
+
  restart:
     for(;;) {
         int call_argc;
@@ -17241,11 +17803,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_check_var):
             {
                 int ret;
-                JSAtom atom;
-                atom = get_u32(pc);
+                uint32_t idx;
+                idx = get_u32(pc); /* atom if there are no global caches */
                 pc += 4;
 
-                ret = JS_CheckGlobalVar(ctx, atom);
+                if (likely(b->global_cache))
+                    ret = js_global_cache_check(ctx, &b->global_cache[idx]);
+                else
+                    ret = JS_CheckGlobalVar(ctx, idx);
                 if (ret < 0)
                     goto exception;
                 *sp++ = JS_NewBool(ctx, ret);
@@ -17256,11 +17821,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_get_var):
             {
                 JSValue val;
-                JSAtom atom;
-                atom = get_u32(pc);
+                uint32_t idx;
+                idx = get_u32(pc);
                 pc += 4;
 
-                val = JS_GetGlobalVar(ctx, atom, opcode - OP_get_var_undef);
+                if (likely(b->global_cache))
+                    val = js_global_cache_get(ctx, &b->global_cache[idx],
+                                              opcode - OP_get_var_undef);
+                else
+                    val = JS_GetGlobalVar(ctx, idx, opcode - OP_get_var_undef);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
@@ -17268,6 +17837,23 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
         CASE(OP_put_var):
+            {
+                int ret;
+                uint32_t idx;
+                idx = get_u32(pc);
+                pc += 4;
+
+                if (likely(b->global_cache))
+                    ret = js_global_cache_put(ctx, &b->global_cache[idx],
+                                              sp[-1], 0);
+                else
+                    ret = JS_SetGlobalVar(ctx, idx, sp[-1], 0);
+                sp--;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
         CASE(OP_put_var_init):
             {
                 int ret;
@@ -17275,7 +17861,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = get_u32(pc);
                 pc += 4;
 
-                ret = JS_SetGlobalVar(ctx, atom, sp[-1], opcode - OP_put_var);
+                ret = JS_SetGlobalVar(ctx, atom, sp[-1], 1);
                 sp--;
                 if (unlikely(ret < 0))
                     goto exception;
@@ -17285,16 +17871,21 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_put_var_strict):
             {
                 int ret;
-                JSAtom atom;
-                atom = get_u32(pc);
+                JSGlobalVarCache *gc;
+                uint32_t idx;
+                idx = get_u32(pc);
                 pc += 4;
 
+                gc = b->global_cache ? &b->global_cache[idx] : NULL;
                 /* sp[-2] is JS_TRUE or JS_FALSE */
                 if (unlikely(!JS_VALUE_GET_INT(sp[-2]))) {
-                    JS_ThrowReferenceErrorNotDefined(ctx, atom);
+                    JS_ThrowReferenceErrorNotDefined(ctx, gc ? gc->atom : idx);
                     goto exception;
                 }
-                ret = JS_SetGlobalVar(ctx, atom, sp[-1], 2);
+                if (likely(gc))
+                    ret = js_global_cache_put(ctx, gc, sp[-1], 2);
+                else
+                    ret = JS_SetGlobalVar(ctx, idx, sp[-1], 2);
                 sp -= 2;
                 if (unlikely(ret < 0))
                     goto exception;
@@ -17700,6 +18291,54 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     goto exception;
             }
             BREAK;
+        CASE(OP_lt_if_false):
+            {
+                JSValue op1, op2;
+                int res;
+
+                op1 = sp[-2];
+                op2 = sp[-1];
+                pc += 4;
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
+                    res = JS_VALUE_GET_INT(op1) < JS_VALUE_GET_INT(op2);
+                } else {
+                    if (js_relational_slow(ctx, sp, OP_lt))
+                        goto exception;
+                    res = JS_VALUE_GET_BOOL(sp[-2]);
+                }
+                sp -= 2;
+                if (!res) {
+                    pc += (int32_t)get_u32(pc - 4) - 4;
+                }
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+            }
+            BREAK;
+        CASE(OP_get_loc_i32_lt_if_false):
+            {
+                JSValue op1, tab[2];
+                int32_t v2;
+                int res;
+
+                op1 = var_buf[get_u16(pc)];
+                v2 = get_u32(pc + 2);
+                pc += 10;
+                if (likely(JS_VALUE_GET_TAG(op1) == JS_TAG_INT)) {
+                    res = JS_VALUE_GET_INT(op1) < v2;
+                } else {
+                    tab[0] = JS_DupValue(ctx, op1);
+                    tab[1] = JS_NewInt32(ctx, v2);
+                    if (js_relational_slow(ctx, tab + 2, OP_lt))
+                        goto exception;
+                    res = JS_VALUE_GET_BOOL(tab[0]);
+                }
+                if (!res) {
+                    pc += (int32_t)get_u32(pc - 4) - 4;
+                }
+                if (unlikely(js_poll_interrupts(ctx)))
+                    goto exception;
+            }
+            BREAK;
 #endif
         CASE(OP_catch):
             {
@@ -17879,11 +18518,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_get_field):
             {
                 JSValue val;
-                JSAtom atom;
-                atom = get_u32(pc);
+                uint32_t idx;
+                idx = get_u32(pc); /* atom if there are no inline caches */
                 pc += 4;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                if (likely(b->ic))
+                    val = js_ic_get_field(ctx, &b->ic[idx], sp[-1]);
+                else
+                    val = JS_GetProperty(ctx, sp[-1], idx);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 JS_FreeValue(ctx, sp[-1]);
@@ -17894,26 +18536,83 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_get_field2):
             {
                 JSValue val;
-                JSAtom atom;
-                atom = get_u32(pc);
+                uint32_t idx;
+                idx = get_u32(pc);
                 pc += 4;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                if (likely(b->ic))
+                    val = js_ic_get_field(ctx, &b->ic[idx], sp[-1]);
+                else
+                    val = JS_GetProperty(ctx, sp[-1], idx);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
             }
             BREAK;
 
+#if SHORT_OPCODES
+        CASE(OP_get_loc_field):
+        CASE(OP_get_arg_field):
+            {
+                JSValue val;
+                uint32_t idx;
+                idx = get_u32(pc);
+                if (opcode == OP_get_loc_field)
+                    val = var_buf[get_u16(pc + 4)];
+                else
+                    val = arg_buf[get_u16(pc + 4)];
+                pc += 6;
+                /* the object stays on the stack during the access as it
+                   would with get_loc or get_arg */
+                *sp++ = JS_DupValue(ctx, val);
+                if (likely(b->ic))
+                    val = js_ic_get_field(ctx, &b->ic[idx], sp[-1]);
+                else
+                    val = JS_GetProperty(ctx, sp[-1], idx);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = val;
+            }
+            BREAK;
+
+        CASE(OP_get_field_call0):
+            {
+                JSValue func;
+                uint32_t idx;
+                idx = get_u32(pc);
+                pc += 4;
+
+                if (likely(b->ic))
+                    func = js_ic_get_field(ctx, &b->ic[idx], sp[-1]);
+                else
+                    func = JS_GetProperty(ctx, sp[-1], idx);
+                if (unlikely(JS_IsException(func)))
+                    goto exception;
+                sf->cur_pc = pc;
+                ret_val = JS_CallInternal(ctx, func, sp[-1], JS_UNDEFINED,
+                                          0, NULL, 0);
+                JS_FreeValue(ctx, func);
+                if (unlikely(JS_IsException(ret_val)))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = ret_val;
+            }
+            BREAK;
+#endif
+
         CASE(OP_put_field):
             {
                 int ret;
-                JSAtom atom;
-                atom = get_u32(pc);
+                uint32_t idx;
+                idx = get_u32(pc);
                 pc += 4;
 
-                ret = JS_SetPropertyInternal(ctx, sp[-2], atom, sp[-1],
-                                             JS_PROP_THROW_STRICT);
+                if (likely(b->ic))
+                    ret = js_ic_put_field(ctx, &b->ic[idx], sp[-2], sp[-1]);
+                else
+                    ret = JS_SetPropertyInternal(ctx, sp[-2], idx, sp[-1],
+                                                 JS_PROP_THROW_STRICT);
                 JS_FreeValue(ctx, sp[-2]);
                 sp -= 2;
                 if (unlikely(ret < 0))
@@ -19062,6 +19761,10 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             JS_FreeValue(ctx, *pval);
         }
     }
+#ifdef CONFIG_PROFILE_OPCODES
+    if (!sf->prev_frame)
+        js_profile_stop(rt);
+#endif
     rt->current_stack_frame = sf->prev_frame;
     return ret_val;
 }
@@ -20465,7 +21168,8 @@ typedef struct JSParseState {
 } JSParseState;
 
 typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_SEQUENCES) || \
+    defined(CONFIG_PROFILE_OPCODES)
     const char *name;
 #endif
     uint8_t size; /* in bytes */
@@ -20478,7 +21182,8 @@ typedef struct JSOpCode {
 
 static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define FMT(f)
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(DUMP_OPCODE_SEQUENCES) || \
+    defined(CONFIG_PROFILE_OPCODES)
 #define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
 #else
 #define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
@@ -29277,9 +29982,2544 @@ static JSFunctionDef *js_new_function_def(JSContext *ctx,
     return fd;
 }
 
+static inline BOOL is_ic_opcode(int op)
+{
+    return op == OP_get_field || op == OP_get_field2 || op == OP_put_field ||
+        op == OP_get_loc_field || op == OP_get_arg_field ||
+        op == OP_get_field_call0;
+}
+
+static inline BOOL is_global_cache_opcode(int op)
+{
+    return op == OP_check_var || op == OP_get_var_undef ||
+        op == OP_get_var || op == OP_put_var || op == OP_put_var_strict;
+}
+
+/* TRUE if the atom operand of the instruction 'op' of the final byte code
+   is replaced by the index of a cache */
+static inline BOOL bc_has_cache(const JSFunctionBytecode *b, int op)
+{
+    return b && ((b->ic && is_ic_opcode(op)) ||
+                 (b->global_cache && is_global_cache_opcode(op)));
+}
+
+/* return the atom operand at 'operand' of the instruction 'op' of the
+   final byte code */
+static JSAtom bc_operand_atom(const JSFunctionBytecode *b, int op,
+                              const uint8_t *operand)
+{
+    uint32_t idx = get_u32(operand);
+    if (bc_has_cache(b, op)) {
+        if (is_ic_opcode(op))
+            return b->ic[idx].atom;
+        else
+            return b->global_cache[idx].atom;
+    }
+    return idx;
+}
+
+/* replace the atom operands of the property accesses (is_ic_opcode()) by
+   the indexes of their inline caches, and the ones of the global variable
+   accesses by the indexes of their global caches. The caches take the
+   references to the atoms. If there is not enough memory, the byte code is
+   unchanged. */
+static void js_init_inline_caches(JSContext *ctx, JSFunctionBytecode *b)
+{
+    uint8_t *bc_buf = b->byte_code_buf;
+    JSInlineCache *ic;
+    JSGlobalVarCache *gc;
+    int pos, op, ic_count, gc_count;
+
+    ic_count = 0;
+    gc_count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (is_ic_opcode(op))
+            ic_count++;
+        else if (is_global_cache_opcode(op))
+            gc_count++;
+    }
+    ic = NULL;
+    gc = NULL;
+    if (ic_count != 0)
+        ic = js_mallocz_rt(ctx->rt, sizeof(ic[0]) * ic_count);
+    if (gc_count != 0)
+        gc = js_mallocz_rt(ctx->rt, sizeof(gc[0]) * gc_count);
+    ic_count = 0;
+    gc_count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (ic && is_ic_opcode(op)) {
+            ic[ic_count].atom = get_u32(bc_buf + pos + 1);
+            put_u32(bc_buf + pos + 1, ic_count);
+            ic_count++;
+        } else if (gc && is_global_cache_opcode(op)) {
+            gc[gc_count].atom = get_u32(bc_buf + pos + 1);
+            put_u32(bc_buf + pos + 1, gc_count);
+            gc_count++;
+        }
+    }
+    b->ic = ic;
+    b->ic_count = ic_count;
+    b->global_cache = gc;
+    b->global_cache_count = gc_count;
+}
+
+static void js_free_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSInlineCache *ic;
+    int i, j;
+
+    for(i = 0; i < b->ic_count; i++) {
+        ic = &b->ic[i];
+        JS_FreeAtomRT(rt, ic->atom);
+        for(j = 0; j < ic->count; j++) {
+            js_free_shape(rt, ic->entries[j].shape);
+            js_free_shape_null(rt, ic->entries[j].proto_shape);
+        }
+        js_free_rt(rt, ic->entries);
+    }
+    js_free_rt(rt, b->ic);
+    b->ic = NULL;
+    b->ic_count = 0;
+    for(i = 0; i < b->global_cache_count; i++)
+        JS_FreeAtomRT(rt, b->global_cache[i].atom);
+    js_free_rt(rt, b->global_cache);
+    b->global_cache = NULL;
+    b->global_cache_count = 0;
+}
+
+#ifdef CONFIG_JIT
+
+/* Baseline compiler: the byte code of the functions called
+   rt->jit_threshold times is translated to x86-64 code by concatenating
+   one template per opcode. The frequent opcodes (local variables,
+   integer arithmetic and comparisons, branches) are expanded inline with
+   a call to a helper in the slow case, the other ones are only calls to
+   helpers which execute the opcode as the interpreter does. The native
+   code uses the stack frame allocated by JS_CallInternal() and returns
+   to it on exceptions, which are handled by the interpreter as usual, and
+   at the opcodes which are not supported: the interpreter executes the
+   rest of the call. */
+
+static JSValue *js_jit_exception(JSJITState *s, JSValue *sp)
+{
+    s->sp = sp;
+    return NULL;
+}
+
+/* The helpers execute the opcode at 'pos' and return the new stack
+   pointer, or NULL in case of exception with s->sp set to the stack
+   pointer the interpreter would have. */
+typedef JSValue *JSJITHelper(JSJITState *s, JSValue *sp, int pos);
+
+static JSValue *js_jit_poll_interrupts(JSJITState *s, JSValue *sp, int pos)
+{
+    /* interrupt_counter is decremented by the native code */
+    if (__js_poll_interrupts(s->ctx))
+        return js_jit_exception(s, sp);
+    return sp;
+}
+
+static JSValue *js_jit_push(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    const uint8_t *pc = b->byte_code_buf + pos;
+    JSValue val;
+
+    switch(pc[0]) {
+    case OP_fclosure:
+        val = js_closure(ctx, JS_DupValue(ctx, b->cpool[get_u32(pc + 1)]),
+                         s->var_refs, s->sf);
+        break;
+    case OP_fclosure8:
+        val = js_closure(ctx, JS_DupValue(ctx, b->cpool[pc[1]]),
+                         s->var_refs, s->sf);
+        break;
+    case OP_push_atom_value:
+        val = JS_AtomToValue(ctx, get_u32(pc + 1));
+        break;
+    case OP_private_symbol:
+        val = JS_NewSymbolFromAtom(ctx, get_u32(pc + 1), JS_ATOM_TYPE_PRIVATE);
+        break;
+    case OP_push_empty_string:
+        val = JS_AtomToString(ctx, JS_ATOM_empty_string);
+        break;
+    case OP_push_this:
+        if (!(b->js_mode & JS_MODE_STRICT) &&
+            JS_VALUE_GET_TAG(s->this_obj) != JS_TAG_OBJECT) {
+            if (JS_IsNull(s->this_obj) || JS_IsUndefined(s->this_obj))
+                val = JS_DupValue(ctx, ctx->global_obj);
+            else
+                val = JS_ToObject(ctx, s->this_obj);
+        } else {
+            val = JS_DupValue(ctx, s->this_obj);
+        }
+        break;
+    case OP_object:
+        val = JS_NewObject(ctx);
+        break;
+    case OP_special_object:
+        switch(pc[1]) {
+        case OP_SPECIAL_OBJECT_ARGUMENTS:
+            val = js_build_arguments(ctx, s->argc, (JSValueConst *)s->argv);
+            break;
+        case OP_SPECIAL_OBJECT_MAPPED_ARGUMENTS:
+            val = js_build_mapped_arguments(ctx, s->argc, (JSValueConst *)s->argv,
+                                            s->sf, min_int(s->argc, b->arg_count));
+            break;
+        case OP_SPECIAL_OBJECT_THIS_FUNC:
+            val = JS_DupValue(ctx, s->sf->cur_func);
+            break;
+        case OP_SPECIAL_OBJECT_NEW_TARGET:
+            val = JS_DupValue(ctx, s->new_target);
+            break;
+        case OP_SPECIAL_OBJECT_HOME_OBJECT:
+            {
+                JSObject *p1;
+                p1 = JS_VALUE_GET_OBJ(s->sf->cur_func)->u.func.home_object;
+                if (unlikely(!p1))
+                    val = JS_UNDEFINED;
+                else
+                    val = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, p1));
+            }
+            break;
+        case OP_SPECIAL_OBJECT_VAR_OBJECT:
+            val = JS_NewObjectProto(ctx, JS_NULL);
+            break;
+        case OP_SPECIAL_OBJECT_IMPORT_META:
+            val = js_import_meta(ctx);
+            break;
+        default:
+            abort();
+        }
+        break;
+    case OP_rest:
+        val = js_build_rest(ctx, get_u16(pc + 1), s->argc,
+                            (JSValueConst *)s->argv);
+        break;
+    default:
+        abort();
+    }
+    if (unlikely(JS_IsException(val)))
+        return js_jit_exception(s, sp);
+    *sp++ = val;
+    return sp;
+}
+
+static JSValue *js_jit_stack(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSValue tmp, tmp2;
+
+    switch(s->b->byte_code_buf[pos]) {
+    case OP_nip:
+        JS_FreeValue(ctx, sp[-2]);
+        sp[-2] = sp[-1];
+        sp--;
+        break;
+    case OP_nip1: /* a b c -> b c */
+        JS_FreeValue(ctx, sp[-3]);
+        sp[-3] = sp[-2];
+        sp[-2] = sp[-1];
+        sp--;
+        break;
+    case OP_dup1: /* a b -> a a b */
+        sp[0] = sp[-1];
+        sp[-1] = JS_DupValue(ctx, sp[-2]);
+        sp++;
+        break;
+    case OP_dup2: /* a b -> a b a b */
+        sp[0] = JS_DupValue(ctx, sp[-2]);
+        sp[1] = JS_DupValue(ctx, sp[-1]);
+        sp += 2;
+        break;
+    case OP_dup3: /* a b c -> a b c a b c */
+        sp[0] = JS_DupValue(ctx, sp[-3]);
+        sp[1] = JS_DupValue(ctx, sp[-2]);
+        sp[2] = JS_DupValue(ctx, sp[-1]);
+        sp += 3;
+        break;
+    case OP_insert2: /* obj a -> a obj a (dup_x1) */
+        sp[0] = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = JS_DupValue(ctx, sp[0]);
+        sp++;
+        break;
+    case OP_insert3: /* obj prop a -> a obj prop a (dup_x2) */
+        sp[0] = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = JS_DupValue(ctx, sp[0]);
+        sp++;
+        break;
+    case OP_insert4: /* this obj prop a -> a this obj prop a */
+        sp[0] = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = sp[-4];
+        sp[-4] = JS_DupValue(ctx, sp[0]);
+        sp++;
+        break;
+    case OP_perm3: /* obj a b -> a obj b (213) */
+        tmp = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = tmp;
+        break;
+    case OP_rot3l: /* x a b -> a b x (231) */
+        tmp = sp[-3];
+        sp[-3] = sp[-2];
+        sp[-2] = sp[-1];
+        sp[-1] = tmp;
+        break;
+    case OP_rot4l: /* x a b c -> a b c x */
+        tmp = sp[-4];
+        sp[-4] = sp[-3];
+        sp[-3] = sp[-2];
+        sp[-2] = sp[-1];
+        sp[-1] = tmp;
+        break;
+    case OP_rot5l: /* x a b c d -> a b c d x */
+        tmp = sp[-5];
+        sp[-5] = sp[-4];
+        sp[-4] = sp[-3];
+        sp[-3] = sp[-2];
+        sp[-2] = sp[-1];
+        sp[-1] = tmp;
+        break;
+    case OP_rot3r: /* a b x -> x a b (312) */
+        tmp = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = tmp;
+        break;
+    case OP_perm4: /* obj prop a b -> a obj prop b */
+        tmp = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = sp[-4];
+        sp[-4] = tmp;
+        break;
+    case OP_perm5: /* this obj prop a b -> a this obj prop b */
+        tmp = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = sp[-4];
+        sp[-4] = sp[-5];
+        sp[-5] = tmp;
+        break;
+    case OP_swap2: /* a b c d -> c d a b */
+        tmp = sp[-4];
+        tmp2 = sp[-3];
+        sp[-4] = sp[-2];
+        sp[-3] = sp[-1];
+        sp[-2] = tmp;
+        sp[-1] = tmp2;
+        break;
+    default:
+        abort();
+    }
+    return sp;
+}
+
+static JSValue *js_jit_call(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *pc = s->b->byte_code_buf + pos;
+    JSValue *call_argv, ret_val;
+    int opcode, call_argc, i;
+
+    opcode = *pc++;
+    if (opcode >= OP_call0 && opcode <= OP_call3) {
+        call_argc = opcode - OP_call0;
+        opcode = OP_call;
+    } else {
+        call_argc = get_u16(pc);
+        pc += 2;
+    }
+    call_argv = sp - call_argc;
+    s->sf->cur_pc = pc;
+    switch(opcode) {
+    case OP_call:
+    case OP_tail_call:
+        ret_val = JS_CallInternal(ctx, call_argv[-1], JS_UNDEFINED,
+                                  JS_UNDEFINED, call_argc, call_argv, 0);
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        if (opcode == OP_tail_call) {
+            /* the arguments are freed with the stack frame */
+            s->ret_val = ret_val;
+            return sp;
+        }
+        for(i = -1; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        sp -= call_argc + 1;
+        break;
+    case OP_call_method:
+    case OP_tail_call_method:
+        ret_val = JS_CallInternal(ctx, call_argv[-1], call_argv[-2],
+                                  JS_UNDEFINED, call_argc, call_argv, 0);
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        if (opcode == OP_tail_call_method) {
+            s->ret_val = ret_val;
+            return sp;
+        }
+        for(i = -2; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        sp -= call_argc + 2;
+        break;
+    case OP_call_constructor:
+        ret_val = JS_CallConstructorInternal(ctx, call_argv[-2],
+                                             call_argv[-1],
+                                             call_argc, call_argv, 0);
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        for(i = -2; i < call_argc; i++)
+            JS_FreeValue(ctx, call_argv[i]);
+        sp -= call_argc + 2;
+        break;
+    case OP_array_from:
+        ret_val = JS_NewArray(ctx);
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        for(i = 0; i < call_argc; i++) {
+            int ret;
+            ret = JS_DefinePropertyValue(ctx, ret_val, __JS_AtomFromUInt32(i),
+                                         call_argv[i],
+                                         JS_PROP_C_W_E | JS_PROP_THROW);
+            call_argv[i] = JS_UNDEFINED;
+            if (ret < 0) {
+                JS_FreeValue(ctx, ret_val);
+                goto exception;
+            }
+        }
+        sp -= call_argc;
+        break;
+    case OP_apply:
+        /* the operand is the magic value */
+        ret_val = js_function_apply(ctx, sp[-3], 2, (JSValueConst *)&sp[-2],
+                                    call_argc);
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        JS_FreeValue(ctx, sp[-3]);
+        JS_FreeValue(ctx, sp[-2]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp -= 3;
+        break;
+    default:
+        abort();
+    }
+    *sp++ = ret_val;
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+/* slow cases of the inline templates of the local variable opcodes and
+   the other opcodes which access to variables */
+static JSValue *js_jit_var(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    const uint8_t *pc = b->byte_code_buf + pos;
+    JSValue *var_buf = s->var_buf;
+    JSVarRef **var_refs = s->var_refs;
+    JSValue *pv, op1;
+    int opcode, idx, val;
+
+    opcode = *pc++;
+    switch(opcode) {
+    case OP_get_loc_check:
+        idx = get_u16(pc);
+        if (unlikely(JS_IsUninitialized(var_buf[idx]))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, FALSE);
+            goto exception;
+        }
+        *sp++ = JS_DupValue(ctx, var_buf[idx]);
+        break;
+    case OP_put_loc_check:
+        idx = get_u16(pc);
+        if (unlikely(JS_IsUninitialized(var_buf[idx]))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, FALSE);
+            goto exception;
+        }
+        set_value(ctx, &var_buf[idx], sp[-1]);
+        sp--;
+        break;
+    case OP_put_loc_check_init:
+        idx = get_u16(pc);
+        if (unlikely(!JS_IsUninitialized(var_buf[idx]))) {
+            JS_ThrowReferenceError(ctx, "'this' can be initialized only once");
+            goto exception;
+        }
+        set_value(ctx, &var_buf[idx], sp[-1]);
+        sp--;
+        break;
+    case OP_get_var_ref_check:
+        idx = get_u16(pc);
+        if (unlikely(JS_IsUninitialized(*var_refs[idx]->pvalue))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, TRUE);
+            goto exception;
+        }
+        *sp++ = JS_DupValue(ctx, *var_refs[idx]->pvalue);
+        break;
+    case OP_put_var_ref_check:
+        idx = get_u16(pc);
+        if (unlikely(JS_IsUninitialized(*var_refs[idx]->pvalue))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, TRUE);
+            goto exception;
+        }
+        set_value(ctx, var_refs[idx]->pvalue, sp[-1]);
+        sp--;
+        break;
+    case OP_put_var_ref_check_init:
+        idx = get_u16(pc);
+        if (unlikely(!JS_IsUninitialized(*var_refs[idx]->pvalue))) {
+            JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, TRUE);
+            goto exception;
+        }
+        set_value(ctx, var_refs[idx]->pvalue, sp[-1]);
+        sp--;
+        break;
+    case OP_close_loc:
+        close_lexical_var(ctx, s->sf, get_u16(pc), FALSE);
+        break;
+    case OP_inc_loc:
+    case OP_dec_loc:
+        pv = &var_buf[pc[0]];
+        op1 = *pv;
+        if (JS_VALUE_GET_TAG(op1) == JS_TAG_INT) {
+            val = JS_VALUE_GET_INT(op1);
+            if (opcode == OP_inc_loc && val != INT32_MAX) {
+                *pv = JS_NewInt32(ctx, val + 1);
+                break;
+            }
+            if (opcode == OP_dec_loc && val != INT32_MIN) {
+                *pv = JS_NewInt32(ctx, val - 1);
+                break;
+            }
+        }
+        /* must duplicate otherwise the variable value may be destroyed
+           before JS code accesses it */
+        op1 = JS_DupValue(ctx, op1);
+        if (js_unary_arith_slow(ctx, &op1 + 1, opcode == OP_inc_loc ?
+                                OP_inc : OP_dec))
+            goto exception;
+        set_value(ctx, pv, op1);
+        break;
+    case OP_add_loc:
+        pv = &var_buf[pc[0]];
+        if (likely(JS_VALUE_IS_BOTH_INT(*pv, sp[-1]))) {
+            int64_t r;
+            r = (int64_t)JS_VALUE_GET_INT(*pv) + JS_VALUE_GET_INT(sp[-1]);
+            if (likely((int)r == r)) {
+                *pv = JS_NewInt32(ctx, r);
+                sp--;
+                break;
+            }
+        } else if (JS_VALUE_GET_TAG(*pv) == JS_TAG_STRING) {
+            op1 = sp[-1];
+            sp--;
+            op1 = JS_ToPrimitiveFree(ctx, op1, HINT_NONE);
+            if (JS_IsException(op1))
+                goto exception;
+            op1 = JS_ConcatString(ctx, JS_DupValue(ctx, *pv), op1);
+            if (JS_IsException(op1))
+                goto exception;
+            set_value(ctx, pv, op1);
+            break;
+        }
+        {
+            JSValue ops[2];
+            /* In case of exception, js_add_slow frees ops[0] and ops[1],
+               so we must duplicate *pv */
+            ops[0] = JS_DupValue(ctx, *pv);
+            ops[1] = sp[-1];
+            sp--;
+            if (js_add_slow(ctx, ops + 2))
+                goto exception;
+            set_value(ctx, pv, ops[0]);
+        }
+        break;
+    case OP_make_loc_ref:
+    case OP_make_arg_ref:
+    case OP_make_var_ref_ref:
+        {
+            JSVarRef *var_ref;
+            JSProperty *pr;
+            JSAtom atom;
+
+            atom = get_u32(pc);
+            idx = get_u16(pc + 4);
+            *sp++ = JS_NewObjectProto(ctx, JS_NULL);
+            if (unlikely(JS_IsException(sp[-1])))
+                goto exception;
+            if (opcode == OP_make_var_ref_ref) {
+                var_ref = var_refs[idx];
+                var_ref->header.ref_count++;
+            } else {
+                var_ref = get_var_ref(ctx, s->sf, idx, opcode == OP_make_arg_ref);
+                if (!var_ref)
+                    goto exception;
+            }
+            pr = add_property(ctx, JS_VALUE_GET_OBJ(sp[-1]), atom,
+                              JS_PROP_WRITABLE | JS_PROP_VARREF);
+            if (!pr) {
+                free_var_ref(ctx->rt, var_ref);
+                goto exception;
+            }
+            pr->u.var_ref = var_ref;
+            *sp++ = JS_AtomToValue(ctx, atom);
+        }
+        break;
+    case OP_make_var_ref:
+        if (JS_GetGlobalVarRef(ctx, get_u32(pc), sp))
+            goto exception;
+        sp += 2;
+        break;
+    default:
+        abort();
+    }
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+static JSValue *js_jit_get_var(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    const uint8_t *pc = b->byte_code_buf + pos;
+    JSValue val;
+    uint32_t idx;
+
+    idx = get_u32(pc + 1); /* atom if there are no global caches */
+    if (likely(b->global_cache))
+        val = js_global_cache_get(ctx, &b->global_cache[idx],
+                                  pc[0] - OP_get_var_undef);
+    else
+        val = JS_GetGlobalVar(ctx, idx, pc[0] - OP_get_var_undef);
+    if (unlikely(JS_IsException(val)))
+        return js_jit_exception(s, sp);
+    *sp++ = val;
+    return sp;
+}
+
+static JSValue *js_jit_global(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    const uint8_t *pc = b->byte_code_buf + pos;
+    JSGlobalVarCache *gc;
+    uint32_t idx;
+    int opcode, ret;
+
+    opcode = *pc++;
+    idx = get_u32(pc);
+    switch(opcode) {
+    case OP_check_var:
+        if (likely(b->global_cache))
+            ret = js_global_cache_check(ctx, &b->global_cache[idx]);
+        else
+            ret = JS_CheckGlobalVar(ctx, idx);
+        if (ret < 0)
+            goto exception;
+        *sp++ = JS_NewBool(ctx, ret);
+        break;
+    case OP_put_var:
+        if (likely(b->global_cache))
+            ret = js_global_cache_put(ctx, &b->global_cache[idx], sp[-1], 0);
+        else
+            ret = JS_SetGlobalVar(ctx, idx, sp[-1], 0);
+        sp--;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_put_var_init:
+        ret = JS_SetGlobalVar(ctx, idx, sp[-1], 1);
+        sp--;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_put_var_strict:
+        gc = b->global_cache ? &b->global_cache[idx] : NULL;
+        /* sp[-2] is JS_TRUE or JS_FALSE */
+        if (unlikely(!JS_VALUE_GET_INT(sp[-2]))) {
+            JS_ThrowReferenceErrorNotDefined(ctx, gc ? gc->atom : idx);
+            goto exception;
+        }
+        if (likely(gc))
+            ret = js_global_cache_put(ctx, gc, sp[-1], 2);
+        else
+            ret = JS_SetGlobalVar(ctx, idx, sp[-1], 2);
+        sp -= 2;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_check_define_var:
+        if (JS_CheckDefineGlobalVar(ctx, idx, pc[4]))
+            goto exception;
+        break;
+    case OP_define_var:
+        if (JS_DefineGlobalVar(ctx, idx, pc[4]))
+            goto exception;
+        break;
+    case OP_define_func:
+        if (JS_DefineGlobalFunction(ctx, idx, sp[-1], pc[4]))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        sp--;
+        break;
+    case OP_delete_var:
+        ret = JS_DeleteProperty(ctx, ctx->global_obj, idx, 0);
+        if (unlikely(ret < 0))
+            goto exception;
+        *sp++ = JS_NewBool(ctx, ret);
+        break;
+    default:
+        abort();
+    }
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+/* get_field, get_field2 and get_field_call0. Also used by get_loc_field
+   and get_arg_field once the native code has pushed the variable. */
+static JSValue *js_jit_get_field(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    const uint8_t *pc = b->byte_code_buf + pos;
+    JSValue val;
+    uint32_t idx;
+
+    idx = get_u32(pc + 1); /* atom if there are no inline caches */
+    if (likely(b->ic))
+        val = js_ic_get_field(ctx, &b->ic[idx], sp[-1]);
+    else
+        val = JS_GetProperty(ctx, sp[-1], idx);
+    if (unlikely(JS_IsException(val)))
+        return js_jit_exception(s, sp);
+    if (pc[0] == OP_get_field2) {
+        *sp++ = val;
+        return sp;
+    }
+    if (pc[0] == OP_get_field_call0) {
+        JSValue func = val;
+        s->sf->cur_pc = pc + 5;
+        val = JS_CallInternal(ctx, func, sp[-1], JS_UNDEFINED, 0, NULL, 0);
+        JS_FreeValue(ctx, func);
+        if (unlikely(JS_IsException(val)))
+            return js_jit_exception(s, sp);
+    }
+    JS_FreeValue(ctx, sp[-1]);
+    sp[-1] = val;
+    return sp;
+}
+
+static JSValue *js_jit_put_field(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSFunctionBytecode *b = s->b;
+    uint32_t idx;
+    int ret;
+
+    idx = get_u32(b->byte_code_buf + pos + 1);
+    if (likely(b->ic))
+        ret = js_ic_put_field(ctx, &b->ic[idx], sp[-2], sp[-1]);
+    else
+        ret = JS_SetPropertyInternal(ctx, sp[-2], idx, sp[-1],
+                                     JS_PROP_THROW_STRICT);
+    JS_FreeValue(ctx, sp[-2]);
+    sp -= 2;
+    if (unlikely(ret < 0))
+        return js_jit_exception(s, sp);
+    return sp;
+}
+
+static JSValue *js_jit_get_array_el(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val;
+
+    val = JS_GetPropertyValue(ctx, sp[-2], sp[-1]);
+    if (s->b->byte_code_buf[pos] == OP_get_array_el2) {
+        sp[-1] = val;
+    } else {
+        JS_FreeValue(ctx, sp[-2]);
+        sp[-2] = val;
+        sp--;
+    }
+    if (unlikely(JS_IsException(val)))
+        return js_jit_exception(s, sp);
+    return sp;
+}
+
+static JSValue *js_jit_put_array_el(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    int ret;
+
+    ret = JS_SetPropertyValue(ctx, sp[-3], sp[-2], sp[-1], JS_PROP_THROW_STRICT);
+    JS_FreeValue(ctx, sp[-3]);
+    sp -= 3;
+    if (unlikely(ret < 0))
+        return js_jit_exception(s, sp);
+    return sp;
+}
+
+static JSValue *js_jit_get_length(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val;
+
+    val = JS_GetProperty(ctx, sp[-1], JS_ATOM_length);
+    if (unlikely(JS_IsException(val)))
+        return js_jit_exception(s, sp);
+    JS_FreeValue(ctx, sp[-1]);
+    sp[-1] = val;
+    return sp;
+}
+
+/* the other property accesses and definitions */
+static JSValue *js_jit_object(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *pc = s->b->byte_code_buf + pos;
+    JSValue val;
+    JSAtom atom;
+    int opcode, ret;
+
+    opcode = *pc++;
+    switch(opcode) {
+    case OP_get_private_field:
+        val = JS_GetPrivateField(ctx, sp[-2], sp[-1]);
+        JS_FreeValue(ctx, sp[-1]);
+        JS_FreeValue(ctx, sp[-2]);
+        sp[-2] = val;
+        sp--;
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        break;
+    case OP_put_private_field:
+        ret = JS_SetPrivateField(ctx, sp[-3], sp[-1], sp[-2]);
+        JS_FreeValue(ctx, sp[-3]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp -= 3;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_define_private_field:
+        ret = JS_DefinePrivateField(ctx, sp[-3], sp[-2], sp[-1]);
+        JS_FreeValue(ctx, sp[-2]);
+        sp -= 2;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_get_ref_value:
+        if (unlikely(JS_IsUndefined(sp[-2]))) {
+            atom = JS_ValueToAtom(ctx, sp[-1]);
+            if (atom != JS_ATOM_NULL) {
+                JS_ThrowReferenceErrorNotDefined(ctx, atom);
+                JS_FreeAtom(ctx, atom);
+            }
+            goto exception;
+        }
+        val = JS_GetPropertyValue(ctx, sp[-2], JS_DupValue(ctx, sp[-1]));
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        *sp++ = val;
+        break;
+    case OP_put_ref_value:
+        {
+            int flags = JS_PROP_THROW_STRICT;
+            if (unlikely(JS_IsUndefined(sp[-3]))) {
+                if (is_strict_mode(ctx)) {
+                    atom = JS_ValueToAtom(ctx, sp[-2]);
+                    if (atom != JS_ATOM_NULL) {
+                        JS_ThrowReferenceErrorNotDefined(ctx, atom);
+                        JS_FreeAtom(ctx, atom);
+                    }
+                    goto exception;
+                } else {
+                    sp[-3] = JS_DupValue(ctx, ctx->global_obj);
+                }
+            } else {
+                if (is_strict_mode(ctx))
+                    flags |= JS_PROP_NO_ADD;
+            }
+            ret = JS_SetPropertyValue(ctx, sp[-3], sp[-2], sp[-1], flags);
+            JS_FreeValue(ctx, sp[-3]);
+            sp -= 3;
+            if (unlikely(ret < 0))
+                goto exception;
+        }
+        break;
+    case OP_get_super_value:
+        atom = JS_ValueToAtom(ctx, sp[-1]);
+        if (unlikely(atom == JS_ATOM_NULL))
+            goto exception;
+        val = JS_GetPropertyInternal(ctx, sp[-2], atom, sp[-3], FALSE);
+        JS_FreeAtom(ctx, atom);
+        if (unlikely(JS_IsException(val)))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        JS_FreeValue(ctx, sp[-2]);
+        JS_FreeValue(ctx, sp[-3]);
+        sp[-3] = val;
+        sp -= 2;
+        break;
+    case OP_put_super_value:
+        if (JS_VALUE_GET_TAG(sp[-3]) != JS_TAG_OBJECT) {
+            JS_ThrowTypeErrorNotAnObject(ctx);
+            goto exception;
+        }
+        atom = JS_ValueToAtom(ctx, sp[-2]);
+        if (unlikely(atom == JS_ATOM_NULL))
+            goto exception;
+        ret = JS_SetPropertyGeneric(ctx, sp[-3], atom, sp[-1], sp[-4],
+                                    JS_PROP_THROW_STRICT);
+        JS_FreeAtom(ctx, atom);
+        JS_FreeValue(ctx, sp[-4]);
+        JS_FreeValue(ctx, sp[-3]);
+        JS_FreeValue(ctx, sp[-2]);
+        sp -= 4;
+        if (ret < 0)
+            goto exception;
+        break;
+    case OP_define_field:
+        ret = JS_DefinePropertyValue(ctx, sp[-2], get_u32(pc), sp[-1],
+                                     JS_PROP_C_W_E | JS_PROP_THROW);
+        sp--;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_set_name:
+        ret = JS_DefineObjectName(ctx, sp[-1], get_u32(pc), JS_PROP_CONFIGURABLE);
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_set_name_computed:
+        ret = JS_DefineObjectNameComputed(ctx, sp[-1], sp[-2], JS_PROP_CONFIGURABLE);
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_set_proto:
+        val = sp[-1];
+        if (JS_IsObject(val) || JS_IsNull(val)) {
+            if (JS_SetPrototypeInternal(ctx, sp[-2], val, TRUE) < 0)
+                goto exception;
+        }
+        JS_FreeValue(ctx, val);
+        sp--;
+        break;
+    case OP_set_home_object:
+        js_method_set_home_object(ctx, sp[-1], sp[-2]);
+        break;
+    case OP_define_method:
+    case OP_define_method_computed:
+        {
+            JSValue getter, setter, value;
+            JSValueConst obj;
+            int flags, op_flags;
+            BOOL is_computed;
+
+            is_computed = (opcode == OP_define_method_computed);
+            if (is_computed) {
+                atom = JS_ValueToAtom(ctx, sp[-2]);
+                if (unlikely(atom == JS_ATOM_NULL))
+                    goto exception;
+            } else {
+                atom = get_u32(pc);
+                pc += 4;
+            }
+            op_flags = *pc;
+
+            obj = sp[-2 - is_computed];
+            flags = JS_PROP_HAS_CONFIGURABLE | JS_PROP_CONFIGURABLE |
+                JS_PROP_HAS_ENUMERABLE | JS_PROP_THROW;
+            if (op_flags & OP_DEFINE_METHOD_ENUMERABLE)
+                flags |= JS_PROP_ENUMERABLE;
+            op_flags &= 3;
+            value = JS_UNDEFINED;
+            getter = JS_UNDEFINED;
+            setter = JS_UNDEFINED;
+            if (op_flags == OP_DEFINE_METHOD_METHOD) {
+                value = sp[-1];
+                flags |= JS_PROP_HAS_VALUE | JS_PROP_HAS_WRITABLE | JS_PROP_WRITABLE;
+            } else if (op_flags == OP_DEFINE_METHOD_GETTER) {
+                getter = sp[-1];
+                flags |= JS_PROP_HAS_GET;
+            } else {
+                setter = sp[-1];
+                flags |= JS_PROP_HAS_SET;
+            }
+            ret = js_method_set_properties(ctx, sp[-1], atom, flags, obj);
+            if (ret >= 0) {
+                ret = JS_DefineProperty(ctx, obj, atom, value,
+                                        getter, setter, flags);
+            }
+            JS_FreeValue(ctx, sp[-1]);
+            if (is_computed) {
+                JS_FreeAtom(ctx, atom);
+                JS_FreeValue(ctx, sp[-2]);
+            }
+            sp -= 1 + is_computed;
+            if (unlikely(ret < 0))
+                goto exception;
+        }
+        break;
+    case OP_define_class:
+    case OP_define_class_computed:
+        if (js_op_define_class(ctx, sp, get_u32(pc), pc[4],
+                               s->var_refs, s->sf,
+                               (opcode == OP_define_class_computed)) < 0)
+            goto exception;
+        break;
+    case OP_define_array_el:
+        ret = JS_DefinePropertyValueValue(ctx, sp[-3], JS_DupValue(ctx, sp[-2]), sp[-1],
+                                          JS_PROP_C_W_E | JS_PROP_THROW);
+        sp -= 1;
+        if (unlikely(ret < 0))
+            goto exception;
+        break;
+    case OP_append:
+        if (js_append_enumerate(ctx, sp))
+            goto exception;
+        JS_FreeValue(ctx, *--sp);
+        break;
+    case OP_copy_data_properties:
+        {
+            /* stack offsets (-1 based):
+               2 bits for target,
+               3 bits for source,
+               2 bits for exclusionList */
+            int mask = *pc;
+            if (JS_CopyDataProperties(ctx, sp[-1 - (mask & 3)],
+                                      sp[-1 - ((mask >> 2) & 7)],
+                                      sp[-1 - ((mask >> 5) & 7)], 0))
+                goto exception;
+        }
+        break;
+    default:
+        abort();
+    }
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+/* operators: the helper is called for all the cases of the opcodes which
+   have no inline template and for the slow cases of the other ones */
+static JSValue *js_jit_arith(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    JSValue op1, op2, val;
+    JSAtom atom;
+    int opcode, v1, v2, res;
+    double d;
+
+    opcode = s->b->byte_code_buf[pos];
+    /* the branch of lt_if_false is compiled separately */
+    if (opcode == OP_lt_if_false)
+        opcode = OP_lt;
+    switch(opcode) {
+    case OP_add:
+        op1 = sp[-2];
+        op2 = sp[-1];
+        if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+            sp[-2] = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(op1) +
+                                     JS_VALUE_GET_FLOAT64(op2));
+        } else {
+            if (js_add_slow(ctx, sp))
+                goto exception;
+        }
+        sp--;
+        break;
+    case OP_sub:
+        op1 = sp[-2];
+        op2 = sp[-1];
+        if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+            sp[-2] = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(op1) -
+                                     JS_VALUE_GET_FLOAT64(op2));
+            sp--;
+            break;
+        }
+        goto binary_arith_slow;
+    case OP_mul:
+        op1 = sp[-2];
+        op2 = sp[-1];
+        if (unlikely(s->sf->js_mode & JS_MODE_MATH))
+            goto binary_arith_slow;
+        if (JS_VALUE_IS_BOTH_INT(op1, op2)) {
+            int64_t r;
+            v1 = JS_VALUE_GET_INT(op1);
+            v2 = JS_VALUE_GET_INT(op2);
+            r = (int64_t)v1 * v2;
+            if (unlikely((int)r != r)) {
+                d = (double)r;
+            } else if (unlikely(r == 0 && (v1 | v2) < 0)) {
+                /* -0 result */
+                d = -0.0;
+            } else {
+                sp[-2] = JS_NewInt32(ctx, r);
+                sp--;
+                break;
+            }
+        } else if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+            d = JS_VALUE_GET_FLOAT64(op1) * JS_VALUE_GET_FLOAT64(op2);
+        } else {
+            goto binary_arith_slow;
+        }
+        sp[-2] = __JS_NewFloat64(ctx, d);
+        sp--;
+        break;
+    case OP_div:
+        op1 = sp[-2];
+        op2 = sp[-1];
+        if (JS_VALUE_IS_BOTH_INT(op1, op2) &&
+            !(s->sf->js_mode & JS_MODE_MATH)) {
+            sp[-2] = JS_NewFloat64(ctx, (double)JS_VALUE_GET_INT(op1) /
+                                   (double)JS_VALUE_GET_INT(op2));
+            sp--;
+            break;
+        }
+        goto binary_arith_slow;
+    case OP_mod:
+#ifdef CONFIG_BIGNUM
+    case OP_math_mod:
+#endif
+        op1 = sp[-2];
+        op2 = sp[-1];
+        if (JS_VALUE_IS_BOTH_INT(op1, op2)) {
+            v1 = JS_VALUE_GET_INT(op1);
+            v2 = JS_VALUE_GET_INT(op2);
+            /* avoid v2 = 0, v1 = INT32_MIN and v2 = -1 and the cases
+               where the result is -0 */
+            if (v1 >= 0 && v2 > 0) {
+                sp[-2] = JS_NewInt32(ctx, v1 % v2);
+                sp--;
+                break;
+            }
+        }
+        goto binary_arith_slow;
+    case OP_pow:
+    binary_arith_slow:
+        if (js_binary_arith_slow(ctx, sp, opcode))
+            goto exception;
+        sp--;
+        break;
+    case OP_plus:
+    case OP_neg:
+    case OP_inc:
+    case OP_dec:
+        if (opcode == OP_neg && JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(sp[-1]))) {
+            sp[-1] = __JS_NewFloat64(ctx, -JS_VALUE_GET_FLOAT64(sp[-1]));
+            break;
+        }
+        if (opcode == OP_plus && JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(sp[-1])))
+            break;
+        if (js_unary_arith_slow(ctx, sp, opcode))
+            goto exception;
+        break;
+    case OP_post_inc:
+    case OP_post_dec:
+        if (js_post_inc_slow(ctx, sp, opcode))
+            goto exception;
+        sp++;
+        break;
+    case OP_not:
+        if (js_not_slow(ctx, sp))
+            goto exception;
+        break;
+    case OP_shl:
+    case OP_sar:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+        if (js_binary_logic_slow(ctx, sp, opcode))
+            goto exception;
+        sp--;
+        break;
+    case OP_shr:
+        if (js_shr_slow(ctx, sp))
+            goto exception;
+        sp--;
+        break;
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+        if (js_relational_slow(ctx, sp, opcode))
+            goto exception;
+        sp--;
+        break;
+    case OP_get_loc_i32_lt_if_false:
+        {
+            const uint8_t *pc = s->b->byte_code_buf + pos;
+            JSValue tab[2];
+            /* no stack slot is reserved for the operands */
+            tab[0] = JS_DupValue(ctx, s->var_buf[get_u16(pc + 1)]);
+            tab[1] = JS_NewInt32(ctx, get_u32(pc + 3));
+            if (js_relational_slow(ctx, tab + 2, OP_lt))
+                goto exception;
+            s->cond = JS_VALUE_GET_BOOL(tab[0]);
+        }
+        break;
+    case OP_eq:
+    case OP_neq:
+        if (js_eq_slow(ctx, sp, opcode == OP_neq))
+            goto exception;
+        sp--;
+        break;
+    case OP_strict_eq:
+    case OP_strict_neq:
+        if (js_strict_eq_slow(ctx, sp, opcode == OP_strict_neq))
+            goto exception;
+        sp--;
+        break;
+#ifdef CONFIG_BIGNUM
+    case OP_mul_pow10:
+        if (ctx->rt->bigfloat_ops.mul_pow10(ctx, sp))
+            goto exception;
+        sp--;
+        break;
+#endif
+    case OP_in:
+        if (js_operator_in(ctx, sp))
+            goto exception;
+        sp--;
+        break;
+    case OP_instanceof:
+        if (js_operator_instanceof(ctx, sp))
+            goto exception;
+        sp--;
+        break;
+    case OP_delete:
+        if (js_operator_delete(ctx, sp))
+            goto exception;
+        sp--;
+        break;
+    case OP_typeof:
+        op1 = sp[-1];
+        atom = js_operator_typeof(ctx, op1);
+        JS_FreeValue(ctx, op1);
+        sp[-1] = JS_AtomToString(ctx, atom);
+        break;
+    case OP_typeof_is_undefined:
+    case OP_typeof_is_function:
+        atom = js_operator_typeof(ctx, sp[-1]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = JS_NewBool(ctx, atom == (opcode == OP_typeof_is_undefined ?
+                                          JS_ATOM_undefined : JS_ATOM_function));
+        break;
+    case OP_is_undefined_or_null:
+    case OP_is_undefined:
+    case OP_is_null:
+        switch(JS_VALUE_GET_TAG(sp[-1])) {
+        case JS_TAG_UNDEFINED:
+            res = (opcode != OP_is_null);
+            break;
+        case JS_TAG_NULL:
+            res = (opcode != OP_is_undefined);
+            break;
+        default:
+            res = FALSE;
+            break;
+        }
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = JS_NewBool(ctx, res);
+        break;
+    case OP_lnot:
+        res = JS_ToBoolFree(ctx, sp[-1]);
+        sp[-1] = JS_NewBool(ctx, !res);
+        break;
+    case OP_to_object:
+        if (JS_VALUE_GET_TAG(sp[-1]) != JS_TAG_OBJECT) {
+            val = JS_ToObject(ctx, sp[-1]);
+            if (JS_IsException(val))
+                goto exception;
+            JS_FreeValue(ctx, sp[-1]);
+            sp[-1] = val;
+        }
+        break;
+    case OP_to_propkey2:
+        /* must be tested first */
+        if (unlikely(JS_IsUndefined(sp[-2]) || JS_IsNull(sp[-2]))) {
+            JS_ThrowTypeError(ctx, "value has no property");
+            goto exception;
+        }
+        /* fall thru */
+    case OP_to_propkey:
+        switch (JS_VALUE_GET_TAG(sp[-1])) {
+        case JS_TAG_INT:
+        case JS_TAG_STRING:
+        case JS_TAG_SYMBOL:
+            break;
+        default:
+            val = JS_ToPropertyKey(ctx, sp[-1]);
+            if (JS_IsException(val))
+                goto exception;
+            JS_FreeValue(ctx, sp[-1]);
+            sp[-1] = val;
+            break;
+        }
+        break;
+    default:
+        abort();
+    }
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+static JSValue *js_jit_misc(JSJITState *s, JSValue *sp, int pos)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *pc = s->b->byte_code_buf + pos;
+    JSValue val;
+    int opcode, ret;
+
+    opcode = *pc++;
+    switch(opcode) {
+    case OP_check_ctor_return:
+        /* return TRUE if 'this' should be returned */
+        if (!JS_IsObject(sp[-1])) {
+            if (!JS_IsUndefined(sp[-1])) {
+                JS_ThrowTypeError(s->caller_ctx, "derived class constructor must return an object or undefined");
+                goto exception;
+            }
+            sp[0] = JS_TRUE;
+        } else {
+            sp[0] = JS_FALSE;
+        }
+        sp++;
+        break;
+    case OP_check_ctor:
+        if (JS_IsUndefined(s->new_target)) {
+            JS_ThrowTypeError(ctx, "class constructors must be invoked with 'new'");
+            goto exception;
+        }
+        break;
+    case OP_check_brand:
+        if (JS_CheckBrand(ctx, sp[-2], sp[-1]) < 0)
+            goto exception;
+        break;
+    case OP_add_brand:
+        if (JS_AddBrand(ctx, sp[-2], sp[-1]) < 0)
+            goto exception;
+        JS_FreeValue(ctx, sp[-2]);
+        JS_FreeValue(ctx, sp[-1]);
+        sp -= 2;
+        break;
+    case OP_throw:
+        JS_Throw(ctx, *--sp);
+        goto exception;
+    case OP_throw_error:
+        {
+            JSAtom atom;
+            int type;
+            atom = get_u32(pc);
+            type = pc[4];
+            if (type == JS_THROW_VAR_RO)
+                JS_ThrowTypeErrorReadOnly(ctx, JS_PROP_THROW, atom);
+            else if (type == JS_THROW_VAR_REDECL)
+                JS_ThrowSyntaxErrorVarRedeclaration(ctx, atom);
+            else if (type == JS_THROW_VAR_UNINITIALIZED)
+                JS_ThrowReferenceErrorUninitialized(ctx, atom);
+            else if (type == JS_THROW_ERROR_DELETE_SUPER)
+                JS_ThrowReferenceError(ctx, "unsupported reference to 'super'");
+            else if (type == JS_THROW_ERROR_ITERATOR_THROW)
+                JS_ThrowTypeError(ctx, "iterator does not have a throw method");
+            else
+                JS_ThrowInternalError(ctx, "invalid throw var type %d", type);
+        }
+        goto exception;
+    case OP_regexp:
+        sp[-2] = js_regexp_constructor_internal(ctx, JS_UNDEFINED,
+                                                sp[-2], sp[-1]);
+        sp--;
+        break;
+    case OP_get_super:
+        val = JS_GetPrototype(ctx, sp[-1]);
+        if (JS_IsException(val))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = val;
+        break;
+    case OP_import:
+        val = js_dynamic_import(ctx, sp[-1]);
+        if (JS_IsException(val))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = val;
+        break;
+    case OP_for_in_start:
+        if (js_for_in_start(ctx, sp))
+            goto exception;
+        break;
+    case OP_for_in_next:
+        if (js_for_in_next(ctx, sp))
+            goto exception;
+        sp += 2;
+        break;
+    case OP_for_of_start:
+        if (js_for_of_start(ctx, sp, FALSE))
+            goto exception;
+        sp += 1;
+        *sp++ = JS_NewCatchOffset(ctx, 0);
+        break;
+    case OP_for_of_next:
+        if (js_for_of_next(ctx, sp, -3 - pc[0]))
+            goto exception;
+        sp += 2;
+        break;
+    case OP_iterator_get_value_done:
+        if (js_iterator_get_value_done(ctx, sp))
+            goto exception;
+        sp += 1;
+        break;
+    case OP_iterator_check_object:
+        if (unlikely(!JS_IsObject(sp[-1]))) {
+            JS_ThrowTypeError(ctx, "iterator must return an object");
+            goto exception;
+        }
+        break;
+    case OP_iterator_close:
+        /* iter_obj next catch_offset -> */
+        sp--; /* drop the catch offset to avoid getting caught by exception */
+        JS_FreeValue(ctx, sp[-1]); /* drop the next method */
+        sp--;
+        if (!JS_IsUndefined(sp[-1])) {
+            if (JS_IteratorClose(ctx, sp[-1], FALSE))
+                goto exception;
+            JS_FreeValue(ctx, sp[-1]);
+        }
+        sp--;
+        break;
+    case OP_iterator_close_return:
+        {
+            JSValue *stack_buf = s->var_buf + s->b->var_count;
+            /* iter_obj next catch_offset ... ret_val ->
+               ret_eval iter_obj next catch_offset */
+            val = *--sp;
+            while (sp > stack_buf &&
+                   JS_VALUE_GET_TAG(sp[-1]) != JS_TAG_CATCH_OFFSET) {
+                JS_FreeValue(ctx, *--sp);
+            }
+            if (unlikely(sp < stack_buf + 3)) {
+                JS_ThrowInternalError(ctx, "iterator_close_return");
+                JS_FreeValue(ctx, val);
+                goto exception;
+            }
+            sp[0] = sp[-1];
+            sp[-1] = sp[-2];
+            sp[-2] = sp[-3];
+            sp[-3] = val;
+            sp++;
+        }
+        break;
+    case OP_iterator_next:
+        /* stack: iter_obj next catch_offset val */
+        val = JS_Call(ctx, sp[-3], sp[-4], 1, (JSValueConst *)(sp - 1));
+        if (JS_IsException(val))
+            goto exception;
+        JS_FreeValue(ctx, sp[-1]);
+        sp[-1] = val;
+        break;
+    case OP_iterator_call:
+        /* stack: iter_obj next catch_offset val */
+        {
+            JSValue method;
+            int flags = pc[0];
+            method = JS_GetProperty(ctx, sp[-4], (flags & 1) ?
+                                    JS_ATOM_throw : JS_ATOM_return);
+            if (JS_IsException(method))
+                goto exception;
+            if (JS_IsUndefined(method) || JS_IsNull(method)) {
+                ret = TRUE;
+            } else {
+                if (flags & 2) {
+                    /* no argument */
+                    val = JS_CallFree(ctx, method, sp[-4], 0, NULL);
+                } else {
+                    val = JS_CallFree(ctx, method, sp[-4],
+                                      1, (JSValueConst *)(sp - 1));
+                }
+                if (JS_IsException(val))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = val;
+                ret = FALSE;
+            }
+            sp[0] = JS_NewBool(ctx, ret);
+            sp += 1;
+        }
+        break;
+    default:
+        abort();
+    }
+    return sp;
+ exception:
+    return js_jit_exception(s, sp);
+}
+
+/* x86-64 code generation */
+
+enum {
+    JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+/* registers preserved by the helpers */
+#define JIT_SP        JIT_R12 /* stack pointer */
+#define JIT_VAR_BUF   JIT_R13
+#define JIT_ARG_BUF   JIT_R14
+#define JIT_STATE     JIT_R15 /* JSJITState */
+#define JIT_VAR_REFS  JIT_RBX
+
+/* condition codes */
+enum {
+    JIT_CC_O = 0x0,
+    JIT_CC_E = 0x4,
+    JIT_CC_NE = 0x5,
+    JIT_CC_A = 0x7,
+    JIT_CC_L = 0xc,
+    JIT_CC_GE = 0xd,
+    JIT_CC_LE = 0xe,
+    JIT_CC_G = 0xf,
+};
+
+/* group 1 arithmetic: opcode for the register form or /digit for the
+   immediate form */
+enum {
+    JIT_ADD = 0,
+    JIT_OR = 1,
+    JIT_AND = 4,
+    JIT_SUB = 5,
+    JIT_XOR = 6,
+    JIT_CMP = 7,
+};
+
+/* jump target which is not a byte code position */
+#define JIT_LABEL_EPILOGUE  (-1)
+
+typedef struct JSJITReloc {
+    uint32_t offset; /* offset of the 32 bit displacement in the code */
+    int target; /* byte code position or JIT_LABEL_x */
+} JSJITReloc;
+
+typedef struct JSJITCompiler {
+    JSFunctionBytecode *b;
+    DynBuf code;
+    DynBuf relocs; /* JSJITReloc, jumps to the labels */
+    DynBuf stubs; /* JSJITReloc, jumps to the exception exit of 'target' */
+    int *pos_offset; /* code offset of each byte code position */
+} JSJITCompiler;
+
+static void jit_put8(JSJITCompiler *c, int v)
+{
+    dbuf_putc(&c->code, v);
+}
+
+static void jit_put32(JSJITCompiler *c, uint32_t v)
+{
+    dbuf_put_u32(&c->code, v);
+}
+
+static void jit_rex(JSJITCompiler *c, int w, int reg, int rm)
+{
+    int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40)
+        jit_put8(c, rex);
+}
+
+static void jit_opcode(JSJITCompiler *c, int op)
+{
+    if (op > 0xff)
+        jit_put8(c, op >> 8);
+    jit_put8(c, op);
+}
+
+/* op reg, rm (register operands) */
+static void jit_op_rr(JSJITCompiler *c, int w, int op, int reg, int rm)
+{
+    jit_rex(c, w, reg, rm);
+    jit_opcode(c, op);
+    jit_put8(c, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op reg, [base + disp] */
+static void jit_op_rm(JSJITCompiler *c, int w, int op, int reg, int base,
+                      int32_t disp)
+{
+    int mod;
+
+    jit_rex(c, w, reg, base);
+    jit_opcode(c, op);
+    if (disp == 0 && (base & 7) != JIT_RBP)
+        mod = 0;
+    else if (disp == (int8_t)disp)
+        mod = 1;
+    else
+        mod = 2;
+    jit_put8(c, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == JIT_RSP)
+        jit_put8(c, 0x24); /* SIB without index */
+    if (mod == 1)
+        jit_put8(c, disp);
+    else if (mod == 2)
+        jit_put32(c, disp);
+}
+
+static void jit_load(JSJITCompiler *c, int reg, int base, int32_t disp)
+{
+    jit_op_rm(c, 1, 0x8b, reg, base, disp);
+}
+
+static void jit_store(JSJITCompiler *c, int base, int32_t disp, int reg)
+{
+    jit_op_rm(c, 1, 0x89, reg, base, disp);
+}
+
+static void jit_store32_imm(JSJITCompiler *c, int base, int32_t disp,
+                            uint32_t v)
+{
+    jit_op_rm(c, 0, 0xc7, 0, base, disp);
+    jit_put32(c, v);
+}
+
+static void jit_mov_rr(JSJITCompiler *c, int dst, int src)
+{
+    jit_op_rr(c, 1, 0x89, src, dst);
+}
+
+static void jit_mov_imm(JSJITCompiler *c, int reg, uint64_t v)
+{
+    if (v <= UINT32_MAX) {
+        /* zero extended */
+        jit_rex(c, 0, 0, reg);
+        jit_put8(c, 0xb8 + (reg & 7));
+        jit_put32(c, v);
+    } else {
+        jit_rex(c, 1, 0, reg);
+        jit_put8(c, 0xb8 + (reg & 7));
+        dbuf_put_u64(&c->code, v);
+    }
+}
+
+/* arithmetic with an immediate operand */
+static void jit_alu_imm(JSJITCompiler *c, int w, int alu, int reg, int32_t v)
+{
+    if (v == (int8_t)v) {
+        jit_op_rr(c, w, 0x83, alu, reg);
+        jit_put8(c, v);
+    } else {
+        jit_op_rr(c, w, 0x81, alu, reg);
+        jit_put32(c, v);
+    }
+}
+
+/* arithmetic between registers: dst = dst op src */
+static void jit_alu_rr(JSJITCompiler *c, int w, int alu, int dst, int src)
+{
+    jit_op_rr(c, w, (alu << 3) | 1, src, dst);
+}
+
+static void jit_shift_imm(JSJITCompiler *c, BOOL left, int reg, int n)
+{
+    jit_op_rr(c, 1, 0xc1, left ? 4 : 5, reg);
+    jit_put8(c, n);
+}
+
+/* emit a conditional jump with an 8 bit displacement and return its
+   position, to be set by jit_patch8() */
+static int jit_jcc8(JSJITCompiler *c, int cc)
+{
+    jit_put8(c, 0x70 + cc);
+    jit_put8(c, 0);
+    return c->code.size;
+}
+
+static int jit_jmp8(JSJITCompiler *c)
+{
+    jit_put8(c, 0xeb);
+    jit_put8(c, 0);
+    return c->code.size;
+}
+
+/* the jump at 'label' goes to the current position */
+static void jit_patch8(JSJITCompiler *c, int label)
+{
+    int disp = c->code.size - label;
+    assert(disp < 128);
+    c->code.buf[label - 1] = disp;
+}
+
+static void jit_reloc(JSJITCompiler *c, DynBuf *list, int target)
+{
+    JSJITReloc r;
+    r.offset = c->code.size;
+    r.target = target;
+    dbuf_put(list, (const uint8_t *)&r, sizeof(r));
+    jit_put32(c, 0);
+}
+
+/* 'target' is a byte code position or JIT_LABEL_x */
+static void jit_jcc(JSJITCompiler *c, int cc, int target)
+{
+    jit_put8(c, 0x0f);
+    jit_put8(c, 0x80 + cc);
+    jit_reloc(c, &c->relocs, target);
+}
+
+static void jit_jmp(JSJITCompiler *c, int target)
+{
+    jit_put8(c, 0xe9);
+    jit_reloc(c, &c->relocs, target);
+}
+
+static void jit_call(JSJITCompiler *c, const void *func)
+{
+    jit_mov_imm(c, JIT_RAX, (uintptr_t)func);
+    jit_put8(c, 0xff); /* call rax */
+    jit_put8(c, 0xd0);
+}
+
+/* rcx = the JSRefCountHeader of the value in 'reg', which is kept */
+static void jit_get_ptr(JSJITCompiler *c, int reg)
+{
+    jit_mov_rr(c, JIT_RCX, reg);
+    jit_shift_imm(c, TRUE, JIT_RCX, 16);
+    jit_shift_imm(c, FALSE, JIT_RCX, 16);
+}
+
+/* jump if the value in 'reg' has no reference count, rcx is modified */
+static int jit_jump_if_no_ref_count(JSJITCompiler *c, int reg)
+{
+    jit_mov_rr(c, JIT_RCX, reg);
+    jit_shift_imm(c, FALSE, JIT_RCX, 51);
+    jit_alu_imm(c, 0, JIT_CMP, JIT_RCX, 1);
+    return jit_jcc8(c, JIT_CC_NE);
+}
+
+/* JS_DupValue() of the value in 'reg', rcx is modified */
+static void jit_dup(JSJITCompiler *c, int reg)
+{
+    int l;
+    l = jit_jump_if_no_ref_count(c, reg);
+    jit_get_ptr(c, reg);
+    jit_op_rm(c, 0, 0xff, 0, JIT_RCX, 0); /* inc dword [rcx] */
+    jit_patch8(c, l);
+}
+
+/* JS_FreeValue() of the value in 'reg' (not rcx), the scratch registers
+   are modified */
+static void jit_free(JSJITCompiler *c, int reg)
+{
+    int l1, l2;
+    l1 = jit_jump_if_no_ref_count(c, reg);
+    jit_get_ptr(c, reg);
+    jit_op_rm(c, 0, 0xff, 1, JIT_RCX, 0); /* dec dword [rcx] */
+    l2 = jit_jcc8(c, JIT_CC_G);
+    jit_mov_rr(c, JIT_RSI, reg);
+    jit_mov_imm(c, JIT_RDI, (uintptr_t)c->b->realm->rt);
+    jit_call(c, __JS_FreeValueRT);
+    jit_patch8(c, l1);
+    jit_patch8(c, l2);
+}
+
+/* jump if the value in 'reg' is not an integer, 'tmp' is modified */
+static int jit_jump_if_not_int(JSJITCompiler *c, int reg, int tmp)
+{
+    jit_mov_rr(c, tmp, reg);
+    jit_shift_imm(c, FALSE, tmp, 32);
+    jit_alu_imm(c, 0, JIT_CMP, tmp, JS_TAG_INT << 16);
+    return jit_jcc8(c, JIT_CC_NE);
+}
+
+static void jit_push_reg(JSJITCompiler *c, int reg)
+{
+    jit_store(c, JIT_SP, 0, reg);
+    jit_alu_imm(c, 1, JIT_ADD, JIT_SP, 8);
+}
+
+static void jit_push_value(JSJITCompiler *c, JSValue v)
+{
+    jit_mov_imm(c, JIT_RAX, v);
+    if (JS_VALUE_HAS_REF_COUNT(v)) {
+        jit_mov_imm(c, JIT_RCX, (uintptr_t)JS_VALUE_GET_PTR(v));
+        jit_op_rm(c, 0, 0xff, 0, JIT_RCX, 0); /* inc dword [rcx] */
+    }
+    jit_push_reg(c, JIT_RAX);
+}
+
+/* call the helper which executes the instruction at 'pos' */
+static void jit_call_helper(JSJITCompiler *c, JSJITHelper *func, int pos)
+{
+    jit_mov_rr(c, JIT_RDI, JIT_STATE);
+    jit_mov_rr(c, JIT_RSI, JIT_SP);
+    jit_mov_imm(c, JIT_RDX, pos);
+    jit_call(c, func);
+    jit_op_rr(c, 1, 0x85, JIT_RAX, JIT_RAX); /* test rax, rax */
+    jit_put8(c, 0x0f);
+    jit_put8(c, 0x80 + JIT_CC_E);
+    jit_reloc(c, &c->stubs, pos);
+    jit_mov_rr(c, JIT_SP, JIT_RAX);
+}
+
+/* return to JS_CallInternal() with 'status' */
+static void jit_exit(JSJITCompiler *c, JSJITStatusEnum status, int pos)
+{
+    jit_store(c, JIT_STATE, offsetof(JSJITState, sp), JIT_SP);
+    if (pos >= 0)
+        jit_store32_imm(c, JIT_STATE, offsetof(JSJITState, pos), pos);
+    jit_mov_imm(c, JIT_RAX, status);
+    jit_jmp(c, JIT_LABEL_EPILOGUE);
+}
+
+static void jit_poll_interrupts(JSJITCompiler *c, int pos)
+{
+    int l;
+    jit_mov_imm(c, JIT_RAX, (uintptr_t)&c->b->realm->interrupt_counter);
+    jit_op_rm(c, 0, 0xff, 1, JIT_RAX, 0); /* dec dword [rax] */
+    l = jit_jcc8(c, JIT_CC_G);
+    jit_call_helper(c, js_jit_poll_interrupts, pos);
+    jit_patch8(c, l);
+}
+
+/* the jump to 'target' polls the interrupts if it is a backward jump, as
+   the interpreter does for all the jumps */
+static void jit_branch(JSJITCompiler *c, int pos, int target, int cond)
+{
+    int l1, l2;
+
+    if (target <= pos)
+        jit_poll_interrupts(c, pos);
+    if (cond < 0) {
+        jit_jmp(c, target);
+        return;
+    }
+    /* pop the condition and convert it to a boolean */
+    jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+    jit_load(c, JIT_RSI, JIT_SP, 0);
+    jit_mov_rr(c, JIT_RAX, JIT_RSI);
+    jit_shift_imm(c, FALSE, JIT_RAX, 48);
+    jit_alu_imm(c, 0, JIT_CMP, JIT_RAX, JS_TAG_UNDEFINED);
+    l1 = jit_jcc8(c, JIT_CC_A);
+    jit_op_rr(c, 0, 0x89, JIT_RSI, JIT_RAX); /* mov eax, esi */
+    l2 = jit_jmp8(c);
+    jit_patch8(c, l1);
+    jit_mov_imm(c, JIT_RDI, (uintptr_t)c->b->realm);
+    jit_call(c, JS_ToBoolFree);
+    jit_patch8(c, l2);
+    jit_op_rr(c, 0, 0x85, JIT_RAX, JIT_RAX); /* test eax, eax */
+    jit_jcc(c, cond ? JIT_CC_NE : JIT_CC_E, target);
+}
+
+/* get_loc_i32_lt_if_false: no stack slot is reserved for the operands
+   of the comparison, so the helper of the slow path sets s->cond */
+static void jit_loc_i32_lt_branch(JSJITCompiler *c, int pos)
+{
+    const uint8_t *pc = c->b->byte_code_buf + pos;
+    int target, l1, l2;
+
+    target = pos + 7 + (int32_t)get_u32(pc + 7);
+    if (target <= pos)
+        jit_poll_interrupts(c, pos);
+    jit_load(c, JIT_RAX, JIT_VAR_BUF, get_u16(pc + 1) * 8);
+    l1 = jit_jump_if_not_int(c, JIT_RAX, JIT_RDX);
+    jit_alu_imm(c, 0, JIT_CMP, JIT_RAX, get_u32(pc + 3));
+    jit_jcc(c, JIT_CC_GE, target);
+    l2 = jit_jmp8(c);
+    jit_patch8(c, l1);
+    jit_call_helper(c, js_jit_arith, pos);
+    /* cmp dword [state + cond], 0 */
+    jit_op_rm(c, 0, 0x83, JIT_CMP, JIT_STATE, offsetof(JSJITState, cond));
+    jit_put8(c, 0);
+    jit_jcc(c, JIT_CC_E, target);
+    jit_patch8(c, l2);
+}
+
+/* integer fast path of the binary operators. The slow path calls
+   'helper'. */
+static void jit_binary_op(JSJITCompiler *c, int op, int pos)
+{
+    int l1, l2, l3, l4;
+
+    jit_load(c, JIT_RAX, JIT_SP, -16);
+    jit_load(c, JIT_RCX, JIT_SP, -8);
+    l1 = jit_jump_if_not_int(c, JIT_RAX, JIT_RDX);
+    l2 = jit_jump_if_not_int(c, JIT_RCX, JIT_RDX);
+    l3 = -1;
+    switch(op) {
+    case OP_add:
+    case OP_sub:
+        jit_alu_rr(c, 0, op == OP_add ? JIT_ADD : JIT_SUB, JIT_RAX, JIT_RCX);
+        l3 = jit_jcc8(c, JIT_CC_O);
+        goto set_int;
+    case OP_and:
+        jit_alu_rr(c, 0, JIT_AND, JIT_RAX, JIT_RCX);
+        goto set_int;
+    case OP_or:
+        jit_alu_rr(c, 0, JIT_OR, JIT_RAX, JIT_RCX);
+        goto set_int;
+    case OP_xor:
+        jit_alu_rr(c, 0, JIT_XOR, JIT_RAX, JIT_RCX);
+    set_int:
+        /* the 32 bit operation cleared the tag */
+        jit_op_rr(c, 1, 0x0fba, 5, JIT_RAX); /* bts rax, 48 */
+        jit_put8(c, 48);
+        break;
+    default:
+        {
+            int cc;
+            switch(op) {
+            case OP_lt:
+                cc = JIT_CC_L;
+                break;
+            case OP_lte:
+                cc = JIT_CC_LE;
+                break;
+            case OP_gt:
+                cc = JIT_CC_G;
+                break;
+            case OP_gte:
+                cc = JIT_CC_GE;
+                break;
+            case OP_eq:
+            case OP_strict_eq:
+                cc = JIT_CC_E;
+                break;
+            default:
+                cc = JIT_CC_NE;
+                break;
+            }
+            jit_alu_rr(c, 0, JIT_CMP, JIT_RAX, JIT_RCX);
+            jit_op_rr(c, 0, 0x0f90 + cc, 0, JIT_RDX); /* setcc dl */
+            jit_op_rr(c, 0, 0x0fb6, JIT_RDX, JIT_RDX); /* movzx edx, dl */
+            jit_mov_imm(c, JIT_RAX, JS_FALSE);
+            jit_alu_rr(c, 1, JIT_OR, JIT_RAX, JIT_RDX);
+        }
+        break;
+    }
+    jit_store(c, JIT_SP, -16, JIT_RAX);
+    jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+    l4 = jit_jmp8(c);
+    jit_patch8(c, l1);
+    jit_patch8(c, l2);
+    if (l3 >= 0)
+        jit_patch8(c, l3);
+    jit_call_helper(c, js_jit_arith, pos);
+    jit_patch8(c, l4);
+}
+
+/* fast path of inc, dec (value in [base + disp]) and add_loc (value in
+   [base + disp] and on the stack) */
+static void jit_inc_op(JSJITCompiler *c, int op, int base, int32_t disp,
+                       JSJITHelper *helper, int pos)
+{
+    int l1, l2, l3, l4;
+
+    jit_load(c, JIT_RAX, base, disp);
+    l1 = jit_jump_if_not_int(c, JIT_RAX, JIT_RDX);
+    l2 = -1;
+    if (op == OP_add_loc) {
+        jit_load(c, JIT_RCX, JIT_SP, -8);
+        l2 = jit_jump_if_not_int(c, JIT_RCX, JIT_RDX);
+        jit_alu_rr(c, 0, JIT_ADD, JIT_RAX, JIT_RCX);
+    } else {
+        jit_alu_imm(c, 0, (op == OP_inc || op == OP_inc_loc) ?
+                    JIT_ADD : JIT_SUB, JIT_RAX, 1);
+    }
+    l3 = jit_jcc8(c, JIT_CC_O);
+    jit_op_rr(c, 1, 0x0fba, 5, JIT_RAX); /* bts rax, 48 */
+    jit_put8(c, 48);
+    jit_store(c, base, disp, JIT_RAX);
+    if (op == OP_add_loc)
+        jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+    l4 = jit_jmp8(c);
+    jit_patch8(c, l1);
+    if (l2 >= 0)
+        jit_patch8(c, l2);
+    jit_patch8(c, l3);
+    jit_call_helper(c, helper, pos);
+    jit_patch8(c, l4);
+}
+
+/* set the address of the variable of the instruction to [*pbase + *pdisp],
+   rdx is used for the closure variables */
+static void jit_var_addr(JSJITCompiler *c, int kind, int idx,
+                         int *pbase, int *pdisp)
+{
+    switch(kind) {
+    case OP_FMT_loc:
+        *pbase = JIT_VAR_BUF;
+        *pdisp = idx * 8;
+        break;
+    case OP_FMT_arg:
+        *pbase = JIT_ARG_BUF;
+        *pdisp = idx * 8;
+        break;
+    default:
+        jit_load(c, JIT_RDX, JIT_VAR_REFS, idx * 8);
+        jit_load(c, JIT_RDX, JIT_RDX, offsetof(JSVarRef, pvalue));
+        *pbase = JIT_RDX;
+        *pdisp = 0;
+        break;
+    }
+}
+
+/* get, put or set a variable. 'check' is set for the variables in TDZ:
+   the helper throws the exception if the variable is not initialized. */
+static void jit_var_op(JSJITCompiler *c, int kind, int idx, int op,
+                       BOOL check, int pos)
+{
+    int l1, l2, base, disp;
+
+    jit_var_addr(c, kind, idx, &base, &disp);
+    l1 = l2 = -1;
+    if (check) {
+        jit_op_rm(c, 1, 0x83, JIT_CMP, base, disp); /* cmp qword [var], 0 */
+        jit_put8(c, 0);
+        l1 = jit_jcc8(c, JIT_CC_NE);
+        jit_call_helper(c, js_jit_var, pos);
+        l2 = jit_jmp8(c);
+        jit_patch8(c, l1);
+    }
+    switch(op) {
+    case OP_get_loc:
+        jit_load(c, JIT_RAX, base, disp);
+        jit_dup(c, JIT_RAX);
+        jit_push_reg(c, JIT_RAX);
+        break;
+    case OP_put_loc:
+    case OP_set_loc:
+        jit_load(c, JIT_R8, JIT_SP, -8);
+        if (op == OP_put_loc)
+            jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+        else
+            jit_dup(c, JIT_R8);
+        jit_load(c, JIT_RAX, base, disp);
+        jit_store(c, base, disp, JIT_R8);
+        jit_free(c, JIT_RAX);
+        break;
+    default:
+        abort();
+    }
+    if (check)
+        jit_patch8(c, l2);
+}
+
+/* Compile the function to native code. Return -1 if there is not enough
+   memory. The exceptions are not thrown. */
+static int js_jit_compile(JSContext *ctx, JSFunctionBytecode *b)
+{
+    JSJITCompiler c_s, *c = &c_s;
+    const uint8_t *bc_buf = b->byte_code_buf;
+    int pos, len, op, i, epilogue, exception, offset, target, supported;
+    JSJITReloc *r;
+    void *code;
+
+    memset(c, 0, sizeof(*c));
+    c->b = b;
+    js_dbuf_init(ctx, &c->code);
+    js_dbuf_init(ctx, &c->relocs);
+    js_dbuf_init(ctx, &c->stubs);
+    c->pos_offset = js_malloc_rt(ctx->rt, sizeof(c->pos_offset[0]) *
+                                 (b->byte_code_len + 1));
+    if (!c->pos_offset)
+        goto fail;
+
+    /* prologue: the stack stays aligned on 16 bytes for the calls */
+    jit_put8(c, 0x55); /* push rbp */
+    jit_put8(c, 0x53); /* push rbx */
+    jit_put8(c, 0x41); /* push r12 .. r15 */
+    jit_put8(c, 0x54);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x55);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x56);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x57);
+    jit_alu_imm(c, 1, JIT_SUB, JIT_RSP, 8);
+    jit_mov_rr(c, JIT_STATE, JIT_RDI);
+    jit_mov_rr(c, JIT_SP, JIT_RSI);
+    jit_load(c, JIT_VAR_BUF, JIT_STATE, offsetof(JSJITState, var_buf));
+    jit_load(c, JIT_ARG_BUF, JIT_STATE, offsetof(JSJITState, arg_buf));
+    jit_load(c, JIT_VAR_REFS, JIT_STATE, offsetof(JSJITState, var_refs));
+
+    supported = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += len) {
+        op = bc_buf[pos];
+        len = short_opcode_info(op).size;
+        c->pos_offset[pos] = c->code.size;
+        switch(op) {
+        case OP_push_minus1:
+        case OP_push_0:
+        case OP_push_1:
+        case OP_push_2:
+        case OP_push_3:
+        case OP_push_4:
+        case OP_push_5:
+        case OP_push_6:
+        case OP_push_7:
+            jit_push_value(c, JS_NewInt32(ctx, op - OP_push_0));
+            break;
+        case OP_push_i8:
+            jit_push_value(c, JS_NewInt32(ctx, get_i8(bc_buf + pos + 1)));
+            break;
+        case OP_push_i16:
+            jit_push_value(c, JS_NewInt32(ctx, get_i16(bc_buf + pos + 1)));
+            break;
+        case OP_push_i32:
+            jit_push_value(c, JS_NewInt32(ctx, get_u32(bc_buf + pos + 1)));
+            break;
+        case OP_push_const:
+            jit_push_value(c, b->cpool[get_u32(bc_buf + pos + 1)]);
+            break;
+        case OP_push_const8:
+            jit_push_value(c, b->cpool[bc_buf[pos + 1]]);
+            break;
+        case OP_undefined:
+            jit_push_value(c, JS_UNDEFINED);
+            break;
+        case OP_null:
+            jit_push_value(c, JS_NULL);
+            break;
+        case OP_push_false:
+            jit_push_value(c, JS_FALSE);
+            break;
+        case OP_push_true:
+            jit_push_value(c, JS_TRUE);
+            break;
+        case OP_fclosure:
+        case OP_fclosure8:
+        case OP_push_atom_value:
+        case OP_private_symbol:
+        case OP_push_empty_string:
+        case OP_push_this:
+        case OP_object:
+        case OP_special_object:
+        case OP_rest:
+            jit_call_helper(c, js_jit_push, pos);
+            break;
+
+        case OP_drop:
+            jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+            jit_load(c, JIT_RAX, JIT_SP, 0);
+            jit_free(c, JIT_RAX);
+            break;
+        case OP_dup:
+            jit_load(c, JIT_RAX, JIT_SP, -8);
+            jit_dup(c, JIT_RAX);
+            jit_push_reg(c, JIT_RAX);
+            break;
+        case OP_swap:
+            jit_load(c, JIT_RAX, JIT_SP, -16);
+            jit_load(c, JIT_RCX, JIT_SP, -8);
+            jit_store(c, JIT_SP, -16, JIT_RCX);
+            jit_store(c, JIT_SP, -8, JIT_RAX);
+            break;
+        case OP_nip:
+        case OP_nip1:
+        case OP_dup1:
+        case OP_dup2:
+        case OP_dup3:
+        case OP_insert2:
+        case OP_insert3:
+        case OP_insert4:
+        case OP_perm3:
+        case OP_perm4:
+        case OP_perm5:
+        case OP_swap2:
+        case OP_rot3l:
+        case OP_rot3r:
+        case OP_rot4l:
+        case OP_rot5l:
+            jit_call_helper(c, js_jit_stack, pos);
+            break;
+        case OP_nop:
+            break;
+
+        case OP_call0:
+        case OP_call1:
+        case OP_call2:
+        case OP_call3:
+        case OP_call:
+        case OP_call_method:
+        case OP_call_constructor:
+        case OP_array_from:
+        case OP_apply:
+            jit_call_helper(c, js_jit_call, pos);
+            break;
+        case OP_tail_call:
+        case OP_tail_call_method:
+            /* the helper sets the return value */
+            jit_call_helper(c, js_jit_call, pos);
+            jit_exit(c, JS_JIT_RETURN, -1);
+            break;
+        case OP_return:
+            jit_alu_imm(c, 1, JIT_SUB, JIT_SP, 8);
+            jit_load(c, JIT_RAX, JIT_SP, 0);
+            jit_store(c, JIT_STATE, offsetof(JSJITState, ret_val), JIT_RAX);
+            jit_exit(c, JS_JIT_RETURN, -1);
+            break;
+        case OP_return_undef:
+            jit_mov_imm(c, JIT_RAX, JS_UNDEFINED);
+            jit_store(c, JIT_STATE, offsetof(JSJITState, ret_val), JIT_RAX);
+            jit_exit(c, JS_JIT_RETURN, -1);
+            break;
+
+        case OP_get_loc:
+        case OP_put_loc:
+        case OP_set_loc:
+            jit_var_op(c, OP_FMT_loc, get_u16(bc_buf + pos + 1), op,
+                       FALSE, pos);
+            break;
+        case OP_get_arg:
+        case OP_put_arg:
+        case OP_set_arg:
+            jit_var_op(c, OP_FMT_arg, get_u16(bc_buf + pos + 1),
+                       op - OP_get_arg + OP_get_loc, FALSE, pos);
+            break;
+        case OP_get_var_ref:
+        case OP_put_var_ref:
+        case OP_set_var_ref:
+            jit_var_op(c, OP_FMT_var_ref, get_u16(bc_buf + pos + 1),
+                       op - OP_get_var_ref + OP_get_loc, FALSE, pos);
+            break;
+        case OP_get_loc8:
+        case OP_put_loc8:
+        case OP_set_loc8:
+            jit_var_op(c, OP_FMT_loc, bc_buf[pos + 1],
+                       op - OP_get_loc8 + OP_get_loc, FALSE, pos);
+            break;
+        case OP_get_loc0: case OP_get_loc1: case OP_get_loc2: case OP_get_loc3:
+            jit_var_op(c, OP_FMT_loc, op - OP_get_loc0, OP_get_loc, FALSE, pos);
+            break;
+        case OP_put_loc0: case OP_put_loc1: case OP_put_loc2: case OP_put_loc3:
+            jit_var_op(c, OP_FMT_loc, op - OP_put_loc0, OP_put_loc, FALSE, pos);
+            break;
+        case OP_set_loc0: case OP_set_loc1: case OP_set_loc2: case OP_set_loc3:
+            jit_var_op(c, OP_FMT_loc, op - OP_set_loc0, OP_set_loc, FALSE, pos);
+            break;
+        case OP_get_arg0: case OP_get_arg1: case OP_get_arg2: case OP_get_arg3:
+            jit_var_op(c, OP_FMT_arg, op - OP_get_arg0, OP_get_loc, FALSE, pos);
+            break;
+        case OP_put_arg0: case OP_put_arg1: case OP_put_arg2: case OP_put_arg3:
+            jit_var_op(c, OP_FMT_arg, op - OP_put_arg0, OP_put_loc, FALSE, pos);
+            break;
+        case OP_set_arg0: case OP_set_arg1: case OP_set_arg2: case OP_set_arg3:
+            jit_var_op(c, OP_FMT_arg, op - OP_set_arg0, OP_set_loc, FALSE, pos);
+            break;
+        case OP_get_var_ref0: case OP_get_var_ref1:
+        case OP_get_var_ref2: case OP_get_var_ref3:
+            jit_var_op(c, OP_FMT_var_ref, op - OP_get_var_ref0, OP_get_loc,
+                       FALSE, pos);
+            break;
+        case OP_put_var_ref0: case OP_put_var_ref1:
+        case OP_put_var_ref2: case OP_put_var_ref3:
+            jit_var_op(c, OP_FMT_var_ref, op - OP_put_var_ref0, OP_put_loc,
+                       FALSE, pos);
+            break;
+        case OP_set_var_ref0: case OP_set_var_ref1:
+        case OP_set_var_ref2: case OP_set_var_ref3:
+            jit_var_op(c, OP_FMT_var_ref, op - OP_set_var_ref0, OP_set_loc,
+                       FALSE, pos);
+            break;
+        case OP_get_loc_check:
+            jit_var_op(c, OP_FMT_loc, get_u16(bc_buf + pos + 1), OP_get_loc,
+                       TRUE, pos);
+            break;
+        case OP_put_loc_check:
+            jit_var_op(c, OP_FMT_loc, get_u16(bc_buf + pos + 1), OP_put_loc,
+                       TRUE, pos);
+            break;
+        case OP_get_var_ref_check:
+            jit_var_op(c, OP_FMT_var_ref, get_u16(bc_buf + pos + 1),
+                       OP_get_loc, TRUE, pos);
+            break;
+        case OP_put_var_ref_check:
+            jit_var_op(c, OP_FMT_var_ref, get_u16(bc_buf + pos + 1),
+                       OP_put_loc, TRUE, pos);
+            break;
+        case OP_set_loc_uninitialized:
+            i = get_u16(bc_buf + pos + 1);
+            jit_load(c, JIT_RAX, JIT_VAR_BUF, i * 8);
+            jit_op_rm(c, 1, 0xc7, 0, JIT_VAR_BUF, i * 8); /* mov qword, 0 */
+            jit_put32(c, 0);
+            jit_free(c, JIT_RAX);
+            break;
+        case OP_put_loc_check_init:
+        case OP_put_var_ref_check_init:
+        case OP_close_loc:
+        case OP_make_loc_ref:
+        case OP_make_arg_ref:
+        case OP_make_var_ref_ref:
+        case OP_make_var_ref:
+            jit_call_helper(c, js_jit_var, pos);
+            break;
+        case OP_inc_loc:
+        case OP_dec_loc:
+        case OP_add_loc:
+            jit_inc_op(c, op, JIT_VAR_BUF, bc_buf[pos + 1] * 8, js_jit_var, pos);
+            break;
+
+        case OP_get_var_undef:
+        case OP_get_var:
+            jit_call_helper(c, js_jit_get_var, pos);
+            break;
+        case OP_check_var:
+        case OP_put_var:
+        case OP_put_var_init:
+        case OP_put_var_strict:
+        case OP_check_define_var:
+        case OP_define_var:
+        case OP_define_func:
+        case OP_delete_var:
+            jit_call_helper(c, js_jit_global, pos);
+            break;
+        case OP_get_field:
+        case OP_get_field2:
+        case OP_get_field_call0:
+            jit_call_helper(c, js_jit_get_field, pos);
+            break;
+        case OP_get_loc_field:
+        case OP_get_arg_field:
+            jit_var_op(c, op == OP_get_loc_field ? OP_FMT_loc : OP_FMT_arg,
+                       get_u16(bc_buf + pos + 5), OP_get_loc, FALSE, pos);
+            jit_call_helper(c, js_jit_get_field, pos);
+            break;
+        case OP_put_field:
+            jit_call_helper(c, js_jit_put_field, pos);
+            break;
+        case OP_get_array_el:
+        case OP_get_array_el2:
+            jit_call_helper(c, js_jit_get_array_el, pos);
+            break;
+        case OP_put_array_el:
+            jit_call_helper(c, js_jit_put_array_el, pos);
+            break;
+        case OP_get_length:
+            jit_call_helper(c, js_jit_get_length, pos);
+            break;
+        case OP_get_private_field:
+        case OP_put_private_field:
+        case OP_define_private_field:
+        case OP_get_ref_value:
+        case OP_put_ref_value:
+        case OP_get_super_value:
+        case OP_put_super_value:
+        case OP_define_field:
+        case OP_set_name:
+        case OP_set_name_computed:
+        case OP_set_proto:
+        case OP_set_home_object:
+        case OP_define_method:
+        case OP_define_method_computed:
+        case OP_define_class:
+        case OP_define_class_computed:
+        case OP_define_array_el:
+        case OP_append:
+        case OP_copy_data_properties:
+            jit_call_helper(c, js_jit_object, pos);
+            break;
+
+        case OP_add:
+        case OP_sub:
+        case OP_and:
+        case OP_or:
+        case OP_xor:
+        case OP_lt:
+        case OP_lte:
+        case OP_gt:
+        case OP_gte:
+        case OP_eq:
+        case OP_neq:
+        case OP_strict_eq:
+        case OP_strict_neq:
+            jit_binary_op(c, op, pos);
+            break;
+        case OP_inc:
+        case OP_dec:
+            jit_inc_op(c, op, JIT_SP, -8, js_jit_arith, pos);
+            break;
+        case OP_mul:
+        case OP_div:
+        case OP_mod:
+        case OP_pow:
+        case OP_plus:
+        case OP_neg:
+        case OP_post_inc:
+        case OP_post_dec:
+        case OP_not:
+        case OP_shl:
+        case OP_sar:
+        case OP_shr:
+#ifdef CONFIG_BIGNUM
+        case OP_mul_pow10:
+        case OP_math_mod:
+#endif
+        case OP_in:
+        case OP_instanceof:
+        case OP_delete:
+        case OP_typeof:
+        case OP_typeof_is_undefined:
+        case OP_typeof_is_function:
+        case OP_is_undefined_or_null:
+        case OP_is_undefined:
+        case OP_is_null:
+        case OP_lnot:
+        case OP_to_object:
+        case OP_to_propkey:
+        case OP_to_propkey2:
+            jit_call_helper(c, js_jit_arith, pos);
+            break;
+
+        case OP_check_ctor_return:
+        case OP_check_ctor:
+        case OP_check_brand:
+        case OP_add_brand:
+        case OP_throw:
+        case OP_throw_error:
+        case OP_regexp:
+        case OP_get_super:
+        case OP_import:
+        case OP_for_in_start:
+        case OP_for_in_next:
+        case OP_for_of_start:
+        case OP_for_of_next:
+        case OP_iterator_get_value_done:
+        case OP_iterator_check_object:
+        case OP_iterator_close:
+        case OP_iterator_close_return:
+        case OP_iterator_next:
+        case OP_iterator_call:
+            jit_call_helper(c, js_jit_misc, pos);
+            break;
+
+        case OP_goto:
+            jit_branch(c, pos, pos + 1 + (int32_t)get_u32(bc_buf + pos + 1), -1);
+            break;
+        case OP_goto16:
+            jit_branch(c, pos, pos + 1 + (int16_t)get_u16(bc_buf + pos + 1), -1);
+            break;
+        case OP_goto8:
+            jit_branch(c, pos, pos + 1 + (int8_t)bc_buf[pos + 1], -1);
+            break;
+        case OP_if_true:
+        case OP_if_false:
+            jit_branch(c, pos, pos + 1 + (int32_t)get_u32(bc_buf + pos + 1),
+                       op == OP_if_true);
+            break;
+        case OP_if_true8:
+        case OP_if_false8:
+            jit_branch(c, pos, pos + 1 + (int8_t)bc_buf[pos + 1],
+                       op == OP_if_true8);
+            break;
+        case OP_lt_if_false:
+            jit_binary_op(c, OP_lt, pos);
+            jit_branch(c, pos, pos + 1 + (int32_t)get_u32(bc_buf + pos + 1), 0);
+            break;
+        case OP_get_loc_i32_lt_if_false:
+            jit_loc_i32_lt_branch(c, pos);
+            break;
+        case OP_catch:
+            jit_push_value(c, JS_NewCatchOffset(ctx, pos + 1 +
+                                                (int32_t)get_u32(bc_buf + pos + 1)));
+            break;
+
+        default:
+            /* gosub, ret, with_x, eval, generators: the interpreter
+               executes the rest of the function */
+            jit_exit(c, JS_JIT_BAILOUT, pos);
+            continue;
+        }
+        supported++;
+    }
+    c->pos_offset[pos] = c->code.size;
+    /* not worth it if most of the instructions exit to the interpreter */
+    if (supported == 0)
+        goto fail;
+
+    /* exits */
+    exception = c->code.size;
+    jit_mov_imm(c, JIT_RAX, JS_JIT_EXCEPTION);
+    epilogue = c->code.size;
+    jit_alu_imm(c, 1, JIT_ADD, JIT_RSP, 8);
+    jit_put8(c, 0x41); /* pop r15 .. r12 */
+    jit_put8(c, 0x5f);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x5e);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x5d);
+    jit_put8(c, 0x41);
+    jit_put8(c, 0x5c);
+    jit_put8(c, 0x5b); /* pop rbx */
+    jit_put8(c, 0x5d); /* pop rbp */
+    jit_put8(c, 0xc3); /* ret */
+
+    /* exception exits of the helper calls */
+    r = (JSJITReloc *)c->stubs.buf;
+    for(i = 0; i < c->stubs.size / sizeof(*r); i++) {
+        put_u32(c->code.buf + r[i].offset, c->code.size - (r[i].offset + 4));
+        jit_store32_imm(c, JIT_STATE, offsetof(JSJITState, pos), r[i].target);
+        jit_put8(c, 0xe9);
+        jit_put32(c, exception - (c->code.size + 4));
+    }
+    if (dbuf_error(&c->code) || dbuf_error(&c->relocs) || dbuf_error(&c->stubs))
+        goto fail;
+
+    r = (JSJITReloc *)c->relocs.buf;
+    for(i = 0; i < c->relocs.size / sizeof(*r); i++) {
+        if (r[i].target == JIT_LABEL_EPILOGUE)
+            target = epilogue;
+        else
+            target = c->pos_offset[r[i].target];
+        offset = r[i].offset;
+        put_u32(c->code.buf + offset, target - (offset + 4));
+    }
+
+    code = mmap(NULL, c->code.size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        goto fail;
+    memcpy(code, c->code.buf, c->code.size);
+    if (mprotect(code, c->code.size, PROT_READ | PROT_EXEC) < 0) {
+        munmap(code, c->code.size);
+        goto fail;
+    }
+    b->jit_code = code;
+    b->jit_size = c->code.size;
+    js_free_rt(ctx->rt, c->pos_offset);
+    dbuf_free(&c->code);
+    dbuf_free(&c->relocs);
+    dbuf_free(&c->stubs);
+    return 0;
+ fail:
+    js_free_rt(ctx->rt, c->pos_offset);
+    dbuf_free(&c->code);
+    dbuf_free(&c->relocs);
+    dbuf_free(&c->stubs);
+    return -1;
+}
+
+static void js_jit_free(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    if (b->jit_code) {
+        munmap(b->jit_code, b->jit_size);
+        b->jit_code = NULL;
+    }
+}
+
+#endif /* CONFIG_JIT */
+
 static void free_bytecode_atoms(JSRuntime *rt,
                                 const uint8_t *bc_buf, int bc_len,
-                                BOOL use_short_opcodes)
+                                BOOL use_short_opcodes,
+                                const JSFunctionBytecode *b)
 {
     int pos, len, op;
     JSAtom atom;
@@ -29300,6 +32540,9 @@ static void free_bytecode_atoms(JSRuntime *rt,
         case OP_FMT_atom_u16:
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
+            /* the atoms of the caches are freed with them */
+            if (bc_has_cache(b, op))
+                break;
             atom = get_u32(bc_buf + pos + 1);
             JS_FreeAtomRT(rt, atom);
             break;
@@ -29323,7 +32566,7 @@ static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
     }
 
     free_bytecode_atoms(ctx->rt, fd->byte_code.buf, fd->byte_code.size,
-                        fd->use_short_opcodes);
+                        fd->use_short_opcodes, NULL);
     dbuf_free(&fd->byte_code);
     js_free(ctx, fd->jump_slots);
     js_free(ctx, fd->label_slots);
@@ -29429,6 +32672,10 @@ static void dump_byte_code(JSContext *ctx, int pass,
                 pos++;
                 addr = (int16_t)get_u16(tab + pos);
                 goto has_addr;
+            case OP_FMT_loc_i32_label:
+                pos += 7;
+                addr = get_u32(tab + pos);
+                goto has_addr;
 #endif
             case OP_FMT_atom_label_u8:
             case OP_FMT_atom_label_u16:
@@ -29573,6 +32820,11 @@ static void dump_byte_code(JSContext *ctx, int pass,
             printf(",%u", get_u16(tab + pos + 4));
             break;
 #if SHORT_OPCODES
+        case OP_FMT_loc_i32_label:
+            addr = get_u32(tab + pos + 6);
+            printf(" %u,%d,%u", get_u16(tab + pos), get_i32(tab + pos + 2),
+                   addr + pos + 6);
+            break;
         case OP_FMT_const8:
             idx = get_u8(tab + pos);
             goto has_pool_idx;
@@ -29588,22 +32840,22 @@ static void dump_byte_code(JSContext *ctx, int pass,
             break;
         case OP_FMT_atom:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, bc_operand_atom(b, op, tab + pos));
             break;
         case OP_FMT_atom_u8:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, bc_operand_atom(b, op, tab + pos));
             printf(",%d", get_u8(tab + pos + 4));
             break;
         case OP_FMT_atom_u16:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, bc_operand_atom(b, op, tab + pos));
             printf(",%d", get_u16(tab + pos + 4));
             break;
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
             printf(" ");
-            print_atom(ctx, get_u32(tab + pos));
+            print_atom(ctx, bc_operand_atom(b, op, tab + pos));
             addr = get_u32(tab + pos + 4);
             if (pass == 1)
                 printf(",%u:%u", addr, label_slots[addr].pos);
@@ -32310,10 +35562,47 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
             }
             goto no_change;
+
+        case OP_get_field2:
+            if (OPTIMIZE) {
+                /* transformation: get_field2(x) call_method(0) -> get_field_call0(x)
+                   except before return where tail_call_method is used */
+                if (code_match(&cc, pos_next, OP_call_method, 0, -1)) {
+                    int pos1 = cc.pos;
+                    int line1 = cc.line_num;
+                    if (!code_match(&cc, pos1, OP_return, -1)) {
+                        if (line1 >= 0) line_num = line1;
+                        add_pc2line_info(s, bc_out.size, line_num);
+                        dbuf_putc(&bc_out, OP_get_field_call0);
+                        dbuf_put_u32(&bc_out, get_u32(bc_buf + pos + 1));
+                        pos_next = pos1;
+                        break;
+                    }
+                }
+            }
+            goto no_change;
+
+        case OP_lt:
+            if (OPTIMIZE) {
+                /* transformation: lt if_false(l) -> lt_if_false(l) */
+                if (code_match(&cc, pos_next, OP_if_false, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    pos_next = cc.pos;
+                    label = find_jump_target(s, cc.label, &op1, NULL);
+                    op = OP_lt_if_false;
+                    goto has_label;
+                }
+            }
+            goto no_change;
 #endif
         case OP_push_atom_value:
             if (OPTIMIZE) {
                 JSAtom atom = get_u32(bc_buf + pos + 1);
+                /* transformation: push_atom_value(x) to_propkey -> push_atom_value(x) */
+                if (code_match(&cc, pos_next, OP_to_propkey, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    pos_next = cc.pos;
+                }
                 /* remove push/drop pairs generated by the parser */
                 if (code_match(&cc, pos_next, OP_drop, -1)) {
                     JS_FreeAtom(ctx, atom);
@@ -32500,6 +35789,49 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     pos_next = cc.pos;
                     break;
                 }
+#if SHORT_OPCODES
+                /* transformation: get_loc(n) get_field(x) -> get_loc_field(x, n) */
+                if (code_match(&cc, pos_next, OP_get_field, -1) &&
+                    cc.atom != JS_ATOM_length) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, OP_get_loc_field);
+                    dbuf_put_u32(&bc_out, cc.atom);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
+                /* transformation:
+                   get_loc(n) push_i32(x) lt if_false(l) -> get_loc_i32_lt_if_false(n, x, l)
+                 */
+                if (code_match(&cc, pos_next, OP_push_i32, -1)) {
+                    int pos1 = cc.pos;
+                    val = cc.label;
+                    if (code_match(&cc, pos1, OP_lt, OP_if_false, -1)) {
+                        if (cc.line_num >= 0) line_num = cc.line_num;
+                        pos_next = cc.pos;
+                        label = find_jump_target(s, cc.label, &op1, NULL);
+                        assert(label >= 0 && label < s->label_count);
+                        ls = &label_slots[label];
+                        add_pc2line_info(s, bc_out.size, line_num);
+                        jp = &s->jump_slots[s->jump_count++];
+                        jp->op = OP_get_loc_i32_lt_if_false;
+                        jp->size = 4;
+                        jp->pos = bc_out.size + 7;
+                        jp->label = label;
+                        dbuf_putc(&bc_out, OP_get_loc_i32_lt_if_false);
+                        dbuf_put_u16(&bc_out, idx);
+                        dbuf_put_u32(&bc_out, val);
+                        dbuf_put_u32(&bc_out, ls->addr - bc_out.size);
+                        if (ls->addr == -1) {
+                            /* unresolved yet: create a new relocation entry */
+                            if (!add_reloc(ctx, ls, bc_out.size - 4, 4))
+                                goto fail;
+                        }
+                        break;
+                    }
+                }
+#endif
                 add_pc2line_info(s, bc_out.size, line_num);
                 put_short_code(&bc_out, op, idx);
                 break;
@@ -32511,6 +35843,18 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             if (OPTIMIZE) {
                 int idx;
                 idx = get_u16(bc_buf + pos + 1);
+                /* transformation: get_arg(n) get_field(x) -> get_arg_field(x, n) */
+                if (op == OP_get_arg &&
+                    code_match(&cc, pos_next, OP_get_field, -1) &&
+                    cc.atom != JS_ATOM_length) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, OP_get_arg_field);
+                    dbuf_put_u32(&bc_out, cc.atom);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
                 add_pc2line_info(s, bc_out.size, line_num);
                 put_short_code(&bc_out, op, idx);
                 break;
@@ -32522,9 +35866,12 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
         case OP_put_var_ref:
             if (OPTIMIZE) {
                 /* transformation: put_x(n) get_x(n) -> set_x(n) */
+                /* transformation: put_loc(n) get_loc_check(n) -> set_loc(n) */
                 int idx;
                 idx = get_u16(bc_buf + pos + 1);
-                if (code_match(&cc, pos_next, op - 1, idx, -1)) {
+                if (code_match(&cc, pos_next, op - 1, idx, -1) ||
+                    (op == OP_put_loc &&
+                     code_match(&cc, pos_next, OP_get_loc_check, idx, -1))) {
                     if (cc.line_num >= 0) line_num = cc.line_num;
                     add_pc2line_info(s, bc_out.size, line_num);
                     put_short_code(&bc_out, op + 1, idx);
@@ -32878,6 +36225,16 @@ static __exception int compute_stack_size(JSContext *ctx,
             if (ss_check(ctx, s, pos + 1 + diff, op, stack_len))
                 goto fail;
             break;
+        case OP_lt_if_false:
+            diff = get_u32(bc_buf + pos + 1);
+            if (ss_check(ctx, s, pos + 1 + diff, op, stack_len))
+                goto fail;
+            break;
+        case OP_get_loc_i32_lt_if_false:
+            diff = get_u32(bc_buf + pos + 7);
+            if (ss_check(ctx, s, pos + 7 + diff, op, stack_len))
+                goto fail;
+            break;
 #endif
         case OP_if_true:
         case OP_if_false:
@@ -32962,6 +36319,392 @@ static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
     return 0;
 }
 
+#ifdef DUMP_OPCODE_SEQUENCES
+
+#define JS_OP_SEQ_HASH_BITS 16
+
+/* 'key' is (n << 24) | op1 | (op2 << 8) [| (op3 << 16)] for a sequence
+   of n opcodes of the final byte code, 0 if the entry is free */
+typedef struct JSOpSeqCount {
+    uint32_t key;
+    uint32_t count;
+} JSOpSeqCount;
+
+static void js_count_opcode_seq(JSRuntime *rt, uint32_t key)
+{
+    JSOpSeqCount *tab = rt->op_seq_tab;
+    uint32_t i, h, mask = (1 << JS_OP_SEQ_HASH_BITS) - 1;
+
+    h = (key * 0x9e3779b1) >> (32 - JS_OP_SEQ_HASH_BITS);
+    /* when the table is full, the new sequences are ignored */
+    for(i = 0; i <= mask; i++) {
+        if (tab[h].key == key) {
+            tab[h].count++;
+            return;
+        }
+        if (tab[h].key == 0) {
+            tab[h].key = key;
+            tab[h].count = 1;
+            return;
+        }
+        h = (h + 1) & mask;
+    }
+}
+
+/* count the pairs and triples of consecutive opcodes of the final byte
+   code of a function. Run 'qjsc -c' on a set of scripts to get the
+   statistics of a corpus without executing it. */
+static void js_count_opcode_sequences(JSContext *ctx, const uint8_t *bc_buf,
+                                      int bc_len)
+{
+    JSRuntime *rt = ctx->rt;
+    int pos, op, op1, op2;
+
+    if (!rt->op_seq_tab) {
+        rt->op_seq_tab = js_mallocz_rt(rt, sizeof(JSOpSeqCount) <<
+                                       JS_OP_SEQ_HASH_BITS);
+        if (!rt->op_seq_tab)
+            return;
+    }
+    op1 = op2 = -1;
+    for(pos = 0; pos < bc_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (op1 >= 0)
+            js_count_opcode_seq(rt, (2 << 24) | op1 | (op << 8));
+        if (op2 >= 0)
+            js_count_opcode_seq(rt, (3 << 24) | op2 | (op1 << 8) | (op << 16));
+        op2 = op1;
+        op1 = op;
+    }
+}
+
+static int js_op_seq_count_cmp(const void *a, const void *b)
+{
+    const JSOpSeqCount *e1 = a, *e2 = b;
+    if (e1->count != e2->count)
+        return e1->count < e2->count ? 1 : -1;
+    return (e1->key > e2->key) - (e1->key < e2->key);
+}
+
+static void js_dump_opcode_sequences(JSRuntime *rt)
+{
+    JSOpSeqCount *tab = rt->op_seq_tab;
+    int i, j, n, len, count[4];
+
+    if (!tab)
+        return;
+    qsort(tab, 1 << JS_OP_SEQ_HASH_BITS, sizeof(tab[0]), js_op_seq_count_cmp);
+    count[2] = count[3] = 0;
+    for(i = 0; i < (1 << JS_OP_SEQ_HASH_BITS) && tab[i].key != 0; i++)
+        count[tab[i].key >> 24] += tab[i].count;
+    for(n = 2; n <= 3; n++) {
+        printf("%-7s %8s %6s  %s\n", "RANK", "COUNT", "%",
+               n == 2 ? "OPCODE PAIR" : "OPCODE TRIPLE");
+        j = 0;
+        for(i = 0; i < (1 << JS_OP_SEQ_HASH_BITS) && tab[i].key != 0 &&
+                j < 50; i++) {
+            if ((tab[i].key >> 24) != n)
+                continue;
+            printf("%-7d %8u %6.2f ", ++j, tab[i].count,
+                   tab[i].count * 100.0 / count[n]);
+            for(len = 0; len < n; len++) {
+                printf(" %s",
+                       short_opcode_info((tab[i].key >> (8 * len)) & 0xff).name);
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+    js_free_rt(rt, tab);
+    rt->op_seq_tab = NULL;
+}
+#endif /* DUMP_OPCODE_SEQUENCES */
+
+#ifdef CONFIG_PROFILE_OPCODES
+
+/* number of functions in the report and of hot instructions shown for
+   each of the first ones */
+#define JS_PROFILE_MAX_FUNCS       50
+#define JS_PROFILE_MAX_HOT_FUNCS   20
+#define JS_PROFILE_MAX_HOT_PCS     10
+
+static void js_profile_free_func(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSOpProfileFunc *pf = b->profile;
+    int pos;
+
+    if (!pf)
+        return;
+    /* keep what the report needs. In case of memory error, only the
+       totals of the function are reported. */
+    pf->byte_code = js_malloc_rt(rt, b->byte_code_len);
+    pf->pc_line = js_malloc_rt(rt, sizeof(pf->pc_line[0]) * b->byte_code_len);
+    if (pf->byte_code && pf->pc_line) {
+        memcpy(pf->byte_code, b->byte_code_buf, b->byte_code_len);
+        for(pos = 0; pos < b->byte_code_len; pos++) {
+            if (pf->count[pos] != 0)
+                pf->pc_line[pos] = find_line_num(b->realm, b, pos);
+            else
+                pf->pc_line[pos] = -1;
+        }
+    } else {
+        js_free_rt(rt, pf->byte_code);
+        js_free_rt(rt, pf->pc_line);
+        pf->byte_code = NULL;
+        pf->pc_line = NULL;
+    }
+    pf->b = NULL;
+    b->profile = NULL;
+}
+
+static void js_profile_free(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+
+    list_for_each_safe(el, el1, &rt->profile_list) {
+        JSOpProfileFunc *pf = list_entry(el, JSOpProfileFunc, link);
+        if (pf->b)
+            pf->b->profile = NULL;
+        JS_FreeAtomRT(rt, pf->func_name);
+        JS_FreeAtomRT(rt, pf->filename);
+        js_free_rt(rt, pf->byte_code);
+        js_free_rt(rt, pf->pc_line);
+        js_free_rt(rt, pf);
+    }
+    init_list_head(&rt->profile_list);
+    rt->profile_cur = NULL;
+}
+
+/* return the opcode at 'pos' or -1 if it is no longer known */
+static int js_profile_get_opcode(JSOpProfileFunc *pf, int pos)
+{
+    if (pf->b)
+        return pf->b->byte_code_buf[pos];
+    else if (pf->byte_code)
+        return pf->byte_code[pos];
+    else
+        return -1;
+}
+
+static int js_profile_get_line(JSOpProfileFunc *pf, int pos)
+{
+    if (pf->b)
+        return find_line_num(pf->b->realm, pf->b, pos);
+    else if (pf->pc_line)
+        return pf->pc_line[pos];
+    else
+        return -1;
+}
+
+/* the functions are ranked by self cycles if they are available,
+   otherwise by execution count */
+static int js_profile_func_cmp(const void *a, const void *b, void *opaque)
+{
+    const JSOpProfileFunc *pf1 = *(JSOpProfileFunc **)a;
+    const JSOpProfileFunc *pf2 = *(JSOpProfileFunc **)b;
+    uint64_t v1, v2;
+
+    if (*(BOOL *)opaque) {
+        v1 = pf1->total_cycles;
+        v2 = pf2->total_cycles;
+    } else {
+        v1 = pf1->total_count;
+        v2 = pf2->total_count;
+    }
+    return (v1 < v2) - (v1 > v2);
+}
+
+typedef struct JSProfileSortContext {
+    const uint64_t *count;
+    const uint64_t *cycles;
+    BOOL has_cycles;
+} JSProfileSortContext;
+
+/* sort indexes in the 'count' and 'cycles' arrays */
+static int js_profile_index_cmp(const void *a, const void *b, void *opaque)
+{
+    const JSProfileSortContext *sc = opaque;
+    int i1 = *(int *)a, i2 = *(int *)b;
+    uint64_t v1, v2;
+
+    if (sc->has_cycles) {
+        v1 = sc->cycles[i1];
+        v2 = sc->cycles[i2];
+    } else {
+        v1 = sc->count[i1];
+        v2 = sc->count[i2];
+    }
+    if (v1 != v2)
+        return (v1 < v2) - (v1 > v2);
+    return (i1 > i2) - (i1 < i2);
+}
+
+static void js_profile_dump_func_name(JSRuntime *rt, FILE *f,
+                                      JSOpProfileFunc *pf)
+{
+    char buf[ATOM_GET_STR_BUF_SIZE];
+
+    if (pf->func_name == JS_ATOM_NULL)
+        fprintf(f, "<anonymous>");
+    else
+        fprintf(f, "%s", JS_AtomGetStrRT(rt, buf, sizeof(buf), pf->func_name));
+    if (pf->filename != JS_ATOM_NULL) {
+        fprintf(f, " (%s:%d)",
+                JS_AtomGetStrRT(rt, buf, sizeof(buf), pf->filename),
+                pf->line_num);
+    }
+}
+
+static double js_profile_percent(uint64_t v, uint64_t total)
+{
+    return total ? v * 100.0 / total : 0;
+}
+
+static int js_profile_dump_hot_pcs(JSRuntime *rt, FILE *f, JSOpProfileFunc *pf,
+                                   BOOL has_cycles)
+{
+    JSProfileSortContext sc;
+    int *tab, pos, n, i, op, line;
+    uint64_t total;
+
+    if (js_profile_get_opcode(pf, 0) < 0)
+        return 0;
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * pf->byte_code_len);
+    if (!tab)
+        return -1;
+    n = 0;
+    for(pos = 0; pos < pf->byte_code_len; pos++) {
+        if (pf->count[pos] != 0)
+            tab[n++] = pos;
+    }
+    sc.count = pf->count;
+    sc.cycles = pf->cycles;
+    sc.has_cycles = has_cycles;
+    rqsort(tab, n, sizeof(tab[0]), js_profile_index_cmp, &sc);
+
+    fprintf(f, "\n");
+    js_profile_dump_func_name(rt, f, pf);
+    fprintf(f, ":\n%6s %6s  %-24s %12s %14s %7s\n",
+            "PC", "LINE", "OPCODE", "COUNT", "CYCLES", "%");
+    total = has_cycles ? pf->total_cycles : pf->total_count;
+    for(i = 0; i < n && i < JS_PROFILE_MAX_HOT_PCS; i++) {
+        pos = tab[i];
+        op = js_profile_get_opcode(pf, pos);
+        line = js_profile_get_line(pf, pos);
+        fprintf(f, "%6d ", pos);
+        if (line >= 0)
+            fprintf(f, "%6d", line);
+        else
+            fprintf(f, "%6s", "?");
+        fprintf(f, "  %-24s %12"PRIu64" %14"PRIu64" %6.2f%%\n",
+                short_opcode_info(op).name, pf->count[pos], pf->cycles[pos],
+                js_profile_percent(has_cycles ? pf->cycles[pos] :
+                                   pf->count[pos], total));
+    }
+    js_free_rt(rt, tab);
+    return 0;
+}
+
+int JS_DumpOpcodeProfile(JSRuntime *rt, FILE *f)
+{
+    struct list_head *el;
+    JSOpProfileFunc *pf, **tab;
+    JSProfileSortContext sc;
+    uint64_t total_count, total_cycles, total;
+    uint64_t op_count[256], op_cycles[256];
+    int op_tab[256];
+    int n, i, pos, op;
+    BOOL has_cycles;
+
+    n = 0;
+    list_for_each(el, &rt->profile_list)
+        n++;
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * max_int(n, 1));
+    if (!tab)
+        return -1;
+
+    total_count = 0;
+    total_cycles = 0;
+    memset(op_count, 0, sizeof(op_count));
+    memset(op_cycles, 0, sizeof(op_cycles));
+    n = 0;
+    list_for_each(el, &rt->profile_list) {
+        pf = list_entry(el, JSOpProfileFunc, link);
+        pf->total_count = 0;
+        pf->total_cycles = 0;
+        for(pos = 0; pos < pf->byte_code_len; pos++) {
+            if (pf->count[pos] == 0)
+                continue;
+            pf->total_count += pf->count[pos];
+            pf->total_cycles += pf->cycles[pos];
+            op = js_profile_get_opcode(pf, pos);
+            if (op >= 0) {
+                op_count[op] += pf->count[pos];
+                op_cycles[op] += pf->cycles[pos];
+            }
+        }
+        total_count += pf->total_count;
+        total_cycles += pf->total_cycles;
+        tab[n++] = pf;
+    }
+    has_cycles = (total_cycles != 0);
+    total = has_cycles ? total_cycles : total_count;
+    rqsort(tab, n, sizeof(tab[0]), js_profile_func_cmp, &has_cycles);
+
+    fprintf(f, "QuickJS opcode profile: %"PRIu64" instructions", total_count);
+    if (has_cycles)
+        fprintf(f, ", %"PRIu64" cycles", total_cycles);
+    fprintf(f, " in %d functions\n\n", n);
+
+    fprintf(f, "%7s %14s %12s  %s\n", "SELF%", "CYCLES", "COUNT", "FUNCTION");
+    for(i = 0; i < n && i < JS_PROFILE_MAX_FUNCS; i++) {
+        pf = tab[i];
+        fprintf(f, "%6.2f%% %14"PRIu64" %12"PRIu64"  ",
+                js_profile_percent(has_cycles ? pf->total_cycles :
+                                   pf->total_count, total),
+                pf->total_cycles, pf->total_count);
+        js_profile_dump_func_name(rt, f, pf);
+        fprintf(f, "\n");
+    }
+
+    for(i = 0; i < n && i < JS_PROFILE_MAX_HOT_FUNCS; i++) {
+        if (js_profile_dump_hot_pcs(rt, f, tab[i], has_cycles)) {
+            js_free_rt(rt, tab);
+            return -1;
+        }
+    }
+    js_free_rt(rt, tab);
+
+    n = 0;
+    for(op = 0; op < 256; op++) {
+        if (op_count[op] != 0)
+            op_tab[n++] = op;
+    }
+    sc.count = op_count;
+    sc.cycles = op_cycles;
+    sc.has_cycles = has_cycles;
+    rqsort(op_tab, n, sizeof(op_tab[0]), js_profile_index_cmp, &sc);
+    fprintf(f, "\n%-24s %14s %7s %14s %7s\n",
+            "OPCODE", "COUNT", "%", "CYCLES", "%");
+    for(i = 0; i < n; i++) {
+        op = op_tab[i];
+        fprintf(f, "%-24s %14"PRIu64" %6.2f%% %14"PRIu64" %6.2f%%\n",
+                short_opcode_info(op).name,
+                op_count[op], js_profile_percent(op_count[op], total_count),
+                op_cycles[op], js_profile_percent(op_cycles[op], total_cycles));
+    }
+    return 0;
+}
+
+#else
+
+int JS_DumpOpcodeProfile(JSRuntime *rt, FILE *f)
+{
+    return -1;
+}
+
+#endif /* CONFIG_PROFILE_OPCODES */
+
 /* create a function object from a function definition. The function
    definition is freed. All the child functions are also created. It
    must be done this way to resolve all the variables. */
@@ -33061,6 +36804,10 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     if (compute_stack_size(ctx, fd, &stack_size) < 0)
         goto fail;
 
+#ifdef DUMP_OPCODE_SEQUENCES
+    js_count_opcode_sequences(ctx, fd->byte_code.buf, fd->byte_code.size);
+#endif
+
     if (fd->js_mode & JS_MODE_STRIP) {
         function_size = offsetof(JSFunctionBytecode, debug);
     } else {
@@ -33087,6 +36834,7 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     memcpy(b->byte_code_buf, fd->byte_code.buf, fd->byte_code.size);
     js_free(ctx, fd->byte_code.buf);
     fd->byte_code.buf = NULL;
+    js_init_inline_caches(ctx, b);
 
     b->func_name = fd->func_name;
     if (fd->arg_count + fd->var_count > 0) {
@@ -33201,7 +36949,14 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
                JS_AtomGetStrRT(rt, buf, sizeof(buf), b->func_name));
     }
 #endif
-    free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, TRUE);
+#ifdef CONFIG_PROFILE_OPCODES
+    js_profile_free_func(rt, b);
+#endif
+    free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, TRUE, b);
+    js_free_inline_caches(rt, b);
+#ifdef CONFIG_JIT
+    js_jit_free(rt, b);
+#endif
 
     if (b->vardefs) {
         for(i = 0; i < b->arg_count + b->var_count; i++) {
@@ -34403,10 +38158,12 @@ typedef enum BCTagEnum {
     BC_TAG_OBJECT_REFERENCE,
 } BCTagEnum;
 
+/* incremented when the opcodes change: bytecode of older versions is
+   rejected instead of being executed with a different opcode table */
 #ifdef CONFIG_BIGNUM
-#define BC_BASE_VERSION 2
+#define BC_BASE_VERSION 4
 #else
-#define BC_BASE_VERSION 1
+#define BC_BASE_VERSION 3
 #endif
 #define BC_BE_VERSION 0x40
 #ifdef WORDS_BIGENDIAN
@@ -34595,6 +38352,14 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
             put_u16(bc_buf + pos + 1 + 4,
                     bswap16(get_u16(bc_buf + pos + 1 + 4)));
             break;
+        case OP_FMT_loc_i32_label:
+            put_u16(bc_buf + pos + 1,
+                    bswap16(get_u16(bc_buf + pos + 1)));
+            put_u32(bc_buf + pos + 1 + 2,
+                    bswap32(get_u32(bc_buf + pos + 1 + 2)));
+            put_u32(bc_buf + pos + 1 + 6,
+                    bswap32(get_u32(bc_buf + pos + 1 + 6)));
+            break;
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
             put_u32(bc_buf + pos + 1,
@@ -34620,9 +38385,9 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
 }
 
 static int JS_WriteFunctionBytecode(BCWriterState *s,
-                                    const uint8_t *bc_buf1, int bc_len)
+                                    const JSFunctionBytecode *b)
 {
-    int pos, len, op;
+    int pos, len, op, bc_len = b->byte_code_len;
     JSAtom atom;
     uint8_t *bc_buf;
     uint32_t val;
@@ -34630,7 +38395,7 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
     bc_buf = js_malloc(s->ctx, bc_len);
     if (!bc_buf)
         return -1;
-    memcpy(bc_buf, bc_buf1, bc_len);
+    memcpy(bc_buf, b->byte_code_buf, bc_len);
 
     pos = 0;
     while (pos < bc_len) {
@@ -34642,7 +38407,7 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
         case OP_FMT_atom_u16:
         case OP_FMT_atom_label_u8:
         case OP_FMT_atom_label_u16:
-            atom = get_u32(bc_buf + pos + 1);
+            atom = bc_operand_atom(b, op, bc_buf + pos + 1);
             if (bc_atom_to_idx(s, &val, atom))
                 goto fail;
             put_u32(bc_buf + pos + 1, val);
@@ -34881,7 +38646,7 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
         bc_put_u8(s, flags);
     }
     
-    if (JS_WriteFunctionBytecode(s, b->byte_code_buf, b->byte_code_len))
+    if (JS_WriteFunctionBytecode(s, b))
         goto fail;
     
     if (b->has_debug) {
@@ -35588,6 +39353,9 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
         }
         pos += len;
     }
+    /* the byte code of ROM data is read-only */
+    if (!s->is_rom_data)
+        js_init_inline_caches(s->ctx, b);
     return 0;
 }
 
@@ -46455,6 +50223,7 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    MARK_MODIFIED_VALUE(this_val);
     key = map_normalize_key(ctx, argv[0]);
     if (s->is_weak && !JS_IsObject(key))
         return JS_ThrowTypeErrorNotAnObject(ctx);
@@ -46483,6 +50252,7 @@ static JSValue js_map_get(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    PRELOAD_PERSISTENT_VALUE(this_val);
     key = map_normalize_key(ctx, argv[0]);
     mr = map_find_record(ctx, s, key);
     if (!mr)
@@ -46500,6 +50270,7 @@ static JSValue js_map_has(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    PRELOAD_PERSISTENT_VALUE(this_val);
     key = map_normalize_key(ctx, argv[0]);
     mr = map_find_record(ctx, s, key);
     return JS_NewBool(ctx, (mr != NULL));
@@ -46514,6 +50285,7 @@ static JSValue js_map_delete(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    MARK_MODIFIED_VALUE(this_val);
     key = map_normalize_key(ctx, argv[0]);
     mr = map_find_record(ctx, s, key);
     if (!mr)
@@ -46531,6 +50303,7 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    MARK_MODIFIED_VALUE(this_val);
     list_for_each_safe(el, el1, &s->records) {
         mr = list_entry(el, JSMapRecord, link);
         map_delete_record(ctx->rt, s, mr);
@@ -46543,6 +50316,7 @@ static JSValue js_map_get_size(JSContext *ctx, JSValueConst this_val, int magic)
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     if (!s)
         return JS_EXCEPTION;
+    PRELOAD_PERSISTENT_VALUE(this_val);
     return JS_NewUint32(ctx, s->record_count);
 }
 
@@ -46557,6 +50331,7 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
 
     if (!s)
         return JS_EXCEPTION;
+    PRELOAD_PERSISTENT_VALUE(this_val);
     func = argv[0];
     if (argc > 1)
         this_arg = argv[1];
@@ -46724,6 +50499,7 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     }
     if (JS_IsUndefined(it->obj))
         goto done;
+    PRELOAD_PERSISTENT_VALUE(it->obj); /* dormant if unloaded before the first step */
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
     if (!it->cur_record) {
@@ -52257,6 +56033,56 @@ JSValue JS_GetTypedArrayBuffer(JSContext *ctx, JSValueConst obj,
     }
     return JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, ta->buffer));
 }
+
+/* class ids in the order of JSTypedArrayEnum */
+static const uint16_t typed_array_enum_class_id[] = {
+    JS_CLASS_UINT8C_ARRAY,
+    JS_CLASS_INT8_ARRAY,
+    JS_CLASS_UINT8_ARRAY,
+    JS_CLASS_INT16_ARRAY,
+    JS_CLASS_UINT16_ARRAY,
+    JS_CLASS_INT32_ARRAY,
+    JS_CLASS_UINT32_ARRAY,
+#ifdef CONFIG_BIGNUM
+    JS_CLASS_BIG_INT64_ARRAY,
+    JS_CLASS_BIG_UINT64_ARRAY,
+#else
+    0,
+    0,
+#endif
+    JS_CLASS_FLOAT32_ARRAY,
+    JS_CLASS_FLOAT64_ARRAY,
+};
+
+JSValue JS_NewTypedArray(JSContext *ctx, int argc, JSValueConst *argv,
+                         JSTypedArrayEnum array_type)
+{
+    JSValueConst args[3];
+    int i;
+
+    if ((unsigned)array_type >= countof(typed_array_enum_class_id) ||
+        !typed_array_enum_class_id[array_type])
+        return JS_ThrowRangeError(ctx, "invalid typed array type");
+    /* the constructor reads offset and length when argv[0] is a buffer */
+    for(i = 0; i < 3; i++)
+        args[i] = i < argc ? argv[i] : JS_UNDEFINED;
+    return js_typed_array_constructor(ctx, JS_UNDEFINED, 3, args,
+                                      typed_array_enum_class_id[array_type]);
+}
+
+int JS_GetTypedArrayType(JSValueConst obj)
+{
+    JSClassID class_id = JS_GetClassID(obj);
+    int i;
+
+    if (class_id < JS_CLASS_UINT8C_ARRAY || class_id > JS_CLASS_FLOAT64_ARRAY)
+        return -1;
+    for(i = 0; i < countof(typed_array_enum_class_id); i++) {
+        if (typed_array_enum_class_id[i] == class_id)
+            return i;
+    }
+    return -1;
+}
                                
 static JSValue js_typed_array_get_toStringTag(JSContext *ctx,
                                               JSValueConst this_val)
@@ -54953,7 +58779,7 @@ JSValue JS_GetLocalValue(JSContext *ctx, JSAtom name)
 
 JS_BOOL js_is_persitable(JSValue val);
 
-JS_BOOL js_set_persistent_rt(JSRuntime* rt, JSValue val, struct JSStorage* pst, uint32_t oid, JS_PERSISTENT_STATUS status) {
+JS_BOOL js_set_persistent_rt(JSRuntime* rt, JSValue val, struct JSStorage* pst, JS_PERSISTENT_OID oid, JS_PERSISTENT_STATUS status) {
 
   assert(js_is_persitable(val));
 
@@ -54976,11 +58802,13 @@ JS_BOOL js_set_persistent_rt(JSRuntime* rt, JSValue val, struct JSStorage* pst,
   po->persistent->status = status; // loaded, modified, etc.
   po->persistent->oid = oid;
   po->persistent->storage = pst;
+  po->persistent->size = 0;
+  po->persistent->accessed = 0;
 
   return 1;
 }
 
-JS_BOOL js_set_persistent(JSContext* ctx, JSValue val, struct JSStorage* pst, uint32_t oid, JS_PERSISTENT_STATUS status) {
+JS_BOOL js_set_persistent(JSContext* ctx, JSValue val, struct JSStorage* pst, JS_PERSISTENT_OID oid, JS_PERSISTENT_STATUS status) {
   return js_set_persistent_rt(JS_GetRuntime(ctx), val, pst, oid, status);
 }
 
@@ -54992,7 +58820,7 @@ void js_set_persistent_status(JSValue val, JS_PERSISTENT_STATUS status) {
   po->persistent->status = status;   
 }
 
-JS_PERSISTENT_STATUS js_is_persistent(JSValue val, struct JSStorage** pstor, uint32_t* poid)
+JS_PERSISTENT_STATUS js_is_persistent(JSValue val, struct JSStorage** pstor, JS_PERSISTENT_OID* poid)
 {
   if(!js_is_persitable(val))
     return JS_NOT_PERSISTENT;
@@ -55010,7 +58838,179 @@ JS_PERSISTENT_STATUS js_is_persistent(JSValue val, struct JSStorage** pstor, uin
   return po->persistent->status;
 }
 
-uint32_t* js_get_persistent_oid_ref(JSValue val)
+uint32_t js_get_persistent_size(JSValue val)
+{
+  JSObject* po = JS_VALUE_GET_OBJ(val);
+  assert(po->persistent);
+  return po->persistent->size;
+}
+
+void js_set_persistent_size(JSValue val, uint32_t size)
+{
+  JSObject* po = JS_VALUE_GET_OBJ(val);
+  assert(po->persistent);
+  po->persistent->size = min_uint32(size, 0x7fffffff);
+}
+
+/* returns the access flag of persistent object and clears it */
+JS_BOOL js_test_persistent_accessed(JSValue val)
+{
+  JSObject* po = JS_VALUE_GET_OBJ(val);
+  JS_BOOL accessed;
+  assert(po->persistent);
+  accessed = po->persistent->accessed;
+  po->persistent->accessed = 0;
+  return accessed;
+}
+
+/* Releases properties or elements of the clean persistent object and puts it
+   back to the dormant state, the state of the object just fetched from the
+   storage: it is loaded again on next access. Objects which are not extensible,
+   arrays with holes or named properties, Map and Set objects being iterated are
+   left loaded. Returns TRUE if the object is unloaded. */
+JS_BOOL js_unload_persistent_object(JSContext *ctx, JSValueConst val)
+{
+  JSRuntime *rt = ctx->rt;
+  JSObject *p = JS_VALUE_GET_OBJ(val);
+  JSShape *sh = p->shape, *new_sh;
+  JSShapeProperty *prs;
+  JSProperty *new_prop;
+  int i;
+
+  if (!p->persistent || p->persistent->status != JS_PERSISTENT_LOADED || !p->extensible)
+    return FALSE;
+
+  switch (p->class_id) {
+  case JS_CLASS_OBJECT:
+    if (sh->prop_count == 0)
+      return FALSE;
+    new_sh = find_hashed_shape_proto(rt, sh->proto);
+    if (new_sh) {
+      new_sh = js_dup_shape(new_sh);
+    } else {
+      new_sh = js_new_shape(ctx, sh->proto);
+      if (!new_sh)
+        return FALSE;
+    }
+    new_prop = js_malloc(ctx, sizeof(JSProperty) * new_sh->prop_size);
+    if (!new_prop) {
+      js_free_shape(rt, new_sh);
+      return FALSE;
+    }
+    p->persistent->status = JS_PERSISTENT_DORMANT;
+    /* detach the properties first: freeing them can run finalizers */
+    {
+      JSProperty *prop = p->prop;
+      p->shape = new_sh;
+      p->prop = new_prop;
+      for (i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++)
+        free_property(rt, &prop[i], prs->flags);
+      js_free_rt(rt, prop);
+      js_free_shape(rt, sh);
+    }
+    return TRUE;
+  case JS_CLASS_ARRAY:
+    if (!p->fast_array || sh->prop_count != 1)
+      return FALSE;
+    p->persistent->status = JS_PERSISTENT_DORMANT;
+    {
+      JSValue *values = p->u.array.u.values;
+      uint32_t k, count = p->u.array.count;
+      p->u.array.u.values = NULL;
+      p->u.array.count = 0;
+      p->u.array.u1.size = 0;
+      p->prop[0].u.value = JS_NewInt32(ctx, 0);
+      for (k = 0; k < count; k++)
+        JS_FreeValueRT(rt, values[k]);
+      js_free_rt(rt, values);
+    }
+    return TRUE;
+  case JS_CLASS_MAP:
+  case JS_CLASS_SET:
+    {
+      JSMapState *s = p->u.map_state;
+      struct list_head *el, *el1;
+      JSMapRecord *mr;
+      /* records locked by forEach() or by iterators must stay */
+      list_for_each(el, &s->records) {
+        mr = list_entry(el, JSMapRecord, link);
+        if (mr->empty || mr->ref_count != 1)
+          return FALSE;
+      }
+      p->persistent->status = JS_PERSISTENT_DORMANT;
+      list_for_each_safe(el, el1, &s->records) {
+        mr = list_entry(el, JSMapRecord, link);
+        map_delete_record(rt, s, mr);
+      }
+    }
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+/* Map and Set objects are stored as collections of entries, value of the
+   entry of Set is undefined */
+
+typedef int js_collection_cb(JSContext *ctx, JSValueConst key, JSValueConst value, void *opaque);
+
+JS_BOOL js_is_collection(JSValueConst val, JS_BOOL *pis_set)
+{
+  JSClassID class_id = JS_GetClassID(val);
+  if (class_id != JS_CLASS_MAP && class_id != JS_CLASS_SET)
+    return FALSE;
+  if (pis_set)
+    *pis_set = class_id == JS_CLASS_SET;
+  return TRUE;
+}
+
+JSValue js_new_collection(JSContext *ctx, JS_BOOL is_set)
+{
+  return js_map_constructor(ctx, JS_UNDEFINED, 0, NULL, is_set ? MAGIC_SET : 0);
+}
+
+uint32_t js_collection_size(JSValueConst obj)
+{
+  JSMapState *s = JS_VALUE_GET_OBJ(obj)->u.map_state;
+  return s->record_count;
+}
+
+/* adds the entry without notification of the storage */
+int js_collection_add(JSContext *ctx, JSValueConst obj, JSValueConst key, JSValueConst value)
+{
+  JSMapState *s = JS_VALUE_GET_OBJ(obj)->u.map_state;
+  JSMapRecord *mr;
+
+  key = map_normalize_key(ctx, key);
+  mr = map_find_record(ctx, s, key);
+  if (mr) {
+    JS_FreeValue(ctx, mr->value);
+  } else {
+    mr = map_add_record(ctx, s, key);
+    if (!mr)
+      return -1;
+  }
+  mr->value = JS_DupValue(ctx, value);
+  return 0;
+}
+
+/* calls cb for each entry in insertion order, the callback must not modify
+   the collection. Returns non-zero if stopped by the callback. */
+int js_collection_each(JSContext *ctx, JSValueConst obj, js_collection_cb *cb, void *opaque)
+{
+  JSMapState *s = JS_VALUE_GET_OBJ(obj)->u.map_state;
+  struct list_head *el;
+  JSMapRecord *mr;
+
+  list_for_each(el, &s->records) {
+    mr = list_entry(el, JSMapRecord, link);
+    if (!mr->empty && cb(ctx, mr->key, mr->value, opaque))
+      return 1;
+  }
+  return 0;
+}
+
+JS_PERSISTENT_OID* js_get_persistent_oid_ref(JSValue val)
 {
   assert(js_is_persitable(val));
  
@@ -68,6 +68,13 @@ typedef enum JS_PERSISTENT_STATUS {
   JS_PERSISTENT_LOADED = 2,
   JS_PERSISTENT_MODIFIED = 3
 } JS_PERSISTENT_STATUS;
+
+/* identifier of the object in the storage, the same type as dybase_oid_t */
+#ifdef DYBASE_OID64
+typedef unsigned long long JS_PERSISTENT_OID;
+#else
+typedef uint32_t JS_PERSISTENT_OID;
+#endif
 #endif
 
 #if INTPTR_MAX >= INT64_MAX
@@ -323,7 +330,12 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 
 #endif /* !JS_STRICT_NAN_BOXING */
 
+#if defined(JS_STRICT_NAN_BOXING)
+  /* JS_TAG_INT is not 0 */
+  #define JS_VALUE_IS_BOTH_INT(v1, v2) (JS_VALUE_GET_TAG(v1) == JS_TAG_INT && JS_VALUE_GET_TAG(v2) == JS_TAG_INT)
+#else
 #define JS_VALUE_IS_BOTH_INT(v1, v2) ((JS_VALUE_GET_TAG(v1) | JS_VALUE_GET_TAG(v2)) == 0)
+#endif
 #define JS_VALUE_IS_BOTH_FLOAT(v1, v2) (JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(v1)) && JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(v2)))
 
 #define JS_VALUE_GET_OBJ(v) ((JSObject *)JS_VALUE_GET_PTR(v))
@@ -902,6 +914,24 @@ QJS_API JSValue JS_GetTypedArrayBuffer(JSContext *ctx, JSValueConst obj,
                                size_t *pbyte_offset,
                                size_t *pbyte_length,
                                size_t *pbytes_per_element);
+typedef enum JSTypedArrayEnum {
+    JS_TYPED_ARRAY_UINT8C = 0,
+    JS_TYPED_ARRAY_INT8,
+    JS_TYPED_ARRAY_UINT8,
+    JS_TYPED_ARRAY_INT16,
+    JS_TYPED_ARRAY_UINT16,
+    JS_TYPED_ARRAY_INT32,
+    JS_TYPED_ARRAY_UINT32,
+    JS_TYPED_ARRAY_BIG_INT64,
+    JS_TYPED_ARRAY_BIG_UINT64,
+    JS_TYPED_ARRAY_FLOAT32,
+    JS_TYPED_ARRAY_FLOAT64,
+} JSTypedArrayEnum;
+/* same arguments as the TypedArray constructors */
+QJS_API JSValue JS_NewTypedArray(JSContext *ctx, int argc, JSValueConst *argv,
+                                 JSTypedArrayEnum array_type);
+/* return the type of the typed array or -1 if obj is not a typed array */
+QJS_API int JS_GetTypedArrayType(JSValueConst obj);
 typedef struct {
     void *(*sab_alloc)(void *opaque, size_t size);
     void (*sab_free)(void *opaque, void *ptr);
@@ -925,6 +955,14 @@ typedef int JSInterruptHandler(JSRuntime *rt, void *opaque);
 QJS_API void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque);
 /* if can_block is TRUE, Atomics.wait() can be used */
 QJS_API void JS_SetCanBlock(JSRuntime *rt, JS_BOOL can_block);
+/* compile the functions to native code after 'threshold' calls if the
+   library is built with CONFIG_JIT. 0 (default) disables the compiler. */
+QJS_API void JS_SetJITThreshold(JSRuntime *rt, int threshold);
+/* write the report of the opcode profiler (functions ranked by self
+   time, hot instructions and opcode statistics). Return -1 if the
+   library is not built with CONFIG_PROFILE_OPCODES or in case of
+   memory error. */
+QJS_API int JS_DumpOpcodeProfile(JSRuntime *rt, FILE *f);
 /* set the [IsHTMLDDA] internal slot */
 QJS_API void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
 
@@ -39,6 +39,9 @@ enum dybase_type {
 
   dybase_long_type   = 10,
   dybase_bytes_type  = 11,  // literal blob - byte vector, max length 2^32
+  dybase_typed_array_type = 12, // literal blob, the first byte is the type of elements
+  dybase_map_ref_type = 13, // ref of Map object, oid
+  dybase_set_ref_type = 14, // ref of Set object, oid
 };
 
 /**
@@ -56,27 +59,61 @@ enum dybase_error_code {
 typedef void *   dybase_storage_t;
 typedef void *   dybase_handle_t;
 typedef void *   dybase_iterator_t;
+/**
+ * Object identifiers are 32-bit by default. Build with DYBASE_OID64 defined
+ * (for all modules including the library) to use 64-bit identifiers and
+ * offsets: storage can contain more than 4G objects and terabytes of data.
+ * Files of the two formats are not compatible, use dybase_export and
+ * dybase_import to convert them.
+ */
+#ifdef DYBASE_OID64
+typedef unsigned long long dybase_oid_t;
+#else
 typedef unsigned dybase_oid_t;
+#endif
 
 typedef void *   hashtable_t;
 
 typedef void (*dybase_error_handler_t)(int error_code, char const *msg);
 
+/**
+ * Storage open flags
+ */
+enum dybase_open_flags {
+  dybase_open_wal  = 0x01, // commit appends modified pages to write-ahead log
+                           // (file_path + ".wal") instead of flushing them
+  dybase_open_mmap = 0x02, // pages are accessed through memory mapping of
+                           // the file instead of the page pool
+  dybase_open_2q   = 0x04, // scan resistant (2Q) page pool replacement
+                           // policy instead of LRU
+  dybase_open_readahead = 0x08, // dybase_prefetch advises the operating
+                                // system to read ahead prefetched pages
+  dybase_open_compress = 0x10, // store objects larger than 128 bytes
+                               // compressed by LZ77 codec
+  dybase_open_snapshot = 0x20, // read-only snapshot of the last committed
+                               // state of the storage opened for update by
+                               // this process (other flags except 2Q are
+                               // ignored), normal read-only open otherwise
+};
+
 /**
  * Open storage
  * @param file_path path to the storage file
  * @page_pool_size size of page pool in bytes, if 0, then default value will be
  * used
  * @param hnd error handler
+ * @param read_write open storage for update
+ * @param flags combination of dybase_open_flags
  * @return pointer to the opened storage or NULL if open failed
  */
 dybase_storage_t DYBASE_DLL_ENTRY dybase_open(const char *file_path,
                                               int         page_pool_size,
                                               dybase_error_handler_t hnd,
-                                              int read_write);
+                                              int read_write, int flags);
 
 /**
- * Close storage
+ * Close storage. If snapshots of the storage are still opened, the file is
+ * closed when the last of them is closed.
  * @param storage pointer to the opened storage
  */
 void DYBASE_DLL_ENTRY dybase_close(dybase_storage_t storage);
@@ -87,6 +124,47 @@ void DYBASE_DLL_ENTRY dybase_close(dybase_storage_t storage);
  */
 void DYBASE_DLL_ENTRY dybase_commit(dybase_storage_t storage);
 
+/**
+ * Write pages committed to the write-ahead log to the storage file and
+ * truncate the log. Does nothing if storage is not opened with dybase_open_wal.
+ * @param storage pointer to the opened storage
+ */
+void DYBASE_DLL_ENTRY dybase_checkpoint(dybase_storage_t storage);
+
+/**
+ * Read pages of the objects which are going to be loaded soon. Pages are read
+ * in the order of their positions in the file, so a batch of random object
+ * loads turns into one forward pass over the file.
+ * @param storage pointer to the opened storage
+ * @param oids identifiers of the objects
+ * @param n_oids number of objects
+ */
+void DYBASE_DLL_ENTRY dybase_prefetch(dybase_storage_t    storage,
+                                      dybase_oid_t const *oids, int n_oids);
+
+/**
+ * Page pool and file write statistic
+ */
+typedef struct dybase_cache_stats {
+  unsigned long long hits;          // requested page was found in the pool
+  unsigned long long misses;        // requested page was read from the file
+  unsigned long long evictions;     // page was thrown away from the pool
+  unsigned long long writes;        // write requests (system calls)
+  unsigned long long bytes_written; // bytes written to the file and the log
+  unsigned long long commit_writes; // write requests issued by last commit
+  unsigned long long commit_bytes;  // bytes written by last commit
+} dybase_cache_stats_t;
+
+/**
+ * Get page pool and write statistic collected since the storage was opened.
+ * Dirty pages are written in the order of their offsets, runs of adjacent
+ * pages are written by one request.
+ * @param storage pointer to the opened storage
+ * @param stats [out] statistic
+ */
+void DYBASE_DLL_ENTRY dybase_get_cache_stats(dybase_storage_t      storage,
+                                             dybase_cache_stats_t *stats);
+
 /**
  * Rollback current transaction
  * @param storage pointer to the opened storage
@@ -207,6 +285,16 @@ void dybase_end_load_object(dybase_handle_t handle);
  */
 DYBASE_DLL_ENTRY char *dybase_get_class_name(dybase_handle_t handle);
 
+/**
+ * Get identifier of the loaded object class. Objects with the same class name
+ * and the same set of field names share one class descriptor, so this
+ * identifier can be used to cache information derived from field names.
+ * It remains valid until the storage is closed.
+ * @param handle object handle returned by dybase_begin_load_object
+ * @return object identifier of the class descriptor
+ */
+DYBASE_DLL_ENTRY dybase_oid_t dybase_get_class_id(dybase_handle_t handle);
+
 /**
  * Move to next field. This function should be called before dybase_get_value
  * function. When this functions is called first time after
@@ -240,15 +328,29 @@ void DYBASE_DLL_ENTRY dybase_next_element(dybase_handle_t handle);
 void DYBASE_DLL_ENTRY dybase_get_value(dybase_handle_t handle, int *type,
                                        void **value_ptr, int *value_length);
 
+/**
+ * Index creation flags
+ */
+enum dybase_index_flags {
+  dybase_index_prefix_keys = 0x01, // pages of string keys store common prefix
+                                   // of their keys once, ignored for other
+                                   // key types
+  dybase_index_composite_keys = 0x02, // keys are tuples packed by
+                                      // dybase_composite_key_append, index
+                                      // type should be dybase_bytes_type
+};
+
 /**
  * Create object index
  * @param storage pointer to the opened storage
  * @param key_type type of the index key
  * @param unique whether index allows duplicates or not
+ * @param flags combination of dybase_index_flags
  * @return OID of created index
  */
 dybase_oid_t DYBASE_DLL_ENTRY dybase_create_index(dybase_storage_t storage,
-                                                  int key_type, int unique);
+                                                  int key_type, int unique,
+                                                  int flags);
 
 /**
  * Insert value in index
@@ -270,6 +372,33 @@ int DYBASE_DLL_ENTRY dybase_insert_in_index(dybase_storage_t storage,
                                             int key_type, int key_size,
                                             dybase_oid_t obj, int replace);
 
+/**
+ * Key and associated object for dybase_bulk_load_index
+ */
+typedef struct dybase_key {
+  void *       key;      // pointer to the value of the key
+  int          key_size; // size of the string key
+  dybase_oid_t obj;      // OID of the object associated with this key
+} dybase_key_t;
+
+/**
+ * Insert many keys in the index. If index is empty, keys are sorted and
+ * B-Tree is built bottom-up with leaf pages filled up to fill_factor percents,
+ * otherwise keys are inserted one by one in sorted order.
+ * For unique index only the first of the equal keys is inserted.
+ * @param storage pointer to the opened storage
+ * @param index OID of index created by dybase_create_index
+ * @param key_type type of the keys which should match type of the index
+ * @param keys array of keys
+ * @param n_keys number of keys
+ * @param fill_factor percent of leaf page space used by the loader (1..100)
+ * @return number of inserted keys
+ */
+int DYBASE_DLL_ENTRY dybase_bulk_load_index(dybase_storage_t storage,
+                                            dybase_oid_t index, int key_type,
+                                            dybase_key_t *keys, int n_keys,
+                                            int fill_factor);
+
 /**
  * Remove key from the index
  * @param storage pointer to the opened storage
@@ -307,6 +436,62 @@ int DYBASE_DLL_ENTRY dybase_is_index_unique(dybase_storage_t storage,
 int DYBASE_DLL_ENTRY dybase_get_index_type(dybase_storage_t storage,
                                            dybase_oid_t index);
 
+/**
+ * Returns flags of the index.
+ * @param storage pointer to the opened storage
+ * @param index OID of index created by dybase_create_index
+ * @return dybase_index_flags the index was created with
+ */
+int DYBASE_DLL_ENTRY dybase_get_index_flags(dybase_storage_t storage,
+                                            dybase_oid_t     index);
+
+/**
+ * Append element to the key of composite index. Elements are packed in
+ * order preserving way: keys are ordered by their first element, then by the
+ * second and so on. Numbers of int and real types are compared with each
+ * other, other types are ordered by type: null, bool, number, long, date,
+ * chars, bytes.
+ * @param key buffer with the key
+ * @param key_size size of the key in the buffer
+ * @param buf_size size of the buffer
+ * @param type type of the element: dybase_bool_type, dybase_int_type,
+ * dybase_real_type, dybase_long_type, dybase_date_type, dybase_chars_type or
+ * dybase_bytes_type
+ * @param value pointer to the element value or NULL for null
+ * @param value_size size of chars or bytes value
+ * @return new size of the key, -1 if buffer is too small, -2 if type is not
+ * supported
+ */
+int DYBASE_DLL_ENTRY dybase_composite_key_append(void *key, int key_size,
+                                                 int buf_size, int type,
+                                                 void const *value,
+                                                 int         value_size);
+
+/**
+ * Make the key of composite index greater than keys of all tuples which
+ * start with the elements of this key. Used for high boundary of inclusive
+ * or low boundary of exclusive search by key prefix.
+ * @return new size of the key or -1 if buffer is too small
+ */
+int DYBASE_DLL_ENTRY dybase_composite_key_bound(void *key, int key_size,
+                                                int buf_size);
+
+/**
+ * Extract element from the key of composite index
+ * @param key the key
+ * @param key_size size of the key
+ * @param pos [in/out] position of the element, 0 for the first element
+ * @param type [out] type of the element, -1 for null
+ * @param value buffer receiving element value, should be of key_size bytes
+ * at least (and not less than 8)
+ * @param value_size [out] size of the value
+ * @return 1 if element is extracted, 0 if there are no more elements, -1 if
+ * key is malformed
+ */
+int DYBASE_DLL_ENTRY dybase_composite_key_next(void const *key, int key_size,
+                                               int *pos, int *type,
+                                               void *value, int *value_size);
+
 
 
 /**
@@ -333,6 +518,18 @@ int DYBASE_DLL_ENTRY dybase_index_search(
     int min_key_size, int min_key_inclusive, void *max_key, int max_key_size,
     int max_key_inclusive, dybase_oid_t **selected_objects);
 
+/**
+ * Count objects in the index range without loading them or building the
+ * selection. Parameters have the same meaning as in dybase_index_search.
+ * @return number of the objects whose keys belong to the range
+ */
+long DYBASE_DLL_ENTRY dybase_index_count(dybase_storage_t storage,
+                                         dybase_oid_t index, int key_type,
+                                         void *min_key, int min_key_size,
+                                         int   min_key_inclusive,
+                                         void *max_key, int max_key_size,
+                                         int max_key_inclusive);
+
 /**
  * Deallocate selection
  * @param storage pointer to the opened storage
@@ -391,6 +588,17 @@ dybase_iterator_t DYBASE_DLL_ENTRY dybase_create_index_iterator(
 dybase_oid_t DYBASE_DLL_ENTRY
              dybase_index_iterator_next(dybase_iterator_t iterator);
 
+/**
+ * Get next element together with its key
+ * @param iterator index iterator
+ * @param key [out] pointer to the key stored in the index, it remains valid
+ * until the next call of the iterator
+ * @param key_size [out] size of the key in bytes
+ * @return oid of next object in the index or 0 if there are no more objects
+ */
+dybase_oid_t DYBASE_DLL_ENTRY dybase_index_iterator_next_key(
+    dybase_iterator_t iterator, void **key, int *key_size);
+
 /**
  * Free index iterator
  * @param iterator index iterator
@@ -414,6 +622,99 @@ void DYBASE_DLL_ENTRY dybase_set_gc_threshold(dybase_storage_t storage,
  */
 void DYBASE_DLL_ENTRY dybase_gc(dybase_storage_t storage);
 
+/**
+ * Switch garbage collector to incremental mode.
+ * Instead of stop-the-world collection started by the allocator, each commit
+ * performs one bounded step of the collection cycle. New cycle is started when
+ * the threshold set by dybase_set_gc_threshold is exceeded.
+ * Objects stored while the cycle is active are treated as reachable, but
+ * objects which are not reachable from the root object at commit may be
+ * collected.
+ * @param storage pointer to the opened storage
+ * @param max_work maximal number of objects, index entries and handles
+ * processed by one step, 0 to switch to stop-the-world collection
+ */
+void DYBASE_DLL_ENTRY dybase_set_gc_step(dybase_storage_t storage,
+                                         long             max_work);
+
+/**
+ * Perform one step of incremental garbage collection, starting new cycle if
+ * there is no active one. It should be called between transactions.
+ * @param storage pointer to the opened storage
+ * @param max_work maximal amount of work, 0 to complete the cycle
+ * @return 1 if the cycle was completed by this step, 0 otherwise
+ */
+int DYBASE_DLL_ENTRY dybase_gc_step(dybase_storage_t storage, long max_work);
+
+/**
+ * Progress of the incremental garbage collector
+ */
+typedef struct dybase_gc_stats {
+  int  phase;   // 0 - idle, 1 - marking, 2 - sweeping
+  long cycles;  // number of completed cycles
+  long steps;   // number of performed steps
+  long marked;  // objects marked by the current or the last cycle
+  long freed;   // objects freed by the current or the last cycle
+  long pending; // grey objects when marking, handles to check when sweeping
+} dybase_gc_stats_t;
+
+/**
+ * Get statistic of the incremental garbage collector
+ * @param storage pointer to the opened storage
+ * @param stats [out] statistic
+ */
+void DYBASE_DLL_ENTRY dybase_get_gc_stats(dybase_storage_t   storage,
+                                          dybase_gc_stats_t *stats);
+
+/**
+ * Copy the last committed state of the storage to another file. The state is
+ * read from a snapshot, so transactions can be committed meanwhile.
+ * @param storage pointer to the opened storage
+ * @param file_path path to the backup file, existing file is overwritten
+ * @return 1 if the backup was written, 0 otherwise
+ */
+int DYBASE_DLL_ENTRY dybase_backup(dybase_storage_t storage,
+                                   const char *     file_path);
+
+/**
+ * Write objects of the last committed state which are reachable from the
+ * root object to a new storage file. Objects are placed in the order of
+ * traversal from the root, indexes are rebuilt with full pages, free space
+ * and unreachable objects are not copied. Like dybase_backup, it does not
+ * block transactions.
+ * @param storage pointer to the opened storage
+ * @param file_path path to the new storage file, existing file is overwritten
+ * @return 1 if the compacted storage was written, 0 otherwise
+ */
+int DYBASE_DLL_ENTRY dybase_compact(dybase_storage_t storage,
+                                    const char *     file_path);
+
+/**
+ * Write objects of the last committed state which are reachable from the
+ * root object to a dump file which does not depend on the size of object
+ * identifiers. Like dybase_backup, it does not block transactions.
+ * @param storage pointer to the opened storage
+ * @param dump_path path to the dump file, existing file is overwritten
+ * @return 1 if the dump was written, 0 otherwise
+ */
+int DYBASE_DLL_ENTRY dybase_export(dybase_storage_t storage,
+                                   const char *     dump_path);
+
+/**
+ * Create new storage file from the dump written by dybase_export, possibly
+ * by the library built with other size of object identifiers. Identifiers
+ * of the objects are shifted by the difference of the number of identifiers
+ * reserved by the two formats.
+ * @param dump_path path to the dump file
+ * @param file_path path to the new storage file, existing file is
+ * overwritten
+ * @param hnd error handler
+ * @return 1 if the storage was created, 0 otherwise
+ */
+int DYBASE_DLL_ENTRY dybase_import(const char *           dump_path,
+                                   const char *           file_path,
+                                   dybase_error_handler_t hnd);
+
 
 hashtable_t DYBASE_DLL_ENTRY hashtable_create();
 void       DYBASE_DLL_ENTRY hashtable_put(hashtable_t ht, void *key, int keySize, void *value);
@@ -16,6 +16,12 @@
 #define NO_LARGE_LOCAL_ARRAYS
 #endif
 
+inline int compareStrings(void *s1, length_t n1, void *s2, length_t n2) {
+  length_t len  = n1 < n2 ? n1 : n2;
+  int      diff = memcmp(s1, s2, len);
+  return diff != 0 ? diff : int(n1) - int(n2);
+}
+
 void dbBtree::find(dbDatabase *db, oid_t treeId, dbSearchContext &sc) {
   dbCriticalSection cs(db->mutex);
   if (!db->opened) {
@@ -43,7 +49,7 @@ void dbBtree::find(dbDatabase *db, oid_t treeId, dbSearchContext &sc) {
   }
 }
 
-oid_t dbBtree::allocate(dbDatabase *db, int type, bool unique) {
+oid_t dbBtree::allocate(dbDatabase *db, int type, bool unique, int flags) {
   dbCriticalSection cs(db->mutex);
   if (!db->opened) {
     db->handleError(dybase_not_opened, "Database not opened");
@@ -64,6 +70,8 @@ oid_t dbBtree::allocate(dbDatabase *db, int type, bool unique) {
   tree.height = 0;
   tree.type   = type;
   tree.unique = unique;
+  tree.flags  = flags;
+  tree.magic  = dbBtreeMagic;
   tree.cid    = dbBtreeId;
   return db->allocateObject(&tree);
 }
@@ -128,6 +136,12 @@ bool dbBtree::insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
     db->handleError(dybase_not_opened, "Database not opened");
     return false;
   }
+  db->shadeOid(oid);
+  return _insert(db, treeId, key, keyType, keySize, oid, replace);
+}
+
+bool dbBtree::_insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
+                      length_t keySize, oid_t oid, bool replace) {
   dbGetTie          treeTie;
   dbBtreePage::item ins;
   dbBtree *         tree = (dbBtree *)db->getObject(treeTie, treeId);
@@ -140,7 +154,8 @@ bool dbBtree::insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
   if (rootId == 0) {
     dbPutTie tie;
     dbBtree *t = (dbBtree *)db->putObject(tie, treeId);
-    t->root    = dbBtreePage::allocate(db, 0, tree->type, ins);
+    t->root = dbBtreePage::allocate(db, 0, tree->type, ins,
+                                    tree->prefixedPages());
     t->height  = 1;
     return true;
   } else {
@@ -150,13 +165,383 @@ bool dbBtree::insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
     if (result == overflow) {
       dbPutTie tie;
       dbBtree *t = (dbBtree *)db->putObject(tie, treeId);
-      t->root    = dbBtreePage::allocate(db, rootId, tree->type, ins);
+      t->root = dbBtreePage::allocate(db, rootId, tree->type, ins, false);
       t->height += 1;
     }
     return result != duplicate;
   }
 }
 
+//
+// Prefix compressed pages are modified by collecting references to their
+// keys, updating this list and packing it back to one or two pages.
+//
+struct dbStrKeyRef {
+  char *   prefix;
+  length_t prefixLen;
+  char *   suffix;
+  length_t suffixLen;
+  oid_t    oid;
+
+  length_t length() const { return prefixLen + suffixLen; }
+  char     at(length_t i) const {
+    return i < prefixLen ? prefix[i] : suffix[i - prefixLen];
+  }
+  void copy(char *dst, length_t from, length_t len) const {
+    if (from < prefixLen) {
+      length_t n = prefixLen - from < len ? prefixLen - from : len;
+      memcpy(dst, prefix + from, n);
+      dst += n;
+      from += n;
+      len -= n;
+    }
+    memcpy(dst, suffix + from - prefixLen, len);
+  }
+  void assign(char *key, length_t keyLen, oid_t keyOid) {
+    prefix    = key;
+    prefixLen = keyLen;
+    suffix    = key + keyLen;
+    suffixLen = 0;
+    oid       = keyOid;
+  }
+};
+
+const int dbMaxStrKeys =
+    sizeof(((dbBtreePage *)0)->charKey) / sizeof(dbBtreePage::str);
+
+static int unpackKeys(dbBtreePage *pg, dbStrKeyRef *keys) {
+  length_t prefixLen = pg->keyPrefixLength();
+  char *   prefix    = &pg->charKey[sizeof(pg->charKey) - prefixLen];
+  int      n         = pg->nItems;
+  for (int i = 0; i < n; i++) {
+    keys[i].prefix    = prefix;
+    keys[i].prefixLen = prefixLen;
+    keys[i].suffix    = &pg->charKey[pg->strKey[i].offs];
+    keys[i].suffixLen = pg->strKey[i].size;
+    keys[i].oid       = pg->strKey[i].oid;
+  }
+  return n;
+}
+
+static length_t commonPrefix(dbStrKeyRef const &a, dbStrKeyRef const &b) {
+  length_t n = a.length() < b.length() ? a.length() : b.length();
+  length_t i = 0;
+  if (a.prefix == b.prefix) { // keys of the same page
+    i = a.prefixLen < b.prefixLen ? a.prefixLen : b.prefixLen;
+  }
+  while (i < n && a.at(i) == b.at(i)) {
+    i += 1;
+  }
+  return i;
+}
+
+// Keys are sorted, so common prefix of the first and the last key is shared
+// by all of them
+static length_t commonPrefix(dbStrKeyRef *keys, int n) {
+  if (n == 0) { return 0; }
+  length_t prefixLen = commonPrefix(keys[0], keys[n - 1]);
+  return prefixLen < dbBtreePage::dbPrefixMask ? prefixLen
+                                               : dbBtreePage::dbPrefixMask;
+}
+
+static length_t packedSize(dbStrKeyRef *keys, int n, bool inner) {
+  length_t prefixLen = commonPrefix(keys, n);
+  length_t size      = prefixLen + (n + inner) * sizeof(dbBtreePage::str);
+  for (int i = 0; i < n; i++) {
+    size += keys[i].length() - prefixLen;
+  }
+  return size;
+}
+
+static void packKeys(dbBtreePage *pg, dbStrKeyRef *keys, int n, oid_t last,
+                     bool inner) {
+  const length_t pageSize  = sizeof(pg->charKey);
+  length_t       prefixLen = commonPrefix(keys, n);
+  length_t       size      = prefixLen;
+  if (n != 0) { keys[0].copy(&pg->charKey[pageSize - prefixLen], 0, prefixLen); }
+  for (int i = 0; i < n; i++) {
+    length_t len = keys[i].length() - prefixLen;
+    size += len;
+    pg->strKey[i].offs = db_nat2(pageSize - size);
+    pg->strKey[i].size = db_nat2(len);
+    pg->strKey[i].oid  = keys[i].oid;
+    keys[i].copy(&pg->charKey[pageSize - size], prefixLen, len);
+  }
+  if (inner) { pg->strKey[n].oid = last; }
+  pg->nItems = n;
+  pg->size   = db_nat4(dbBtreePage::dbPrefixedPage |
+                     (prefixLen << dbBtreePage::dbPrefixShift) | size);
+}
+
+//
+// Choose how to divide keys between two pages: the left page gets keys[0..m)
+// (keys[0..m-1) and child keys[m-1].oid for inner page), the right page gets
+// the rest and keys[m-1] becomes the separator. Pages are balanced by the
+// size of their packed content.
+//
+static int splitPosition(dbStrKeyRef *keys, int n, bool inner) {
+  const length_t pageSize = sizeof(((dbBtreePage *)0)->charKey);
+  const length_t slot     = sizeof(dbBtreePage::str);
+  length_t       total    = 0;
+  length_t *     sum      = new length_t[n + 1];
+  int            i, best = 0;
+  length_t       bestDiff = pageSize;
+  for (i = 0, sum[0] = 0; i < n; i++) {
+    sum[i + 1] = total += keys[i].length();
+  }
+  for (int m = (inner && n > 2) ? 2 : 1; m < n; m++) {
+    int      ln = inner ? m - 1 : m;
+    length_t lp = commonPrefix(keys, ln);
+    length_t rp = commonPrefix(keys + m, n - m);
+    length_t left  = sum[ln] - ln * lp + lp + (ln + inner) * slot;
+    length_t right = total - sum[m] - (n - m) * rp + rp + (n - m + inner) * slot;
+    if (left <= pageSize && right <= pageSize) {
+      length_t diff = left > right ? left - right : right - left;
+      if (best == 0 || diff < bestDiff) {
+        best     = m;
+        bestDiff = diff;
+      }
+    }
+  }
+  delete[] sum;
+  assert(((void)"String fits in the B-Tree page", best != 0));
+  return best;
+}
+
+#define BULK_COMPARE(NAME, TYPE)                                               \
+  static int __cdecl NAME(void const *a, void const *b) {                      \
+    dbBtreeKey *ka = *(dbBtreeKey **)a;                                        \
+    dbBtreeKey *kb = *(dbBtreeKey **)b;                                        \
+    TYPE        va = *(TYPE *)ka->key;                                         \
+    TYPE        vb = *(TYPE *)kb->key;                                         \
+    /* keys with the same value keep their original order */                  \
+    return va < vb ? -1 : va > vb ? 1 : ka < kb ? -1 : ka > kb ? 1 : 0;        \
+  }
+
+BULK_COMPARE(compareBulkRef, oid_t)
+BULK_COMPARE(compareBulkBool, db_int1)
+BULK_COMPARE(compareBulkInt, db_int4)
+BULK_COMPARE(compareBulkLong, db_int8)
+BULK_COMPARE(compareBulkReal, db_real8)
+
+static int __cdecl compareBulkStr(void const *a, void const *b) {
+  dbBtreeKey *ka   = *(dbBtreeKey **)a;
+  dbBtreeKey *kb   = *(dbBtreeKey **)b;
+  int         diff = compareStrings(ka->key, ka->keySize, kb->key, kb->keySize);
+  return diff != 0 ? diff : ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+static bool sameBulkKey(int type, dbBtreeKey *ka, dbBtreeKey *kb) {
+  switch (type) {
+  case dybase_bool_type: return *(db_int1 *)ka->key == *(db_int1 *)kb->key;
+  case dybase_int_type: return *(db_int4 *)ka->key == *(db_int4 *)kb->key;
+  case dybase_date_type:
+  case dybase_long_type: return *(db_int8 *)ka->key == *(db_int8 *)kb->key;
+  case dybase_real_type: return *(db_real8 *)ka->key == *(db_real8 *)kb->key;
+  case dybase_chars_type:
+  case dybase_bytes_type:
+    return compareStrings(ka->key, ka->keySize, kb->key, kb->keySize) == 0;
+  default: return *(oid_t *)ka->key == *(oid_t *)kb->key;
+  }
+}
+
+//
+// Build one level of the B-Tree from the sorted entries. Entries of the leaf
+// level are keys of the objects, entries of the upper levels are pages of the
+// level below with their largest keys. Returns number of created pages,
+// descriptors of the pages are stored in "pages" array.
+//
+length_t dbBtree::buildLevel(dbDatabase *db, int type, dbBtreeKey **level,
+                             length_t n, dbBtreeKey *pages, bool leaf,
+                             int fillFactor, bool prefixed) {
+  length_t nPages = 0;
+  length_t i, j, c;
+  if (prefixed) {
+    const length_t pageSize = sizeof(((dbBtreePage *)0)->charKey);
+    const length_t limit    = pageSize * fillFactor / 100;
+    const length_t slot     = sizeof(dbBtreePage::str);
+    dbStrKeyRef *  refs     = new dbStrKeyRef[n];
+    for (i = 0; i < n; i++) {
+      refs[i].assign((char *)level[i]->key, level[i]->keySize, level[i]->oid);
+    }
+    for (i = 0; i < n; i += c) {
+      // inner page stores keys of all children except the last one
+      length_t sum = leaf ? refs[i].length() : 0;
+      for (c = 1; i + c < n; c++) {
+        int      k      = leaf ? int(c) + 1 : int(c);
+        length_t len    = sum + refs[i + k - 1].length();
+        length_t prefix = commonPrefix(refs + i, k);
+        length_t next   = prefix + len - k * prefix + (k + !leaf) * slot;
+        // inner page should have at least two children
+        if (next > pageSize || (next > limit && (leaf || c > 1))) { break; }
+        sum = len;
+      }
+      oid_t        pageId = db->allocatePage();
+      dbBtreePage *pg     = (dbBtreePage *)db->put(pageId);
+      packKeys(pg, refs + i, int(leaf ? c : c - 1), refs[i + c - 1].oid, !leaf);
+      db->pool.unfix(pg);
+      pages[nPages].key     = level[i + c - 1]->key;
+      pages[nPages].keySize = level[i + c - 1]->keySize;
+      pages[nPages].oid     = pageId;
+      nPages += 1;
+    }
+    delete[] refs;
+  } else if (type == dybase_chars_type || type == dybase_bytes_type) {
+    const length_t pageSize = sizeof(((dbBtreePage *)0)->charKey);
+    const length_t limit    = pageSize * fillFactor / 100;
+    for (i = 0; i < n; i += c) {
+      // inner page stores keys of all children except the last one
+      length_t used = sizeof(dbBtreePage::str) + (leaf ? level[i]->keySize : 0);
+      for (c = 1; i + c < n; c++) {
+        length_t next = used + sizeof(dbBtreePage::str) +
+                        level[leaf ? i + c : i + c - 1]->keySize;
+        // inner page should have at least two children
+        if (next > pageSize || (next > limit && (leaf || c > 1))) { break; }
+        used = next;
+      }
+      oid_t        pageId = db->allocatePage();
+      dbBtreePage *pg     = (dbBtreePage *)db->put(pageId);
+      length_t     nKeys  = leaf ? c : c - 1;
+      length_t     size   = 0;
+      for (j = 0; j < c; j++) {
+        dbBtreeKey *e     = level[i + j];
+        pg->strKey[j].oid = e->oid;
+        if (j < nKeys) {
+          size += e->keySize;
+          pg->strKey[j].offs = db_nat2(pageSize - size);
+          pg->strKey[j].size = db_nat2(e->keySize);
+          memcpy(&pg->charKey[pageSize - size], e->key, e->keySize);
+        }
+      }
+      pg->nItems = db_nat4(nKeys);
+      pg->size   = db_nat4(size);
+      db->pool.unfix(pg);
+      pages[nPages].key     = level[i + c - 1]->key;
+      pages[nPages].keySize = level[i + c - 1]->keySize;
+      pages[nPages].oid     = pageId;
+      nPages += 1;
+    }
+  } else {
+    const length_t keySize = dbSizeofType[type];
+    const length_t maxEntries =
+        sizeof(((dbBtreePage *)0)->charKey) / (sizeof(oid_t) + keySize);
+    length_t capacity = maxEntries * fillFactor / 100;
+    if (capacity < 2) { capacity = 2; }
+    // spread entries evenly between pages
+    length_t nGroups = (n + capacity - 1) / capacity;
+    for (i = 0; i < n; i += c) {
+      c = n / nGroups + (nPages < n % nGroups ? 1 : 0);
+      oid_t        pageId = db->allocatePage();
+      dbBtreePage *pg     = (dbBtreePage *)db->put(pageId);
+      length_t     nKeys  = leaf ? c : c - 1;
+      for (j = 0; j < c; j++) {
+        dbBtreeKey *e = level[i + j];
+        if (j < nKeys) { memcpy(pg->charKey + j * keySize, e->key, keySize); }
+        pg->record[dbBtreePage::maxItems - 1 - j] = e->oid;
+      }
+      pg->nItems = db_nat4(nKeys);
+      pg->size   = 0;
+      db->pool.unfix(pg);
+      pages[nPages].key     = level[i + c - 1]->key;
+      pages[nPages].keySize = keySize;
+      pages[nPages].oid     = pageId;
+      nPages += 1;
+    }
+  }
+  return nPages;
+}
+
+int dbBtree::bulkLoad(dbDatabase *db, oid_t treeId, int keyType,
+                      dbBtreeKey *keys, length_t nKeys, int fillFactor) {
+  dbCriticalSection cs(db->mutex);
+  if (!db->opened) {
+    db->handleError(dybase_not_opened, "Database not opened");
+    return 0;
+  }
+  dbGetTie treeTie;
+  dbBtree *tree = (dbBtree *)db->getObject(treeTie, treeId);
+  if (keyType != tree->type) {
+    db->handleError(dybase_bad_key_type,
+                    "Type of the key doesn't match index type");
+    return 0;
+  }
+  length_t i, n = 0;
+  for (i = 0; i < nKeys; i++) {
+    if ((keyType == dybase_chars_type || keyType == dybase_bytes_type) &&
+        keys[i].keySize > dbBtreePage::dbMaxKeyLen) {
+      db->handleError(dybase_bad_key_type, "Size of string key is too large");
+      return 0;
+    }
+  }
+  if (nKeys == 0) { return 0; }
+  if (fillFactor <= 0 || fillFactor > 100) { fillFactor = 100; }
+  for (i = 0; i < nKeys; i++) {
+    db->shadeOid(keys[i].oid);
+  }
+
+  dbBuffer<dbBtreeKey *> sorted;
+  dbBtreeKey **          level = sorted.append(int(nKeys));
+  for (i = 0; i < nKeys; i++) {
+    level[i] = &keys[i];
+  }
+  int(__cdecl * compare)(void const *, void const *);
+  switch (keyType) {
+  case dybase_bool_type: compare = compareBulkBool; break;
+  case dybase_int_type: compare = compareBulkInt; break;
+  case dybase_date_type:
+  case dybase_long_type: compare = compareBulkLong; break;
+  case dybase_real_type: compare = compareBulkReal; break;
+  case dybase_chars_type:
+  case dybase_bytes_type: compare = compareBulkStr; break;
+  default: compare = compareBulkRef;
+  }
+  qsort(level, nKeys, sizeof(dbBtreeKey *), compare);
+
+  if (tree->root != 0) {
+    // tree is not empty: sorted insert at least keeps path to the leaf in
+    // the page pool
+    for (i = 0; i < nKeys; i++) {
+      if (_insert(db, treeId, level[i]->key, keyType, level[i]->keySize,
+                  level[i]->oid, false)) {
+        n += 1;
+      }
+    }
+    return int(n);
+  }
+  if (tree->unique) { // the first of the equal keys wins as in insert()
+    for (i = 0; i < nKeys; i++) {
+      if (n == 0 || !sameBulkKey(keyType, level[n - 1], level[i])) {
+        level[n++] = level[i];
+      }
+    }
+  } else {
+    n = nKeys;
+  }
+  int      count    = int(n);
+  bool     prefixed = tree->prefixedPages();
+  int      height;
+  bool     leaf = true;
+  dbBuffer<dbBtreeKey> buf[2];
+  dbBtreeKey *         pages[2] = {buf[0].append(int(n)), buf[1].append(int(n))};
+  for (height = 1;; height++) {
+    dbBtreeKey *out = pages[height & 1];
+    // fill factor applies to leaf pages only: full inner pages keep the tree
+    // height within iterator limits (MaxTreeHeight)
+    n = buildLevel(db, keyType, level, n, out, leaf, leaf ? fillFactor : 100,
+                   prefixed);
+    if (n == 1) { break; }
+    for (i = 0; i < n; i++) {
+      level[i] = &out[i];
+    }
+    leaf = false;
+  }
+  dbPutTie tie;
+  dbBtree *t = (dbBtree *)db->putObject(tie, treeId);
+  t->root    = pages[height & 1][0].oid;
+  t->height  = height;
+  return count;
+}
+
 bool dbBtree::is_unique(dbDatabase *db, oid_t treeId) {
   dbCriticalSection cs(db->mutex);
   if (!db->opened) {
@@ -179,6 +564,145 @@ int dbBtree::get_type(dbDatabase *db, oid_t treeId) {
   return tree->type;
 }
 
+int dbBtree::get_flags(dbDatabase *db, oid_t treeId) {
+  dbCriticalSection cs(db->mutex);
+  if (!db->opened) {
+    db->handleError(dybase_not_opened, "Database not opened");
+    return 0;
+  }
+  dbGetTie treeTie;
+  dbBtree *tree = (dbBtree *)db->getObject(treeTie, treeId);
+  return (tree->prefixedPages() ? prefixKeys : 0) |
+         (tree->type == dybase_bytes_type ? tree->getFlags() & compositeKeys
+                                          : 0);
+}
+
+//
+// Composite keys
+//
+static byte *packInt8(byte *dst, db_nat8 v) {
+  for (int i = 56; i >= 0; i -= 8) {
+    *dst++ = byte(v >> i);
+  }
+  return dst;
+}
+
+static db_nat8 unpackInt8(byte const *src) {
+  db_nat8 v = 0;
+  for (int i = 0; i < 8; i++) {
+    v = (v << 8) | src[i];
+  }
+  return v;
+}
+
+const db_nat8 dbSignBit = db_nat8(1) << 63;
+
+int dbCompositeKey::append(byte *key, length_t used, length_t bufSize,
+                           int type, void const *value, length_t valueSize) {
+  byte *dst = key + used;
+  byte *end = key + bufSize;
+  if (value == NULL) {
+    if (dst == end) { return -1; }
+    *dst++ = tagNull;
+    return int(dst - key);
+  }
+  db_nat8 bits;
+  switch (type) {
+  case dybase_bool_type:
+    if (dst == end) { return -1; }
+    *dst++ = *(db_int1 *)value ? tagTrue : tagFalse;
+    return int(dst - key);
+  case dybase_int_type:
+  case dybase_real_type: {
+    db_real8 r = type == dybase_int_type ? db_real8(*(db_int4 *)value)
+                                         : *(db_real8 *)value;
+    if (r == 0) { r = 0; } // -0 == 0
+    memcpy(&bits, &r, sizeof bits);
+    // negative numbers are ordered in reverse order of their bits
+    bits = (bits & dbSignBit) ? ~bits : bits ^ dbSignBit;
+    if (end - dst < 9) { return -1; }
+    *dst++ = tagNumber;
+    return int(packInt8(dst, bits) - key);
+  }
+  case dybase_long_type:
+  case dybase_date_type:
+    if (end - dst < 9) { return -1; }
+    *dst++ = type == dybase_long_type ? tagLong : tagDate;
+    return int(packInt8(dst, db_nat8(*(db_int8 *)value) ^ dbSignBit) - key);
+  case dybase_chars_type:
+  case dybase_bytes_type: {
+    byte const *src = (byte const *)value;
+    if (dst == end) { return -1; }
+    *dst++ = type == dybase_chars_type ? tagChars : tagBytes;
+    for (length_t i = 0; i < valueSize; i++) {
+      if (dst == end) { return -1; }
+      *dst++ = src[i];
+      if (src[i] == 0) {
+        if (dst == end) { return -1; }
+        *dst++ = 0xFF;
+      }
+    }
+    if (end - dst < 2) { return -1; }
+    *dst++ = 0;
+    *dst++ = 1;
+    return int(dst - key);
+  }
+  default: return -2;
+  }
+}
+
+int dbCompositeKey::next(byte const *key, length_t size, length_t &pos,
+                         int &type, void *value, length_t &valueSize) {
+  if (pos >= size) { return 0; }
+  db_nat8 bits;
+  switch (key[pos++]) {
+  case tagNull:
+    type      = -1;
+    valueSize = 0;
+    return 1;
+  case tagFalse:
+  case tagTrue:
+    type              = dybase_bool_type;
+    *(db_int1 *)value = key[pos - 1] == tagTrue;
+    valueSize         = sizeof(db_int1);
+    return 1;
+  case tagNumber:
+    if (size - pos < 8) { return -1; }
+    bits = unpackInt8(key + pos);
+    bits = (bits & dbSignBit) ? bits ^ dbSignBit : ~bits;
+    memcpy(value, &bits, sizeof(db_real8));
+    type      = dybase_real_type;
+    valueSize = sizeof(db_real8);
+    pos += 8;
+    return 1;
+  case tagLong:
+  case tagDate:
+    if (size - pos < 8) { return -1; }
+    type              = key[pos - 1] == tagLong ? dybase_long_type
+                                                : dybase_date_type;
+    *(db_int8 *)value = db_int8(unpackInt8(key + pos) ^ dbSignBit);
+    valueSize         = sizeof(db_int8);
+    pos += 8;
+    return 1;
+  case tagChars:
+  case tagBytes: {
+    byte *dst = (byte *)value;
+    type      = key[pos - 1] == tagChars ? dybase_chars_type : dybase_bytes_type;
+    while (true) {
+      if (pos >= size) { return -1; }
+      byte b = key[pos++];
+      if (b == 0) {
+        if (pos >= size) { return -1; }
+        if (key[pos++] == 1) { break; }
+      }
+      *dst++ = b;
+    }
+    valueSize = length_t(dst - (byte *)value);
+    return 1;
+  }
+  default: return -1;
+  }
+}
 
 bool dbBtree::remove(dbDatabase *db, oid_t treeId, void *key, int keyType,
                      length_t keySize, oid_t oid) {
@@ -228,7 +752,7 @@ bool dbBtree::remove(dbDatabase *db, oid_t treeId, void *key, int keyType,
   } else if (result == dbBtree::overflow) {
     dbPutTie tie;
     dbBtree *t = (dbBtree *)db->putObject(tie, treeId);
-    t->root    = dbBtreePage::allocate(db, rootId, tree->type, rem);
+    t->root    = dbBtreePage::allocate(db, rootId, tree->type, rem, false);
     t->height += 1;
   }
   return result != not_found;
@@ -288,7 +812,7 @@ void dbBtree::_drop(dbDatabase *db, oid_t treeId) {
     if (height == 0) {                                                         \
       while (l < n) {                                                          \
         if (CHECK(KEY[l], key, highInclusion)) { return false; }               \
-        sc.selection.add(record[maxItems - 1 - l]);                            \
+        sc.add(record[maxItems - 1 - l]);                                      \
         l += 1;                                                                \
       }                                                                        \
       return true;                                                             \
@@ -307,12 +831,6 @@ void dbBtree::_drop(dbDatabase *db, oid_t treeId) {
   }                                                                            \
   break
 
-inline int compareStrings(void *s1, length_t n1, void *s2, length_t n2) {
-  length_t len  = n1 < n2 ? n1 : n2;
-  int      diff = memcmp(s1, s2, len);
-  return diff != 0 ? diff : int(n1) - int(n2);
-}
-
 bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
   int l = 0, n = nItems, r = n;
   height -= 1;
@@ -333,8 +851,7 @@ bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
     if (sc.low != NULL) {
       while (l < r) {
         int i = (l + r) >> 1;
-        if (compareStrings(sc.low, sc.lowSize, &charKey[strKey[i].offs],
-                           strKey[i].size) >= lowInclusion) {
+        if (compareStrKey(sc.low, sc.lowSize, i) >= lowInclusion) {
           l = i + 1;
         } else {
           r = i;
@@ -345,11 +862,10 @@ bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
     if (sc.high != NULL) {
       if (height == 0) {
         while (l < n) {
-          if (compareStrings(&charKey[strKey[l].offs], strKey[l].size, sc.high,
-                             sc.highSize) >= highInclusion) {
+          if (-compareStrKey(sc.high, sc.highSize, l) >= highInclusion) {
             return false;
           }
-          sc.selection.add(strKey[l].oid);
+          sc.add(strKey[l].oid);
           l += 1;
         }
       } else {
@@ -362,15 +878,18 @@ bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
           db->pool.unfix(pg);
           if (l == n) { return true; }
           l += 1;
-        } while (compareStrings(&charKey[strKey[l - 1].offs],
-                                strKey[l - 1].size, sc.high, sc.highSize) <= 0);
+        } while (compareStrKey(sc.high, sc.highSize, l - 1) >= 0);
         return false;
       }
     } else {
       if (height == 0) {
-        while (l < n) {
-          sc.selection.add(strKey[l].oid);
-          l += 1;
+        if (sc.countOnly) {
+          sc.count += n - l;
+        } else {
+          while (l < n) {
+            sc.selection.add(strKey[l].oid);
+            l += 1;
+          }
         }
       } else {
         do {
@@ -386,9 +905,13 @@ bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
     return true;
   }
   if (height == 0) {
-    while (l < n) {
-      sc.selection.add(record[maxItems - 1 - l]);
-      l += 1;
+    if (sc.countOnly) {
+      sc.count += n - l;
+    } else {
+      while (l < n) {
+        sc.selection.add(record[maxItems - 1 - l]);
+        l += 1;
+      }
     }
   } else {
     do {
@@ -403,12 +926,23 @@ bool dbBtreePage::find(dbDatabase *db, dbSearchContext &sc, int height) {
   return true;
 }
 
-oid_t dbBtreePage::allocate(dbDatabase *db, oid_t root, int type, item &ins) {
+//
+// Create new root page. Format of the new root of non-empty tree is the same
+// as of its old root, "prefixed" specifies format of the first page.
+//
+oid_t dbBtreePage::allocate(dbDatabase *db, oid_t root, int type, item &ins,
+                            bool prefixed) {
+  if (root != 0 && (type == dybase_chars_type || type == dybase_bytes_type)) {
+    dbBtreePage *pg = (dbBtreePage *)db->get(root);
+    prefixed        = pg->isPrefixed();
+    db->pool.unfix(pg);
+  }
   oid_t        pageId = db->allocatePage();
   dbBtreePage *page   = (dbBtreePage *)db->put(pageId);
   page->nItems        = 1;
   if (type == dybase_chars_type || type == dybase_bytes_type) {
     page->size = ins.keyLen * sizeof(char);
+    if (prefixed) { page->size |= dbPrefixedPage; }
     page->strKey[0].offs = db_nat2(sizeof(page->charKey) - ins.keyLen * sizeof(char));
     page->strKey[0].size = db_nat2(ins.keyLen);
     page->strKey[0].oid  = ins.oid;
@@ -458,8 +992,8 @@ oid_t dbBtreePage::allocate(dbDatabase *db, oid_t root, int type, item &ins) {
     const int max = sizeof(pg->KEY) / (sizeof(oid_t) + sizeof(TYPE));          \
     if (n < max) {                                                             \
       memmove(&pg->KEY[r + 1], &pg->KEY[r], (n - r) * sizeof(TYPE));           \
-      memcpy(&pg->record[maxItems - n - 1], &pg->record[maxItems - n],         \
-             (n - r) * sizeof(oid_t));                                         \
+      memmove(&pg->record[maxItems - n - 1], &pg->record[maxItems - n],        \
+              (n - r) * sizeof(oid_t));                                        \
       pg->KEY[r]                   = ins.KEY;                                  \
       pg->record[maxItems - r - 1] = ins.oid;                                  \
       pg->nItems += 1;                                                         \
@@ -473,7 +1007,7 @@ oid_t dbBtreePage::allocate(dbDatabase *db, oid_t root, int type, item &ins) {
         memcpy(b->KEY, pg->KEY, r * sizeof(TYPE));                             \
         b->KEY[r] = ins.KEY;                                                   \
         memcpy(&b->KEY[r + 1], &pg->KEY[r], (m - r - 1) * sizeof(TYPE));       \
-        memcpy(pg->KEY, &pg->KEY[m - 1], (max - m + 1) * sizeof(TYPE));        \
+        memmove(pg->KEY, &pg->KEY[m - 1], (max - m + 1) * sizeof(TYPE));       \
         memcpy(&b->record[maxItems - r], &pg->record[maxItems - r],            \
                r * sizeof(oid_t));                                             \
         b->record[maxItems - r - 1] = ins.oid;                                 \
@@ -483,9 +1017,9 @@ oid_t dbBtreePage::allocate(dbDatabase *db, oid_t root, int type, item &ins) {
                 &pg->record[maxItems - max], (max - m + 1) * sizeof(oid_t));   \
       } else {                                                                 \
         memcpy(b->KEY, pg->KEY, m * sizeof(TYPE));                             \
-        memcpy(pg->KEY, &pg->KEY[m], (r - m) * sizeof(TYPE));                  \
+        memmove(pg->KEY, &pg->KEY[m], (r - m) * sizeof(TYPE));                 \
         pg->KEY[r - m] = ins.KEY;                                              \
-        memcpy(&pg->KEY[r - m + 1], &pg->KEY[r], (max - r) * sizeof(TYPE));    \
+        memmove(&pg->KEY[r - m + 1], &pg->KEY[r], (max - r) * sizeof(TYPE));   \
         memcpy(&b->record[maxItems - m], &pg->record[maxItems - m],            \
                m * sizeof(oid_t));                                             \
         memmove(&pg->record[maxItems - r + m], &pg->record[maxItems - r],      \
@@ -529,9 +1063,7 @@ int dbBtreePage::insert(dbDatabase *db, oid_t pageId, int type, item &ins,
   case dybase_chars_type: {
     while (l < r) {
       int i = (l + r) >> 1;
-      if (compareStrings(ins.charKey, ins.keyLen,
-                         &pg->charKey[pg->strKey[i].offs],
-                         pg->strKey[i].size) > 0) {
+      if (pg->compareStrKey(ins.charKey, ins.keyLen, i) > 0) {
         l = i + 1;
       } else {
         r = i;
@@ -545,9 +1077,7 @@ int dbBtreePage::insert(dbDatabase *db, oid_t pageId, int type, item &ins,
         db->pool.unfix(pg);
         return result;
       }
-    } else if (r < n && compareStrings(ins.charKey, ins.keyLen,
-                                       &pg->charKey[pg->strKey[r].offs],
-                                       pg->strKey[r].size) == 0) {
+    } else if (r < n && pg->compareStrKey(ins.charKey, ins.keyLen, r) == 0) {
       if (replace) {
         db->pool.unfix(pg);
         pg                = (dbBtreePage *)db->put(tie, pageId);
@@ -559,7 +1089,8 @@ int dbBtreePage::insert(dbDatabase *db, oid_t pageId, int type, item &ins,
     }
     db->pool.unfix(pg);
     pg = (dbBtreePage *)db->put(tie, pageId);
-    return pg->insertStrKey(db, r, ins, height);
+    return pg->isPrefixed() ? pg->insertPrefixedKey(db, r, ins, height)
+                            : pg->insertStrKey(db, r, ins, height);
   }
   }
   return dbBtree::done;
@@ -736,7 +1267,7 @@ int dbBtreePage::removeStrKey(int r) {
   int offs = strKey[r].offs;
   memmove(charKey + sizeof(charKey) - size + len * sizeof(char),
           charKey + sizeof(charKey) - size, size - sizeof(charKey) + offs);
-  memcpy(&strKey[r], &strKey[r + 1], (nItems - r) * sizeof(str));
+  memmove(&strKey[r], &strKey[r + 1], (nItems - r) * sizeof(str));
   nItems -= 1;
   size -= len * sizeof(char);
   for (int i = nItems; --i >= 0;) {
@@ -755,6 +1286,169 @@ int dbBtreePage::replaceStrKey(dbDatabase *db, int r, item &ins, int height) {
   return insertStrKey(db, r, ins, height);
 }
 
+int dbBtreePage::compareStrKey(void *key, length_t keyLen, int i) {
+  length_t prefixLen = keyPrefixLength();
+  char *   k         = (char *)key;
+  if (prefixLen != 0) {
+    char *prefix = &charKey[sizeof(charKey) - prefixLen];
+    if (keyLen < prefixLen) {
+      int diff = memcmp(k, prefix, keyLen);
+      return diff != 0 ? diff : -1;
+    }
+    int diff = memcmp(k, prefix, prefixLen);
+    if (diff != 0) { return diff; }
+    k += prefixLen;
+    keyLen -= prefixLen;
+  }
+  return compareStrings(k, keyLen, &charKey[strKey[i].offs], strKey[i].size);
+}
+
+//
+// Pack keys to the page. If they do not fit, divide them between the page and
+// the new one, which is returned in "ins" with its largest key.
+//
+int dbBtreePage::storePrefixedKeys(dbDatabase *db, dbStrKeyRef *keys, int n,
+                                   oid_t last, item &ins, bool inner) {
+  dbBtreePage page; // keys can refer to the content of this page
+  length_t    used = packedSize(keys, n, inner);
+  if (used <= sizeof(charKey)) {
+    packKeys(&page, keys, n, last, inner);
+    memcpy(this, &page, sizeof(dbBtreePage));
+    return used < sizeof(charKey) / 2 ? dbBtree::underflow : dbBtree::done;
+  }
+  int      m      = splitPosition(keys, n, inner);
+  length_t sepLen = keys[m - 1].length();
+  char     sep[dbBtreePage::dbMaxKeyLen];
+  keys[m - 1].copy(sep, 0, sepLen);
+
+  oid_t        pageId = db->allocatePage();
+  dbBtreePage *b      = (dbBtreePage *)db->put(pageId);
+  packKeys(b, keys, inner ? m - 1 : m, keys[m - 1].oid, inner);
+  packKeys(&page, keys + m, n - m, last, inner);
+  memcpy(this, &page, sizeof(dbBtreePage));
+  db->pool.unfix(b);
+
+  memcpy(ins.charKey, sep, sepLen);
+  ins.keyLen = int(sepLen);
+  ins.oid    = pageId;
+  return dbBtree::overflow;
+}
+
+int dbBtreePage::insertPrefixedKey(dbDatabase *db, int r, item &ins,
+                                   int height) {
+  length_t prefixLen = keyPrefixLength();
+  int      n         = height != 0 ? nItems + 1 : nItems;
+  length_t len       = ins.keyLen - prefixLen;
+  length_t used      = (size & dbCharsMask) + (n + 1) * sizeof(str) + len;
+  if (ins.keyLen >= (int)prefixLen && used <= sizeof(charKey) &&
+      memcmp(ins.charKey, &charKey[sizeof(charKey) - prefixLen], prefixLen) ==
+          0) { // key has the prefix of the page: insert its suffix in place
+    memmove(&strKey[r + 1], &strKey[r], (n - r) * sizeof(str));
+    size += db_nat4(len);
+    strKey[r].offs = db_nat2(sizeof(charKey) - (size & dbCharsMask));
+    strKey[r].size = db_nat2(len);
+    strKey[r].oid  = ins.oid;
+    memcpy(&charKey[strKey[r].offs], ins.charKey + prefixLen, len);
+    nItems += 1;
+    return used < sizeof(charKey) / 2 ? dbBtree::underflow : dbBtree::done;
+  }
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  dbStrKeyRef *keys = new dbStrKeyRef[dbMaxStrKeys + 1];
+#else
+  dbStrKeyRef keys[dbMaxStrKeys + 1];
+#endif
+  n          = unpackKeys(this, keys);
+  oid_t last = height != 0 ? strKey[n].oid : 0;
+  // insert before e[r]
+  memmove(&keys[r + 1], &keys[r], (n - r) * sizeof(dbStrKeyRef));
+  keys[r].assign(ins.charKey, ins.keyLen, ins.oid);
+  int result = storePrefixedKeys(db, keys, n + 1, last, ins, height != 0);
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  delete[] keys;
+#endif
+  return result;
+}
+
+int dbBtreePage::removePrefixedKey(int r, bool inner) {
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  dbStrKeyRef *keys = new dbStrKeyRef[dbMaxStrKeys];
+#else
+  dbStrKeyRef keys[dbMaxStrKeys];
+#endif
+  dbBtreePage page;
+  int         n    = unpackKeys(this, keys);
+  oid_t       last = inner ? strKey[n].oid : 0;
+  memmove(&keys[r], &keys[r + 1], (n - r - 1) * sizeof(dbStrKeyRef));
+  length_t used = packedSize(keys, n - 1, inner);
+  packKeys(&page, keys, n - 1, last, inner);
+  memcpy(this, &page, sizeof(dbBtreePage));
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  delete[] keys;
+#endif
+  return used < sizeof(charKey) / 2 ? dbBtree::underflow : dbBtree::done;
+}
+
+//
+// Child page r of this page is underflowed: merge it with its neighbour or,
+// if they do not fit in one page, redistribute keys between them
+//
+int dbBtreePage::handlePrefixedUnderflow(dbDatabase *db, int r, item &rem,
+                                         int height) {
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  dbStrKeyRef *keys = new dbStrKeyRef[dbMaxStrKeys * 2 + 1];
+#else
+  dbStrKeyRef keys[dbMaxStrKeys * 2 + 1];
+#endif
+  dbPutTie     tieA, tieB;
+  dbBtreePage  pageA, pageB;
+  bool         inner  = height != 1;
+  int          s      = r < (int)nItems ? r : r - 1; // separator of a and b
+  oid_t        aId    = strKey[s].oid;
+  oid_t        bId    = strKey[s + 1].oid;
+  dbBtreePage *a      = (dbBtreePage *)db->get(aId);
+  dbBtreePage *b      = (dbBtreePage *)db->get(bId);
+  int          n      = unpackKeys(a, keys);
+  int          result = dbBtree::done;
+  if (inner) {
+    keys[n].prefix    = &charKey[sizeof(charKey) - keyPrefixLength()];
+    keys[n].prefixLen = keyPrefixLength();
+    keys[n].suffix    = &charKey[strKey[s].offs];
+    keys[n].suffixLen = strKey[s].size;
+    keys[n].oid       = a->strKey[a->nItems].oid;
+    n += 1;
+  }
+  n += unpackKeys(b, keys + n);
+  oid_t last = inner ? b->strKey[b->nItems].oid : 0;
+
+  if (packedSize(keys, n, inner) <= sizeof(charKey)) { // merge page a to b
+    packKeys(&pageB, keys, n, last, inner);
+    db->pool.unfix(a);
+    db->pool.unfix(b);
+    memcpy(db->put(tieB, bId), &pageB, sizeof(dbBtreePage));
+    db->freePage(aId);
+    result = removePrefixedKey(s, true);
+  } else { // reallocation of nodes between pages a and b
+    int      m   = splitPosition(keys, n, inner);
+    length_t len = keys[m - 1].length();
+    keys[m - 1].copy(rem.charKey, 0, len);
+    rem.keyLen = int(len);
+    packKeys(&pageA, keys, inner ? m - 1 : m, keys[m - 1].oid, inner);
+    packKeys(&pageB, keys + m, n - m, last, inner);
+    db->pool.unfix(a);
+    db->pool.unfix(b);
+    memcpy(db->put(tieA, aId), &pageA, sizeof(dbBtreePage));
+    memcpy(db->put(tieB, bId), &pageB, sizeof(dbBtreePage));
+    // replace separator of the pages
+    n = unpackKeys(this, keys);
+    keys[s].assign(rem.charKey, rem.keyLen, aId);
+    result = storePrefixedKeys(db, keys, n, strKey[n].oid, rem, true);
+  }
+#ifdef NO_LARGE_LOCAL_ARRAYS
+  delete[] keys;
+#endif
+  return result;
+}
+
 int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
                                      int height) {
   dbPutTie tie;
@@ -992,7 +1686,7 @@ int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
         db->pool.unfix(b);
         b = (dbBtreePage *)db->put(tie, record[maxItems - r - 2]);
         memcpy(a->charKey + an * sizeofType, b->charKey, i * sizeofType);
-        memcpy(b->charKey, b->charKey + i * sizeofType, (bn - i) * sizeofType);
+        memmove(b->charKey, b->charKey + i * sizeofType, (bn - i) * sizeofType);
         memcpy(&a->record[maxItems - an - i], &b->record[maxItems - i],
                i * sizeof(oid_t));
         memmove(&b->record[maxItems - bn + i], &b->record[maxItems - bn],
@@ -1010,8 +1704,8 @@ int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
         db->freePage(record[maxItems - r - 2]);
         memmove(&record[maxItems - nItems], &record[maxItems - nItems - 1],
                 (nItems - r - 1) * sizeof(oid_t));
-        memcpy(charKey + r * sizeofType, charKey + (r + 1) * sizeofType,
-               (nItems - r - 1) * sizeofType);
+        memmove(charKey + r * sizeofType, charKey + (r + 1) * sizeofType,
+                (nItems - r - 1) * sizeofType);
         a->nItems += bn;
         nItems -= 1;
         return (nItems + 1) * (sizeofType + sizeof(oid_t)) < sizeof(charKey) / 2
@@ -1035,8 +1729,8 @@ int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
         b = (dbBtreePage *)db->put(tie, record[maxItems - r]);
         memmove(a->charKey + i * sizeofType, a->charKey, an * sizeofType);
         memcpy(a->charKey, b->charKey + (bn - i) * sizeofType, i * sizeofType);
-        memcpy(&a->record[maxItems - an - i], &a->record[maxItems - an],
-               an * sizeof(oid_t));
+        memmove(&a->record[maxItems - an - i], &a->record[maxItems - an],
+                an * sizeof(oid_t));
         memcpy(&a->record[maxItems - i], &b->record[maxItems - bn],
                i * sizeof(oid_t));
         if (height != 1) {
@@ -1051,8 +1745,8 @@ int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
       } else { // merge page b to a
         memmove(a->charKey + bn * sizeofType, a->charKey, an * sizeofType);
         memcpy(a->charKey, b->charKey, bn * sizeofType);
-        memcpy(&a->record[maxItems - an - bn], &a->record[maxItems - an],
-               an * sizeof(oid_t));
+        memmove(&a->record[maxItems - an - bn], &a->record[maxItems - an],
+                an * sizeof(oid_t));
         memcpy(&a->record[maxItems - bn], &b->record[maxItems - bn],
                bn * sizeof(oid_t));
         if (height != 1) {
@@ -1089,7 +1783,7 @@ int dbBtreePage::handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
           if (pg->record[maxItems - r - 1] == oid || oid == 0) {               \
             db->pool.unfix(pg);                                                \
             pg = (dbBtreePage *)db->put(tie, pageId);                          \
-            memcpy(&pg->KEY[r], &pg->KEY[r + 1], (n - r - 1) * sizeof(TYPE));  \
+            memmove(&pg->KEY[r], &pg->KEY[r + 1], (n - r - 1) * sizeof(TYPE)); \
             memmove(&pg->record[maxItems - n + 1], &pg->record[maxItems - n],  \
                     (n - r - 1) * sizeof(oid_t));                              \
             pg->nItems = --n;                                                  \
@@ -1129,9 +1823,7 @@ int dbBtreePage::remove(dbDatabase *db, oid_t pageId, int type, item &rem,
   case dybase_chars_type: {
     while (l < r) {
       i = (l + r) >> 1;
-      if (compareStrings(rem.charKey, rem.keyLen,
-                         &pg->charKey[pg->strKey[i].offs],
-                         pg->strKey[i].size) > 0) {
+      if (pg->compareStrKey(rem.charKey, rem.keyLen, i) > 0) {
         l = i + 1;
       } else {
         r = i;
@@ -1143,23 +1835,25 @@ int dbBtreePage::remove(dbDatabase *db, oid_t pageId, int type, item &rem,
         case dbBtree::underflow:
           db->pool.unfix(pg);
           pg = (dbBtreePage *)db->put(tie, pageId);
-          return pg->handlePageUnderflow(db, r, type, rem, height);
+          return pg->isPrefixed()
+                     ? pg->handlePrefixedUnderflow(db, r, rem, height)
+                     : pg->handlePageUnderflow(db, r, type, rem, height);
         case dbBtree::done: db->pool.unfix(pg); return dbBtree::done;
         case dbBtree::overflow:
           db->pool.unfix(pg);
           pg = (dbBtreePage *)db->put(tie, pageId);
-          return pg->insertStrKey(db, r, rem, height);
+          return pg->isPrefixed() ? pg->insertPrefixedKey(db, r, rem, height)
+                                  : pg->insertStrKey(db, r, rem, height);
         }
       } while (++r <= n);
     } else {
       while (r < n) {
-        if (compareStrings(rem.charKey, rem.keyLen,
-                           &pg->charKey[pg->strKey[r].offs],
-                           pg->strKey[r].size) == 0) {
+        if (pg->compareStrKey(rem.charKey, rem.keyLen, r) == 0) {
           if (pg->strKey[r].oid == rem.oid || rem.oid == 0) {
             db->pool.unfix(pg);
             pg = (dbBtreePage *)db->put(tie, pageId);
-            return pg->removeStrKey(r);
+            return pg->isPrefixed() ? pg->removePrefixedKey(r, false)
+                                    : pg->removeStrKey(r);
           }
         } else {
           break;
@@ -1254,8 +1948,7 @@ int dbBtreeIterator::compare(void *key, int keyType, dbBtreePage *pg, int pos) {
 
 int dbBtreeIterator::compareStr(void *key, length_t keyLength, dbBtreePage *pg,
                                 int pos) {
-  return compareStrings(key, keyLength, &pg->charKey[pg->strKey[pos].offs],
-                        pg->strKey[pos].size);
+  return pg->compareStrKey(key, keyLength, pos);
 }
 
 dbBtreeIterator::dbBtreeIterator(dbDatabase *db, oid_t treeId, int type,
@@ -1267,6 +1960,8 @@ dbBtreeIterator::dbBtreeIterator(dbDatabase *db, oid_t treeId, int type,
   dbGetTie tie;
   dbBtree *tree = (dbBtree *)db->getObject(tie, treeId);
   sp            = 0;
+  fromCopy      = NULL;
+  tillCopy      = NULL;
 
   if (tree->height == 0) { return; }
 
@@ -1316,6 +2011,12 @@ dbBtreeIterator::dbBtreeIterator(dbDatabase *db, oid_t treeId, int type,
       from_val.realKey = *(db_real8 *)from;
       this->from       = &from_val.realKey;
       break;
+    case dybase_bytes_type:
+    case dybase_chars_type: // caller may release the key before iteration
+      fromCopy = new char[fromLength];
+      memcpy(fromCopy, from, fromLength);
+      this->from = fromCopy;
+      break;
     }
   }
   if (till != NULL) {
@@ -1343,6 +2044,12 @@ dbBtreeIterator::dbBtreeIterator(dbDatabase *db, oid_t treeId, int type,
       till_val.realKey = *(db_real8 *)till;
       this->till       = &till_val.realKey;
       break;
+    case dybase_bytes_type:
+    case dybase_chars_type: // caller may release the key before iteration
+      tillCopy = new char[tillLength];
+      memcpy(tillCopy, till, tillLength);
+      this->till = tillCopy;
+      break;
     }
   }
 
@@ -1599,6 +2306,11 @@ dbBtreeIterator::dbBtreeIterator(dbDatabase *db, oid_t treeId, int type,
   }
 }
 
+dbBtreeIterator::~dbBtreeIterator() {
+  delete[] fromCopy;
+  delete[] tillCopy;
+}
+
 oid_t dbBtreeIterator::next() {
   if (sp == 0) { return 0; }
   int          pos = posStack[sp - 1];
@@ -1610,6 +2322,37 @@ oid_t dbBtreeIterator::next() {
   return oid;
 }
 
+oid_t dbBtreeIterator::next(void *&key, length_t &keyLength) {
+  if (sp == 0) { return 0; }
+  int          pos = posStack[sp - 1];
+  dbBtreePage *pg  = (dbBtreePage *)db->get(pageStack[sp - 1]);
+  oid_t        oid = (type == dybase_chars_type || type == dybase_bytes_type)
+                  ? pg->strKey[pos].oid
+                  : pg->record[dbBtreePage::maxItems - 1 - pos];
+  fetchKey(pg, pos);
+  gotoNextItem(pg, pos);
+  key       = this->key.charKey;
+  keyLength = this->keyLength;
+  return oid;
+}
+
+//
+// Copy key of the current item, the page is unfixed when the iterator moves
+//
+void dbBtreeIterator::fetchKey(dbBtreePage *pg, int pos) {
+  if (type == dybase_chars_type || type == dybase_bytes_type) {
+    length_t prefixLen = pg->keyPrefixLength();
+    length_t size      = pg->strKey[pos].size;
+    memcpy(key.charKey, &pg->charKey[sizeof(pg->charKey) - prefixLen],
+           prefixLen);
+    memcpy(key.charKey + prefixLen, &pg->charKey[pg->strKey[pos].offs], size);
+    keyLength = prefixLen + size;
+  } else {
+    keyLength = dbSizeofType[type];
+    memcpy(key.charKey, pg->charKey + pos * keyLength, keyLength);
+  }
+}
+
 void dbBtreeIterator::gotoNextItem(dbBtreePage *pg, int pos) {
   oid_t pageId;
   if (type == dybase_chars_type || type == dybase_bytes_type) {
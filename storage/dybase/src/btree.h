@@ -22,9 +22,77 @@ public:
   length_t        highSize;
   int             highInclusive;
   int             keyType;
+  bool            countOnly; // only count matched objects
+  length_t        count;     // number of matched objects if countOnly is set
   dbBuffer<oid_t> selection;
+
+  void add(oid_t oid) {
+    if (countOnly) {
+      count += 1;
+    } else {
+      selection.add(oid);
+    }
+  }
+
+  dbSearchContext() : countOnly(false), count(0) {}
 };
 
+/**
+ * Key and associated object passed to dbBtree::bulkLoad
+ */
+struct dbBtreeKey {
+  void *   key;
+  length_t keySize;
+  oid_t    oid;
+};
+
+/**
+ * Order preserving encoding of tuples of values used as keys of indexes with
+ * dbBtree::compositeKeys flag. Encoded keys are compared as byte strings, so
+ * tuples are ordered by their first element, then by the second and so on,
+ * and key of a tuple is a prefix of the keys of all its extensions.
+ */
+class dbCompositeKey {
+public:
+  enum Tag {
+    tagNull   = 0x01,
+    tagFalse  = 0x02,
+    tagTrue   = 0x03,
+    tagNumber = 0x10, // int and real values, encoded as real
+    tagLong   = 0x11,
+    tagDate   = 0x12,
+    tagChars  = 0x20, // 0 is escaped as 0,0xFF, terminated by 0,1
+    tagBytes  = 0x21,
+    tagEnd    = 0xFF // greater than any element
+  };
+
+  /**
+   * Append element to the key
+   * @param key buffer with the key
+   * @param used size of the key
+   * @param bufSize size of the buffer
+   * @param type dybase type of the element, value is NULL for null element
+   * @return new size of the key, -1 if buffer is too small, -2 if type is not
+   * supported
+   */
+  static int append(byte *key, length_t used, length_t bufSize, int type,
+                    void const *value, length_t valueSize);
+
+  /**
+   * Extract element of the key
+   * @param pos [in/out] position of the element in the key
+   * @param type [out] dybase type of the element or -1 for null
+   * @param value [out] buffer receiving the value, should be at least of
+   * key size or 8 bytes
+   * @return 1 if element is extracted, 0 at the end of the key, -1 if key is
+   * malformed
+   */
+  static int next(byte const *key, length_t size, length_t &pos, int &type,
+                  void *value, length_t &valueSize);
+};
+
+struct dbStrKeyRef;
+
 class dbBtreePage {
 public:
   db_nat4 nItems;
@@ -52,6 +120,20 @@ public:
   };
   enum { maxItems = (dbPageSize - 8) / sizeof(oid_t) };
 
+  /**
+   * Pages of trees with dbBtree::prefixKeys flag keep the common prefix of
+   * their string keys only once. Such page is marked by dbPrefixedPage bit in
+   * "size", bits 16..30 contain length of the prefix and lower bits - total
+   * size of the prefix and key suffixes. Pages of older databases do not have
+   * this bit and are handled as before.
+   */
+  enum {
+    dbPrefixedPage = 0x80000000,
+    dbPrefixShift  = 16,
+    dbPrefixMask   = 0x7FFF,
+    dbCharsMask    = 0xFFFF
+  };
+
   union {
     oid_t    record[maxItems];
     oid_t    refKey[(dbPageSize - 8) / sizeof(oid_t)];
@@ -63,7 +145,8 @@ public:
     str      strKey[1];
   };
 
-  static oid_t allocate(dbDatabase *db, oid_t root, int type, item &ins);
+  static oid_t allocate(dbDatabase *db, oid_t root, int type, item &ins,
+                        bool prefixed);
 
   static int insert(dbDatabase *db, oid_t pageId, int type, item &ins,
                     bool unique, bool replace, int height);
@@ -79,12 +162,26 @@ public:
   int  removeStrKey(int r);
   void compactify(int m);
 
+  bool     isPrefixed() { return (size & dbPrefixedPage) != 0; }
+  length_t keyPrefixLength() { return (size >> dbPrefixShift) & dbPrefixMask; }
+  int      compareStrKey(void *key, length_t keyLen, int i);
+  int      insertPrefixedKey(dbDatabase *db, int r, item &ins, int height);
+  int      removePrefixedKey(int r, bool inner);
+  int      storePrefixedKeys(dbDatabase *db, dbStrKeyRef *keys, int n,
+                             oid_t last, item &ins, bool inner);
+
   int handlePageUnderflow(dbDatabase *db, int r, int type, item &rem,
                           int height);
+  int handlePrefixedUnderflow(dbDatabase *db, int r, item &rem, int height);
 
   bool find(dbDatabase *db, dbSearchContext &sc, int height);
 };
 
+/**
+ * Mark of the trees which flags are initialized
+ */
+const db_nat4 dbBtreeMagic = 0x45455254; // "TREE"
+
 class dbBtree : public dbObject {
   friend class dbDatabase;
   friend class dbBtreeIterator;
@@ -95,26 +192,53 @@ protected:
   db_int4 type;
   db_int4 flags;
   db_int4 unique;
+  db_nat4 magic; // dbBtreeMagic
 
   static bool packItem(dbDatabase *db, dbBtree *tree, dbBtreePage::item &it,
                        void *key, int keyType, length_t keySize, oid_t oid);
 
   static void _drop(dbDatabase *db, oid_t treeId);
   static void _clear(dbDatabase *db, oid_t treeId);
+  static bool _insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
+                      length_t keySize, oid_t oid, bool replace);
+  static length_t buildLevel(dbDatabase *db, int type, dbBtreeKey **level,
+                             length_t n, dbBtreeKey *pages, bool leaf,
+                             int fillFactor, bool prefixed);
+
+  /**
+   * Trees created by older versions have no magic and their flags were not
+   * initialized, so they are ignored. Format of the pages is also recorded
+   * in the pages themselves.
+   */
+  int getFlags() {
+    return size >= sizeof(dbBtree) && magic == dbBtreeMagic ? flags : 0;
+  }
+
+  bool prefixedPages() {
+    return (getFlags() & prefixKeys) != 0 &&
+           (type == dybase_chars_type || type == dybase_bytes_type);
+  }
 
 public:
   enum OperationEffect { done, overflow, underflow, duplicate, not_found };
+  enum Flags {
+    prefixKeys    = 1, // string keys are stored in prefix compressed pages
+    compositeKeys = 2  // byte string keys are packed by dbCompositeKey
+  };
 
-  static oid_t allocate(dbDatabase *db, int type, bool unique);
+  static oid_t allocate(dbDatabase *db, int type, bool unique, int flags);
   static void  find(dbDatabase *db, oid_t treeId, dbSearchContext &sc);
   static bool  insert(dbDatabase *db, oid_t treeId, void *key, int keyType,
                       length_t keySize, oid_t oid, bool replace);
   static bool  remove(dbDatabase *db, oid_t treeId, void *key, int keyType,
                       length_t keySize, oid_t oid);
+  static int   bulkLoad(dbDatabase *db, oid_t treeId, int keyType,
+                       dbBtreeKey *keys, length_t nKeys, int fillFactor);
   static void  drop(dbDatabase *db, oid_t treeId);
   static void  clear(dbDatabase *db, oid_t treeId);
   static bool  is_unique(dbDatabase *db, oid_t treeId);
   static int   get_type(dbDatabase *db, oid_t treeId);
+  static int   get_flags(dbDatabase *db, oid_t treeId);
 
   void markTree(dbDatabase *db) {
     if (root != 0) { dbBtreePage::markPage(db, root, type, height); }
@@ -126,9 +250,19 @@ public:
   dbBtreeIterator(dbDatabase *db, oid_t treeId, int keyType, void *from,
                   length_t fromLength, int fromInclusion, void *till,
                   length_t tillLength, int tillInclusion, bool ascent);
+  ~dbBtreeIterator();
   oid_t next();
 
+  /**
+   * Get next element together with its key
+   * @param key [out] pointer to the key, valid until next call of the iterator
+   * @param keyLength [out] size of the key in bytes
+   * @return oid of the object or 0 if there are no more objects
+   */
+  oid_t next(void *&key, length_t &keyLength);
+
 private:
+  void       fetchKey(dbBtreePage *pg, int pos);
   void       gotoNextItem(dbBtreePage *pg, int pos);
   static int compare(void *key, int keyType, dbBtreePage *pg, int pos);
   static int compareStr(void *key, length_t keyLength, dbBtreePage *pg,
@@ -150,6 +284,8 @@ private:
   } from_val, till_val;
   void *   from;
   void *   till;
+  char *   fromCopy; // copies of string boundaries
+  char *   tillCopy;
   length_t fromLength;
   length_t tillLength;
   int      fromInclusion;
@@ -157,6 +293,12 @@ private:
   bool     ascent;
   oid_t    pageStack[MaxTreeHeight];
   int      posStack[MaxTreeHeight];
+  union {
+    db_int8  longKey; // alignment
+    db_real8 realKey;
+    char     charKey[dbBtreePage::dbMaxKeyLen];
+  } key;
+  length_t keyLength;
 };
 
 #endif
@@ -68,6 +68,8 @@ public:
 
   void add(T val) { *append(1) = val; }
 
+  void truncate(length_t n) { used = n; }
+
   T *append(int n) {
     if (n + used > allocated) {
       length_t newSize = n + used > allocated * 2 ? n + used : allocated * 2;
@@ -0,0 +1,160 @@
+//-< COMPRESS.CPP >--------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// LZ77 codec used for compression of stored objects
+//-------------------------------------------------------------------*--------*
+
+#include "stdtp.h"
+#include "database.h"
+#include "compress.h"
+
+const length_t dbMinMatch      = 4;
+const length_t dbMaxOffset     = 0xFFFF;
+const int      dbMaxHashBits   = 14;
+const int      dbMinHashBits   = 8;
+const int      dbRunLengthMask = 15;
+
+static inline db_nat4 load4(byte const *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((db_nat4)p[3] << 24);
+}
+
+static inline unsigned hash4(db_nat4 v, int bits) {
+  return (v * 2654435761U) >> (32 - bits);
+}
+
+// writes extension of the length which doesn't fit in the token
+static inline byte *putLength(byte *op, byte *end, length_t len) {
+  while (len >= 255) {
+    if (op == end) { return NULL; }
+    *op++ = 255;
+    len -= 255;
+  }
+  if (op == end) { return NULL; }
+  *op++ = (byte)len;
+  return op;
+}
+
+static byte *putSequence(byte *op, byte *end, byte const *literals,
+                         length_t nLiterals, length_t offset,
+                         length_t matchLength) {
+  if (op == end) { return NULL; }
+  byte *token = op++;
+  if (nLiterals >= (length_t)dbRunLengthMask) {
+    *token = dbRunLengthMask << 4;
+    if ((op = putLength(op, end, nLiterals - dbRunLengthMask)) == NULL) {
+      return NULL;
+    }
+  } else {
+    *token = (byte)(nLiterals << 4);
+  }
+  if ((length_t)(end - op) < nLiterals) { return NULL; }
+  memcpy(op, literals, nLiterals);
+  op += nLiterals;
+  if (matchLength == 0) { return op; } // last sequence
+  if (end - op < 2) { return NULL; }
+  *op++       = (byte)offset;
+  *op++       = (byte)(offset >> 8);
+  matchLength -= dbMinMatch;
+  if (matchLength >= (length_t)dbRunLengthMask) {
+    *token |= dbRunLengthMask;
+    return putLength(op, end, matchLength - dbRunLengthMask);
+  }
+  *token |= (byte)matchLength;
+  return op;
+}
+
+length_t dbCompress(byte const *src, length_t srcSize, byte *dst,
+                    length_t dstSize) {
+  db_nat4 table[1 << dbMaxHashBits]; // position + 1, 0 if empty
+  int     bits = dbMinHashBits;
+  while (bits < dbMaxHashBits && ((length_t)1 << bits) < srcSize) {
+    bits += 1;
+  }
+  memset(table, 0, sizeof(db_nat4) << bits);
+
+  byte *      op     = dst;
+  byte *      end    = dst + dstSize;
+  byte const *anchor = src;
+  byte const *ip     = src;
+  byte const *iend   = src + srcSize;
+  while (iend - ip >= (ptrdiff_t)dbMinMatch) {
+    db_nat4  v   = load4(ip);
+    unsigned h   = hash4(v, bits);
+    length_t ref = table[h];
+    table[h]     = db_nat4(ip - src + 1);
+    if (ref == 0 || (length_t)(ip - src) - (ref - 1) > dbMaxOffset ||
+        load4(src + ref - 1) != v) {
+      ip += 1;
+      continue;
+    }
+    byte const *match = src + ref - 1;
+    length_t    len   = dbMinMatch;
+    while (ip + len < iend && match[len] == ip[len]) {
+      len += 1;
+    }
+    op = putSequence(op, end, anchor, ip - anchor, ip - match, len);
+    if (op == NULL) { return 0; }
+    ip += len;
+    anchor = ip;
+  }
+  op = putSequence(op, end, anchor, iend - anchor, 0, 0);
+  return op == NULL ? 0 : length_t(op - dst);
+}
+
+// reads extension of the length, returns false if input is exhausted
+static inline bool getLength(byte const *&ip, byte const *iend,
+                             length_t &len) {
+  byte b;
+  do {
+    if (ip == iend) { return false; }
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+bool dbDecompress(byte const *src, length_t srcSize, byte *dst,
+                  length_t dstSize) {
+  byte const *ip   = src;
+  byte const *iend = src + srcSize;
+  byte *      op   = dst;
+  byte *      oend = dst + dstSize;
+  while (ip < iend) {
+    int      token = *ip++;
+    length_t len   = token >> 4;
+    if (len == (length_t)dbRunLengthMask && !getLength(ip, iend, len)) {
+      return false;
+    }
+    if ((length_t)(iend - ip) < len || (length_t)(oend - op) < len) {
+      return false;
+    }
+    memcpy(op, ip, len);
+    ip += len;
+    op += len;
+    if (ip == iend) { break; } // last sequence has no match
+    if (iend - ip < 2) { return false; }
+    length_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (length_t)(op - dst)) { return false; }
+    len = token & dbRunLengthMask;
+    if (len == (length_t)dbRunLengthMask && !getLength(ip, iend, len)) {
+      return false;
+    }
+    len += dbMinMatch;
+    if ((length_t)(oend - op) < len) { return false; }
+    byte const *match = op - offset;
+    if (offset >= len) {
+      memcpy(op, match, len);
+      op += len;
+    } else {
+      while (len-- != 0) { // overlapping copy repeats the pattern
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == oend;
+}
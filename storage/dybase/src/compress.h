@@ -0,0 +1,39 @@
+//-< COMPRESS.H >----------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// LZ77 codec used for compression of stored objects
+//-------------------------------------------------------------------*--------*
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+/**
+ * Compress data. Output is a sequence of LZ4-like tokens: length of literals
+ * and length of the match packed in one byte, literals, 2-byte offset of the
+ * match.
+ * @param src data to be compressed
+ * @param srcSize size of the data
+ * @param dst buffer for compressed data
+ * @param dstSize size of the buffer
+ * @return size of compressed data or 0 if it doesn't fit in the buffer
+ */
+length_t dbCompress(byte const *src, length_t srcSize, byte *dst,
+                    length_t dstSize);
+
+/**
+ * Decompress data produced by dbCompress
+ * @param src compressed data
+ * @param srcSize size of compressed data
+ * @param dst buffer for original data
+ * @param dstSize size of original data
+ * @return <code>true</code> if exactly dstSize bytes were decompressed,
+ * <code>false</code> if compressed data is corrupted
+ */
+bool dbDecompress(byte const *src, length_t srcSize, byte *dst,
+                  length_t dstSize);
+
+#endif
@@ -11,6 +11,11 @@
 #include "stdtp.h"
 #include "database.h"
 #include "btree.h"
+#include "compress.h"
+#include "snapshot.h"
+
+static dbMutex     openedMutex; // protects openedChain and dbDatabase::nRefs
+static dbDatabase *openedChain;
 
 void dbDatabase::handleError(int error, char const *msg) {
   if (errorHandler != NULL) {
@@ -29,17 +34,8 @@ void dbDatabase::throwException(int error, char const *msg) {
   //return open(cvt::w2a(name), openAttr);
 //}
 
-bool dbDatabase::open(const char *name, int openAttr) {
-  dbCriticalSection cs(mutex);
-  int               rc;
-  opened = false;
-
-  length_t indexSize =
-      initIndexSize < dbFirstUserId ? length_t(dbFirstUserId) : initIndexSize;
-  indexSize = DOALIGN(indexSize, dbHandlesPerPage);
-
-  memset(dirtyPagesMap, 0, dbDirtyPageBitmapSize + 4);
-
+void dbDatabase::resetState() {
+  memset(dirtyPagesMap, 0, dirtyPagesMapSize * sizeof(db_int4));
   for (int i = dbBitmapId + dbBitmapPages; --i >= 0;) {
     bitmapPageAvailableSpace[i] = INT_MAX;
   }
@@ -50,7 +46,21 @@ bool dbDatabase::open(const char *name, int openAttr) {
   gcThreshold                       = 0;
   allocatedDelta                    = 0;
   gcDone                            = false;
+  gcStepSize                        = 0;
+  gcCycles = gcSteps = gcMarked = gcFreed = 0;
   modified                          = false;
+}
+
+bool dbDatabase::open(const char *name, int openAttr) {
+  dbCriticalSection cs(mutex);
+  int               rc;
+  opened = false;
+
+  length_t indexSize =
+      initIndexSize < dbFirstUserId ? length_t(dbFirstUserId) : initIndexSize;
+  indexSize = DOALIGN(indexSize, dbHandlesPerPage);
+
+  resetState();
 
   if (accessType == dbReadOnly) { openAttr |= dbFile::read_only; }
   if (*name == L'@') {
@@ -147,6 +157,15 @@ bool dbDatabase::open(const char *name, int openAttr) {
       return false;
     }
   }
+  delete[] logName;
+  logName = new char[strlen(name) + 5];
+  sprintf(logName, "%s.wal", name);
+  if (!recoverLog()) {
+    delete file;
+    handleError(dybase_open_error, "Failed to recover database from the log");
+    return false;
+  }
+
   memset(header, 0, sizeof(dbHeader));
   rc = file->read(0, header, dbPageSize);
   if (rc != dbFile::ok && rc != dbFile::eof) {
@@ -155,6 +174,25 @@ bool dbDatabase::open(const char *name, int openAttr) {
     return false;
   }
 
+  // files with 32-bit identifiers start with the index of the current root
+  db_nat4 *word = (db_nat4 *)header;
+#ifdef DYBASE_OID64
+  if (header->format != dbWideFileFormat && word[0] <= 1 && word[2] == 1) {
+    delete file;
+    handleError(dybase_open_error, "Database file has 32-bit object "
+                                   "identifiers, it should be exported and "
+                                   "imported to the new file");
+    return false;
+  }
+#else
+  if (word[0] == dbWideFileFormat) {
+    delete file;
+    handleError(dybase_open_error, "Database file has 64-bit object "
+                                   "identifiers, it should be exported and "
+                                   "imported to the new file");
+    return false;
+  }
+#endif
   if ((unsigned)header->curr > 1) {
     delete file;
     handleError(dybase_open_error,
@@ -168,6 +206,9 @@ bool dbDatabase::open(const char *name, int openAttr) {
                   "Can not open uninitialized file in read only mode");
       return false;
     }
+#ifdef DYBASE_OID64
+    header->format = dbWideFileFormat;
+#endif
     curr = header->curr           = 0;
     length_t used                 = dbPageSize;
     header->root[0].index         = used;
@@ -311,16 +352,730 @@ bool dbDatabase::open(const char *name, int openAttr) {
     currIndexSize = header->root[1 - curr].indexUsed;
   }
   committedIndexSize = currIndexSize;
+  extendDirtyPagesMap(header->root[0].indexSize);
+  extendDirtyPagesMap(header->root[1].indexSize);
+
+  if (checkpointSize != 0 && accessType != dbReadOnly) {
+    log = new dbWriteAheadLog();
+    if (log->open(logName, false) != dbFile::ok) {
+      delete log;
+      log = NULL;
+      pool.close();
+      delete file;
+      handleError(dybase_open_error, "Failed to create log file");
+      return false;
+    }
+  }
+  commitLsn = 0;
+
+  loadScheme();
+  opened = true;
+  delete[] fileName;
+  fileName = new char[strlen(name) + 1];
+  strcpy(fileName, name);
+  if (accessType != dbReadOnly) {
+    // snapshots of this database can be opened by other threads
+    dbCriticalSection chain(openedMutex);
+    nextOpened  = openedChain;
+    openedChain = this;
+  }
+  return true;
+}
+
+bool dbDatabase::open(dbDatabase *source) {
+  dbCriticalSection cs(mutex);
+  opened = false;
+  resetState();
 
+  dbSnapshotFile *snapshotFile = source->createSnapshot(this);
+  if (snapshotFile == NULL) {
+    source->release();
+    handleError(dybase_open_error, "Failed to create snapshot");
+    return false;
+  }
+  this->source = source;
+  file         = snapshotFile;
+  file->read(0, header, dbPageSize);
+  curr          = header->curr;
+  currIndexSize = committedIndexSize = header->root[curr].indexUsed;
+  if (!pool.open(file, header->root[curr].size)) {
+    delete file;
+    source->removeSnapshot(this);
+    source->release();
+    this->source = NULL;
+    handleError(dybase_open_error, "Failed to allocate page pool");
+    return false;
+  }
+  log       = NULL;
+  commitLsn = 0;
   loadScheme();
   opened = true;
   return true;
 }
 
+dbDatabase *dbDatabase::findOpened(char const *name) {
+  dbCriticalSection chain(openedMutex);
+  for (dbDatabase *db = openedChain; db != NULL; db = db->nextOpened) {
+    if (strcmp(db->fileName, name) == 0) {
+      db->nRefs += 1;
+      return db;
+    }
+  }
+  return NULL;
+}
+
+void dbDatabase::release() {
+  bool last;
+  {
+    dbCriticalSection chain(openedMutex);
+    last = --nRefs == 0;
+  }
+  if (last) {
+    if (closePending) {
+      try {
+        closeFile();
+      } catch (dbException &) {}
+    }
+    delete this;
+  }
+}
+
+dbSnapshotFile *dbDatabase::createSnapshot(dbDatabase *snapshot) {
+  dbCriticalSection cs(mutex);
+  if (!opened) { return NULL; }
+  dbSnapshotFile *snapshotFile = new dbSnapshotFile();
+  if (snapshotFile->open(this) != dbFile::ok) {
+    delete snapshotFile;
+    return NULL;
+  }
+  snapshot->snapshotSeq  = commitSeq;
+  snapshot->nextSnapshot = snapshots;
+  snapshots              = snapshot;
+  return snapshotFile;
+}
+
+void dbDatabase::removeSnapshot(dbDatabase *snapshot) {
+  dbCriticalSection cs(mutex);
+  dbDatabase **spp = &snapshots;
+  while (*spp != snapshot) {
+    spp = &(*spp)->nextSnapshot;
+  }
+  *spp = snapshot->nextSnapshot;
+}
+
+void dbDatabase::closeSnapshot() {
+  dbClassDescriptor *desc, *next;
+  for (desc = classDescList; desc != NULL; desc = next) {
+    next = desc->next;
+    delete desc;
+  }
+  classDescList = NULL;
+  classOidHash.clear();
+  classSignatureHash.clear();
+  opened = false;
+  pool.close();
+  delete file;
+  file = NULL;
+  source->removeSnapshot(this);
+  source->release();
+  source = NULL;
+}
+
+dbDatabase *dbDatabase::openSnapshot(char const *target) {
+  char const *name = (source != NULL ? source : this)->fileName;
+  dbDatabase *user = findOpened(target);
+  if (user != NULL) { user->release(); }
+  if (user != NULL || (name != NULL && strcmp(name, target) == 0)) {
+    handleError(dybase_open_error, "File is used by the opened database");
+    return NULL;
+  }
+  {
+    dbCriticalSection chain(openedMutex);
+    nRefs += 1;
+  }
+  dbDatabase *snapshot = new dbDatabase(dbReadOnly, errorHandler,
+                                        dbDefaultPagePoolSize / dbPageSize);
+  if (!snapshot->open(this)) {
+    delete snapshot;
+    return NULL;
+  }
+  return snapshot;
+}
+
+bool dbDatabase::backup(char const *path) {
+  dbDatabase *snapshot = openSnapshot(path);
+  if (snapshot == NULL) { return false; }
+  const length_t bufSize = 64 * dbPageSize;
+  byte *         buf     = (byte *)dbFile::allocateBuffer(bufSize);
+  dbHeader *     hdr     = (dbHeader *)dbFile::allocateBuffer(dbPageSize);
+  dbFile *       in      = snapshot->file;
+  int            curr    = snapshot->curr;
+  length_t       n;
+  offs_t         pos;
+
+  // backup is a normally closed database: its shadow root describes the
+  // same state in the other index area
+  memcpy(hdr, snapshot->header, dbPageSize);
+  hdr->root[1 - curr].index           = hdr->root[curr].shadowIndex;
+  hdr->root[1 - curr].indexSize       = hdr->root[curr].shadowIndexSize;
+  hdr->root[1 - curr].shadowIndex     = hdr->root[curr].index;
+  hdr->root[1 - curr].shadowIndexSize = hdr->root[curr].indexSize;
+
+  dbFile out;
+  int    rc   = out.open(path, dbFile::truncate);
+  offs_t size = DOALIGN(hdr->root[curr].size, dbPageSize);
+  for (pos = 0; rc == dbFile::ok && pos < size; pos += n) {
+    n  = size - pos < bufSize ? length_t(size - pos) : bufSize;
+    rc = in->read(pos, buf, n);
+    if (rc == dbFile::ok) {
+      if (pos == 0) { memcpy(buf, hdr, dbPageSize); }
+      rc = out.write(pos, buf, n);
+    }
+  }
+  size = DOALIGN(hdr->root[curr].indexUsed * sizeof(offs_t), dbPageSize);
+  for (pos = 0; rc == dbFile::ok && pos < size; pos += n) {
+    n  = size - pos < bufSize ? length_t(size - pos) : bufSize;
+    rc = in->read(hdr->root[curr].index + pos, buf, n);
+    if (rc == dbFile::ok) {
+      rc = out.write(hdr->root[curr].shadowIndex + pos, buf, n);
+    }
+  }
+  if (rc == dbFile::ok) { rc = out.flush(); }
+  out.close();
+  dbFile::deallocateBuffer(buf, bufSize);
+  dbFile::deallocateBuffer(hdr, dbPageSize);
+  snapshot->close();
+  snapshot->release();
+  if (rc != dbFile::ok) {
+    handleError(dybase_file_error, "Failed to write backup file");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Sink which stores enumerated objects in the new database with the same
+ * identifiers
+ */
+class dbCopySink : public dbObjectSink {
+  dbDatabase *dst;
+  oid_t       nHandles;
+
+public:
+  void object(oid_t oid, dbObject *stored, dbObject *) {
+    dst->copyObject(oid, stored);
+  }
+
+  void index(oid_t oid, int type, int unique, int flags, dbBtreeKey *keys,
+             length_t nKeys) {
+    dst->copyIndex(oid, type, unique, flags, keys, nKeys);
+  }
+
+  void end(oid_t rootObject, oid_t classDescList, db_int4 const *visited) {
+    // handles of unreachable objects are free, the lowest is reused first
+    for (oid_t oid = nHandles; --oid >= dbFirstUserId;) {
+      if ((visited[oid >> 5] & (1 << (oid & 31))) == 0) { dst->freeId(oid); }
+    }
+    int curr = 1 - dst->curr;
+    dst->header->root[curr].rootObject    = rootObject;
+    dst->header->root[curr].classDescList = classDescList;
+  }
+
+  /**
+   * @param dst new database which index is at least nHandles long
+   * @param nHandles number of handles in the copied database
+   */
+  dbCopySink(dbDatabase *dst, oid_t nHandles) : dst(dst), nHandles(nHandles) {
+    dst->setDirty();
+    dst->currIndexSize                         = nHandles;
+    dst->header->root[1 - dst->curr].indexUsed = nHandles;
+  }
+};
+
+bool dbDatabase::compact(char const *path) {
+  dbDatabase *snapshot = openSnapshot(path);
+  if (snapshot == NULL) { return false; }
+  bool        done = false;
+  dbDatabase *dst  = new dbDatabase(
+      dbAllAccess, errorHandler, dbDefaultPagePoolSize / dbPageSize,
+      extensionQuantum, snapshot->currIndexSize);
+  if (dst->open(path, dbFile::truncate | dbFile::no_buffering)) {
+    try {
+      dbCopySink sink(dst, oid_t(snapshot->currIndexSize));
+      snapshot->enumerateReachableObjects(sink);
+      dst->close();
+      done = true;
+    } catch (dbException &) {
+      try {
+        dst->close();
+      } catch (dbException &) {}
+    }
+  }
+  dst->release();
+  snapshot->close();
+  snapshot->release();
+  return done;
+}
+
+void dbDatabase::copyObject(oid_t oid, dbObject *obj) {
+  offs_t pos = allocate(obj->size);
+  setPos(oid, pos | dbModifiedFlag);
+  pool.put(pos, (byte *)obj, obj->size);
+}
+
+void dbDatabase::copyIndex(oid_t treeId, int type, int unique, int flags,
+                           dbBtreeKey *keys, length_t nKeys) {
+  dbBtree tree;
+  memset(&tree, 0, sizeof(dbBtree));
+  tree.cid    = dbBtreeId;
+  tree.size   = sizeof(dbBtree);
+  tree.type   = type;
+  tree.unique = unique;
+  tree.flags  = flags;
+  tree.magic  = dbBtreeMagic;
+  copyObject(treeId, &tree);
+  dbBtree::bulkLoad(this, treeId, type, keys, nKeys, 100);
+}
+
+/**
+ * Find the next reference in the fields of the stored object. Elements of
+ * arrays and maps follow their headers, so they are scanned as fields.
+ * @return position of the reference or NULL if there are no more of them
+ */
+static byte *nextReference(byte *p, byte *end) {
+  db_int4 len;
+  while (p < end) {
+    int type = *p++;
+    switch (type & 0xF) {
+    case dybase_object_ref_type:
+    case dybase_array_ref_type:
+    case dybase_index_ref_type:
+    case dybase_map_ref_type:
+    case dybase_set_ref_type: return p;
+    case dybase_bool_type: p += 1; break;
+    case dybase_int_type: p += sizeof(db_int4); break;
+    case dybase_date_type:
+    case dybase_long_type:
+    case dybase_real_type: p += sizeof(db_int8); break;
+    case dybase_chars_type:
+    case dybase_bytes_type:
+    case dybase_typed_array_type:
+      if ((type & 0xF) != type) {
+        // small string or blob
+        p += type >> 4;
+      } else {
+        memcpy(&len, p, sizeof(db_int4));
+        p += sizeof(db_int4) + len;
+      }
+      break;
+    case dybase_array_type:
+    case dybase_map_type:
+      if ((type & 0xF) == type) { p += sizeof(db_int4); }
+    }
+  }
+  return NULL;
+}
+
+void dbDatabase::enumerateReachableObjects(dbObjectSink &sink) {
+  oid_t           nHandles = oid_t(currIndexSize);
+  length_t        mapSize  = length_t(nHandles / 32 + 1);
+  db_int4 *       visited  = new db_int4[mapSize];
+  dbBuffer<oid_t> queue;
+  dbGetTie        tie;
+  oid_t           oid, ref;
+
+  memset(visited, 0, mapSize * sizeof(db_int4));
+  // class descriptors are not referenced by objects
+  for (oid = header->root[curr].classDescList; oid != 0;) {
+    dbClass *cls = (dbClass *)getObject(tie, oid);
+    visited[oid >> 5] |= 1 << (oid & 31);
+    sink.object(oid, cls, cls);
+    oid = cls->next;
+  }
+  oid = header->root[curr].rootObject;
+  if (oid != 0) {
+    visited[oid >> 5] |= 1 << (oid & 31);
+    queue.add(oid);
+  }
+  // breadth first order places objects next to the objects referenced by
+  // the same object
+  for (length_t i = 0; i < queue.size(); i++) {
+    oid           = queue.base()[i];
+    dbObject *obj = getObject(tie, oid);
+    if (obj->cid == dbBtreeId) {
+      enumerateIndex(sink, oid, queue, visited);
+      continue;
+    }
+    dbSmallBuffer<byte, 256> buf;
+    dbObject *body = unpackObject(obj, buf);
+    sink.object(oid, obj, body);
+    byte *p   = (byte *)(body + 1);
+    byte *end = (byte *)body + body->size;
+    while ((p = nextReference(p, end)) != NULL) {
+      memcpy(&ref, p, sizeof(oid_t));
+      p += sizeof(oid_t);
+      if (ref != 0 && ref < nHandles &&
+          (visited[ref >> 5] & (1 << (ref & 31))) == 0 &&
+          (getPos(ref) & (dbFreeHandleFlag | dbPageObjectFlag)) == 0) {
+        visited[ref >> 5] |= 1 << (ref & 31);
+        queue.add(ref);
+      }
+    }
+  }
+  sink.end(header->root[curr].rootObject, header->root[curr].classDescList,
+           visited);
+  delete[] visited;
+}
+
+void dbDatabase::enumerateIndex(dbObjectSink &sink, oid_t treeId,
+                                dbBuffer<oid_t> &queue, db_int4 *visited) {
+  dbGetTie tie;
+  dbBtree *tree   = (dbBtree *)getObject(tie, treeId);
+  int      type   = tree->type;
+  int      unique = tree->unique;
+  int      flags  = tree->getFlags();
+
+  dbBuffer<dbBtreeKey> keys;
+  dbBuffer<char>       keyData;
+  dbBtreeIterator      iterator(this, treeId, type, NULL, 0, 0, NULL, 0, 0,
+                                true);
+  void *               key;
+  length_t             keyLength;
+  oid_t                oid;
+  while ((oid = iterator.next(key, keyLength)) != 0) {
+    dbBtreeKey *k = keys.append(1);
+    k->key        = (void *)(size_t)keyData.size(); // offset until the end
+    k->keySize    = keyLength;
+    k->oid        = oid;
+    memcpy(keyData.append(int(keyLength)), key, keyLength);
+    if ((visited[oid >> 5] & (1 << (oid & 31))) == 0) {
+      visited[oid >> 5] |= 1 << (oid & 31);
+      queue.add(oid);
+    }
+  }
+  length_t n = keys.size();
+  for (length_t i = 0; i < n; i++) {
+    keys.base()[i].key = keyData.base() + (size_t)keys.base()[i].key;
+  }
+  sink.index(treeId, type, unique, flags, keys.base(), n);
+}
+
+/**
+ * Dump written by exportObjects() starts with magic, version, number of
+ * identifiers reserved by the format (dbFirstUserId) and number of handles.
+ * It is followed by the records of objects tagged by dbDumpTag and the end
+ * record. Identifiers are stored as db_nat8, other values in native byte
+ * order.
+ */
+const db_nat4 dbDumpMagic   = 0x504D5944; // "DYMP"
+const db_nat4 dbDumpVersion = 1;
+
+enum dbDumpTag {
+  dbDumpClass  = 'C', // oid, next, size of signature, signature
+  dbDumpObject = 'O', // oid, cid, size of body, body
+  dbDumpIndex  = 'I', // oid, type, unique, flags, number of keys, keys
+                      // (size, key, oid)
+  dbDumpEnd    = 'E'  // root object, list of class descriptors
+};
+
+static db_nat8 loadReference(byte *p, length_t size) {
+  if (size == sizeof(db_nat4)) {
+    db_nat4 oid;
+    memcpy(&oid, p, sizeof(oid));
+    return oid;
+  }
+  db_nat8 oid;
+  memcpy(&oid, p, sizeof(oid));
+  return oid;
+}
+
+/**
+ * Append fields of the object body to the buffer changing size of the
+ * references and shifting them by delta
+ * @return false if reference doesn't fit in the new size
+ */
+static bool convertReferences(byte *p, byte *end, length_t srcSize,
+                              length_t dstSize, db_int8 delta,
+                              dbBuffer<byte> &buf) {
+  byte *ref;
+  while ((ref = nextReference(p, end)) != NULL) {
+    memcpy(buf.append(int(ref - p)), p, ref - p);
+    db_nat8 oid = loadReference(ref, srcSize);
+    if (oid != 0) { oid += delta; }
+    if (dstSize == sizeof(db_nat4)) {
+      if (oid > 0xFFFFFFFF) { return false; }
+      db_nat4 oid4 = db_nat4(oid);
+      memcpy(buf.append(sizeof(oid4)), &oid4, sizeof(oid4));
+    } else {
+      memcpy(buf.append(sizeof(oid)), &oid, sizeof(oid));
+    }
+    p = ref + srcSize;
+  }
+  memcpy(buf.append(int(end - p)), p, end - p);
+  return true;
+}
+
+/**
+ * Sink which writes enumerated objects to the dump
+ */
+class dbDumpSink : public dbObjectSink {
+  FILE *         f;
+  dbBuffer<byte> buf;
+
+public:
+  bool ok;
+
+  void write(void const *data, size_t size) {
+    if (ok && size != 0 && fwrite(data, size, 1, f) != 1) { ok = false; }
+  }
+  void write1(int val) {
+    if (ok && putc(val, f) == EOF) { ok = false; }
+  }
+  void write4(db_nat4 val) { write(&val, sizeof(val)); }
+  void write8(db_nat8 val) { write(&val, sizeof(val)); }
+
+  void object(oid_t oid, dbObject *, dbObject *body) {
+    if (body->cid == dbClassDescId) {
+      dbClass *cls = (dbClass *)body;
+      write1(dbDumpClass);
+      write8(oid);
+      write8(cls->next);
+      write4(db_nat4(cls->getSignatureSize()));
+      write(cls->signature, cls->getSignatureSize());
+    } else {
+      buf.truncate(0);
+      convertReferences((byte *)(body + 1), (byte *)body + body->size,
+                        sizeof(oid_t), sizeof(db_nat8), 0, buf);
+      write1(dbDumpObject);
+      write8(oid);
+      write8(body->cid);
+      write4(db_nat4(buf.size()));
+      write(buf.base(), buf.size());
+    }
+  }
+
+  void index(oid_t oid, int type, int unique, int flags, dbBtreeKey *keys,
+             length_t nKeys) {
+    write1(dbDumpIndex);
+    write8(oid);
+    write4(type);
+    write4(unique);
+    write4(flags);
+    write8(nKeys);
+    for (length_t i = 0; i < nKeys; i++) {
+      write4(db_nat4(keys[i].keySize));
+      write(keys[i].key, keys[i].keySize);
+      write8(keys[i].oid);
+    }
+  }
+
+  void end(oid_t rootObject, oid_t classDescList, db_int4 const *) {
+    write1(dbDumpEnd);
+    write8(rootObject);
+    write8(classDescList);
+  }
+
+  dbDumpSink(FILE *f) : f(f), ok(true) {}
+};
+
+bool dbDatabase::exportObjects(char const *path) {
+  dbDatabase *snapshot = openSnapshot(path);
+  if (snapshot == NULL) { return false; }
+  bool  done = false;
+  FILE *f    = fopen(path, "wb");
+  if (f != NULL) {
+    dbDumpSink sink(f);
+    sink.write4(dbDumpMagic);
+    sink.write4(dbDumpVersion);
+    sink.write8(dbFirstUserId);
+    sink.write8(snapshot->currIndexSize);
+    try {
+      snapshot->enumerateReachableObjects(sink);
+      done = sink.ok;
+    } catch (dbException &) {}
+    if (fclose(f) != 0) { done = false; }
+  }
+  snapshot->close();
+  snapshot->release();
+  if (!done) { handleError(dybase_file_error, "Failed to write dump file"); }
+  return done;
+}
+
+static void dumpError(dbDatabase *db, char const *msg) {
+  db->handleError(dybase_file_error, msg);
+  throw dbException(dybase_file_error, msg);
+}
+
+static void readDump(dbDatabase *db, FILE *f, void *buf, size_t size) {
+  if (size != 0 && fread(buf, size, 1, f) != 1) {
+    dumpError(db, "Dump file is truncated");
+  }
+}
+
+static db_nat8 readDump8(dbDatabase *db, FILE *f) {
+  db_nat8 val;
+  readDump(db, f, &val, sizeof(val));
+  return val;
+}
+
+static db_nat4 readDump4(dbDatabase *db, FILE *f) {
+  db_nat4 val;
+  readDump(db, f, &val, sizeof(val));
+  return val;
+}
+
+bool dbDatabase::importObjects(char const *dumpPath, char const *path,
+                               dbErrorHandler hnd) {
+  FILE *      f        = fopen(dumpPath, "rb");
+  char const *error    = NULL;
+  db_nat4     magic    = 0;
+  db_nat4     version  = 0;
+  db_nat8     firstId  = 0;
+  db_nat8     nHandles = 0;
+  if (f == NULL) {
+    error = "Failed to open dump file";
+  } else if (fread(&magic, sizeof(magic), 1, f) != 1 ||
+             fread(&version, sizeof(version), 1, f) != 1 ||
+             fread(&firstId, sizeof(firstId), 1, f) != 1 ||
+             fread(&nHandles, sizeof(nHandles), 1, f) != 1 ||
+             magic != dbDumpMagic || version != dbDumpVersion ||
+             nHandles < firstId) {
+    error = "Invalid dump file";
+  }
+  // identifiers of user objects follow identifiers of bitmap pages
+  db_int8 delta = db_int8(dbFirstUserId) - db_int8(firstId);
+  nHandles += delta;
+  if (error == NULL && nHandles > (db_nat8)(offs_t(~0) >> dbFlagsBits)) {
+    error = "Too many objects for the size of object identifiers";
+  }
+  dbDatabase *dst = new dbDatabase(
+      dbAllAccess, hnd, dbDefaultPagePoolSize / dbPageSize,
+      dbDefaultExtensionQuantum,
+      error == NULL ? length_t(nHandles) : dbDefaultInitIndexSize);
+  bool done = false;
+  if (error != NULL) {
+    dst->handleError(dybase_open_error, error);
+  } else if (dst->open(path, dbFile::truncate | dbFile::no_buffering)) {
+    length_t mapSize = length_t(nHandles / 32 + 1);
+    db_int4 *visited = new db_int4[mapSize];
+    memset(visited, 0, mapSize * sizeof(db_int4));
+    try {
+      dbCopySink           sink(dst, oid_t(nHandles));
+      dbBuffer<byte>       body;
+      dbBuffer<byte>       buf;
+      dbBuffer<dbBtreeKey> keys;
+      dbBuffer<char>       keyData;
+      int                  tag;
+      while ((tag = getc(f)) != dbDumpEnd) {
+        db_nat8 id = readDump8(dst, f) + delta;
+        if (id >= nHandles) {
+          dumpError(dst, "Dump file is corrupted");
+        }
+        oid_t oid = oid_t(id);
+        visited[oid >> 5] |= 1 << (oid & 31);
+        if (tag == dbDumpClass || tag == dbDumpObject) {
+          db_nat8 ref  = readDump8(dst, f);
+          db_nat4 size = readDump4(dst, f);
+          body.truncate(0);
+          readDump(dst, f, body.append(int(size)), size);
+          buf.truncate(0);
+          buf.append(sizeof(dbObject));
+          if (ref != 0) { ref += delta; }
+          if (tag == dbDumpClass) {
+            oid_t next = oid_t(ref);
+            memcpy(buf.append(sizeof(oid_t)), &next, sizeof(oid_t));
+            memcpy(buf.append(int(size)), body.base(), size);
+          } else if (!convertReferences(body.base(), body.base() + size,
+                                        sizeof(db_nat8), sizeof(oid_t),
+                                        delta, buf)) {
+            dumpError(dst, "Too many objects for the size of object "
+                           "identifiers");
+          }
+          dbObject *obj = (dbObject *)buf.base();
+          obj->cid      = tag == dbDumpClass ? oid_t(dbClassDescId) : oid_t(ref);
+          obj->size     = db_nat4(buf.size());
+          sink.object(oid, obj, obj);
+        } else if (tag == dbDumpIndex) {
+          int     type   = int(readDump4(dst, f));
+          int     unique = int(readDump4(dst, f));
+          int     flags  = int(readDump4(dst, f));
+          db_nat8 nKeys  = readDump8(dst, f);
+          keys.truncate(0);
+          keyData.truncate(0);
+          for (db_nat8 i = 0; i < nKeys; i++) {
+            dbBtreeKey *k = keys.append(1);
+            k->keySize    = readDump4(dst, f);
+            k->key        = (void *)(size_t)keyData.size();
+            readDump(dst, f, keyData.append(int(k->keySize)), k->keySize);
+            k->oid = oid_t(readDump8(dst, f) + delta);
+          }
+          for (length_t i = 0; i < keys.size(); i++) {
+            keys.base()[i].key = keyData.base() + (size_t)keys.base()[i].key;
+          }
+          sink.index(oid, type, unique, flags, keys.base(), keys.size());
+        } else {
+          dumpError(dst, tag == EOF ? "Dump file is truncated"
+                                    : "Dump file is corrupted");
+        }
+      }
+      db_nat8 rootObject    = readDump8(dst, f);
+      db_nat8 classDescList = readDump8(dst, f);
+      sink.end(rootObject != 0 ? oid_t(rootObject + delta) : 0,
+               classDescList != 0 ? oid_t(classDescList + delta) : 0,
+               visited);
+      dst->close();
+      done = true;
+    } catch (dbException &) {
+      try {
+        dst->close();
+      } catch (dbException &) {}
+    }
+    delete[] visited;
+  }
+  if (f != NULL) { fclose(f); }
+  dst->release();
+  return done;
+}
+
+bool dbDatabase::recoverLog() {
+  dbWriteAheadLog wal;
+  if (wal.open(logName, true) != dbFile::ok) {
+    return true; // there is no log
+  }
+  if (accessType != dbReadOnly) {
+    wal.close();
+    if (wal.open(logName, false) != dbFile::ok) { return false; }
+  }
+  bool recovered = wal.recover(file, accessType == dbReadOnly);
+  wal.close();
+  if (recovered && accessType != dbReadOnly) { ::remove(logName); }
+  return recovered;
+}
+
+void dbDatabase::checkpoint() {
+  dbCriticalSection cs(mutex);
+  if (!opened) {
+    handleError(dybase_not_opened, "Database not opened");
+    return;
+  }
+  if (log != NULL) { checkpointLog(); }
+}
+
+void dbDatabase::checkpointLog() {
+  pool.flush();
+  if (file->write(0, header, dbPageSize) != dbFile::ok ||
+      file->flush() != dbFile::ok) {
+    throwException(dybase_file_error, "Failed to write header to the disk");
+  }
+  if (log->truncate() != dbFile::ok) {
+    throwException(dybase_file_error, "Failed to truncate log");
+  }
+}
+
 void dbDatabase::loadScheme() {
   dbGetTie            tie;
   dbClassDescriptor **cpp = &classDescList;
-  int                 cid = header->root[1 - curr].classDescList;
+  oid_t               cid = header->root[1 - curr].classDescList;
   while (cid != 0) {
     dbClass *          cls  = ((dbClass *)getObject(tie, cid))->clone();
     dbClassDescriptor *desc = new dbClassDescriptor(cls, cid);
@@ -334,12 +1089,27 @@ void dbDatabase::loadScheme() {
 }
 
 void dbDatabase::close() {
+  if (fileName != NULL) {
+    // no more snapshots can be taken
+    dbCriticalSection chain(openedMutex);
+    dbDatabase **       dpp = &openedChain;
+    while (*dpp != NULL && *dpp != this) {
+      dpp = &(*dpp)->nextOpened;
+    }
+    if (*dpp != NULL) { *dpp = nextOpened; }
+  }
   dbCriticalSection cs(mutex);
   if (!opened) {
     handleError(dybase_not_opened, "Database not opened");
     return;
   }
+  if (source != NULL) {
+    closeSnapshot();
+    return;
+  }
+  releaseRetainedSpace();
   if (modified) { commitTransaction(); }
+  stopIncrementalGC();
   dbClassDescriptor *desc, *next;
   for (desc = classDescList; desc != NULL; desc = next) {
     next = desc->next;
@@ -350,6 +1120,22 @@ void dbDatabase::close() {
   classSignatureHash.clear();
 
   opened = false;
+  if (snapshots != NULL) {
+    closePending = true;
+    return;
+  }
+  closeFile();
+}
+
+void dbDatabase::closeFile() {
+  closePending = false;
+  if (retainedSpace.size() != 0) {
+    // snapshots which used this space were closed after the database
+    opened = true;
+    releaseRetainedSpace();
+    commitTransaction();
+    opened = false;
+  }
   if (header->dirty) {
     int rc = file->write(0, header, dbPageSize);
     if (rc != dbFile::ok) {
@@ -362,6 +1148,13 @@ void dbDatabase::close() {
       throwException(dybase_file_error, "Failed to write header to the disk");
     }
   }
+  if (log != NULL) {
+    // all committed pages are in the database file now
+    log->close();
+    delete log;
+    log = NULL;
+    ::remove(logName);
+  }
   pool.close();
   file->close();
   delete file;
@@ -402,6 +1195,7 @@ oid_t dbDatabase::getRoot() { return header->root[1 - curr].rootObject; }
 void dbDatabase::setRoot(oid_t oid) {
   header->root[1 - curr].rootObject = oid;
   modified                          = true;
+  shadeOid(oid);
 }
 
 dbLoadHandle *dbDatabase::getLoadHandle(oid_t oid) {
@@ -411,7 +1205,7 @@ dbLoadHandle *dbDatabase::getLoadHandle(oid_t oid) {
     return NULL;
   }
   dbLoadHandle *hnd = new dbLoadHandle();
-  dbObject *    obj = getObject(hnd->tie, oid);
+  dbObject *    obj = unpackObject(getObject(hnd->tie, oid), hnd->unpacked);
   hnd->curr         = (byte *)(obj + 1);
   hnd->end          = (byte *)obj + obj->size;
   hnd->desc =
@@ -422,6 +1216,35 @@ dbLoadHandle *dbDatabase::getLoadHandle(oid_t oid) {
   return hnd;
 }
 
+static int __cdecl compareOffsets(void const *a, void const *b) {
+  offs_t x = *(offs_t *)a, y = *(offs_t *)b;
+  return x < y ? -1 : x == y ? 0 : 1;
+}
+
+void dbDatabase::prefetch(oid_t const *oids, length_t nOids) {
+  dbCriticalSection cs(mutex);
+  if (!opened) {
+    handleError(dybase_not_opened, "Database not opened");
+    return;
+  }
+  dbSmallBuffer<offs_t, 256> buf;
+  offs_t *                   addrs = buf.append(int(nOids));
+  length_t                   n     = 0;
+  oid_t                      used  = header->root[1 - curr].indexUsed;
+  for (length_t i = 0; i < nOids; i++) {
+    if (oids[i] == 0 || oids[i] >= used) { continue; }
+    offs_t pos = getPos(oids[i]);
+    if (pos & dbFreeHandleFlag) { continue; }
+    addrs[n++] = (pos & ~dbFlagsMask) & ~offs_t(dbPageSize - 1);
+  }
+  qsort(addrs, n, sizeof(offs_t), compareOffsets);
+  length_t m = 0;
+  for (length_t i = 0; i < n; i++) {
+    if (m == 0 || addrs[m - 1] != addrs[i]) { addrs[m++] = addrs[i]; }
+  }
+  pool.prefetch(addrs, m, readAhead);
+}
+
 void dbDatabase::storeObject(dbStoreHandle *handle) {
   dbCriticalSection cs(mutex);
   if (!opened) {
@@ -442,8 +1265,27 @@ void dbDatabase::storeObject(dbStoreHandle *handle) {
     desc->next    = classDescList;
     classDescList = desc;
   }
-  obj->size  = handle->body.size();
-  obj->cid   = desc->oid;
+  obj->size = handle->body.size();
+  obj->cid  = desc->oid;
+  dbObject *               body = obj;
+  dbSmallBuffer<byte, 256> packed;
+  if (compressObjects && obj->size - sizeof(dbObject) >= dbCompressionThreshold) {
+    length_t bodySize = obj->size - sizeof(dbObject);
+    // compressed object should take less allocation quanta
+    length_t maxSize =
+        DOALIGN(obj->size, dbAllocationQuantum) - dbAllocationQuantum;
+    byte *   dst = packed.append(int(maxSize));
+    length_t size =
+        dbCompress((byte *)(obj + 1), bodySize, dst + sizeof(dbObject) + 4,
+                   maxSize - sizeof(dbObject) - 4);
+    if (size != 0) {
+      dbObject *hdr = (dbObject *)dst;
+      hdr->cid      = desc->oid | dbCompressedObjectFlag;
+      hdr->size     = db_nat4(sizeof(dbObject) + 4 + size);
+      memcpy(hdr + 1, &bodySize, 4);
+      obj = hdr;
+    }
+  }
   oid_t  oid = handle->oid;
   offs_t pos = getPos(oid);
   if (pos == 0) {
@@ -472,6 +1314,11 @@ void dbDatabase::storeObject(dbStoreHandle *handle) {
     }
   }
   pool.put(pos & ~dbFlagsMask, (byte *)obj, obj->size);
+  if (gcPhase == dbGcMark) {
+    // references of the new version were not seen by the collector
+    shadeOid(body->cid);
+    markObject(body, true);
+  }
 }
 
 oid_t dbDatabase::allocateObject(dbObject *obj) {
@@ -610,7 +1457,8 @@ offs_t dbDatabase::allocate(length_t size, oid_t oid) {
   setDirty();
   size = DOALIGN(size, dbAllocationQuantum);
   allocatedDelta += size;
-  if (gcThreshold != 0 && allocatedDelta > gcThreshold && !gcDone) {
+  if (gcThreshold != 0 && allocatedDelta > gcThreshold && !gcDone &&
+      gcStepSize == 0) {
     startGC();
   }
 
@@ -901,7 +1749,7 @@ offs_t dbDatabase::allocate(length_t size, oid_t oid) {
       }
       return pos;
     }
-    if (gcThreshold != 0 && !gcDone) {
+    if (gcThreshold != 0 && !gcDone && gcStepSize == 0) {
       allocatedDelta -= size;
       startGC();
       currRBitmapPage = currPBitmapPage = dbBitmapId;
@@ -964,22 +1812,25 @@ void dbDatabase::free(offs_t pos, length_t size) {
 void dbDatabase::gc() {
   dbCriticalSection cs(mutex);
   if (gcDone) { return; }
+  stopIncrementalGC();
   startGC();
 }
 
 void dbDatabase::startGC() {
-  int bitmapSize =
-      (int)(header->root[curr].size >> (dbAllocationQuantumBits + 5)) + 1;
+  // the bitmaps are indexed by allocation quantum, which can exceed 32 bits
+  // when dbDatabaseOffsetBits > 32
+  offs_t bitmapSize =
+      (header->root[curr].size >> (dbAllocationQuantumBits + 5)) + 1;
   bool   existsNotMarkedObjects;
-  offs_t pos;
-  int    i, j;
+  offs_t pos, i;
+  int    j;
 
   // mark
   greyBitmap  = new db_int4[bitmapSize];
   blackBitmap = new db_int4[bitmapSize];
   memset(greyBitmap, 0, bitmapSize * sizeof(db_int4));
   memset(blackBitmap, 0, bitmapSize * sizeof(db_int4));
-  int rootOid = header->root[curr].rootObject;
+  oid_t rootOid = header->root[curr].rootObject;
   if (rootOid != 0) {
     dbGetTie tie;
     markOid(rootOid);
@@ -999,9 +1850,11 @@ void dbDatabase::startGC() {
               if (obj->cid == dbBtreeId) {
                 ((dbBtree *)obj)->markTree(this);
               } else if (obj->cid >= dbFirstUserId) {
-                markOid(obj->cid);
+                dbSmallBuffer<byte, 256> buf;
                 tie.set(pool, pos);
-                markObject((dbObject *)tie.get());
+                obj = unpackObject((dbObject *)tie.get(), buf);
+                markOid(obj->cid);
+                markObject(obj);
               }
               pool.unfix(pg);
             }
@@ -1013,20 +1866,20 @@ void dbDatabase::startGC() {
 
   // sweep
   gcDone = true;
-  for (i = dbFirstUserId, j = committedIndexSize; i < j; i++) {
-    pos = getGCPos(i);
+  for (oid_t oid = dbFirstUserId, n = committedIndexSize; oid < n; oid++) {
+    pos = getGCPos(oid);
     if (((int)pos & (dbPageObjectFlag | dbFreeHandleFlag)) == 0) {
-      unsigned bit = (unsigned)(pos >> dbAllocationQuantumBits);
+      offs_t bit = pos >> dbAllocationQuantumBits;
       if ((blackBitmap[bit >> 5] & (1 << (bit & 31))) == 0) {
         // object is not accessible
-        assert(getPos(i) == pos);
+        assert(getPos(oid) == pos);
         int       offs = (int)pos & (dbPageSize - 1);
         byte *    pg   = pool.get(pos - offs);
         dbObject *obj  = (dbObject *)(pg + offs);
         if (obj->cid == dbBtreeId) {
-          dbBtree::_drop(this, i);
+          dbBtree::_drop(this, oid);
         } else if (obj->cid >= dbFirstUserId) {
-          freeId(i);
+          freeId(oid);
           cloneBitmap(pos, obj->size);
         }
         pool.unfix(pg);
@@ -1039,15 +1892,214 @@ void dbDatabase::startGC() {
   allocatedDelta = 0;
 }
 
-void dbDatabase::markObject(dbObject *obj) {
+bool dbDatabase::gcStep(long maxWork) {
+  dbCriticalSection cs(mutex);
+  if (!opened) {
+    handleError(dybase_not_opened, "Database not opened");
+    return false;
+  }
+  return doIncrementalGC(maxWork);
+}
+
+void dbDatabase::getGcStatistic(dybase_gc_stats_t &stats) {
+  dbCriticalSection cs(mutex);
+  stats.phase   = gcPhase;
+  stats.cycles  = gcCycles;
+  stats.steps   = gcSteps;
+  stats.marked  = gcMarked;
+  stats.freed   = gcFreed;
+  stats.pending = gcPhase == dbGcMark    ? long(gcGreyCount)
+                  : gcPhase == dbGcSweep ? long(gcMapSize - gcCursor)
+                                         : 0;
+}
+
+void dbDatabase::startIncrementalGC() {
+  // handles allocated after this point are implicitly black
+  gcMapSize      = currIndexSize;
+  length_t words = (gcMapSize + 31) >> 5;
+  greyOids       = new db_int4[words];
+  blackOids      = new db_int4[words];
+  gcTreeKey      = new char[dbBtreePage::dbMaxKeyLen];
+  memset(greyOids, 0, words * sizeof(db_int4));
+  memset(blackOids, 0, words * sizeof(db_int4));
+  gcGreyCount = 0;
+  gcCursor    = 0;
+  gcTree      = 0;
+  gcMarked = gcFreed = 0;
+  gcPhase            = dbGcMark;
+  shadeOid(header->root[1 - curr].rootObject);
+}
+
+void dbDatabase::stopIncrementalGC() {
+  if (gcPhase != dbGcIdle) {
+    delete[] greyOids;
+    delete[] blackOids;
+    delete[] gcTreeKey;
+    greyOids  = NULL;
+    blackOids = NULL;
+    gcTreeKey = NULL;
+    gcPhase   = dbGcIdle;
+  }
+}
+
+bool dbDatabase::doIncrementalGC(long maxWork) {
+  if (gcPhase == dbGcIdle) { startIncrementalGC(); }
+  gcSteps += 1;
+  long work = 0;
+  while (gcPhase == dbGcMark && (maxWork <= 0 || work < maxWork)) {
+    if (gcTree != 0) {
+      work += markTreeEntries(maxWork <= 0 ? 0 : maxWork - work);
+    } else if (gcGreyCount == 0) {
+      gcPhase  = dbGcSweep;
+      gcCursor = dbFirstUserId;
+    } else {
+      if (gcCursor >= gcMapSize) { gcCursor = 0; }
+      db_int4 bits = greyOids[gcCursor >> 5] >> (gcCursor & 31);
+      if (bits == 0) {
+        // skip the rest of the word, scan of 32 words costs one unit
+        gcCursor = (gcCursor | 31) + 1;
+        if ((gcCursor & (32 * 32 - 1)) == 0) { work += 1; }
+        continue;
+      }
+      while (!(bits & 1)) {
+        bits >>= 1;
+        gcCursor += 1;
+      }
+      oid_t oid = oid_t(gcCursor++);
+      greyOids[oid >> 5] &= ~(1 << (oid & 31));
+      blackOids[oid >> 5] |= 1 << (oid & 31);
+      gcGreyCount -= 1;
+      gcMarked += 1;
+      scanObject(oid);
+      work += 1;
+    }
+  }
+  while (gcPhase == dbGcSweep && (maxWork <= 0 || work < maxWork)) {
+    if (gcCursor >= gcMapSize) {
+      stopIncrementalGC();
+      gcCycles += 1;
+      allocatedDelta = 0;
+      return true;
+    }
+    oid_t oid = oid_t(gcCursor++);
+    if (!(blackOids[oid >> 5] & (1 << (oid & 31))) && sweepObject(oid)) {
+      gcFreed += 1;
+    }
+    work += 1;
+  }
+  return false;
+}
+
+void dbDatabase::scanObject(oid_t oid) {
+  offs_t pos = getPos(oid);
+  if (pos == 0 || (pos & (dbFreeHandleFlag | dbPageObjectFlag))) { return; }
+  dbGetTie  tie;
+  dbObject *obj = getObject(tie, oid);
+  if (obj->cid == dbBtreeId) {
+    // entries are marked by the following steps
+    gcTree        = oid;
+    gcTreeStarted = false;
+  } else if (obj->cid >= dbFirstUserId) {
+    dbSmallBuffer<byte, 256> buf;
+    obj = unpackObject(obj, buf);
+    shadeOid(obj->cid);
+    markObject(obj, true);
+  }
+}
+
+long dbDatabase::markTreeEntries(long maxWork) {
+  offs_t pos = getPos(gcTree);
+  if (pos == 0 || (pos & (dbFreeHandleFlag | dbPageObjectFlag))) {
+    gcTree = 0; // index was dropped
+    return 1;
+  }
+  int type;
+  {
+    dbGetTie  tie;
+    dbBtree * tree = (dbBtree *)getObject(tie, gcTree);
+    if (tree->cid != dbBtreeId) {
+      gcTree = 0;
+      return 1;
+    }
+    type = tree->type;
+  }
+  // marking is resumed from the last visited key, so it is not affected by
+  // modifications of the tree done between steps
+  dbBtreeIterator it(this, gcTree, type, gcTreeStarted ? gcTreeKey : NULL,
+                     gcTreeKeyLength, 1, NULL, 0, 0, true);
+  long work = 0;
+  while (true) {
+    void *   key;
+    length_t keyLength;
+    oid_t    oid = it.next(key, keyLength);
+    if (oid == 0) {
+      gcTree = 0;
+      break;
+    }
+    shadeOid(oid);
+    work += 1;
+    // step is finished only after progress beyond the resume key, so long
+    // runs of duplicates can make it longer than requested
+    if (maxWork > 0 && work >= maxWork &&
+        (!gcTreeStarted || keyLength != gcTreeKeyLength ||
+         memcmp(key, gcTreeKey, keyLength) != 0)) {
+      memcpy(gcTreeKey, key, keyLength);
+      gcTreeKeyLength = keyLength;
+      gcTreeStarted   = true;
+      break;
+    }
+  }
+  return work;
+}
+
+bool dbDatabase::sweepObject(oid_t oid) {
+  if (oid >= committedIndexSize) { return false; }
+  offs_t pos = getGCPos(oid);
+  if (pos == 0 || ((int)pos & (dbPageObjectFlag | dbFreeHandleFlag)) != 0 ||
+      getPos(oid) != pos) {
+    // object is not committed or is changed by the current transaction
+    return false;
+  }
+  int       offs  = (int)pos & (dbPageSize - 1);
+  byte *    pg    = pool.get(pos - offs);
+  dbObject *obj   = (dbObject *)(pg + offs);
+  bool      freed = true;
+  if (obj->cid == dbBtreeId) {
+    dbBtree::_drop(this, oid);
+  } else if (obj->cid >= dbFirstUserId) {
+    freeId(oid);
+    cloneBitmap(pos, obj->size);
+  } else {
+    freed = false;
+  }
+  pool.unfix(pg);
+  return freed;
+}
+
+dbObject *dbDatabase::unpackObject(dbObject *obj,
+                                   dbSmallBuffer<byte, 256> &buf) {
+  if (!(obj->cid & dbCompressedObjectFlag)) { return obj; }
+  db_nat4 bodySize;
+  memcpy(&bodySize, obj + 1, 4);
+  dbObject *unpacked = (dbObject *)buf.append(int(sizeof(dbObject) + bodySize));
+  unpacked->cid      = obj->cid & ~dbCompressedObjectFlag;
+  unpacked->size     = db_nat4(sizeof(dbObject) + bodySize);
+  if (!dbDecompress((byte *)(obj + 1) + 4, obj->size - sizeof(dbObject) - 4,
+                    (byte *)(unpacked + 1), bodySize)) {
+    throwException(dybase_file_error, "Compressed object is corrupted");
+  }
+  return unpacked;
+}
+
+void dbDatabase::markObject(dbObject *obj, bool shade) {
   byte *p   = (byte *)(obj + 1);
   byte *end = (byte *)obj + obj->size;
   while (p < end) {
-    p = markField(p);
+    p = markField(p, shade);
   }
 }
 
-byte *dbDatabase::markField(byte *p) {
+byte *dbDatabase::markField(byte *p, bool shade) {
   int     type = *p++;
   db_int4 len;
   oid_t   oid;
@@ -1057,8 +2109,14 @@ byte *dbDatabase::markField(byte *p) {
   case dybase_object_ref_type:
   case dybase_array_ref_type:
   case dybase_index_ref_type:
+  case dybase_map_ref_type:
+  case dybase_set_ref_type:
     memcpy(&oid, p, sizeof(oid_t));
-    markOid(oid);
+    if (shade) {
+      shadeOid(oid);
+    } else {
+      markOid(oid);
+    }
     p += sizeof(oid_t);
     break;
   case dybase_bool_type: p += 1; break;
@@ -1076,7 +2134,8 @@ byte *dbDatabase::markField(byte *p) {
     }
     break;
   case dybase_bytes_type:
-    if (type != dybase_bytes_type) {
+  case dybase_typed_array_type:
+    if ((type & 0xF) != type) {
       // small blob
       p += type >> 4;
     }
@@ -1089,13 +2148,13 @@ byte *dbDatabase::markField(byte *p) {
     if (type != dybase_array_type) {
       // small array
       for (i = type >> 4; --i >= 0;) {
-        p = markField(p);
+        p = markField(p, shade);
       }
     } else {
       memcpy(&len, p, sizeof(db_int4));
       p += sizeof(db_int4);
       for (i = len; --i >= 0;) {
-        p = markField(p);
+        p = markField(p, shade);
       }
     }
     break;
@@ -1103,13 +2162,13 @@ byte *dbDatabase::markField(byte *p) {
     if (type != dybase_map_type) {
       // small map
       for (i = (type >> 4) << 1; --i >= 0;) {
-        p = markField(p);
+        p = markField(p, shade);
       }
     } else {
       memcpy(&len, p, sizeof(db_int4));
       p += sizeof(db_int4);
       for (i = len << 1; --i >= 0;) {
-        p = markField(p);
+        p = markField(p, shade);
       }
     }
   }
@@ -1177,11 +2236,21 @@ oid_t dbDatabase::allocateId() {
       header->root[curr].index     = newIndex;
       header->root[curr].indexSize = newIndexSize;
       free(oldIndex, oldIndexSize * sizeof(offs_t));
+      extendDirtyPagesMap(newIndexSize);
     }
     oid                          = currIndexSize;
     header->root[curr].indexUsed = ++currIndexSize;
   }
   setPos(oid, 0);
+  if (gcPhase != dbGcIdle && oid < gcMapSize) {
+    // handle may be reused: new object should not be swept by active cycle
+    db_int4 mask = 1 << (oid & 31);
+    if (greyOids[oid >> 5] & mask) {
+      greyOids[oid >> 5] &= ~mask;
+      gcGreyCount -= 1;
+    }
+    blackOids[oid >> 5] |= mask;
+  }
   return oid;
 }
 
@@ -1193,9 +2262,44 @@ void dbDatabase::freeId(oid_t oid) {
   header->root[1 - curr].freeList = oid;
 }
 
+void dbDatabase::extendDirtyPagesMap(length_t indexSize) {
+  length_t size = indexSize / dbHandlesPerPage / 32 + 1;
+  if (size > dirtyPagesMapSize) {
+    db_int4 *map = new db_int4[size];
+    memset(map, 0, size * sizeof(db_int4));
+    if (dirtyPagesMap != NULL) {
+      memcpy(map, dirtyPagesMap, dirtyPagesMapSize * sizeof(db_int4));
+      delete[] dirtyPagesMap;
+    }
+    dirtyPagesMap     = map;
+    dirtyPagesMapSize = size;
+  }
+}
+
 void dbDatabase::commit() {
-  dbCriticalSection cs(mutex);
-  commitTransaction();
+  db_nat8 lsn;
+  {
+    dbCriticalSection cs(mutex);
+    if (source != NULL) {
+      if (modified) {
+        handleError(dybase_file_error, "Snapshot can not be modified");
+      }
+      return;
+    }
+    if (gcStepSize != 0 && opened &&
+        (gcPhase != dbGcIdle ||
+         (gcThreshold != 0 && allocatedDelta > gcThreshold))) {
+      doIncrementalGC(gcStepSize);
+    }
+    commitTransaction();
+    if (log == NULL) { return; }
+    lsn = commitLsn;
+  }
+  // sync is done outside of the database lock to let other committers
+  // append their records and share this sync
+  if (log->sync(lsn) != dbFile::ok) {
+    throwException(dybase_file_error, "Failed to sync log");
+  }
 }
 
 void dbDatabase::commitTransaction() {
@@ -1204,6 +2308,9 @@ void dbDatabase::commitTransaction() {
     return;
   }
   if (!modified) { return; }
+  releaseRetainedSpace();
+  db_nat8 writes, bytes;
+  getWriteStatistic(writes, bytes);
   //
   // Commit transaction
   //
@@ -1235,12 +2342,12 @@ void dbDatabase::commitTransaction() {
         if (srcIndex[j] != pos) {
           if (!(pos & dbFreeHandleFlag)) {
             if (pos & dbPageObjectFlag) {
-              free(pos & ~dbFlagsMask, dbPageSize);
+              freeCommitted(pos & ~dbFlagsMask, dbPageSize);
             } else {
               int       offs = (int)pos & (dbPageSize - 1);
               dbObject *rec =
                   (dbObject *)(pool.get(pos - offs) + (offs & ~dbFlagsMask));
-              free(pos, rec->size);
+              freeCommitted(pos, rec->size);
               pool.unfix(rec);
             }
           }
@@ -1262,12 +2369,12 @@ void dbDatabase::commitTransaction() {
       if (*srcIndex != pos) {
         if (!(pos & dbFreeHandleFlag)) {
           if (pos & dbPageObjectFlag) {
-            free(pos & ~dbFlagsMask, dbPageSize);
+            freeCommitted(pos & ~dbFlagsMask, dbPageSize);
           } else {
             int       offs = (int)pos & (dbPageSize - 1);
             dbObject *rec =
                 (dbObject *)(pool.get(pos - offs) + (offs & ~dbFlagsMask));
-            free(pos, rec->size);
+            freeCommitted(pos, rec->size);
             pool.unfix(rec);
           }
         }
@@ -1307,17 +2414,32 @@ void dbDatabase::commitTransaction() {
     }
   }
 
-  if ((rc = file->write(0, header, dbPageSize)) != dbFile::ok) {
-    throwException(dybase_file_error, "Failed to write header");
-  }
+  if (log != NULL) {
+    // pages of this transaction thrown away from the pool are not in the log
+    if (pool.unloggedWrite) {
+      if (file->flush() != dbFile::ok) {
+        throwException(dybase_file_error, "Failed to flush changes to the disk");
+      }
+      pool.unloggedWrite = false;
+    }
+    header->curr = curr ^= 1;
+    pool.log(*log);
+    if (log->endRecord(header, commitLsn) != dbFile::ok) {
+      throwException(dybase_file_error, "Failed to write log record");
+    }
+  } else {
+    if ((rc = file->write(0, header, dbPageSize)) != dbFile::ok) {
+      throwException(dybase_file_error, "Failed to write header");
+    }
 
-  pool.flush();
+    pool.flush();
 
-  header->curr = curr ^= 1;
+    header->curr = curr ^= 1;
 
-  if ((rc = file->write(0, header, dbPageSize)) != dbFile::ok ||
-      (rc = file->flush()) != dbFile::ok) {
-    throwException(dybase_file_error, "Failed to flush changes to the disk");
+    if ((rc = file->write(0, header, dbPageSize)) != dbFile::ok ||
+        (rc = file->flush()) != dbFile::ok) {
+      throwException(dybase_file_error, "Failed to flush changes to the disk");
+    }
   }
 
   header->root[1 - curr].size          = header->root[curr].size;
@@ -1362,6 +2484,54 @@ void dbDatabase::commitTransaction() {
   this->committedIndexSize = currIndexSize;
   modified                 = false;
   gcDone                   = false;
+  commitSeq += 1;
+
+  if (log != NULL && log->size() >= checkpointSize) { checkpointLog(); }
+
+  db_nat8 totalWrites, totalBytes;
+  getWriteStatistic(totalWrites, totalBytes);
+  commitWrites = totalWrites - writes;
+  commitBytes  = totalBytes - bytes;
+}
+
+void dbDatabase::freeCommitted(offs_t pos, length_t size) {
+  if (snapshots != NULL) {
+    dbRetainedSpace *rs = retainedSpace.append(1);
+    rs->pos             = pos;
+    rs->size            = size;
+    rs->seq             = commitSeq + 1;
+  } else {
+    free(pos, size);
+  }
+}
+
+void dbDatabase::releaseRetainedSpace() {
+  // space freed by the transaction is visible to the snapshots taken before it
+  db_nat8 horizon = ~(db_nat8)0;
+  for (dbDatabase *s = snapshots; s != NULL; s = s->nextSnapshot) {
+    if (s->snapshotSeq < horizon) { horizon = s->snapshotSeq; }
+  }
+  dbRetainedSpace *rs = retainedSpace.base();
+  length_t         n  = retainedSpace.size(), m = 0;
+  for (length_t i = 0; i < n; i++) {
+    if (rs[i].seq <= horizon) {
+      if (m == i) { setDirty(); }
+      free(rs[i].pos, rs[i].size);
+    } else {
+      rs[m++] = rs[i];
+    }
+  }
+  retainedSpace.truncate(m);
+}
+
+void dbDatabase::getWriteStatistic(db_nat8 &writes, db_nat8 &bytes) {
+  file->getWriteStatistic(writes, bytes);
+  if (log != NULL) {
+    db_nat8 logWrites, logBytes;
+    log->getWriteStatistic(logWrites, logBytes);
+    writes += logWrites;
+    bytes += logBytes;
+  }
 }
 
 void dbDatabase::rollback() {
@@ -1370,6 +2540,8 @@ void dbDatabase::rollback() {
     handleError(dybase_not_opened, "Database not opened");
     return;
   }
+  // marking could see objects which are reverted now
+  stopIncrementalGC();
   if (!modified) { return; }
   int      curr = header->curr;
   length_t nPages =
@@ -1421,16 +2593,40 @@ dbDatabase::dbDatabase(dbAccessType type, dbErrorHandler hnd, length_t poolSize,
                        length_t dbExtensionQuantum, length_t dbInitIndexSize)
     : accessType(type), extensionQuantum(dbExtensionQuantum),
       initIndexSize(dbInitIndexSize), pool(this, poolSize), errorHandler(hnd) {
-  dirtyPagesMap            = new db_int4[dbDirtyPageBitmapSize / 4 + 1];
+  dirtyPagesMap            = NULL;
+  dirtyPagesMapSize        = 0;
+  extendDirtyPagesMap(dbFirstUserId);
   bitmapPageAvailableSpace = new int[dbBitmapId + dbBitmapPages];
   classDescList            = NULL;
   opened                   = false;
   header                   = (dbHeader *)dbFile::allocateBuffer(dbPageSize);
   dbFileExtensionQuantum   = 0;
   dbFileSizeLimit          = 0;
+  log                      = NULL;
+  logName                  = NULL;
+  checkpointSize           = 0;
+  readAhead                = false;
+  compressObjects          = false;
+  commitWrites             = 0;
+  commitBytes              = 0;
+  gcPhase                  = dbGcIdle;
+  greyOids                 = NULL;
+  blackOids                = NULL;
+  gcTreeKey                = NULL;
+  fileName                 = NULL;
+  nextOpened               = NULL;
+  nRefs                    = 1;
+  source                   = NULL;
+  snapshots                = NULL;
+  nextSnapshot             = NULL;
+  snapshotSeq              = 0;
+  commitSeq                = 0;
+  closePending             = false;
 }
 
 dbDatabase::~dbDatabase() {
+  delete[] fileName;
+  delete[] logName;
   delete[] dirtyPagesMap;
   delete[] bitmapPageAvailableSpace;
   dbFile::deallocateBuffer(header);
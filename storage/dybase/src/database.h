@@ -18,7 +18,11 @@
 #define _LARGE_FILE_API 1     // access to files greater than 2Gb in AIX
 
 #ifndef dbDatabaseOffsetBits
-#define dbDatabaseOffsetBits 32 // 37 - up to 1 terabyte
+#ifdef DYBASE_OID64
+#define dbDatabaseOffsetBits 40 // up to 1 terabyte
+#else
+#define dbDatabaseOffsetBits 32
+#endif
 #endif
 
 typedef dybase_oid_t oid_t;
@@ -42,6 +46,7 @@ typedef db_nat4 length_t;
 #include "pagepool.h"
 #include "hashtab.h"
 #include "sync.h"
+#include "wal.h"
 
 /**
  * Default size of memory mapping object for the database (bytes)
@@ -80,8 +85,6 @@ const length_t dbBitmapSegmentBits = dbPageBits + 3 + dbAllocationQuantumBits;
 const length_t dbBitmapSegmentSize = 1 << dbBitmapSegmentBits;
 const length_t dbBitmapPages       = 1
                                << (dbDatabaseOffsetBits - dbBitmapSegmentBits);
-const length_t dbDirtyPageBitmapSize =
-    1 << (dbDatabaseOidBits - dbPageBits + (1 + sizeof(offs_t) / 4) - 3);
 
 const int dbMaxFileSegments = 64;
 
@@ -111,6 +114,9 @@ enum dbPredefinedIds {
 
   dybase_long_type   = 10,
   dybase_bytes_type  = 11,  // literal blob, max length 2^32
+  dybase_typed_array_type = 12, // literal blob, the first byte is the type of elements
+  dybase_map_ref_type = 13,
+  dybase_set_ref_type = 14,
 */
 
 static const int dbSizeofType[] = {
@@ -126,6 +132,9 @@ static const int dbSizeofType[] = {
     0, // dybase_map_type
     sizeof(db_int8),  // dybase_long_type
     0,  // dybase_bytes_type
+    0,  // dybase_typed_array_type
+    sizeof(oid_t),    // dybase_map_ref_type
+    sizeof(oid_t),    // dybase_set_ref_type
 };
 
 //static const int dbFieldTypeBits = 3;
@@ -156,8 +165,19 @@ public:
 /**
  * Database header
  */
+/**
+ * Tag in the first word of the header of the files with 64-bit object
+ * identifiers. In the files with 32-bit identifiers this word is the index
+ * of the current root, so versions which know only this format report
+ * invalid root index instead of overwriting the file.
+ */
+const db_nat4 dbWideFileFormat = 0x38425944; // "DYB8"
+
 class dbHeader {
 public:
+#ifdef DYBASE_OID64
+  db_nat4 format;      // dbWideFileFormat
+#endif
   db_int4 curr;        // current root
   db_int4 dirty;       // database was not closed normally
   db_int4 initialized; // database is initilaized
@@ -175,6 +195,9 @@ public:
   } root[2];
 
   bool isInitialized() {
+#ifdef DYBASE_OID64
+    if (format != dbWideFileFormat) { return false; }
+#endif
     return initialized == 1 && (dirty == 1 || dirty == 0) &&
            (curr == 1 || curr == 0) && root[curr].size > root[curr].index &&
            root[curr].size > root[curr].shadowIndex &&
@@ -192,6 +215,18 @@ public:
   db_nat4 size;
 };
 
+/**
+ * Flag of the class identifier of the object which body is compressed. Such
+ * object header is followed by the size of the original body (db_nat4) and
+ * compressed body.
+ */
+const oid_t dbCompressedObjectFlag = (oid_t)1 << (sizeof(oid_t) * 8 - 1);
+
+/**
+ * Bodies of objects smaller than this size are not compressed
+ */
+const length_t dbCompressionThreshold = 128;
+
 class dbClass : public dbObject {
 public:
   oid_t next;
@@ -221,6 +256,8 @@ public:
   }
 };
 
+class dbSnapshotFile;
+
 class dbClassDescriptor {
 
   dbClassDescriptor(const dbClassDescriptor &);
@@ -262,9 +299,10 @@ class dbLoadHandle {
   friend class dbDatabase;
 
 private:
-  dbGetTie tie;
-  byte *   curr;
-  byte *   end;
+  dbGetTie                 tie;
+  dbSmallBuffer<byte, 256> unpacked; // body of compressed object
+  byte *                   curr;
+  byte *                   end;
   union {
     byte     bval;
     oid_t    oval;
@@ -282,6 +320,8 @@ public:
 
   char *getClassName() { return desc->name; }
 
+  oid_t getClassId() { return desc->oid; }
+
   char *getFieldName() { return desc->field[fieldNo]; }
 
   bool hasNextField() {
@@ -298,6 +338,8 @@ public:
     case dybase_object_ref_type:
     case dybase_array_ref_type:
     case dybase_index_ref_type:
+    case dybase_map_ref_type:
+    case dybase_set_ref_type:
       memcpy(&u, curr, sizeof(oid_t));
       curr += sizeof(oid_t);
       break;
@@ -327,10 +369,11 @@ public:
       }
       break;
     case dybase_bytes_type:
-      if (type != dybase_bytes_type) {
-        // small string
+    case dybase_typed_array_type:
+      if ((type & 0xF) != type) {
+        // small blob
         u.ival = type >> 4;
-        type = dybase_bytes_type;
+        type &= 0xF;
         ptr = curr;
         curr += u.ival;
       }
@@ -399,6 +442,8 @@ public:
     case dybase_object_ref_type:
     case dybase_array_ref_type:
     case dybase_index_ref_type:
+    case dybase_map_ref_type:
+    case dybase_set_ref_type:
       *body.append(1) = char(type);
       memcpy(body.append(sizeof(oid_t)), value, sizeof(oid_t));
       break;
@@ -426,8 +471,9 @@ public:
       memcpy(body.append(length), value, length);
       break;
     case dybase_bytes_type:
+    case dybase_typed_array_type:
       if ((unsigned)(length - 1) < 15) {
-        *body.append(1) = (byte)(dybase_bytes_type | (length << 4));
+        *body.append(1) = (byte)(type | (length << 4));
       }
       else {
         *body.append(1) = char(type);
@@ -456,6 +502,37 @@ public:
   }
 };
 
+struct dbBtreeKey;
+
+/**
+ * Receiver of the objects enumerated by
+ * dbDatabase::enumerateReachableObjects()
+ */
+class dbObjectSink {
+public:
+  /**
+   * Object or class descriptor
+   * @param stored object as it is stored in the file
+   * @param body the same object with uncompressed body
+   */
+  virtual void object(oid_t oid, dbObject *stored, dbObject *body) = 0;
+
+  /**
+   * Index with its entries in key order
+   */
+  virtual void index(oid_t oid, int type, int unique, int flags,
+                     dbBtreeKey *keys, length_t nKeys) = 0;
+
+  /**
+   * End of enumeration
+   * @param visited bitmap of identifiers of the enumerated objects
+   */
+  virtual void end(oid_t rootObject, oid_t classDescList,
+                   db_int4 const *visited) = 0;
+
+  virtual ~dbObjectSink() {}
+};
+
 /**
  * Database class
  */
@@ -468,6 +545,8 @@ class dbDatabase {
 
   friend class dbGetTie;
   friend class dbPutTie;
+  friend class dbSnapshotFile;
+  friend class dbCopySink;
 
   dbDatabase(const dbDatabase &);
   dbDatabase &operator=(const dbDatabase &);
@@ -479,15 +558,167 @@ public:
   //bool open(wchar_t const *databaseName, int openAttr = dbFile::no_buffering);
 
   /**
-   * Close database
+   * Open read-only snapshot of the last committed state of other database.
+   * Snapshot has its own page pool and can be used by another thread: it
+   * takes pages from the pool of the source database or reads them from the
+   * file, but never waits for transactions of the source. Space of the
+   * objects replaced while the snapshot is opened is not reused until it is
+   * closed. This database should be constructed with dbReadOnly access type.
+   * @param source database returned by findOpened(), this method takes over
+   * its reference
+   * @return <code>true</code> if the snapshot was opened
+   */
+  bool open(dbDatabase *source);
+
+  /**
+   * Find database opened for writing by this process
+   * @param databaseName name of the database file passed to open()
+   * @return database with reference which should be released by release(),
+   * NULL if database is not opened
+   */
+  static dbDatabase *findOpened(char const *databaseName);
+
+  /**
+   * Close database. If snapshots of the database are opened, its file is
+   * closed when the last of them is closed.
    */
   void close();
 
   /**
-   * Commit transaction
+   * Release reference to the database and delete it when this is the last
+   * one. Snapshots keep references to their source database.
+   */
+  void release();
+
+  /**
+   * Copy the last committed state of the database to another file. It is
+   * copied from a snapshot, so transactions can be committed meanwhile.
+   * @param path name of the backup file, it is overwritten
+   * @return <code>true</code> if the backup was written
+   */
+  bool backup(char const *path);
+
+  /**
+   * Write the objects of the last committed state which are reachable from
+   * the root to a new database file. Objects are placed in the order of
+   * traversal from the root, indexes are rebuilt with full pages and their
+   * objects follow them in key order, unreachable objects and free space are
+   * not copied. Object identifiers are preserved. Like backup(), it works on
+   * a snapshot and does not block transactions.
+   * @param path name of the new database file, it is overwritten
+   * @return <code>true</code> if the compacted database was written
+   */
+  bool compact(char const *path);
+
+  /**
+   * Write the objects of the last committed state which are reachable from
+   * the root to a dump file. References in the dump are 64-bit, so it can be
+   * imported by importObjects() of the library built with any size of object
+   * identifiers. Like backup(), it works on a snapshot.
+   * @param path name of the dump file, it is overwritten
+   * @return <code>true</code> if the dump was written
+   */
+  bool exportObjects(char const *path);
+
+  /**
+   * Create database file from the dump written by exportObjects(). Object
+   * identifiers are shifted by the difference of the number of identifiers
+   * reserved for bitmap pages by the two formats.
+   * @param dumpPath name of the dump file
+   * @param path name of the new database file, it is overwritten
+   * @param hnd error handler
+   * @return <code>true</code> if the database was created
+   */
+  static bool importObjects(char const *dumpPath, char const *path,
+                            dbErrorHandler hnd);
+
+  /**
+   * Commit transaction. In write-ahead log mode concurrent committers share
+   * one sync of the log.
    */
   void commit();
 
+  /**
+   * Write all pages committed to the log to the database file and truncate
+   * the log
+   */
+  void checkpoint();
+
+  /**
+   * Use write-ahead log: commit appends modified pages to the log file
+   * (database file name + ".wal") instead of writing them to the database
+   * file. Should be called before open().
+   * @param logCheckpointSize size of the log which triggers checkpoint
+   */
+  void setWriteAheadLog(length_t logCheckpointSize = dbDefaultCheckpointSize) {
+    checkpointSize = logCheckpointSize;
+  }
+
+  /**
+   * Access database pages through memory mapping of the database file
+   * instead of reading them into the page pool. Should be called before
+   * open(). Ignored for multisegment files.
+   */
+  void setMappedPagePool() { pool.setMapped(true); }
+
+  /**
+   * Set policy of page pool replacement. Should be called before open().
+   */
+  void setPageReplacementPolicy(dbPageReplacementPolicy policy) {
+    pool.setReplacementPolicy(policy);
+  }
+
+  /**
+   * Hint the operating system to read ahead pages of the objects passed to
+   * prefetch(). Should be called before open().
+   */
+  void setReadAhead(bool enabled) { readAhead = enabled; }
+
+  /**
+   * Store bodies of objects compressed. Compressed objects are read
+   * independently of this setting.
+   */
+  void setCompression(bool enabled) { compressObjects = enabled; }
+
+  /**
+   * Read pages of the objects which are going to be loaded. Pages are read
+   * in the order of their positions in the file, instead of the random order
+   * in which objects are accessed.
+   * @param oids identifiers of the objects
+   * @param nOids number of objects
+   */
+  void prefetch(oid_t const *oids, length_t nOids);
+
+  /**
+   * Get page pool statistic
+   */
+  void getPagePoolStatistic(db_nat8 &hits, db_nat8 &misses,
+                            db_nat8 &evictions) {
+    dbCriticalSection cs(mutex);
+    hits      = pool.getHits();
+    misses    = pool.getMisses();
+    evictions = pool.getEvictions();
+  }
+
+  /**
+   * Get number of write requests and written bytes
+   * @param writes [out] write requests issued since the database was opened
+   * @param bytes [out] bytes written since the database was opened
+   * @param lastCommitWrites [out] write requests issued by the last commit
+   * @param lastCommitBytes [out] bytes written by the last commit
+   */
+  void getIoStatistic(db_nat8 &writes, db_nat8 &bytes,
+                      db_nat8 &lastCommitWrites, db_nat8 &lastCommitBytes) {
+    dbCriticalSection cs(mutex);
+    if (opened) {
+      getWriteStatistic(writes, bytes);
+    } else {
+      writes = bytes = 0;
+    }
+    lastCommitWrites = commitWrites;
+    lastCommitBytes  = commitBytes;
+  }
+
   /**
    * Rollback transaction
    */
@@ -523,6 +754,26 @@ public:
 
   void gc();
 
+  /**
+   * Set amount of work done by one step of incremental garbage collector.
+   * In incremental mode collection is performed by bounded steps made at
+   * each commit instead of stop-the-world collection inside allocator.
+   * @param maxWork maximal number of objects, index entries and handles
+   * processed by one step, 0 to disable incremental mode
+   */
+  void setGcStep(long maxWork) { gcStepSize = maxWork; }
+
+  /**
+   * Perform one step of incremental garbage collection, starting new cycle
+   * if no one is active. It should be called only when stored objects are
+   * consistent, i.e. between transactions.
+   * @param maxWork maximal amount of work, 0 to complete the cycle
+   * @return <code>true</code> if the cycle was completed by this step
+   */
+  bool gcStep(long maxWork);
+
+  void getGcStatistic(dybase_gc_stats_t &stats);
+
   void handleError(int error, char const *msg = NULL);
   void throwException(int error, char const *msg = NULL);
 
@@ -544,6 +795,7 @@ public:
 protected:
   dbHeader *header;        // base address of database file mapping
   db_int4 * dirtyPagesMap; // bitmap of changed pages in current index
+  length_t  dirtyPagesMapSize; // number of words in dirtyPagesMap
   bool      modified;
 
   int curr; // copy of header->root, used to allow read access to the database
@@ -575,6 +827,15 @@ protected:
   dbMutex    mutex;
   dbPagePool pool;
 
+  dbWriteAheadLog *log;            // not NULL in write-ahead log mode
+  char *           logName;
+  length_t         checkpointSize; // 0 if write-ahead log is not used
+  db_nat8          commitLsn;      // log position of the last commit record
+  bool             readAhead;      // prefetch() advises OS to read pages
+  bool             compressObjects; // store bodies of objects compressed
+  db_nat8          commitWrites;   // write requests issued by the last commit
+  db_nat8          commitBytes;    // bytes written by the last commit
+
   int *bitmapPageAvailableSpace;
   bool opened;
 
@@ -587,8 +848,49 @@ protected:
   long     allocatedDelta;
   bool     gcDone;
 
+  enum dbGcPhase { dbGcIdle, dbGcMark, dbGcSweep };
+
+  // state of incremental garbage collector: it marks current state of the
+  // database, objects stored while the cycle is active are shaded by
+  // storeObject, setRoot and index insertion
+  long     gcStepSize;    // 0 if incremental collector is not used
+  int      gcPhase;       // dbGcPhase
+  db_int4 *greyOids;      // bitmap of reached but not yet scanned objects
+  db_int4 *blackOids;     // bitmap of scanned and allocated during the cycle
+  length_t gcMapSize;     // number of handles covered by bitmaps
+  length_t gcGreyCount;   // number of bits set in greyOids
+  length_t gcCursor;      // next handle to scan or to sweep
+  oid_t    gcTree;        // index which entries are being marked
+  bool     gcTreeStarted; // gcTreeKey contains key to resume marking from
+  length_t gcTreeKeyLength;
+  char *   gcTreeKey;     // buffer of dbBtreePage::dbMaxKeyLen bytes
+  long     gcCycles;
+  long     gcSteps;
+  long     gcMarked;
+  long     gcFreed;
+
   dbErrorHandler errorHandler;
 
+  /**
+   * Space of the committed object which was freed while snapshots are opened
+   */
+  struct dbRetainedSpace {
+    offs_t   pos;
+    length_t size;
+    db_nat8  seq; // commitSeq of the transaction which freed the object
+  };
+
+  char *      fileName;     // name of the database file
+  dbDatabase *nextOpened;   // chain of databases opened for writing
+  int         nRefs;        // protected by mutex of the chain
+  dbDatabase *source;       // database of which this one is a snapshot
+  dbDatabase *snapshots;    // opened snapshots of this database
+  dbDatabase *nextSnapshot; // next snapshot of the same source
+  db_nat8     snapshotSeq;  // commitSeq of the source taken by the snapshot
+  db_nat8     commitSeq;    // number of committed transactions
+  bool        closePending; // file is closed by the last snapshot
+  dbBuffer<dbRetainedSpace> retainedSpace;
+
   /**
    * Get position of the object in the database file
    * @param oid object identifier
@@ -612,18 +914,46 @@ protected:
 
   void markOid(oid_t oid) {
     if (oid != 0) {
-      offs_t   pos = getGCPos(oid);
-      unsigned bit = (unsigned)(pos >> dbAllocationQuantumBits);
+      offs_t pos = getGCPos(oid);
+      offs_t bit = pos >> dbAllocationQuantumBits;
       if ((blackBitmap[bit >> 5] & (1 << (bit & 31))) == 0) {
         greyBitmap[bit >> 5] |= 1 << (bit & 31);
       }
     }
   }
 
-  void  markObject(dbObject *obj);
-  byte *markField(byte *p);
+  /**
+   * Add object to the grey set of incremental garbage collector
+   */
+  void shadeOid(oid_t oid) {
+    if (gcPhase == dbGcMark && oid != 0 && oid < gcMapSize) {
+      db_int4 mask = 1 << (oid & 31);
+      if (((greyOids[oid >> 5] | blackOids[oid >> 5]) & mask) == 0) {
+        greyOids[oid >> 5] |= mask;
+        gcGreyCount += 1;
+      }
+    }
+  }
+
+  /**
+   * Get object with decompressed body
+   * @param obj stored object
+   * @param buf buffer for decompressed object
+   * @return obj if it is not compressed, object in buf otherwise
+   */
+  dbObject *unpackObject(dbObject *obj, dbSmallBuffer<byte, 256> &buf);
+
+  void  markObject(dbObject *obj, bool shade = false);
+  byte *markField(byte *p, bool shade);
   void  startGC();
 
+  void     startIncrementalGC();
+  void     stopIncrementalGC();
+  bool     doIncrementalGC(long maxWork);
+  void     scanObject(oid_t oid);
+  long     markTreeEntries(long maxWork);
+  bool     sweepObject(oid_t oid);
+
   /**
    * Set position of the object
    * @param  oid object identifier
@@ -788,8 +1118,88 @@ protected:
    */
   void commitLocation();
 
+  void resetState();
   void commitTransaction();
+  void closeFile();
+  void closeSnapshot();
   void setDirty();
+
+  /**
+   * Free space of the object replaced or deleted by the committed
+   * transaction, or retain it if snapshots are opened
+   */
+  void freeCommitted(offs_t pos, length_t size);
+
+  /**
+   * Free retained space which is not visible to the opened snapshots
+   */
+  void releaseRetainedSpace();
+
+  /**
+   * Create file of the snapshot which reads the last committed state.
+   * Locks the mutex.
+   * @return NULL if database is not opened
+   */
+  dbSnapshotFile *createSnapshot(dbDatabase *snapshot);
+
+  /**
+   * Forget closed snapshot. Locks the mutex.
+   */
+  void removeSnapshot(dbDatabase *snapshot);
+
+  /**
+   * Open private snapshot of this database for backup() and compact()
+   * @param target name of the file to be written, it should not be the file
+   * of this database or of other database opened for writing
+   * @return snapshot to be closed by close() and release() or NULL
+   */
+  dbDatabase *openSnapshot(char const *target);
+
+  /**
+   * Store copy of the object with the same identifier
+   */
+  void copyObject(oid_t oid, dbObject *obj);
+
+  /**
+   * Create index with the specified identifier by bulk load of its entries
+   */
+  void copyIndex(oid_t treeId, int type, int unique, int flags,
+                 dbBtreeKey *keys, length_t nKeys);
+
+  /**
+   * Pass objects of this snapshot which are reachable from the root to the
+   * sink in breadth first order, indexes are passed with their entries
+   */
+  void enumerateReachableObjects(dbObjectSink &sink);
+
+  /**
+   * Pass index with its entries to the sink and append its objects which
+   * were not visited yet to the queue
+   */
+  void enumerateIndex(dbObjectSink &sink, oid_t treeId,
+                      dbBuffer<oid_t> &queue, db_int4 *visited);
+
+  /**
+   * Make the bitmap of changed index pages large enough for the index
+   */
+  void extendDirtyPagesMap(length_t indexSize);
+
+  /**
+   * Read the page of the last committed state. It can be called from any
+   * thread without locking the mutex.
+   */
+  int readCommittedPage(offs_t pos, byte *buf) {
+    return pool.share(pos, buf) ? dbFile::ok
+                                : file->read(pos, buf, dbPageSize);
+  }
+  void checkpointLog();
+  void getWriteStatistic(db_nat8 &writes, db_nat8 &bytes);
+
+  /**
+   * Replay write-ahead log left by previous session (if any)
+   * @return <code>false</code> if log can not be applied
+   */
+  bool recoverLog();
 };
 
 #endif
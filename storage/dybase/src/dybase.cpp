@@ -8,15 +8,39 @@
 #include "dybase.h"
 
 dybase_storage_t dybase_open(const char *file_path, int page_pool_size,
-                             dybase_error_handler_t hnd, int read_write) {
+                             dybase_error_handler_t hnd, int read_write,
+                             int flags) {
   try {
     if (page_pool_size == 0) { page_pool_size = dbDefaultPagePoolSize; }
 
+    if (flags & dybase_open_snapshot) {
+      dbDatabase *source = dbDatabase::findOpened(file_path);
+      if (source != NULL) {
+        dbDatabase *db = new dbDatabase(dbDatabase::dbReadOnly,
+                                        (dbDatabase::dbErrorHandler)hnd,
+                                        page_pool_size / dbPageSize);
+        if (flags & dybase_open_2q) {
+          db->setPageReplacementPolicy(db2QReplacement);
+        }
+        if (db->open(source)) { return db; }
+        delete db;
+        return NULL;
+      }
+      read_write = 0;
+    }
+
     dbDatabase::dbAccessType at =
         read_write ? dbDatabase::dbAllAccess : dbDatabase::dbReadOnly;
 
     dbDatabase *db = new dbDatabase(at, (dbDatabase::dbErrorHandler)hnd,
                                     page_pool_size / dbPageSize);
+    if (flags & dybase_open_wal) { db->setWriteAheadLog(); }
+    if (flags & dybase_open_mmap) { db->setMappedPagePool(); }
+    if (flags & dybase_open_2q) {
+      db->setPageReplacementPolicy(db2QReplacement);
+    }
+    if (flags & dybase_open_readahead) { db->setReadAhead(true); }
+    if (flags & dybase_open_compress) { db->setCompression(true); }
     if (db->open(file_path)) {
       return db;
     } else {
@@ -32,8 +56,8 @@ void dybase_close(dybase_storage_t storage) {
   dbDatabase *db = (dbDatabase *)storage;
   try {
     db->close();
-    delete db;
-  } catch (dbException &) { delete db; }
+  } catch (dbException &) {}
+  db->release();
 }
 
 void dybase_commit(dybase_storage_t storage) {
@@ -42,6 +66,35 @@ void dybase_commit(dybase_storage_t storage) {
   } catch (dbException &) {}
 }
 
+void dybase_checkpoint(dybase_storage_t storage) {
+  try {
+    ((dbDatabase *)storage)->checkpoint();
+  } catch (dbException &) {}
+}
+
+void dybase_prefetch(dybase_storage_t storage, dybase_oid_t const *oids,
+                     int n_oids) {
+  try {
+    ((dbDatabase *)storage)->prefetch((oid_t const *)oids, n_oids);
+  } catch (dbException &) {}
+}
+
+void dybase_get_cache_stats(dybase_storage_t      storage,
+                            dybase_cache_stats_t *stats) {
+  db_nat8 hits, misses, evictions;
+  ((dbDatabase *)storage)->getPagePoolStatistic(hits, misses, evictions);
+  stats->hits      = hits;
+  stats->misses    = misses;
+  stats->evictions = evictions;
+  db_nat8 writes, bytes, commitWrites, commitBytes;
+  ((dbDatabase *)storage)
+      ->getIoStatistic(writes, bytes, commitWrites, commitBytes);
+  stats->writes        = writes;
+  stats->bytes_written = bytes;
+  stats->commit_writes = commitWrites;
+  stats->commit_bytes  = commitBytes;
+}
+
 void dybase_rollback(dybase_storage_t storage) {
   try {
     ((dbDatabase *)storage)->rollback();
@@ -134,6 +187,10 @@ char *dybase_get_class_name(dybase_handle_t handle) {
   return ((dbLoadHandle *)handle)->getClassName();
 }
 
+dybase_oid_t dybase_get_class_id(dybase_handle_t handle) {
+  return ((dbLoadHandle *)handle)->getClassId();
+}
+
 char *dybase_next_field(dybase_handle_t handle) {
   dbLoadHandle *hnd = (dbLoadHandle *)handle;
   if (!hnd->hasNextField()) {
@@ -159,9 +216,13 @@ void dybase_get_value(dybase_handle_t handle, int *type, void **value_ptr,
 }
 
 dybase_oid_t dybase_create_index(dybase_storage_t storage, int key_type,
-                                 int unique) {
+                                 int unique, int flags) {
   try {
-    return dbBtree::allocate((dbDatabase *)storage, key_type, (bool)unique);
+    return dbBtree::allocate(
+        (dbDatabase *)storage, key_type, (bool)unique,
+        ((flags & dybase_index_prefix_keys) ? dbBtree::prefixKeys : 0) |
+            ((flags & dybase_index_composite_keys) ? dbBtree::compositeKeys
+                                                   : 0));
   } catch (dbException &) { return 0; }
 }
 
@@ -174,6 +235,24 @@ int dybase_insert_in_index(dybase_storage_t storage, dybase_oid_t index,
   } catch (dbException &) { return 0; }
 }
 
+int dybase_bulk_load_index(dybase_storage_t storage, dybase_oid_t index,
+                           int key_type, dybase_key_t *keys, int n_keys,
+                           int fill_factor) {
+  dbBtreeKey *btreeKeys = new dbBtreeKey[n_keys];
+  for (int i = 0; i < n_keys; i++) {
+    btreeKeys[i].key     = keys[i].key;
+    btreeKeys[i].keySize = keys[i].key_size;
+    btreeKeys[i].oid     = (oid_t)keys[i].obj;
+  }
+  int n;
+  try {
+    n = dbBtree::bulkLoad((dbDatabase *)storage, (oid_t)index, key_type,
+                          btreeKeys, n_keys, fill_factor);
+  } catch (dbException &) { n = 0; }
+  delete[] btreeKeys;
+  return n;
+}
+
 int dybase_remove_from_index(dybase_storage_t storage, dybase_oid_t index,
                              void *key, int key_type, int key_size,
                              dybase_oid_t obj) {
@@ -196,6 +275,39 @@ int dybase_get_index_type(dybase_storage_t storage, dybase_oid_t index) {
   catch (dbException &) { return 0; }
 }
 
+int dybase_get_index_flags(dybase_storage_t storage, dybase_oid_t index) {
+  try {
+    int flags = dbBtree::get_flags((dbDatabase *)storage, (oid_t)index);
+    return ((flags & dbBtree::prefixKeys) ? dybase_index_prefix_keys : 0) |
+           ((flags & dbBtree::compositeKeys) ? dybase_index_composite_keys
+                                             : 0);
+  } catch (dbException &) { return 0; }
+}
+
+int dybase_composite_key_append(void *key, int key_size, int buf_size,
+                                int type, void const *value, int value_size) {
+  return dbCompositeKey::append((byte *)key, key_size, buf_size, type, value,
+                                value_size);
+}
+
+int dybase_composite_key_bound(void *key, int key_size, int buf_size) {
+  if (key_size >= buf_size) { return -1; }
+  ((byte *)key)[key_size] = dbCompositeKey::tagEnd;
+  return key_size + 1;
+}
+
+int dybase_composite_key_next(void const *key, int key_size, int *pos,
+                              int *type, void *value, int *value_size) {
+  length_t p = *pos, size;
+  int rc = dbCompositeKey::next((byte const *)key, key_size, p, *type, value,
+                                size);
+  if (rc > 0) {
+    *pos        = int(p);
+    *value_size = int(size);
+  }
+  return rc;
+}
+
 int dybase_index_search(dybase_storage_t storage, dybase_oid_t index,
                         int key_type, void *min_key, int min_key_size,
                         int min_key_inclusive, void *max_key, int max_key_size,
@@ -216,6 +328,25 @@ int dybase_index_search(dybase_storage_t storage, dybase_oid_t index,
   } catch (dbException &) { return 0; }
 }
 
+long dybase_index_count(dybase_storage_t storage, dybase_oid_t index,
+                        int key_type, void *min_key, int min_key_size,
+                        int min_key_inclusive, void *max_key, int max_key_size,
+                        int max_key_inclusive) {
+  try {
+    dbSearchContext ctx;
+    ctx.low           = min_key;
+    ctx.lowSize       = min_key_size;
+    ctx.lowInclusive  = min_key_inclusive;
+    ctx.high          = max_key;
+    ctx.highSize      = max_key_size;
+    ctx.highInclusive = max_key_inclusive;
+    ctx.keyType       = key_type;
+    ctx.countOnly     = true;
+    dbBtree::find((dbDatabase *)storage, (oid_t)index, ctx);
+    return (long)ctx.count;
+  } catch (dbException &) { return 0; }
+}
+
 void dybase_free_selection(dybase_storage_t /*storage*/,
                            dybase_oid_t *selected_objects, int /*n_selected*/) {
   try {
@@ -253,6 +384,16 @@ dybase_oid_t dybase_index_iterator_next(dybase_iterator_t iterator) {
   } catch (dbException &) { return 0; }
 }
 
+dybase_oid_t dybase_index_iterator_next_key(dybase_iterator_t iterator,
+                                            void **key, int *key_size) {
+  try {
+    length_t     keyLength;
+    dybase_oid_t oid = ((dbBtreeIterator *)iterator)->next(*key, keyLength);
+    *key_size        = (int)keyLength;
+    return oid;
+  } catch (dbException &) { return 0; }
+}
+
 void dybase_free_index_iterator(dybase_iterator_t iterator) {
   delete (dbBtreeIterator *)iterator;
 }
@@ -263,6 +404,46 @@ void dybase_set_gc_threshold(dybase_storage_t storage, long allocated_delta) {
 
 void dybase_gc(dybase_storage_t storage) { ((dbDatabase *)storage)->gc(); }
 
+void dybase_set_gc_step(dybase_storage_t storage, long max_work) {
+  ((dbDatabase *)storage)->setGcStep(max_work);
+}
+
+int dybase_gc_step(dybase_storage_t storage, long max_work) {
+  try {
+    return ((dbDatabase *)storage)->gcStep(max_work);
+  } catch (dbException &) { return 0; }
+}
+
+void dybase_get_gc_stats(dybase_storage_t storage, dybase_gc_stats_t *stats) {
+  ((dbDatabase *)storage)->getGcStatistic(*stats);
+}
+
+int dybase_backup(dybase_storage_t storage, const char *file_path) {
+  try {
+    return ((dbDatabase *)storage)->backup(file_path);
+  } catch (dbException &) { return 0; }
+}
+
+int dybase_compact(dybase_storage_t storage, const char *file_path) {
+  try {
+    return ((dbDatabase *)storage)->compact(file_path);
+  } catch (dbException &) { return 0; }
+}
+
+int dybase_export(dybase_storage_t storage, const char *dump_path) {
+  try {
+    return ((dbDatabase *)storage)->exportObjects(dump_path);
+  } catch (dbException &) { return 0; }
+}
+
+int dybase_import(const char *dump_path, const char *file_path,
+                  dybase_error_handler_t hnd) {
+  try {
+    return dbDatabase::importObjects(dump_path, file_path,
+                                     (dbDatabase::dbErrorHandler)hnd);
+  } catch (dbException &) { return 0; }
+}
+
 
 hashtable_t hashtable_create() {
   return new dbHashtable();
@@ -31,7 +31,10 @@ dbFile::~dbFile() { close(); }
 
 #define BAD_POS 0xFFFFFFFF // returned by SetFilePointer and GetFileSize
 
-dbFile::dbFile() { fh = INVALID_HANDLE_VALUE; }
+dbFile::dbFile() {
+  fh      = INVALID_HANDLE_VALUE;
+  nWrites = nWrittenBytes = 0;
+}
 
 int dbFile::open(char const *fileName, int attr) {
 #ifdef UNICODE
@@ -130,8 +133,33 @@ int dbFile::setSize(offs_t size) {
   return ok;
 }
 
+int dbFile::getSize(offs_t &size) {
+  DWORD high_size;
+  DWORD low_size = GetFileSize(fh, &high_size);
+  if (low_size == BAD_POS && GetLastError() != NO_ERROR) {
+    return GetLastError();
+  }
+  size = offs_t(cons_nat8(high_size, low_size));
+  return ok;
+}
+
+void *dbFile::map(offs_t pos, length_t size) {
+  HANDLE mh = CreateFileMapping(fh, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  if (mh == NULL) { return NULL; }
+  void *addr = MapViewOfFile(mh, FILE_MAP_COPY, nat8_high_part(pos),
+                             nat8_low_part(pos), size);
+  CloseHandle(mh); // view keeps mapping object alive
+  return addr;
+}
+
+void dbFile::unmap(void *addr, length_t) { UnmapViewOfFile(addr); }
+
+void dbFile::advise(offs_t, length_t) {}
+
 int dbFile::write(void const *buf, length_t size) {
   DWORD writtenBytes;
+  nWrites += 1;
+  nWrittenBytes += size;
   return !WriteFile(fh, buf, size, &writtenBytes, NULL)
              ? GetLastError()
              : (writtenBytes == size) ? int(ok) : int(eof);
@@ -139,6 +167,8 @@ int dbFile::write(void const *buf, length_t size) {
 
 int dbFile::write(offs_t pos, void const *buf, length_t size) {
   DWORD writtenBytes;
+  nWrites += 1;
+  nWrittenBytes += size;
   // if (osinfo.dwPlatformId == VER_PLATFORM_WIN32_NT) {
   OVERLAPPED Overlapped;
   Overlapped.Offset     = nat8_low_part(pos);
@@ -159,6 +189,15 @@ int dbFile::write(offs_t pos, void const *buf, length_t size) {
   //}
 }
 
+int dbFile::writev(offs_t pos, dbIoVec const *iov, int n) {
+  for (int i = 0; i < n; i++) {
+    int rc = write(pos, iov[i].ptr, iov[i].size);
+    if (rc != ok) { return rc; }
+    pos += iov[i].size;
+  }
+  return ok;
+}
+
 int dbFile::flush() { return FlushFileBuffers(fh) ? int(ok) : GetLastError(); }
 
 int dbFile::close() {
@@ -213,12 +252,19 @@ char *dbFile::errorText(int code, char *buf, length_t bufSize) {
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #ifdef __linux__
 #define lseek(fd, offs, whence) lseek64(fd, offs, whence)
 #endif
 
-dbFile::dbFile() { fd = -1; }
+dbFile::dbFile() {
+  fd      = -1;
+  nWrites = nWrittenBytes = 0;
+}
 
 int dbFile::open(char const *fileName, int attr) {
   char *name = (char *)fileName;
@@ -256,6 +302,26 @@ int dbFile::open(char const *fileName, int attr) {
 
 int dbFile::setSize(offs_t size) { return ftruncate(fd, size); }
 
+int dbFile::getSize(offs_t &size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) { return errno; }
+  size = st.st_size;
+  return ok;
+}
+
+void *dbFile::map(offs_t pos, length_t size) {
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, pos);
+  return addr == MAP_FAILED ? NULL : addr;
+}
+
+void dbFile::unmap(void *addr, length_t size) { munmap(addr, size); }
+
+void dbFile::advise(offs_t pos, length_t size) {
+#if defined(POSIX_FADV_WILLNEED)
+  posix_fadvise(fd, pos, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
 int dbFile::read(offs_t pos, void *buf, length_t size) {
   ssize_t rc;
 #if defined(__sun) || defined(_AIX43)
@@ -288,6 +354,8 @@ int dbFile::read(void *buf, length_t size) {
 }
 
 int dbFile::write(void const *buf, length_t size) {
+  nWrites += 1;
+  nWrittenBytes += size;
   ssize_t rc = ::write(fd, buf, size);
   if (rc == -1) {
     return errno;
@@ -300,6 +368,8 @@ int dbFile::write(void const *buf, length_t size) {
 
 int dbFile::write(offs_t pos, void const *buf, length_t size) {
   ssize_t rc;
+  nWrites += 1;
+  nWrittenBytes += size;
 #if defined(__sun) || defined(_AIX43)
   rc = pwrite64(fd, buf, size, pos);
 #else
@@ -318,6 +388,54 @@ int dbFile::write(offs_t pos, void const *buf, length_t size) {
   }
 }
 
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__)
+#define HAVE_PWRITEV 1
+#endif
+
+int dbFile::writev(offs_t pos, dbIoVec const *iov, int n) {
+#if defined(HAVE_PWRITEV) && defined(IOV_MAX)
+  struct iovec vec[IOV_MAX < 256 ? IOV_MAX : 256];
+  int          i = 0;
+  length_t     done = 0; // written part of iov[i]
+  while (i < n) {
+    int      m    = 0;
+    length_t size = 0;
+    for (int j = i; j < n && m < int(sizeof(vec) / sizeof(vec[0])); j++, m++) {
+      length_t skip   = j == i ? done : 0;
+      vec[m].iov_base = (char *)iov[j].ptr + skip;
+      vec[m].iov_len  = iov[j].size - skip;
+      size += vec[m].iov_len;
+    }
+    nWrites += 1;
+    nWrittenBytes += size;
+    ssize_t rc = pwritev(fd, vec, m, pos);
+    if (rc == -1) {
+      if (errno == EINTR) { continue; }
+      return errno;
+    } else if (rc == 0) {
+      return eof;
+    }
+    pos += rc;
+    // skip completely written buffers, write of the rest is repeated
+    while (i < n && length_t(rc) >= iov[i].size - done) {
+      rc -= iov[i].size - done;
+      done = 0;
+      i += 1;
+    }
+    done += length_t(rc);
+  }
+  return ok;
+#else
+  for (int i = 0; i < n; i++) {
+    int rc = write(pos, iov[i].ptr, iov[i].size);
+    if (rc != ok) { return rc; }
+    pos += iov[i].size;
+  }
+  return ok;
+#endif
+}
+
 int dbFile::flush() {
 #if defined(_AIX43)
   return ok; // direct IO is used: no need in flush
@@ -421,6 +539,25 @@ int dbMultiFile::write(offs_t pos, void const *ptr, length_t size) {
   return segment[n].write(segment[n].offs + pos, src, size);
 }
 
+int dbMultiFile::writev(offs_t pos, dbIoVec const *iov, int n) {
+  for (int i = 0; i < n; i++) {
+    int rc = write(pos, iov[i].ptr, iov[i].size);
+    if (rc != ok) { return rc; }
+    pos += iov[i].size;
+  }
+  return ok;
+}
+
+void dbMultiFile::getWriteStatistic(db_nat8 &writes, db_nat8 &bytes) {
+  writes = bytes = 0;
+  for (int i = 0; segment != NULL && i < nSegments; i++) {
+    db_nat8 w, b;
+    segment[i].getWriteStatistic(w, b);
+    writes += w;
+    bytes += b;
+  }
+}
+
 int dbMultiFile::read(offs_t pos, void *ptr, length_t size) {
   int   n   = nSegments - 1;
   char *dst = (char *)ptr;
@@ -15,6 +15,14 @@
 
 const length_t dbDefaultRaidBlockSize = 1024 * 1024;
 
+/**
+ * Buffer of the vectored write
+ */
+struct dbIoVec {
+  void const *ptr;
+  length_t    size;
+};
+
 /**
  * Internal implementation of file
  */
@@ -26,6 +34,8 @@ protected:
   int fd;
 #endif
   dbMutex mutex;
+  db_nat8 nWrites;      // number of write requests passed to the OS
+  db_nat8 nWrittenBytes;
 
 public:
   enum ReturnStatus {
@@ -50,10 +60,46 @@ public:
   virtual int close();
 
   virtual int setSize(offs_t offs);
+  virtual int getSize(offs_t &size);
 
   virtual int write(offs_t pos, void const *ptr, length_t size);
   virtual int read(offs_t pos, void *ptr, length_t size);
 
+  /**
+   * Write several buffers to the continuous region of the file. Where it is
+   * supported it is done by one system call (pwritev).
+   * @param pos offset in the file
+   * @param iov buffers
+   * @param n number of buffers
+   * @return dbFile::ok or error code
+   */
+  virtual int writev(offs_t pos, dbIoVec const *iov, int n);
+
+  /**
+   * Get number of write requests and written bytes since the file was
+   * constructed
+   */
+  virtual void getWriteStatistic(db_nat8 &writes, db_nat8 &bytes) {
+    writes = nWrites;
+    bytes  = nWrittenBytes;
+  }
+
+  /**
+   * Map region of the file in memory. Mapping is private: modifications of
+   * the mapped pages are not propagated to the file.
+   * @param pos offset in the file, should be aligned on 64Kb boundary
+   * @param size size of the region, should not exceed size of the file
+   * @return address of the mapped region or NULL if mapping is not possible
+   */
+  virtual void *map(offs_t pos, length_t size);
+  static void   unmap(void *addr, length_t size);
+
+  /**
+   * Hint the operating system that the region of the file will be read soon,
+   * so it can start asynchronous read ahead
+   */
+  virtual void advise(offs_t pos, length_t size);
+
   static void *allocateBuffer(length_t bufferSize);
   static void  deallocateBuffer(void *buffer, length_t size = 0);
   static void  protectBuffer(void *buf, length_t bufSize, bool readonly);
@@ -83,6 +129,13 @@ public:
 
   virtual int write(offs_t pos, void const *ptr, length_t size);
   virtual int read(offs_t pos, void *ptr, length_t size);
+  virtual int writev(offs_t pos, dbIoVec const *iov, int n);
+  virtual void getWriteStatistic(db_nat8 &writes, db_nat8 &bytes);
+
+  // segmented files can not be mapped in memory
+  virtual int   getSize(offs_t &) { return eof; }
+  virtual void *map(offs_t, length_t) { return NULL; }
+  virtual void  advise(offs_t, length_t) {}
 
   dbMultiFile() { segment = NULL; }
   ~dbMultiFile() {}
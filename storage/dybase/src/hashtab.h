@@ -67,8 +67,10 @@ public:
     unsigned h        = hashCode % dbHashtableSize;
     for (epp = &table[h]; (ep = *epp) != NULL; epp = &ep->next) {
       if (ep->hashCode == hashCode && memcmp(ep->key, key, keySize) == 0) {
-        *epp = ep->next;
-        return ep->value;
+        *epp        = ep->next;
+        void *value = ep->value;
+        delete ep;
+        return value;
       }
     }
     return NULL;
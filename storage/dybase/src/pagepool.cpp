@@ -12,6 +12,8 @@
 #include "dybase.h"
 #include "database.h"
 
+const offs_t dbInvalidGhost = ~(offs_t)0;
+
 byte *dbPagePool::find(offs_t addr, int state) {
   dbPageHeader *ph;
   assert(((int)addr & (dbPageSize - 1)) == 0);
@@ -32,23 +34,41 @@ byte *dbPagePool::find(offs_t addr, int state) {
         dirtyPages[nDirtyPages] = ph;
         ph->writeQueueIndex     = nDirtyPages++;
       }
+      if (state & dbPageHeader::psDirty) {
+        ph->state &= ~dbPageHeader::psLogged;
+      }
 #ifdef PROTECT_PAGE_POOL
       if ((state & dbPageHeader::psDirty)) {
         dbFile::protectBuffer(buffer + (i - 1) * dbPageSize, dbPageSize, false);
       }
 #endif
       ph->state |= state;
+      hits += 1;
       // printf("Find page %x, offs=%x\n", ph, addr);
       return buffer + (i - 1) * dbPageSize;
     }
   }
+  misses += 1;
+  dbCriticalSection cs(mutex);
   i = freePages;
   if (i == 0) {
-    i = pages->prev;
+    i = victim();
     assert(((void)"unfixed page availabe", i != 0));
     ph = &pages[i];
+    evictions += 1;
+    if (policy == db2QReplacement && !(ph->state & dbPageHeader::psHot)) {
+      coldPages -= 1;
+      addGhost(ph->offs);
+    }
     // printf("Throw page %p offs=%x\n", ph, ph->offs);
     if (ph->state & dbPageHeader::psDirty) {
+      if (db->log != NULL) {
+        // page can be written to the file only after the log records
+        if (db->log->sync() != dbFile::ok) {
+          db->throwException(dybase_file_error, "Failed to sync log");
+        }
+        if (!(ph->state & dbPageHeader::psLogged)) { unloggedWrite = true; }
+      }
       // printf("Write page " INT8_FORMAT "\n", ph->offs);
       rc = file->write(ph->offs, buffer + (i - 1) * dbPageSize, dbPageSize);
       if (rc != dbFile::ok) {
@@ -79,6 +99,15 @@ byte *dbPagePool::find(offs_t addr, int state) {
   ph->collisionChain  = hashTable[hashCode];
   hashTable[hashCode] = i;
 
+  if (policy == db2QReplacement) {
+    // page thrown away recently from the cold queue is accessed again
+    if (removeGhost(addr)) {
+      ph->state = dbPageHeader::psHot;
+    } else {
+      coldPages += 1;
+    }
+  }
+
   if (state & dbPageHeader::psDirty) {
     dirtyPages[nDirtyPages] = ph;
     ph->writeQueueIndex     = nDirtyPages++;
@@ -111,25 +140,138 @@ byte *dbPagePool::find(offs_t addr, int state) {
   return p;
 }
 
+int dbPagePool::victim() {
+  // 2Q: cold queue is limited by 1/4 of the pool, the rest is for hot pages
+  if (policy == db2QReplacement && pages[hotList].prev != hotList &&
+      (coldPages <= poolSize / 4 || pages->prev == 0)) {
+    return pages[hotList].prev;
+  }
+  return pages->prev;
+}
+
+void dbPagePool::addGhost(offs_t addr) {
+  int g = int(ghostPos + 1);
+  ghostPos = (ghostPos + 1) % ghostSize;
+  if (ghostOffs[g] != dbInvalidGhost) { removeGhost(ghostOffs[g]); }
+  int h         = (unsigned(addr) >> dbPageBits) & hashBits;
+  ghostOffs[g]  = addr;
+  ghostChain[g] = ghostHash[h];
+  ghostHash[h]  = g;
+}
+
+bool dbPagePool::removeGhost(offs_t addr) {
+  int  h = (unsigned(addr) >> dbPageBits) & hashBits;
+  int *gp;
+  for (gp = &ghostHash[h]; *gp != 0; gp = &ghostChain[*gp]) {
+    if (ghostOffs[*gp] == addr) {
+      ghostOffs[*gp] = dbInvalidGhost;
+      *gp            = ghostChain[*gp];
+      return true;
+    }
+  }
+  return false;
+}
+
+byte *dbPagePool::findMapped(offs_t addr, int state) {
+  assert(((int)addr & (dbPageSize - 1)) == 0);
+  length_t i = length_t(addr >> dbMapChunkBits);
+  if (addr >= mappedSize && db->accessType == dbDatabase::dbReadOnly) {
+    // read-only file can not be extended
+    assert(!(state & dbPageHeader::psDirty));
+    return zeroPage;
+  }
+  if (i >= nChunks || chunks[i] == NULL) {
+    misses += 1;
+    dbCriticalSection cs(mutex);
+    mapChunk(i);
+  } else {
+    hits += 1;
+  }
+  length_t offs = length_t(addr) & (dbMapChunkSize - 1);
+  if (state & dbPageHeader::psDirty) {
+    byte *ps = &chunkState[i][offs >> dbPageBits];
+    if (!(*ps & dbPageHeader::psDirty)) {
+      if (nDirtyPages == dirtyOffsSize) {
+        offs_t *newOffs = new offs_t[dirtyOffsSize * 2];
+        memcpy(newOffs, dirtyOffs, dirtyOffsSize * sizeof(offs_t));
+        delete[] dirtyOffs;
+        dirtyOffs = newOffs;
+        dirtyOffsSize *= 2;
+      }
+      dirtyOffs[nDirtyPages++] = addr;
+    }
+    *ps = dbPageHeader::psDirty; // image in the log (if any) is obsolete
+  }
+  return chunks[i] + offs;
+}
+
+void dbPagePool::mapChunk(length_t i) {
+  if (i >= nChunks) {
+    length_t newSize   = i >= nChunks * 2 ? i + 1 : nChunks * 2;
+    byte **  newChunks = new byte *[newSize];
+    byte **  newState  = new byte *[newSize];
+    memcpy(newChunks, chunks, nChunks * sizeof(byte *));
+    memcpy(newState, chunkState, nChunks * sizeof(byte *));
+    memset(newChunks + nChunks, 0, (newSize - nChunks) * sizeof(byte *));
+    memset(newState + nChunks, 0, (newSize - nChunks) * sizeof(byte *));
+    delete[] chunks;
+    delete[] chunkState;
+    chunks     = newChunks;
+    chunkState = newState;
+    nChunks    = newSize;
+  }
+  offs_t   pos  = offs_t(i) << dbMapChunkBits;
+  length_t size = dbMapChunkSize;
+  if (pos + size > mappedSize) {
+    if (db->accessType == dbDatabase::dbReadOnly) {
+      size = length_t(mappedSize - pos);
+    } else {
+      // mapped pages should be backed by the file
+      if (file->setSize(pos + size) != dbFile::ok) {
+        db->throwException(dybase_file_error, "Failed to extend file");
+      }
+      mappedSize = pos + size;
+    }
+  }
+  byte *p = (byte *)file->map(pos, size);
+  if (p == NULL) { db->throwException(dybase_file_error, "Failed to map file"); }
+  chunks[i]     = p;
+  chunkState[i] = new byte[dbMapChunkSize >> dbPageBits];
+  memset(chunkState[i], 0, dbMapChunkSize >> dbPageBits);
+}
+
+byte *dbPagePool::mapObject(offs_t pos, length_t size, int state) {
+  if (!mapped || (pos >> dbMapChunkBits) != ((pos + size - 1) >> dbMapChunkBits)) {
+    return NULL;
+  }
+  offs_t page = pos & ~((offs_t)dbPageSize - 1);
+  byte * p    = findMapped(page, state);
+  if (pos + size > mappedSize) { return NULL; } // tail of read-only file
+  for (offs_t next = page + dbPageSize; next < pos + size; next += dbPageSize) {
+    findMapped(next, state);
+  }
+  return p + length_t(pos - page);
+}
+
 void dbPagePool::copy(offs_t dst, offs_t src, length_t size) {
   length_t dstOffs = (length_t)dst & (dbPageSize - 1);
   length_t srcOffs = (length_t)src & (dbPageSize - 1);
   dst -= dstOffs;
   src -= srcOffs;
-  byte *dstPage = find(dst, dbPageHeader::psDirty);
-  byte *srcPage = find(src, 0);
+  byte *dstPage = put(dst);
+  byte *srcPage = get(src);
   size          = (size + 3) >> 2;
   do {
     if (dstOffs == dbPageSize) {
       unfix(dstPage);
       dst += dbPageSize;
-      dstPage = find(dst, dbPageHeader::psDirty);
+      dstPage = put(dst);
       dstOffs = 0;
     }
     if (srcOffs == dbPageSize) {
       unfix(srcPage);
       src += dbPageSize;
-      srcPage = find(src, 0);
+      srcPage = get(src);
       srcOffs = 0;
     }
     *(db_int4 *)(dstPage + dstOffs) = *(db_int4 *)(srcPage + srcOffs);
@@ -147,6 +289,26 @@ bool dbPagePool::open(dbFile *file, offs_t fileSize) {
   this->file     = file;
   this->fileSize = fileSize;
 
+  flushing      = false;
+  unloggedWrite = false;
+  nDirtyPages   = 0;
+  chunks        = NULL;
+  ghostOffs     = NULL;
+  hits = misses = evictions = 0;
+
+  if (mapped && file->getSize(initFileSize) == dbFile::ok) {
+    mappedSize    = initFileSize;
+    nChunks       = 0;
+    chunkState    = NULL;
+    pages         = NULL;
+    dirtyOffsSize = initialWobArraySize;
+    dirtyOffs     = new offs_t[dirtyOffsSize];
+    zeroPage      = (byte *)dbFile::allocateBuffer(dbPageSize);
+    memset(zeroPage, 0, dbPageSize);
+    return zeroPage != NULL;
+  }
+  mapped = false;
+
   length_t hashSize;
   for (hashSize = minHashSize; hashSize < poolSize; hashSize *= 2)
     ;
@@ -154,7 +316,7 @@ bool dbPagePool::open(dbFile *file, offs_t fileSize) {
   memset(hashTable, 0, sizeof(int) * hashSize);
   hashBits = hashSize - 1;
 
-  pages       = new dbPageHeader[poolSize + 1];
+  pages       = new dbPageHeader[poolSize + 2];
   pages->next = pages->prev = 0;
   for (i = poolSize + 1; --i != 0;) {
     pages[i].state = 0;
@@ -162,11 +324,24 @@ bool dbPagePool::open(dbFile *file, offs_t fileSize) {
   }
   pages[poolSize].next = 0;
   freePages            = 1;
+  hotList              = int(poolSize + 1);
+  pages[hotList].next  = pages[hotList].prev = hotList;
+  coldPages            = 0;
 
-  flushing    = false;
-  nPages      = 0;
-  nDirtyPages = 0;
-  dirtyPages  = new dbPageHeader *[poolSize];
+  if (policy == db2QReplacement) {
+    ghostSize  = poolSize / 2 + 1;
+    ghostPos   = 0;
+    ghostOffs  = new offs_t[ghostSize + 1];
+    ghostChain = new int[ghostSize + 1];
+    ghostHash  = new int[hashSize];
+    for (i = ghostSize + 1; --i != 0;) {
+      ghostOffs[i] = dbInvalidGhost;
+    }
+    memset(ghostHash, 0, sizeof(int) * hashSize);
+  }
+
+  nPages     = 0;
+  dirtyPages = new dbPageHeader *[poolSize];
 
 #if defined(__WATCOMC__)
   // reserve one more pages to allow access after end of page
@@ -178,22 +353,110 @@ bool dbPagePool::open(dbFile *file, offs_t fileSize) {
   return buffer != NULL;
 }
 
+void dbPagePool::closeMapped() {
+  for (length_t i = 0; i < nChunks; i++) {
+    if (chunks[i] != NULL) {
+      offs_t pos = offs_t(i) << dbMapChunkBits;
+      dbFile::unmap(chunks[i], pos + dbMapChunkSize > mappedSize
+                                   ? length_t(mappedSize - pos)
+                                   : dbMapChunkSize);
+      delete[] chunkState[i];
+    }
+  }
+  delete[] chunks;
+  delete[] chunkState;
+  delete[] dirtyOffs;
+  dbFile::deallocateBuffer(zeroPage, dbPageSize);
+  chunks = NULL;
+  // cut off the tail added by mapping of the last chunk
+  if (mappedSize > initFileSize) {
+    file->setSize(fileSize > initFileSize ? fileSize : initFileSize);
+  }
+}
+
 void dbPagePool::close() {
+  if (mapped) {
+    closeMapped();
+    return;
+  }
   delete[] hashTable;
   delete[] pages;
   delete[] dirtyPages;
+  if (ghostOffs != NULL) {
+    delete[] ghostOffs;
+    delete[] ghostChain;
+    delete[] ghostHash;
+  }
   dbFile::deallocateBuffer(buffer, bufferSize);
   pages = NULL;
 }
 
+bool dbPagePool::cached(offs_t addr) {
+  int hashCode = (unsigned(addr) >> dbPageBits) & hashBits;
+  for (int i = hashTable[hashCode]; i != 0; i = pages[i].collisionChain) {
+    if (pages[i].offs == addr) { return true; }
+  }
+  return false;
+}
+
+bool dbPagePool::share(offs_t addr, byte *buf) {
+  dbCriticalSection cs(mutex);
+  if (mapped) {
+    length_t i = length_t(addr >> dbMapChunkBits);
+    if (chunks == NULL || i >= nChunks || chunks[i] == NULL ||
+        addr >= mappedSize) {
+      return false;
+    }
+    memcpy(buf, chunks[i] + (length_t(addr) & (dbMapChunkSize - 1)),
+           dbPageSize);
+    return true;
+  }
+  if (pages == NULL) { return false; }
+  int hashCode = (unsigned(addr) >> dbPageBits) & hashBits;
+  for (int i = hashTable[hashCode]; i != 0; i = pages[i].collisionChain) {
+    if (pages[i].offs == addr) {
+      memcpy(buf, buffer + (i - 1) * dbPageSize, dbPageSize);
+      return true;
+    }
+  }
+  return false;
+}
+
+void dbPagePool::prefetch(offs_t *addrs, length_t n, bool readAhead) {
+  if (!mapped) {
+    // do not let prefetched pages throw away each other
+    if (n > poolSize / 4) { n = poolSize / 4; }
+    length_t m = 0;
+    for (length_t i = 0; i < n; i++) {
+      if (!cached(addrs[i])) { addrs[m++] = addrs[i]; }
+    }
+    n = m;
+  }
+  if (readAhead || mapped) {
+    // one hint for each run of adjacent pages
+    for (length_t i = 0, j; i < n; i = j) {
+      for (j = i + 1; j < n && addrs[j] == addrs[j - 1] + dbPageSize; j++)
+        ;
+      file->advise(addrs[i], (j - i) * dbPageSize);
+    }
+  }
+  if (!mapped) {
+    for (length_t i = 0; i < n; i++) {
+      unfix(find(addrs[i], 0));
+    }
+  }
+}
+
 void dbPagePool::unfix(void *ptr) {
+  if (mapped) { return; } // mapped pages are never thrown away
   int           i  = (length_t((byte *)ptr - buffer) >> dbPageBits) + 1;
   dbPageHeader *ph = &pages[i];
   assert(ph->accessCount > 0);
   if (--ph->accessCount == 0) {
-    ph->next    = pages->next;
-    ph->prev    = 0;
-    pages->next = pages[ph->next].prev = i;
+    int list         = lruList(ph);
+    ph->next         = pages[list].next;
+    ph->prev         = list;
+    pages[list].next = pages[ph->next].prev = i;
 #ifdef PROTECT_PAGE_POOL
     if (ph->state & dbPageHeader::psDirty) {
       dbFile::protectBuffer(buffer + (i - 1) * dbPageSize, dbPageSize, true);
@@ -203,17 +466,20 @@ void dbPagePool::unfix(void *ptr) {
 }
 
 void dbPagePool::unfixLIFO(void *ptr) {
+  if (mapped) { return; }
   int           i  = (length_t((byte *)ptr - buffer) >> dbPageBits) + 1;
   dbPageHeader *ph = &pages[i];
   assert(ph->accessCount > 0);
   if (--ph->accessCount == 0) {
-    ph->next    = 0;
-    ph->prev    = pages->prev;
-    pages->prev = pages[ph->prev].next = i;
+    int list         = lruList(ph);
+    ph->next         = list;
+    ph->prev         = pages[list].prev;
+    pages[list].prev = pages[ph->prev].next = i;
   }
 }
 
 void dbPagePool::fix(void *ptr) {
+  if (mapped) { return; }
   int           i  = (length_t((byte *)ptr - buffer) >> dbPageBits) + 1;
   dbPageHeader *ph = &pages[i];
   assert(ph->accessCount != 0);
@@ -221,6 +487,17 @@ void dbPagePool::fix(void *ptr) {
 }
 
 void dbPagePool::modify(void *ptr) {
+  if (mapped) {
+    for (length_t i = 0; i < nChunks; i++) {
+      if (chunks[i] != NULL && (byte *)ptr >= chunks[i] &&
+          (byte *)ptr < chunks[i] + dbMapChunkSize) {
+        length_t offs = length_t((byte *)ptr - chunks[i]) & ~(dbPageSize - 1);
+        findMapped((offs_t(i) << dbMapChunkBits) + offs, dbPageHeader::psDirty);
+        return;
+      }
+    }
+    assert(false);
+  }
   int           i  = (length_t((byte *)ptr - buffer) >> dbPageBits) + 1;
   dbPageHeader *ph = &pages[i];
   assert(ph->accessCount != 0);
@@ -229,18 +506,19 @@ void dbPagePool::modify(void *ptr) {
     dirtyPages[nDirtyPages] = ph;
     ph->writeQueueIndex     = nDirtyPages++;
   }
+  ph->state &= ~dbPageHeader::psLogged;
 }
 
 void dbPagePool::put(offs_t pos, byte *obj, length_t size) {
   int   offs = (int)pos & (dbPageSize - 1);
-  byte *pg   = find(pos - offs, dbPageHeader::psDirty);
+  byte *pg   = put(pos - offs);
   while (size > dbPageSize - offs) {
     memcpy(pg + offs, obj, dbPageSize - offs);
     unfix(pg);
     size -= dbPageSize - offs;
     pos += dbPageSize - offs;
     obj += dbPageSize - offs;
-    pg   = find(pos, dbPageHeader::psDirty);
+    pg   = put(pos);
     offs = 0;
   }
   memcpy(pg + offs, obj, size);
@@ -253,31 +531,144 @@ static int __cdecl compareOffs(void const *a, void const *b) {
   return pa->offs < pb->offs ? -1 : pa->offs == pb->offs ? 0 : 1;
 }
 
+static int __cdecl compareMappedOffs(void const *a, void const *b) {
+  offs_t pa = *(offs_t *)a;
+  offs_t pb = *(offs_t *)b;
+  return pa < pb ? -1 : pa == pb ? 0 : 1;
+}
+
+/**
+ * Collects pages sorted by offsets in runs of adjacent pages, each run is
+ * written by one vectored write
+ */
+class dbPageWriteBatch {
+  dbFile *                    file;
+  dbSmallBuffer<dbIoVec, 256> iov;
+  int                         runStart; // first buffer of the current run
+  offs_t                      runPos;
+  offs_t                      runEnd;
+
+public:
+  int add(offs_t pos, byte *page) {
+    if ((int)iov.size() != runStart && pos == runEnd) {
+      dbIoVec *last = iov.base() + iov.size() - 1;
+      if ((byte *)last->ptr + last->size == page) {
+        last->size += dbPageSize; // adjacent in memory too
+      } else {
+        dbIoVec *v = iov.append(1);
+        v->ptr     = page;
+        v->size    = dbPageSize;
+      }
+      runEnd += dbPageSize;
+      return dbFile::ok;
+    }
+    int      rc = flush();
+    dbIoVec *v  = iov.append(1);
+    v->ptr     = page;
+    v->size    = dbPageSize;
+    runPos     = pos;
+    runEnd     = pos + dbPageSize;
+    return rc;
+  }
+
+  int flush() {
+    int n = (int)iov.size() - runStart;
+    if (n == 0) { return dbFile::ok; }
+    runStart = (int)iov.size();
+    return file->writev(runPos, iov.base() + runStart - n, n);
+  }
+
+  dbPageWriteBatch(dbFile *f) : file(f), runStart(0), runPos(0), runEnd(0) {}
+};
+
+void dbPagePool::flushMapped() {
+  dbPageWriteBatch batch(file);
+  int              rc = dbFile::ok;
+  qsort(dirtyOffs, nDirtyPages, sizeof(offs_t), compareMappedOffs);
+  for (length_t i = 0; i < nDirtyPages && rc == dbFile::ok; i++) {
+    offs_t   pos   = dirtyOffs[i];
+    length_t chunk = length_t(pos >> dbMapChunkBits);
+    length_t offs  = length_t(pos) & (dbMapChunkSize - 1);
+    rc             = batch.add(pos, chunks[chunk] + offs);
+  }
+  if (rc == dbFile::ok) { rc = batch.flush(); }
+  if (rc != dbFile::ok) {
+    db->throwException(dybase_file_error, "Failed to write page");
+  }
+  for (length_t i = 0; i < nDirtyPages; i++) {
+    offs_t   pos   = dirtyOffs[i];
+    length_t chunk = length_t(pos >> dbMapChunkBits);
+    length_t offs  = length_t(pos) & (dbMapChunkSize - 1);
+    chunkState[chunk][offs >> dbPageBits] = 0;
+    if (pos >= fileSize) { fileSize = pos + dbPageSize; }
+  }
+  nDirtyPages = 0;
+}
+
+void dbPagePool::logMapped(dbWriteAheadLog &wal) {
+  length_t i;
+  db_nat4  n = 0;
+  qsort(dirtyOffs, nDirtyPages, sizeof(offs_t), compareMappedOffs);
+  for (i = 0; i < nDirtyPages; i++) {
+    offs_t pos = dirtyOffs[i];
+    if (!(chunkState[length_t(pos >> dbMapChunkBits)]
+                    [(length_t(pos) & (dbMapChunkSize - 1)) >> dbPageBits] &
+          dbPageHeader::psLogged)) {
+      n += 1;
+    }
+  }
+  wal.beginRecord(n);
+  for (i = 0; i < nDirtyPages; i++) {
+    offs_t   pos   = dirtyOffs[i];
+    length_t chunk = length_t(pos >> dbMapChunkBits);
+    length_t offs  = length_t(pos) & (dbMapChunkSize - 1);
+    byte *   ps    = &chunkState[chunk][offs >> dbPageBits];
+    if (!(*ps & dbPageHeader::psLogged)) {
+      wal.addPage(pos, chunks[chunk] + offs);
+      *ps |= dbPageHeader::psLogged;
+    }
+  }
+}
+
 void dbPagePool::flush() {
   int rc;
-  if (nDirtyPages != 0) {
+  if (nDirtyPages != 0 && db->log != NULL &&
+      db->log->sync() != dbFile::ok) {
+    db->throwException(dybase_file_error, "Failed to sync log");
+  }
+  if (mapped) {
+    flushMapped();
+  } else if (nDirtyPages != 0) {
+    dbPageWriteBatch batch(file);
+    int              i, n = nDirtyPages;
     flushing = true;
     qsort(dirtyPages, nDirtyPages, sizeof(dbPageHeader *), compareOffs);
-    for (int i = 0, n = nDirtyPages; i < n; i++) {
+    // pages are fixed until all runs are written
+    for (i = 0, rc = dbFile::ok; i < n; i++) {
       dbPageHeader *ph = dirtyPages[i];
       if (ph->accessCount++ == 0) {
         pages[ph->next].prev = ph->prev;
         pages[ph->prev].next = ph->next;
       }
+      if ((ph->state & dbPageHeader::psDirty) && rc == dbFile::ok) {
+        rc = batch.add(ph->offs, buffer + (ph - pages - 1) * dbPageSize);
+      }
+    }
+    if (rc == dbFile::ok) { rc = batch.flush(); }
+    if (rc != dbFile::ok) {
+      db->throwException(dybase_file_error, "Failed to write page");
+    }
+    for (i = 0; i < n; i++) {
+      dbPageHeader *ph = dirtyPages[i];
       if (ph->state & dbPageHeader::psDirty) {
-        // printf("Flush page " INT8_FORMAT "\n", ph->offs);
-        rc = file->write(ph->offs, buffer + (ph - pages - 1) * dbPageSize,
-                         dbPageSize);
-        if (rc != dbFile::ok) {
-          db->throwException(dybase_file_error, "Failed to write page");
-        }
-        ph->state &= ~dbPageHeader::psDirty;
+        ph->state &= ~(dbPageHeader::psDirty | dbPageHeader::psLogged);
         if (ph->offs >= fileSize) { fileSize = ph->offs + dbPageSize; }
       }
       if (--ph->accessCount == 0) {
-        ph->next    = pages->next;
-        ph->prev    = 0;
-        pages->next = pages[ph->next].prev = int(ph - pages);
+        int list         = lruList(ph);
+        ph->next         = pages[list].next;
+        ph->prev         = list;
+        pages[list].next = pages[ph->next].prev = int(ph - pages);
       }
     }
     flushing    = false;
@@ -287,6 +678,30 @@ void dbPagePool::flush() {
   if (rc != dbFile::ok) {
     db->throwException(dybase_file_error, "Failed to flush pages pool");
   }
+  unloggedWrite = false;
+}
+
+void dbPagePool::log(dbWriteAheadLog &wal) {
+  if (mapped) {
+    logMapped(wal);
+    return;
+  }
+  int     i;
+  db_nat4 n = 0;
+  qsort(dirtyPages, nDirtyPages, sizeof(dbPageHeader *), compareOffs);
+  for (i = 0; i < (int)nDirtyPages; i++) {
+    dbPageHeader *ph    = dirtyPages[i];
+    ph->writeQueueIndex = i;
+    if (!(ph->state & dbPageHeader::psLogged)) { n += 1; }
+  }
+  wal.beginRecord(n);
+  for (i = 0; i < (int)nDirtyPages; i++) {
+    dbPageHeader *ph = dirtyPages[i];
+    if (!(ph->state & dbPageHeader::psLogged)) {
+      wal.addPage(ph->offs, buffer + (ph - pages - 1) * dbPageSize);
+      ph->state |= dbPageHeader::psLogged;
+    }
+  }
 }
 
 void dbGetTie::set(dbPagePool &pool, offs_t pos) {
@@ -294,7 +709,12 @@ void dbGetTie::set(dbPagePool &pool, offs_t pos) {
   int      offs = (int)pos & (dbPageSize - 1);
   byte *   p    = pool.get(pos - offs);
   length_t size = ((dbObject *)(p + offs))->size;
-  if (offs + size > dbPageSize) {
+  if (offs + size > dbPageSize &&
+      (obj = pool.mapObject(pos, size, 0)) != NULL) {
+    // pages of the object are contiguous in the mapping
+    this->pool = &pool;
+    page       = p;
+  } else if (offs + size > dbPageSize) {
     byte *dst = new byte[size];
     obj       = dst;
     memcpy(dst, p + offs, dbPageSize - offs);
@@ -344,7 +764,11 @@ void dbPutTie::set(dbPagePool &pool, oid_t oid, offs_t pos, length_t size) {
 
   int   offs = (int)pos & (dbPageSize - 1);
   byte *p    = pool.put(pos - offs);
-  if (offs + size > dbPageSize) {
+  if (offs + size > dbPageSize &&
+      (obj = pool.mapObject(pos, size, dbPageHeader::psDirty)) != NULL) {
+    // pages of the object are contiguous in the mapping
+    page = p;
+  } else if (offs + size > dbPageSize) {
     this->size = size;
     this->pos  = pos;
     byte *dst  = new byte[size];
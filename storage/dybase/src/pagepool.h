@@ -25,14 +25,34 @@ public:
   int    state;
   enum PageState {  // flag in accessCount field
     psDirty = 0x01, // page has been modified
-    psRaw   = 0x02, // page is loaded from the disk
-    psWait  = 0x04  // other thread(s) wait load operation completion
+    psRaw    = 0x02, // page is loaded from the disk
+    psWait   = 0x04, // other thread(s) wait load operation completion
+    psLogged = 0x08, // image of the dirty page is in the write-ahead log
+    psHot    = 0x10  // page is in the hot (main) queue of 2Q policy
   };
 };
 
 class dbGetTie;
 class dbPutTie;
 class dbDatabase;
+class dbWriteAheadLog;
+
+/**
+ * In memory mapped mode the file is mapped by chunks of this size. Chunks are
+ * never remapped, so pointers to the mapped pages remain valid while the pool
+ * is opened.
+ */
+const length_t dbMapChunkBits = 22;
+const length_t dbMapChunkSize = 1 << dbMapChunkBits;
+
+/**
+ * Policy of selecting page to be thrown away from the pool
+ */
+enum dbPageReplacementPolicy {
+  dbLruReplacement, // single LRU list
+  db2QReplacement   // 2Q: pages accessed once (scans) are kept in small cold
+                    // queue and do not displace hot pages
+};
 
 class dbPagePool {
   friend class dbGetTie;
@@ -53,7 +73,38 @@ protected:
   length_t    bufferSize;
   offs_t      fileSize;
 
-  int flushing;
+  int  flushing;
+  bool unloggedWrite; // dirty page not present in the log was written to file
+
+  // Page slots are assigned to the file offsets only with this mutex locked,
+  // so readers of database snapshots can copy cached pages by share() from
+  // other threads. Hits of the owner thread do not lock it.
+  dbMutex mutex;
+
+  // 2Q replacement policy
+  dbPageReplacementPolicy policy;
+  int                     hotList;    // head of LRU list of hot pages
+  length_t                coldPages;  // number of loaded cold pages
+  offs_t *                ghostOffs;  // FIFO of recently thrown cold pages
+  int *                   ghostChain; // collision chains of ghost hash table
+  int *                   ghostHash;
+  length_t                ghostSize;
+  length_t                ghostPos;
+
+  db_nat8 hits;
+  db_nat8 misses;
+  db_nat8 evictions;
+
+  // memory mapped mode
+  bool     mapped;       // pages are accessed through the file mapping
+  byte **  chunks;       // mapped chunks of the file (NULL if not mapped yet)
+  byte **  chunkState;   // PageState flags of the pages of each chunk
+  length_t nChunks;      // size of chunks and chunkState arrays
+  offs_t   mappedSize;   // size of the file which can be mapped
+  offs_t   initFileSize; // size of the file when pool was opened
+  byte *   zeroPage;     // page beyond the end of read-only file
+  offs_t * dirtyOffs;    // offsets of the modified mapped pages
+  length_t dirtyOffsSize;
 
   enum {
     initialWobArraySize = 8,
@@ -66,10 +117,28 @@ protected:
   dbPageHeader **dirtyPages;
 
   byte *find(offs_t addr, int state);
+  int   victim();
+  void  addGhost(offs_t addr);
+  bool  removeGhost(offs_t addr);
+  int   lruList(dbPageHeader *ph) {
+    return (ph->state & dbPageHeader::psHot) ? hotList : 0;
+  }
+  bool  cached(offs_t addr);
+  byte *findMapped(offs_t addr, int state);
+  void  mapChunk(length_t i);
+  void  flushMapped();
+  void  logMapped(dbWriteAheadLog &wal);
+  void  closeMapped();
 
 public:
-  byte *get(offs_t addr) { return find(addr, 0); }
-  byte *put(offs_t addr) { return find(addr, dbPageHeader::psDirty); }
+  byte *get(offs_t addr) {
+    return mapped ? findMapped(addr, 0) : find(addr, 0);
+  }
+  byte *put(offs_t addr) {
+    return mapped ? findMapped(addr, dbPageHeader::psDirty)
+                  : find(addr, dbPageHeader::psDirty);
+  }
+  byte *mapObject(offs_t pos, length_t size, int state);
   void  put(offs_t addr, byte *obj, length_t size);
   void  copy(offs_t dst, offs_t src, length_t size);
   void  unfix(void *ptr);
@@ -79,10 +148,45 @@ public:
   bool  open(dbFile *file, offs_t fileSize);
   void  close();
   void  flush();
-
-  bool destructed() { return pages == NULL; }
-
-  dbPagePool(dbDatabase *dbs, length_t size) : db(dbs), poolSize(size) {}
+  void  log(dbWriteAheadLog &wal);
+
+  /**
+   * Copy the page if it is present in the pool. It can be called from any
+   * thread concurrently with the owner of the pool.
+   * @param addr offset of the page
+   * @param buf buffer of dbPageSize bytes
+   * @return <code>false</code> if the page is not cached
+   */
+  bool share(offs_t addr, byte *buf);
+
+  /**
+   * Read pages which are not present in the pool
+   * @param addrs sorted offsets of the pages
+   * @param n number of pages, only part of them fitting in the pool is loaded
+   * @param readAhead let the operating system read all pages asynchronously
+   * before they are requested
+   */
+  void prefetch(offs_t *addrs, length_t n, bool readAhead);
+
+  bool destructed() { return pages == NULL && chunks == NULL; }
+
+  /**
+   * Access pages through memory mapping of the database file instead of
+   * copying them to the pool buffer. Should be called before open().
+   */
+  void setMapped(bool enabled) { mapped = enabled; }
+
+  /**
+   * Set page replacement policy. Should be called before open().
+   */
+  void setReplacementPolicy(dbPageReplacementPolicy p) { policy = p; }
+
+  db_nat8 getHits() { return hits; }
+  db_nat8 getMisses() { return misses; }
+  db_nat8 getEvictions() { return evictions; }
+
+  dbPagePool(dbDatabase *dbs, length_t size)
+      : db(dbs), poolSize(size), policy(dbLruReplacement), mapped(false) {}
 };
 
 class dbGetTie {
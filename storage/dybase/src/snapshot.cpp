@@ -0,0 +1,68 @@
+//-< SNAPSHOT.CPP >--------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// File of the read-only database snapshot
+//-------------------------------------------------------------------*--------*
+
+#include "stdtp.h"
+#include "database.h"
+#include "snapshot.h"
+
+#include <errno.h>
+
+int dbSnapshotFile::open(dbDatabase *source) {
+  int curr     = source->curr;
+  this->source = source;
+  header       = (byte *)dbFile::allocateBuffer(dbPageSize);
+  memcpy(header, source->header, dbPageSize);
+  // both roots of the snapshot describe the committed state
+  dbHeader *hdr = (dbHeader *)header;
+  hdr->curr     = curr;
+  hdr->dirty    = false;
+  hdr->root[1 - curr] = hdr->root[curr];
+
+  indexPos  = hdr->root[curr].index;
+  indexSize = DOALIGN(hdr->root[curr].indexUsed * sizeof(offs_t), dbPageSize);
+  index     = (byte *)dbFile::allocateBuffer(indexSize);
+  for (length_t offs = 0; offs < indexSize; offs += dbPageSize) {
+    int rc = source->readCommittedPage(indexPos + offs, index + offs);
+    if (rc != ok) { return rc; }
+  }
+  return ok;
+}
+
+dbSnapshotFile::~dbSnapshotFile() {
+  if (header != NULL) { dbFile::deallocateBuffer(header, dbPageSize); }
+  if (index != NULL) { dbFile::deallocateBuffer(index, indexSize); }
+}
+
+int dbSnapshotFile::read(offs_t pos, void *buf, length_t size) {
+  assert((pos & (dbPageSize - 1)) == 0 && (size & (dbPageSize - 1)) == 0);
+  for (byte *dst = (byte *)buf; size != 0; size -= dbPageSize) {
+    if (pos == 0) {
+      memcpy(dst, header, dbPageSize);
+    } else if (pos - indexPos < indexSize) {
+      memcpy(dst, index + (pos - indexPos), dbPageSize);
+    } else {
+      int rc = source->readCommittedPage(pos, dst);
+      if (rc != ok) { return rc; }
+    }
+    pos += dbPageSize;
+    dst += dbPageSize;
+  }
+  return ok;
+}
+
+int dbSnapshotFile::write(offs_t, void const *, length_t) {
+  return EACCES; // snapshot is read-only
+}
+
+int dbSnapshotFile::writev(offs_t, dbIoVec const *, int) { return EACCES; }
+
+void dbSnapshotFile::advise(offs_t pos, length_t size) {
+  source->file->advise(pos, size);
+}
@@ -0,0 +1,57 @@
+//-< SNAPSHOT.H >----------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// File of the read-only database snapshot
+//-------------------------------------------------------------------*--------*
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+/**
+ * File through which snapshot reads the committed state of the source
+ * database. The header and the object index are copied when the snapshot is
+ * created, because the source overwrites them by the next commits. Other
+ * pages are taken from the page pool of the source or read from its file:
+ * the source does not reuse space of the objects visible to the snapshot.
+ */
+class dbSnapshotFile : public dbFile {
+  dbDatabase *source;
+  byte *      header;    // image of the header page
+  offs_t      indexPos;  // position of the committed object index
+  length_t    indexSize; // size of the index image (bytes)
+  byte *      index;     // image of the used part of the index
+
+public:
+  virtual int flush() { return ok; }
+  virtual int close() { return ok; }
+
+  virtual int setSize(offs_t) { return ok; }
+  virtual int getSize(offs_t &) { return eof; }
+
+  virtual int write(offs_t, void const *, length_t);
+  virtual int read(offs_t pos, void *ptr, length_t size);
+  virtual int writev(offs_t, dbIoVec const *, int);
+
+  // snapshot is not mapped in memory: source could replace its pages
+  virtual void *map(offs_t, length_t) { return NULL; }
+  virtual void  advise(offs_t pos, length_t size);
+
+  /**
+   * Copy header and object index of the last committed state. Should be
+   * called with the mutex of the source locked.
+   * @return dbFile::ok or error code
+   */
+  int open(dbDatabase *source);
+
+  dbSnapshotFile() {
+    header = NULL;
+    index  = NULL;
+  }
+  ~dbSnapshotFile();
+};
+
+#endif
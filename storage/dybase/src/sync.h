@@ -13,6 +13,7 @@
 
 #if defined(_WIN32)
 class dbMutex {
+  friend class dbLocalEvent;
   CRITICAL_SECTION cs;
 
 public:
@@ -22,6 +23,17 @@ public:
   void unlock() { LeaveCriticalSection(&cs); }
 };
 
+class dbLocalEvent {
+  CONDITION_VARIABLE cond;
+
+public:
+  dbLocalEvent() { InitializeConditionVariable(&cond); }
+  void wait(dbMutex &mutex) {
+    SleepConditionVariableCS(&cond, &mutex.cs, INFINITE);
+  }
+  void pulse() { WakeAllConditionVariable(&cond); }
+};
+
 #else // Unix
 
 #ifndef NO_PTHREADS
@@ -33,6 +45,7 @@ public:
 class dbMutex {
   friend class dbEvent;
   friend class dbSemaphore;
+  friend class dbLocalEvent;
   pthread_mutex_t cs;
 
 public:
@@ -42,6 +55,16 @@ public:
   void unlock() { pthread_mutex_unlock(&cs); }
 };
 
+class dbLocalEvent {
+  pthread_cond_t cond;
+
+public:
+  dbLocalEvent() { pthread_cond_init(&cond, NULL); }
+  ~dbLocalEvent() { pthread_cond_destroy(&cond); }
+  void wait(dbMutex &mutex) { pthread_cond_wait(&cond, &mutex.cs); }
+  void pulse() { pthread_cond_broadcast(&cond); }
+};
+
 #else
 
 class dbMutex {
@@ -50,6 +73,12 @@ public:
   void unlock() {}
 };
 
+class dbLocalEvent {
+public:
+  void wait(dbMutex &) {}
+  void pulse() {}
+};
+
 #endif
 
 #endif
@@ -0,0 +1,167 @@
+//-< WAL.CPP >-------------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// Write-ahead log implementation
+//-------------------------------------------------------------------*--------*
+
+#include "stdtp.h"
+#include "database.h"
+
+static db_nat4 calculateChecksum(byte *p, length_t size) {
+  db_nat4  h = 0;
+  db_nat4 *w = (db_nat4 *)p;
+  for (length_t n = size / sizeof(db_nat4); n != 0; n--) {
+    h = ((h << 1) | (h >> 31)) ^ *w++;
+  }
+  return h;
+}
+
+dbWriteAheadLog::dbWriteAheadLog() {
+  record        = NULL;
+  recordSize    = 0;
+  recordBufSize = 0;
+  nPages        = 0;
+  logSize       = 0;
+  writtenLsn    = 0;
+  syncedLsn     = 0;
+  syncing       = false;
+}
+
+dbWriteAheadLog::~dbWriteAheadLog() {
+  if (record != NULL) { dbFile::deallocateBuffer(record, recordBufSize); }
+}
+
+byte *dbWriteAheadLog::reserve(length_t size) {
+  if (size > recordBufSize) {
+    length_t newSize = size > recordBufSize * 2 ? size : recordBufSize * 2;
+    if (record != NULL) { dbFile::deallocateBuffer(record, recordBufSize); }
+    record        = (byte *)dbFile::allocateBuffer(newSize);
+    recordBufSize = newSize;
+  }
+  return record;
+}
+
+int dbWriteAheadLog::open(char const *name, bool readOnly) {
+  return file.open(name, readOnly ? dbFile::read_only : dbFile::sequential);
+}
+
+bool dbWriteAheadLog::recover(dbFile *db, bool readOnly) {
+  dbLogRecordHeader hdr;
+  db_nat8           pos = 0;
+  offs_t            fileSize;
+  if (file.getSize(fileSize) != dbFile::ok) { return false; }
+
+  // header of the last complete record: record bodies are read into the
+  // record buffer, so a torn tail can not overwrite it
+  byte *header  = (byte *)dbFile::allocateBuffer(dbPageSize);
+  bool  applied = false;
+  bool  ok      = true;
+  while (file.read(pos, &hdr, sizeof hdr) == dbFile::ok &&
+         hdr.magic == dbLogRecordMagic && hdr.nPages < (1 << 24)) {
+    db_nat8 bodySize = (db_nat8)hdr.nPages * sizeof(db_nat8) +
+                       ((db_nat8)hdr.nPages + 1) * dbPageSize;
+    if (pos + sizeof hdr + bodySize > (db_nat8)fileSize) {
+      break; // truncated record: transaction was not committed
+    }
+    byte *body = reserve(length_t(bodySize));
+    if (file.read(pos + sizeof hdr, body, length_t(bodySize)) != dbFile::ok ||
+        calculateChecksum(body, length_t(bodySize)) != hdr.checksum) {
+      break; // incomplete record: transaction was not committed
+    }
+    if (readOnly) {
+      ok = false;
+      break;
+    }
+    db_nat8 *offs  = (db_nat8 *)body;
+    byte *   pages = body + hdr.nPages * sizeof(db_nat8);
+    for (db_nat4 i = 0; i < hdr.nPages && ok; i++) {
+      ok = db->write(offs_t(offs[i]), pages + (i + 1) * dbPageSize,
+                     dbPageSize) == dbFile::ok;
+    }
+    if (!ok) { break; }
+    // header is written after all pages of the last record
+    memcpy(header, pages, dbPageSize);
+    applied = true;
+    pos += sizeof hdr + bodySize;
+  }
+  if (ok && applied) {
+    TRACE_MSG(("Replayed " INT8_FORMAT " bytes of the log\n", pos));
+    ok = db->write(0, header, dbPageSize) == dbFile::ok &&
+         db->flush() == dbFile::ok;
+  }
+  dbFile::deallocateBuffer(header, dbPageSize);
+  // the log is discarded only when the replayed header is on the disk
+  return ok && (readOnly || truncate() == dbFile::ok);
+}
+
+void dbWriteAheadLog::beginRecord(db_nat4 nPages) {
+  this->nPages = 0;
+  length_t size = sizeof(dbLogRecordHeader) + nPages * sizeof(db_nat8) +
+                  (nPages + 1) * dbPageSize;
+  reserve(size);
+  recordSize = size;
+  ((dbLogRecordHeader *)record)->nPages = nPages;
+}
+
+void dbWriteAheadLog::addPage(offs_t pos, byte *page) {
+  dbLogRecordHeader *hdr = (dbLogRecordHeader *)record;
+  assert(nPages < hdr->nPages);
+  db_nat8 *offs  = (db_nat8 *)(hdr + 1);
+  byte *   pages = (byte *)(offs + hdr->nPages);
+  offs[nPages]   = pos;
+  memcpy(pages + (nPages + 1) * dbPageSize, page, dbPageSize);
+  nPages += 1;
+}
+
+int dbWriteAheadLog::endRecord(dbHeader *header, db_nat8 &lsn) {
+  dbLogRecordHeader *hdr = (dbLogRecordHeader *)record;
+  assert(nPages == hdr->nPages);
+  byte *body = (byte *)(hdr + 1);
+  memcpy(body + nPages * sizeof(db_nat8), header, dbPageSize);
+  hdr->magic    = dbLogRecordMagic;
+  hdr->reserved = 0;
+  hdr->checksum = calculateChecksum(body, recordSize - sizeof(*hdr));
+  int rc        = file.write(offs_t(logSize), record, recordSize);
+  if (rc != dbFile::ok) { return rc; }
+  logSize += recordSize;
+  dbCriticalSection cs(syncMutex);
+  writtenLsn += recordSize;
+  lsn = writtenLsn;
+  return dbFile::ok;
+}
+
+int dbWriteAheadLog::sync(db_nat8 lsn) {
+  dbCriticalSection cs(syncMutex);
+  while (syncedLsn < lsn) {
+    if (syncing) {
+      syncEvent.wait(syncMutex);
+      continue;
+    }
+    // become the leader: records appended so far are covered by this fsync
+    db_nat8 target = writtenLsn;
+    syncing        = true;
+    syncMutex.unlock();
+    int rc = file.flush();
+    syncMutex.lock();
+    syncing = false;
+    if (rc == dbFile::ok && target > syncedLsn) { syncedLsn = target; }
+    syncEvent.pulse();
+    if (rc != dbFile::ok) { return rc; }
+  }
+  return dbFile::ok;
+}
+
+int dbWriteAheadLog::truncate() {
+  int rc = file.setSize(0);
+  if (rc == dbFile::ok) { rc = file.flush(); }
+  if (rc == dbFile::ok) {
+    logSize = 0;
+    dbCriticalSection cs(syncMutex);
+    syncedLsn = writtenLsn;
+  }
+  return rc;
+}
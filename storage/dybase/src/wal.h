@@ -0,0 +1,127 @@
+//-< WAL.H >---------------------------------------------------------*--------*
+// GigaBASE                  Version 1.0         (c) 1999  GARRET    *     ?  *
+// (Post Relational Database Management System)                      *   /\|  *
+//                                                                   *  /  \  *
+//                          Created:     16-Oct-26                   * / [] \ *
+//                          Last update: 16-Oct-26                   * GARRET *
+//-------------------------------------------------------------------*--------*
+// Write-ahead log of committed pages
+//-------------------------------------------------------------------*--------*
+
+#ifndef __WAL_H__
+#define __WAL_H__
+
+class dbHeader;
+
+/**
+ * Default size of the log after which it is folded into the database file
+ */
+const length_t dbDefaultCheckpointSize = 16 * 1024 * 1024;
+
+/**
+ * Header of the log record. It is followed by offsets of the page images
+ * (db_nat8 each), image of the database header and page images.
+ */
+struct dbLogRecordHeader {
+  db_nat4 magic;
+  db_nat4 nPages;   // number of page images, database header not included
+  db_nat4 checksum; // checksum of the record body
+  db_nat4 reserved;
+};
+
+const db_nat4 dbLogRecordMagic = 0x4C415744; // "DWAL"
+
+/**
+ * Write-ahead log. In this mode commit appends one sequential record with
+ * images of the pages modified by the transaction instead of writing them to
+ * the database file. Records are folded into the database file by checkpoint
+ * and replayed by recovery when database is opened.
+ */
+class dbWriteAheadLog {
+  dbFile       file;
+  byte *       record;     // buffer where the record is assembled
+  length_t     recordSize; // used part of the buffer
+  length_t     recordBufSize;
+  db_nat4      nPages;     // number of pages added to the current record
+  db_nat8      logSize;    // size of the log file
+  db_nat8      writtenLsn; // logical position of the end of the last record
+  db_nat8      syncedLsn;  // logical position up to which log is synced
+  bool         syncing;    // some committer performs fsync now
+  dbMutex      syncMutex;
+  dbLocalEvent syncEvent;
+
+  /**
+   * Get record buffer of at least the specified size, its old content is
+   * not preserved
+   */
+  byte *reserve(length_t size);
+
+public:
+  /**
+   * Open log file
+   * @param name log file name
+   * @param readOnly open existed log (if any) only for reading
+   * @return dbFile::ok or error code
+   */
+  int open(char const *name, bool readOnly);
+
+  /**
+   * Replay complete records of the log into the database file and truncate
+   * the log
+   * @param db database file
+   * @param readOnly fail if log is not empty
+   * @return <code>true</code> if log was successfully applied
+   */
+  bool recover(dbFile *db, bool readOnly);
+
+  /**
+   * Start new record
+   * @param nPages number of pages which will be added to the record
+   */
+  void beginRecord(db_nat4 nPages);
+
+  /**
+   * Add image of the page to the record
+   */
+  void addPage(offs_t pos, byte *page);
+
+  /**
+   * Write record terminated by the image of the database header
+   * @param header database header
+   * @param lsn [out] log sequence number to be passed to sync()
+   * @return dbFile::ok or error code
+   */
+  int endRecord(dbHeader *header, db_nat8 &lsn);
+
+  /**
+   * Wait until the log is synced up to the specified position. Concurrent
+   * committers share one fsync: only one of them flushes the file, others
+   * wait for its completion.
+   * @return dbFile::ok or error code
+   */
+  int sync(db_nat8 lsn);
+
+  /**
+   * Sync all written records
+   */
+  int sync() { return sync(writtenLsn); }
+
+  /**
+   * Discard log content, it should be called after all pages are written
+   * to the database file
+   */
+  int truncate();
+
+  db_nat8 size() { return logSize; }
+
+  void getWriteStatistic(db_nat8 &writes, db_nat8 &bytes) {
+    file.getWriteStatistic(writes, bytes);
+  }
+
+  int close() { return file.close(); }
+
+  dbWriteAheadLog();
+  ~dbWriteAheadLog();
+};
+
+#endif
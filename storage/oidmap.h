@@ -0,0 +1,192 @@
+/*
+ * QuickJS storage: oid -> object table
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef OIDMAP_H
+#define OIDMAP_H
+
+#include <assert.h>
+#include <string.h>
+#include "../quickjs.h"
+#include "dybase/include/dybase.h"
+
+/*
+ * Open addressing hash table with linear probing, keyed by object identifier.
+ * Slots hold the key and the value side by side, a lookup usually touches one
+ * cache line. Identifier 0 is never allocated by dybase and marks an empty slot,
+ * a slot with non-zero identifier and NULL value is a removed entry (tombstone).
+ *
+ * Removal never moves entries, so callbacks of db_oidmap_each() can remove any
+ * entries, including the current one. Tombstones are dropped when the table is
+ * rehashed, which happens only on insertion. Insertion during iteration is
+ * allowed as well: if it rehashes the table the iteration starts again from the
+ * beginning, so entries which are not removed by the callback can be visited
+ * twice.
+ */
+
+typedef struct db_oidmap_entry {
+  dybase_oid_t oid;
+  void *       obj;
+} db_oidmap_entry;
+
+typedef struct db_oidmap {
+  db_oidmap_entry *entries;
+  size_t           mask;       // capacity - 1, capacity is a power of 2 or 0
+  size_t           count;      // number of entries
+  size_t           used;       // number of entries and tombstones
+  int              shift;      // 64 - log2(capacity)
+  unsigned         generation; // incremented on each rehash
+} db_oidmap;
+
+// if it returns non-zero - stops enumeration
+typedef int db_oidmap_cb(dybase_oid_t oid, void *obj, void *opaque);
+
+#define DB_OIDMAP_MIN_CAPACITY 16
+
+static inline void db_oidmap_init(db_oidmap *m) {
+  memset(m, 0, sizeof(*m));
+}
+
+// Fibonacci hashing: top bits of the product, identifiers which differ in low
+// bits only, or by a power of 2, still spread over the whole table
+static inline size_t db_oidmap_slot(const db_oidmap *m, dybase_oid_t oid) {
+  return (size_t)(((uint64_t)oid * 0x9E3779B97F4A7C15ULL) >> m->shift);
+}
+
+static inline void *db_oidmap_get(const db_oidmap *m, dybase_oid_t oid) {
+  if (!m->entries)
+    return NULL;
+  for (size_t i = db_oidmap_slot(m, oid);; i = (i + 1) & m->mask) {
+    db_oidmap_entry *e = &m->entries[i];
+    if (e->oid == oid)
+      return e->obj;
+    if (!e->oid)
+      return NULL;
+  }
+}
+
+// rehashes the table to the capacity which keeps it at most half full
+static inline int db_oidmap_resize(JSContext *ctx, db_oidmap *m) {
+  size_t capacity = DB_OIDMAP_MIN_CAPACITY;
+  int    bits = 4;
+  while (capacity < (m->count + 1) * 2) {
+    capacity <<= 1;
+    bits += 1;
+  }
+  db_oidmap_entry *entries = js_mallocz(ctx, capacity * sizeof(db_oidmap_entry));
+  if (!entries)
+    return -1;
+  db_oidmap_entry *old = m->entries;
+  size_t old_capacity = old ? m->mask + 1 : 0;
+  m->entries = entries;
+  m->mask = capacity - 1;
+  m->shift = 64 - bits;
+  m->used = m->count;
+  m->generation += 1;
+  for (size_t j = 0; j < old_capacity; j++) {
+    if (!old[j].obj)
+      continue;
+    size_t i = db_oidmap_slot(m, old[j].oid);
+    while (entries[i].oid)
+      i = (i + 1) & m->mask;
+    entries[i] = old[j];
+  }
+  js_free(ctx, old);
+  return 0;
+}
+
+// adds or replaces the entry, returns -1 if out of memory
+static inline int db_oidmap_put(JSContext *ctx, db_oidmap *m, dybase_oid_t oid, void *obj) {
+  assert(oid && obj);
+  // load factor including tombstones is kept below 3/4
+  if ((m->used + 1) * 4 > (m->entries ? m->mask + 1 : 0) * 3 && db_oidmap_resize(ctx, m))
+    return -1;
+  db_oidmap_entry *tombstone = NULL;
+  for (size_t i = db_oidmap_slot(m, oid);; i = (i + 1) & m->mask) {
+    db_oidmap_entry *e = &m->entries[i];
+    if (e->oid == oid) {
+      if (!e->obj)
+        m->count += 1;
+      e->obj = obj;
+      return 0;
+    }
+    if (!e->oid) {
+      if (tombstone)
+        e = tombstone;
+      else
+        m->used += 1;
+      e->oid = oid;
+      e->obj = obj;
+      m->count += 1;
+      return 0;
+    }
+    if (!e->obj && !tombstone)
+      tombstone = e;
+  }
+}
+
+// removes the entry, returns its value or NULL if there is no such entry
+static inline void *db_oidmap_remove(db_oidmap *m, dybase_oid_t oid) {
+  if (!m->entries)
+    return NULL;
+  for (size_t i = db_oidmap_slot(m, oid);; i = (i + 1) & m->mask) {
+    db_oidmap_entry *e = &m->entries[i];
+    if (e->oid == oid) {
+      void *obj = e->obj;
+      if (obj) {
+        e->obj = NULL; // keep the identifier: probe sequences pass through
+        m->count -= 1;
+      }
+      return obj;
+    }
+    if (!e->oid)
+      return NULL;
+  }
+}
+
+// calls cb for each entry, returns non-zero if stopped by the callback
+static inline int db_oidmap_each(db_oidmap *m, db_oidmap_cb *cb, void *opaque) {
+  // the table and its capacity are reloaded at each step: the callback can change them
+  for (size_t i = 0; m->entries && i <= m->mask; i++) {
+    db_oidmap_entry *e = &m->entries[i];
+    if (!e->obj)
+      continue;
+    unsigned generation = m->generation;
+    if (cb(e->oid, e->obj, opaque))
+      return 1;
+    if (m->generation != generation)
+      i = (size_t)-1; // rehashed - start again
+  }
+  return 0;
+}
+
+static inline void db_oidmap_clear(db_oidmap *m) {
+  if (m->entries)
+    memset(m->entries, 0, (m->mask + 1) * sizeof(db_oidmap_entry));
+  m->count = 0;
+  m->used = 0;
+}
+
+static inline void db_oidmap_free(JSContext *ctx, db_oidmap *m) {
+  js_free(ctx, m->entries);
+  db_oidmap_init(m);
+}
+
+#endif
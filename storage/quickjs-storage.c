@@ -29,6 +29,7 @@
 #include "../cutils.h"
 #include "dybase/include/dybase.h"
 #include "quickjs-storage.h"
+#include "oidmap.h"
 
 enum {
   __JS_ATOM_NULL = JS_ATOM_NULL,
@@ -44,11 +45,78 @@ JSValue JS_GetLocalValue(JSContext *ctx, JSAtom name);
 typedef struct JSStorage {
   dybase_storage_t hs;
   JSContext*       ctx;
-  hashtable_t      oid2obj;
+  db_oidmap        oid2obj; // oid -> obj, loaded objects
+  db_oidmap        dirty;   // oid -> obj, objects in JS_PERSISTENT_MODIFIED state, written on next commit
   JSValue          classname2proto;
   JSValue          root;
+  int              prefetch; // number of objects whose pages are read in one batch
+  db_oidmap        shapes;   // class id -> db_shape, atoms of the field names of stored shapes
+  db_oidmap        shape_counts; // hash of the keys -> number of objects stored with them
+  size_t           loaded_size;  // estimated memory taken by the data of loaded objects
+  size_t           memory_limit; // clean objects are unloaded when loaded_size exceeds it, 0 - no limit
+  size_t           unload_threshold; // loaded_size which starts the next unloading
+  size_t           clock_hand;   // slot of oid2obj where the search of objects to unload continues
+  size_t           value_bytes;  // bytes of strings and buffers of the object being loaded or stored
+  int64_t          unloaded;     // number of objects unloaded since open
 } JSStorage;
 
+// Estimated memory taken by the loaded object: the object itself with its
+// persistent block, a slot per property or element, and the bytes of strings
+// and buffers it holds.
+#define DB_OBJECT_SIZE 96
+#define DB_VALUE_SIZE  16
+
+// Plain objects with up to this number of keys are stored by shape: key names
+// go to the class descriptor shared by all objects with the same keys, the record
+// holds only the values. Larger objects are dictionaries rather than records and
+// are stored as maps, as well as objects with integer keys.
+#define DB_MAX_SHAPE_FIELDS 32
+
+// Class descriptors are never removed and are all loaded on open, so the keys
+// get their class only when this number of objects with them were stored since
+// the storage was opened (or when an object of their class was loaded). Until
+// then, and for dictionaries with varying keys, objects are stored as maps.
+#define DB_SHAPE_MIN_OBJECTS 4
+// Counts of the keys seen less than DB_SHAPE_MIN_OBJECTS times are dropped
+// when there are this number of counted key sets
+#define DB_MAX_SHAPE_COUNTS 4096
+
+typedef struct db_shape {
+  dybase_oid_t cid;
+  int          count; // number of atoms resolved so far
+  JS_BOOL      counted; // its keys are in shape_counts
+  JSAtom       atoms[DB_MAX_SHAPE_FIELDS];
+} db_shape;
+
+// hash of the keys of a shape: FNV-1a of their atoms, started with DB_SHAPE_HASH_INIT.
+// It is used as the key of shape_counts, so 0 is replaced by 1 at the end.
+#define DB_SHAPE_HASH_INIT 2166136261u
+
+static inline uint32_t db_shape_hash(uint32_t h, JSAtom atom) {
+  return (h ^ atom) * 16777619u;
+}
+
+static int db_drop_shape_count(dybase_oid_t hash, void* data, void* opaque) {
+  if ((uintptr_t)data < DB_SHAPE_MIN_OBJECTS)
+    db_oidmap_remove((db_oidmap *)opaque, hash);
+  return 0;
+}
+
+// counts the object with these keys, returns true if it should be stored by shape
+static JS_BOOL db_count_shape(JSContext *ctx, JSStorage* pst, JSPropertyEnum *tab, uint32_t len) {
+  uint32_t hash = DB_SHAPE_HASH_INIT;
+  for (uint32_t n = 0; n < len; ++n)
+    hash = db_shape_hash(hash, tab[n].atom);
+  hash += !hash;
+  uintptr_t count = (uintptr_t)db_oidmap_get(&pst->shape_counts, hash);
+  if (count >= DB_SHAPE_MIN_OBJECTS)
+    return TRUE;
+  if (!count && pst->shape_counts.count >= DB_MAX_SHAPE_COUNTS)
+    db_oidmap_each(&pst->shape_counts, &db_drop_shape_count, &pst->shape_counts);
+  db_oidmap_put(ctx, &pst->shape_counts, hash, (void *)(count + 1));
+  return count + 1 >= DB_SHAPE_MIN_OBJECTS;
+}
+
 static JSClassID js_storage_class_id = 0;
 static JSClassID js_index_class_id = 0;
 static JSClassID js_index_iterator_class_id = 0;
@@ -60,25 +128,53 @@ void errHandler(int error_code, char const *msg) {
 
 
 #define JS_CLASS_OBJECT 1
+
 #define JS_CLASS_ARRAY 2
 
+typedef int js_collection_cb(JSContext *ctx, JSValueConst key, JSValueConst value, void *opaque);
+JS_BOOL js_is_collection(JSValueConst val, JS_BOOL *pis_set);
+JSValue js_new_collection(JSContext *ctx, JS_BOOL is_set);
+uint32_t js_collection_size(JSValueConst obj);
+int js_collection_add(JSContext *ctx, JSValueConst obj, JSValueConst key, JSValueConst value);
+int js_collection_each(JSContext *ctx, JSValueConst obj, js_collection_cb *cb, void *opaque);
+
 JS_BOOL js_is_persitable(JSValue val) {
   JSClassID cid = JS_GetClassID(val);
-  return cid == JS_CLASS_OBJECT || cid == JS_CLASS_ARRAY || cid == js_index_class_id;
+  return cid == JS_CLASS_OBJECT || cid == JS_CLASS_ARRAY || cid == js_index_class_id || js_is_collection(val, NULL);
 }
 
-JS_BOOL js_set_persistent_rt(JSRuntime* rt, JSValue val, struct JSStorage* pst, uint32_t oid, JS_PERSISTENT_STATUS status);
-JS_BOOL js_set_persistent(JSContext* ctx, JSValue val, struct JSStorage* pst, uint32_t oid, JS_PERSISTENT_STATUS status);
+JS_BOOL js_set_persistent_rt(JSRuntime* rt, JSValue val, struct JSStorage* pst, JS_PERSISTENT_OID oid, JS_PERSISTENT_STATUS status);
+JS_BOOL js_set_persistent(JSContext* ctx, JSValue val, struct JSStorage* pst, JS_PERSISTENT_OID oid, JS_PERSISTENT_STATUS status);
 void js_set_persistent_status(JSValue val, JS_PERSISTENT_STATUS status);
-JS_PERSISTENT_STATUS js_is_persistent(JSValue val, JSStorage** pstor, uint32_t* poid);
-uint32_t* js_get_persistent_oid_ref(JSValue val);
+JS_PERSISTENT_STATUS js_is_persistent(JSValue val, JSStorage** pstor, JS_PERSISTENT_OID* poid);
+JS_PERSISTENT_OID* js_get_persistent_oid_ref(JSValue val);
+uint32_t js_get_persistent_size(JSValue val);
+void js_set_persistent_size(JSValue val, uint32_t size);
+JS_BOOL js_test_persistent_accessed(JSValue val);
+JS_BOOL js_unload_persistent_object(JSContext *ctx, JSValueConst val);
 
 static JSStorage* storage_of(JSValue obj) { return JS_GetOpaque(obj, js_storage_class_id); }
 
 static dybase_oid_t db_persist_entity(JSContext *ctx, JSStorage* pst, JSValue obj);
 
+// adds the object to the set of objects to be written on next commit
+static void db_mark_dirty(JSContext *ctx, JSStorage* pst, JSValue obj) {
+  db_oidmap_put(ctx, &pst->dirty, *js_get_persistent_oid_ref(obj), JS_VALUE_GET_PTR(obj));
+}
+
 JS_BOOL db_is_index(JSValue val);
 
+// updates the estimated memory of the object which is loaded or stored, count is
+// the number of its properties or elements
+static void db_set_loaded_size(JSStorage* pst, JSValue obj, uint32_t count) {
+  size_t size = DB_OBJECT_SIZE + (size_t)count * DB_VALUE_SIZE + pst->value_bytes;
+  if (size > 0x7fffffff)
+    size = 0x7fffffff;
+  pst->loaded_size += size - js_get_persistent_size(obj);
+  js_set_persistent_size(obj, (uint32_t)size);
+  pst->value_bytes = 0;
+}
+
 typedef unsigned char byte;
 
 typedef union db_data {
@@ -93,10 +189,15 @@ typedef struct db_triplet {
   db_data      data;
   int32_t      type;
   int32_t      len;
+  byte *       packed; // key of composite index or typed array, freed by db_free_transform
 } db_triplet;
 
+static int db_is_blob(int type) {
+  return type == dybase_chars_type || type == dybase_bytes_type || type == dybase_typed_array_type;
+}
+
 static void *keyptr(db_triplet *tri) {
-  if (tri->type == dybase_chars_type || tri->type == dybase_bytes_type)
+  if (db_is_blob(tri->type))
     return (void *)tri->data.s;
   return (void *)&tri->data;
 }
@@ -105,9 +206,12 @@ void db_transform(JSContext *ctx, JSStorage* pst, JSValueConst val, db_triplet *
 
   pt->len = 0;
   pt->data.i64 = 0;
+  pt->packed = NULL;
 
   size_t size;
   double ms1970;
+  int ta_type;
+  JS_BOOL is_set;
 
   switch (JS_VALUE_GET_NORM_TAG(val))
   {
@@ -153,6 +257,29 @@ void db_transform(JSContext *ctx, JSStorage* pst, JSValueConst val, db_triplet *
       if (!js_is_persistent(val, &ipst, &pt->data.oid) || (ipst != pst))
         assert(0);
     }
+    else if (js_is_collection(val, &is_set)) {
+      pt->type = is_set ? dybase_set_ref_type : dybase_map_ref_type;
+      pt->data.oid = db_persist_entity(ctx, pst, val);
+    }
+    else if ((ta_type = JS_GetTypedArrayType(val)) >= 0) {
+      // the byte of the element type followed by the elements as they are in memory
+      size_t offset, length;
+      JSValue buffer = JS_GetTypedArrayBuffer(ctx, val, &offset, &length, NULL);
+      uint8_t *ptr = JS_IsException(buffer) ? NULL : JS_GetArrayBuffer(ctx, &size, buffer);
+      JS_FreeValue(ctx, buffer); // the typed array holds it
+      if (ptr)
+        pt->packed = js_malloc(ctx, length + 1);
+      if (!pt->packed) { // detached, stored as null
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        pt->type = dybase_chars_type;
+        break;
+      }
+      pt->packed[0] = (byte)ta_type;
+      memcpy(pt->packed + 1, ptr + offset, length);
+      pt->data.s = pt->packed;
+      pt->len = length + 1;
+      pt->type = dybase_typed_array_type;
+    }
     else if (JS_GetArrayBuffer(ctx, &size, val)) {
       uint8_t * ptr = JS_GetArrayBuffer(ctx, &size, val);
       pt->len = size; // length in bytes + 1 byte for the type
@@ -175,15 +302,133 @@ void db_transform(JSContext *ctx, JSStorage* pst, JSValueConst val, db_triplet *
 }
 
 void db_free_transform(JSContext *ctx, db_triplet *pt) {
-  if(pt->type == dybase_chars_type)
+  if (pt->packed)
+    js_free(ctx, pt->packed);
+  else if(pt->type == dybase_chars_type)
     JS_FreeCString(ctx, pt->data.s);
   return;
 }
 
+// appends element of the tuple to the packed key
+static int db_pack_element(JSContext *ctx, JSStorage* pst, db_triplet *pt, int *size, JSValueConst val)
+{
+  db_triplet el;
+  if (JS_IsObject(val)) {
+    // objects would be made persistent by db_transform
+    double ms;
+    size_t len;
+    if (!JS_IsDate(ctx, val, &ms) && !JS_GetArrayBuffer(ctx, &len, val)) {
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      JS_ThrowTypeError(ctx, "unsupported type of composite key element");
+      return -1;
+    }
+  }
+  db_transform(ctx, pst, val, &el);
+  int null = JS_IsNull(val) || JS_IsUndefined(val);
+  for (;;) {
+    int rc = dybase_composite_key_append(pt->packed, pt->len, *size, el.type, null ? NULL : keyptr(&el), el.len);
+    if (rc >= 0) {
+      pt->len = rc;
+      break;
+    }
+    if (rc == -2) {
+      db_free_transform(ctx, &el);
+      JS_ThrowTypeError(ctx, "unsupported type of composite key element");
+      return -1;
+    }
+    byte *packed = js_realloc(ctx, pt->packed, *size * 2);
+    if (!packed) {
+      db_free_transform(ctx, &el);
+      return -1;
+    }
+    pt->packed = packed;
+    *size *= 2;
+  }
+  db_free_transform(ctx, &el);
+  return 0;
+}
+
+// transforms key of the index. Tuples (arrays) of composite index are packed,
+// scalar value is treated as tuple of one element. If bound is set the key is
+// made greater than all keys starting with the tuple.
+static int db_transform_key(JSContext *ctx, JSStorage* pst, int composite, JSValueConst val, db_triplet *pt, int bound)
+{
+  if (!composite || JS_IsNull(val) || JS_IsUndefined(val)) {
+    db_transform(ctx, pst, val, pt);
+    return 0;
+  }
+  int size = 64;
+  pt->data.i64 = 0;
+  pt->type = dybase_bytes_type;
+  pt->len = 0;
+  pt->packed = js_malloc(ctx, size);
+  if (!pt->packed)
+    return -1;
+  if (JS_IsArray(ctx, val)) {
+    uint32_t n;
+    JSValue len = JS_GetPropertyStr(ctx, val, "length");
+    int rc = JS_ToUint32(ctx, &n, len);
+    JS_FreeValue(ctx, len);
+    if (rc)
+      goto fail;
+    for (uint32_t i = 0; i < n; i++) {
+      JSValue el = JS_GetPropertyUint32(ctx, val, i);
+      int rc = db_pack_element(ctx, pst, pt, &size, el);
+      JS_FreeValue(ctx, el);
+      if (rc)
+        goto fail;
+    }
+  } else if (db_pack_element(ctx, pst, pt, &size, val))
+    goto fail;
+  if (bound) {
+    if (pt->len == size) {
+      byte *packed = js_realloc(ctx, pt->packed, size + 1);
+      if (!packed)
+        goto fail;
+      pt->packed = packed;
+      size += 1;
+    }
+    pt->len = dybase_composite_key_bound(pt->packed, pt->len, size);
+  }
+  pt->data.s = pt->packed;
+  return 0;
+fail:
+  js_free(ctx, pt->packed);
+  pt->packed = NULL;
+  return -1;
+}
+
+// unpacks key of composite index into array
+static JSValue db_unpack_key(JSContext *ctx, void *key, int key_size)
+{
+  byte *buf = js_malloc(ctx, key_size + 8);
+  if (!buf)
+    return JS_EXCEPTION;
+  JSValue arr = JS_NewArray(ctx);
+  int pos = 0, type, size, n = 0;
+  while (dybase_composite_key_next(key, key_size, &pos, &type, buf, &size) > 0) {
+    JSValue el;
+    switch (type) {
+      case dybase_bool_type: el = JS_NewBool(ctx, *(char *)buf); break;
+      case dybase_real_type: el = JS_NewFloat64(ctx, *(double *)buf); break;
+      case dybase_long_type: el = JS_NewBigInt64(ctx, *(int64_t *)buf); break;
+      case dybase_date_type: el = JS_NewDate(ctx, (*(int64_t *)buf - 116444736000000LL /*SEC_TO_UNIX_EPOCH*/) / 10000.0); break;
+      case dybase_chars_type: el = JS_NewStringLen(ctx, (const char *)buf, size); break;
+      case dybase_bytes_type: el = JS_NewArrayBufferCopy(ctx, buf, size); break;
+      default: el = JS_NULL; break;
+    }
+    JS_SetPropertyUint32(ctx, arr, n++, el);
+  }
+  js_free(ctx, buf);
+  return arr;
+}
+
 void db_store_field(JSContext *ctx, JSStorage* pst, dybase_handle_t h, JSValueConst val)
 {
   db_triplet db_val;
   db_transform(ctx, pst, val, &db_val);
+  if (db_is_blob(db_val.type))
+    pst->value_bytes += db_val.len;
   dybase_store_array_element(h, 
     db_val.type, 
     keyptr(&db_val),
@@ -191,6 +436,16 @@ void db_store_field(JSContext *ctx, JSStorage* pst, dybase_handle_t h, JSValueCo
   db_free_transform(ctx, &db_val);
 }
 
+void db_store_named_field(JSContext *ctx, JSStorage* pst, dybase_handle_t h, const char *name, JSValueConst val)
+{
+  db_triplet db_val;
+  db_transform(ctx, pst, val, &db_val);
+  if (db_is_blob(db_val.type))
+    pst->value_bytes += db_val.len;
+  dybase_store_object_field(h, name, db_val.type, keyptr(&db_val), db_val.len);
+  db_free_transform(ctx, &db_val);
+}
+
 void db_store_atom(JSContext *ctx, JSStorage* pst, dybase_handle_t h, JSAtom atom)
 {
   db_triplet db_val;
@@ -228,21 +483,36 @@ void db_store_object_data(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSVa
 
   JS_GetOwnPropertyNames(ctx, &tab, &len, obj, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY);
 
-  dybase_store_object_field(h, ".", dybase_map_type, 0, len);
-  
-  for (uint32_t n = 0; n < len; ++n) {
-    db_store_atom(ctx, pst, h, tab[n].atom);
-    JSValue val = JS_GetProperty(ctx, obj, tab[n].atom);
-    db_store_field(ctx, pst, h, val);
-    JS_FreeValue(ctx, val);
-    JS_SetProperty(ctx, obj, tab[n].atom, JS_UNDEFINED); // to free sub-items to make obj dormant
+  pst->value_bytes = 0;
+  char buf[1024];
+  JS_BOOL shaped = len <= DB_MAX_SHAPE_FIELDS;
+  if (shaped && len) { // integer keys are enumerated first, so it is enough to check the first one
+    char c = *JS_AtomGetStr(ctx, buf, sizeof(buf), tab[0].atom);
+    shaped = (c < '0' || c > '9') && db_count_shape(ctx, pst, tab, len);
+  }
+  if (shaped) {
+    for (uint32_t n = 0; n < len; ++n) {
+      const char *key = JS_AtomGetStr(ctx, buf, sizeof(buf), tab[n].atom);
+      JSValue val = JS_GetProperty(ctx, obj, tab[n].atom);
+      db_store_named_field(ctx, pst, h, key, val);
+      JS_FreeValue(ctx, val);
+    }
+  } else {
+    dybase_store_object_field(h, ".", dybase_map_type, 0, len);
+    for (uint32_t n = 0; n < len; ++n) {
+      db_store_atom(ctx, pst, h, tab[n].atom);
+      JSValue val = JS_GetProperty(ctx, obj, tab[n].atom);
+      db_store_field(ctx, pst, h, val);
+      JS_FreeValue(ctx, val);
+    }
   }
 
   dybase_end_store_object(h);
 
   js_free_prop_enum(ctx, tab, len);
 
-  js_set_persistent_status(obj, JS_PERSISTENT_DORMANT);
+  db_set_loaded_size(pst, obj, len);
+  js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // stays in memory, clean
 }
 
 void db_store_array_data(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSValue obj) {
@@ -261,37 +531,126 @@ void db_store_array_data(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSVal
 
   dybase_store_object_field(h, ".", dybase_array_type, 0, (int)length);
 
+  pst->value_bytes = 0;
   for (uint32_t n = 0; n < length; ++n) {
     JSValue val = JS_GetPropertyUint32(ctx,obj,n);
     db_store_field(ctx, pst, h, val);
     JS_FreeValue(ctx, val);
-    JS_SetPropertyUint32(ctx, obj, n, JS_UNDEFINED); // to free references
   }
 
   dybase_end_store_object(h);
 
-  js_set_persistent_status(obj, JS_PERSISTENT_DORMANT);
+  db_set_loaded_size(pst, obj, (uint32_t)length);
+  js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // stays in memory, clean
+}
+
+typedef struct db_store_context {
+  JSStorage*      pst;
+  dybase_handle_t h;
+  JS_BOOL         is_set;
+} db_store_context;
+
+static int db_store_entry(JSContext *ctx, JSValueConst key, JSValueConst value, void *opaque) {
+  db_store_context *sc = (db_store_context *)opaque;
+  db_store_field(ctx, sc->pst, sc->h, key);
+  if (!sc->is_set)
+    db_store_field(ctx, sc->pst, sc->h, value);
+  return 0;
 }
 
-void db_store_entity(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSValue obj) {
+// Map is stored as the map of its entries, Set - as the array of its values
+void db_store_collection_data(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSValue obj, JS_BOOL is_set) {
+
+  dybase_handle_t h = dybase_begin_store_object(pst->hs, oid, "");
+  assert(h);
+
+  uint32_t count = js_collection_size(obj);
+  dybase_store_object_field(h, ".", is_set ? dybase_array_type : dybase_map_type, 0, (int)count);
+
+  db_store_context sc = { pst, h, is_set };
+  pst->value_bytes = 0;
+  js_collection_each(ctx, obj, db_store_entry, &sc);
+
+  dybase_end_store_object(h);
+
+  db_set_loaded_size(pst, obj, is_set ? count : count * 2);
+  js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // stays in memory, clean
+}
+
+// writes the object if it is modified, returns 1 if it was written
+int db_store_entity(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSValue obj) {
 
   JS_PERSISTENT_STATUS status = js_is_persistent(obj, NULL, NULL);
   if (status != JS_PERSISTENT_MODIFIED)
-    return;
+    return 0;
+  db_oidmap_remove(&pst->dirty, oid);
+  JS_BOOL is_set;
   if (JS_IsArray(ctx, obj))
     db_store_array_data(ctx, pst, oid, obj);
   else if (JS_IsObjectPlain(ctx, obj)) // pure Object
     db_store_object_data(ctx, pst, oid, obj);
-  else if (db_is_index(obj))
-    ;
-  else 
+  else if (js_is_collection(obj, &is_set))
+    db_store_collection_data(ctx, pst, oid, obj, is_set);
+  else if (db_is_index(obj)) {
+    js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // index data is written by the index itself
+    return 0;
+  }
+  else {
     assert(0);
+    return 0;
+  }
+  return 1;
 }
 
 JSValue db_fetch_value(JSContext *ctx, JSStorage* pst, dybase_handle_t h);
 JSAtom  db_fetch_atom(JSContext *ctx, JSStorage* pst, dybase_handle_t h);
 
 
+// dormant objects referenced by the object being loaded, their pages are read in one batch
+typedef struct db_prefetch_list {
+  dybase_oid_t oids[64];
+  int          count;
+} db_prefetch_list;
+
+static void db_prefetch_flush(JSStorage* pst, db_prefetch_list *pl) {
+  if (pl->count)
+    dybase_prefetch(pst->hs, pl->oids, pl->count);
+  pl->count = 0;
+}
+
+static void db_prefetch_add(JSStorage* pst, db_prefetch_list *pl, JSValueConst val) {
+  dybase_oid_t oid;
+  if (!pst->prefetch || js_is_persistent(val, NULL, &oid) != JS_PERSISTENT_DORMANT)
+    return;
+  pl->oids[pl->count++] = oid;
+  if (pl->count == countof(pl->oids))
+    db_prefetch_flush(pst, pl);
+}
+
+static db_shape *db_get_shape(JSContext *ctx, JSStorage* pst, dybase_oid_t cid) {
+  db_shape *shape = db_oidmap_get(&pst->shapes, cid);
+  if (!shape) {
+    shape = js_mallocz(ctx, sizeof(db_shape));
+    if (!shape)
+      return NULL;
+    shape->cid = cid;
+    if (db_oidmap_put(ctx, &pst->shapes, cid, shape)) {
+      js_free(ctx, shape);
+      return NULL;
+    }
+  }
+  return shape;
+}
+
+static int free_shape(dybase_oid_t cid, void* data, void* opaque) {
+  JSContext *ctx = (JSContext *)opaque;
+  db_shape *shape = (db_shape *)data;
+  for (int i = 0; i < shape->count; i++)
+    JS_FreeAtom(ctx, shape->atoms[i]);
+  js_free(ctx, shape);
+  return 0;
+}
+
 int db_fetch_object_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid_t oid) {
 
   int pf = js_is_persistent(obj, NULL, NULL);
@@ -301,6 +660,8 @@ int db_fetch_object_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid
 
   dybase_handle_t h = dybase_begin_load_object(pst->hs, oid);
 
+  js_set_persistent_status(obj, JS_PERSISTENT_MODIFIED); // filling it below shall not put it in the dirty set
+
   char *class_name = dybase_get_class_name(h);
   if (!class_name) {
     assert(0);
@@ -326,10 +687,15 @@ int db_fetch_object_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid
     JS_FreeAtom(ctx, cname);
   }
 
+  db_prefetch_list pl = { .count = 0 };
+  dybase_oid_t cid = dybase_get_class_id(h);
+  pst->value_bytes = 0;
   char *field_name = dybase_next_field(h);
   if (!field_name) {
-    assert(0);
-    return -1;
+    // object without keys, the handle is released by dybase_next_field
+    db_set_loaded_size(pst, obj, 0);
+    js_set_persistent_status(obj, JS_PERSISTENT_LOADED);
+    return 1;
   }
 
   int type;
@@ -337,21 +703,56 @@ int db_fetch_object_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid
   int   value_length = 0;
   dybase_get_value(h, &type, &value_ptr, &value_length);
 
-  assert(type == dybase_map_type);
-
-  for (int i = 0; i < value_length; i++) {
-    dybase_next_element(h);
-    JSAtom key_atom = db_fetch_atom(ctx,pst,h);
-    assert(key_atom != JS_ATOM_NULL);
-    dybase_next_element(h);
-    JSValue val = db_fetch_value(ctx, pst, h);
-    JS_SetProperty(ctx, obj, key_atom, val);
-    JS_FreeAtom(ctx, key_atom);
-    //??? JS_FreeValue(ctx, val);
+  uint32_t count;
+  if (type == dybase_map_type && strcmp(field_name, ".") == 0) {
+    count = value_length;
+    for (int i = 0; i < value_length; i++) {
+      dybase_next_element(h);
+      JSAtom key_atom = db_fetch_atom(ctx,pst,h);
+      assert(key_atom != JS_ATOM_NULL);
+      dybase_next_element(h);
+      JSValue val = db_fetch_value(ctx, pst, h);
+      db_prefetch_add(pst, &pl, val);
+      JS_SetProperty(ctx, obj, key_atom, val);
+      JS_FreeAtom(ctx, key_atom);
+      //??? JS_FreeValue(ctx, val);
+    }
+    dybase_end_load_object(h);
+  } else {
+    // stored by shape: keys are the field names of the class, their atoms
+    // are created once per shape
+    db_shape *shape = db_get_shape(ctx, pst, cid);
+    int n = 0;
+    do {
+      JSAtom key_atom;
+      if (shape && n < shape->count)
+        key_atom = shape->atoms[n];
+      else {
+        key_atom = JS_NewAtom(ctx, field_name);
+        if (shape && n < DB_MAX_SHAPE_FIELDS)
+          shape->atoms[shape->count++] = key_atom;
+      }
+      JSValue val = db_fetch_value(ctx, pst, h);
+      db_prefetch_add(pst, &pl, val);
+      JS_DefinePropertyValue(ctx, obj, key_atom, val, JS_PROP_C_W_E);
+      if (!shape || n >= DB_MAX_SHAPE_FIELDS)
+        JS_FreeAtom(ctx, key_atom);
+      n += 1;
+    } while ((field_name = dybase_next_field(h)) != NULL); // releases the handle at the end
+    count = n;
+    if (shape && !shape->counted && n == shape->count) {
+      // objects with the keys of an existing class are stored by shape at once
+      uint32_t hash = DB_SHAPE_HASH_INIT;
+      for (int i = 0; i < n; i++)
+        hash = db_shape_hash(hash, shape->atoms[i]);
+      hash += !hash;
+      db_oidmap_put(ctx, &pst->shape_counts, hash, (void *)(uintptr_t)DB_SHAPE_MIN_OBJECTS);
+      shape->counted = TRUE;
+    }
   }
+  db_prefetch_flush(pst, &pl);
 
-  dybase_end_load_object(h);
-
+  db_set_loaded_size(pst, obj, count);
   js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // drop DORMANT flag
 
   return 1;
@@ -368,6 +769,8 @@ int db_fetch_array_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid_
   dybase_handle_t h = dybase_begin_load_object(pst->hs, oid);
   assert(h);
 
+  js_set_persistent_status(obj, JS_PERSISTENT_MODIFIED); // filling it below shall not put it in the dirty set
+
   char *className = dybase_get_class_name(h);
   if (!className) {
     assert(0);
@@ -389,14 +792,71 @@ int db_fetch_array_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid_
 
   assert(type == dybase_array_type);
 
+  db_prefetch_list pl = { .count = 0 };
+  pst->value_bytes = 0;
   for (int i = 0; i < value_length; i++) {
     dybase_next_element(h);
     JSValue el = db_fetch_value(ctx,pst,h);
+    db_prefetch_add(pst, &pl, el);
     JS_SetPropertyInt64(ctx, obj, i, el);
   }
 
   dybase_end_load_object(h);
+  db_prefetch_flush(pst, &pl);
+
+  db_set_loaded_size(pst, obj, value_length);
+  js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // drop DORMANT flag
+
+  return 1;
+}
+
+int db_fetch_collection_data(JSContext *ctx, JSValue obj, JSStorage* pst, dybase_oid_t oid, JS_BOOL is_set) {
+
+  int pf = js_is_persistent(obj, NULL, NULL);
+
+  if (pf >= JS_PERSISTENT_LOADED)
+    return 0; // already loaded, nothing to do.
+
+  dybase_handle_t h = dybase_begin_load_object(pst->hs, oid);
+  assert(h);
+
+  js_set_persistent_status(obj, JS_PERSISTENT_MODIFIED); // filling it below shall not put it in the dirty set
+
+  dybase_get_class_name(h);
+  char *fieldName = dybase_next_field(h);
+  if (!fieldName) {
+    assert(0);
+    return -1;
+  }
+
+  int   type;
+  void *value_ptr = NULL;
+  int   value_length = 0;
+  dybase_get_value(h, &type, &value_ptr, &value_length);
+
+  assert(type == (is_set ? dybase_array_type : dybase_map_type));
+
+  db_prefetch_list pl = { .count = 0 };
+  pst->value_bytes = 0;
+  for (int i = 0; i < value_length; i++) {
+    dybase_next_element(h);
+    JSValue key = db_fetch_value(ctx, pst, h);
+    JSValue val = JS_UNDEFINED;
+    if (!is_set) {
+      dybase_next_element(h);
+      val = db_fetch_value(ctx, pst, h);
+    }
+    db_prefetch_add(pst, &pl, key);
+    db_prefetch_add(pst, &pl, val);
+    js_collection_add(ctx, obj, key, val);
+    JS_FreeValue(ctx, key);
+    JS_FreeValue(ctx, val);
+  }
+
+  dybase_end_load_object(h);
+  db_prefetch_flush(pst, &pl);
 
+  db_set_loaded_size(pst, obj, is_set ? value_length : value_length * 2);
   js_set_persistent_status(obj, JS_PERSISTENT_LOADED); // drop DORMANT flag
 
   return 1;
@@ -406,7 +866,7 @@ JSValue db_fetch_object(JSContext *ctx, JSStorage* pst, dybase_oid_t oid)
 {
   JSValue rv = JS_NewObject(ctx);
   if(js_set_persistent(ctx, rv, pst, oid, JS_PERSISTENT_DORMANT))
-    hashtable_put(pst->oid2obj, &oid, sizeof(oid), JS_VALUE_GET_PTR(rv));
+    db_oidmap_put(ctx, &pst->oid2obj, oid, JS_VALUE_GET_PTR(rv));
   return rv;
 }
 
@@ -414,7 +874,17 @@ JSValue db_fetch_array(JSContext *ctx, JSStorage* pst, dybase_oid_t oid)
 {
   JSValue rv = JS_NewArray(ctx);
   if(js_set_persistent(ctx, rv, pst, oid, JS_PERSISTENT_DORMANT))
-    hashtable_put(pst->oid2obj, &oid, sizeof(oid), JS_VALUE_GET_PTR(rv));
+    db_oidmap_put(ctx, &pst->oid2obj, oid, JS_VALUE_GET_PTR(rv));
+  return rv;
+}
+
+JSValue db_fetch_collection(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JS_BOOL is_set)
+{
+  JSValue rv = js_new_collection(ctx, is_set);
+  if (JS_IsException(rv))
+    return rv;
+  if(js_set_persistent(ctx, rv, pst, oid, JS_PERSISTENT_DORMANT))
+    db_oidmap_put(ctx, &pst->oid2obj, oid, JS_VALUE_GET_PTR(rv));
   return rv;
 }
 
@@ -425,14 +895,14 @@ JSAtom db_fetch_atom(JSContext *ctx, JSStorage* pst, dybase_handle_t h) {
   dybase_get_value(h, &type, &value_ptr, &value_length);
   if (type != dybase_chars_type)
     return JS_ATOM_NULL;
-  if (!value_length)
-    return JS_ATOM_NULL;
+  if (!value_length) // empty key
+    return JS_NewAtomLen(ctx, "", 0);
   return JS_NewAtomLen(ctx, (const char *)value_ptr, value_length);
 }
 
 JS_BOOL db_check_cache(JSContext *ctx, JSStorage* pst, dybase_oid_t oid, JSValue* pval)
 {
-  struct JSObject* pobj = hashtable_get(pst->oid2obj, &oid, sizeof(oid));
+  struct JSObject* pobj = db_oidmap_get(&pst->oid2obj, oid);
   if (!pobj)
     return 0;
   *pval = JS_MKPTR(JS_TAG_OBJECT, pobj);
@@ -445,9 +915,7 @@ JSValue db_load_object(JSContext *ctx, JSStorage* pst, dybase_oid_t oid)
   JSValue obj;
   if (db_check_cache(ctx, pst, oid, &obj))
     return JS_DupValue(ctx,obj);
-  obj = db_fetch_object(ctx, pst, oid);
-  hashtable_put(pst->oid2obj, js_get_persistent_oid_ref(obj), sizeof(oid), JS_VALUE_GET_PTR(obj));
-  return obj;
+  return db_fetch_object(ctx, pst, oid);
 }
 
 static JSValue db_load_index(JSContext *ctx, JSStorage* pst, dybase_oid_t index_oid, int force_new);
@@ -481,6 +949,14 @@ JSValue db_fetch_value(JSContext *ctx, JSStorage* pst, dybase_handle_t h) {
     oid = *((dybase_oid_t *)value_ptr);
     return db_load_index(ctx, pst, oid, FALSE);
   }
+  case dybase_map_ref_type:
+  case dybase_set_ref_type: {
+    oid = *((dybase_oid_t *)value_ptr);
+    if (db_check_cache(ctx, pst, oid, &obj))
+      return JS_DupValue(ctx, obj);
+    obj = db_fetch_collection(ctx, pst, oid, type == dybase_set_ref_type);
+    break;
+  }
   case dybase_bool_type: 
     return JS_NewBool(ctx,*((char *)value_ptr));
       
@@ -501,17 +977,30 @@ JSValue db_fetch_value(JSContext *ctx, JSStorage* pst, dybase_handle_t h) {
   case dybase_chars_type:
     if (!value_length)
       return JS_NULL;
-    else
-      return JS_NewStringLen(ctx, (const char *)value_ptr, value_length);
-    break;
+    pst->value_bytes += value_length;
+    return JS_NewStringLen(ctx, (const char *)value_ptr, value_length);
 
   case dybase_bytes_type:
     if (!value_length)
       return JS_NULL;
-    else
-      return JS_NewArrayBufferCopy(ctx, (const byte *)value_ptr, value_length);
+    pst->value_bytes += value_length;
+    return JS_NewArrayBufferCopy(ctx, (const byte *)value_ptr, value_length);
     break;
 
+  case dybase_typed_array_type: {
+    // the elements are copied at once into the buffer of the new typed array
+    if (!value_length)
+      return JS_NULL;
+    pst->value_bytes += value_length;
+    JSValue args[1];
+    args[0] = JS_NewArrayBufferCopy(ctx, (const byte *)value_ptr + 1, value_length - 1);
+    if (JS_IsException(args[0]))
+      return args[0];
+    obj = JS_NewTypedArray(ctx, 1, args, *(const byte *)value_ptr);
+    JS_FreeValue(ctx, args[0]);
+    return obj;
+  }
+
   //
   case dybase_map_type:
     // element couldn't be a map
@@ -522,11 +1011,38 @@ JSValue db_fetch_value(JSContext *ctx, JSStorage* pst, dybase_handle_t h) {
     return JS_EXCEPTION;
   }
 
-  hashtable_put(pst->oid2obj, js_get_persistent_oid_ref(obj), sizeof(oid), JS_VALUE_GET_PTR(obj));
-
   return obj;
 }
 
+// Unloads clean objects which were not accessed recently until the estimated
+// memory of loaded objects drops to 3/4 of the limit. Second chance (clock)
+// replacement over the slots of oid2obj: the access flag of the object is its
+// reference bit. Unloaded objects stay in oid2obj while they are referenced,
+// the objects referenced only by their properties are freed.
+static void db_unload_objects(JSContext *ctx, JSStorage* pst, JSValueConst keep)
+{
+  size_t target = pst->memory_limit - pst->memory_limit / 4;
+  size_t steps = 2 * (pst->oid2obj.mask + 1); // the first round may only clear access flags
+  while (pst->loaded_size > target && steps-- > 0 && pst->oid2obj.entries) {
+    db_oidmap_entry *e = &pst->oid2obj.entries[pst->clock_hand++ & pst->oid2obj.mask];
+    if (!e->obj || e->obj == JS_VALUE_GET_PTR(keep))
+      continue;
+    JSValue obj = JS_MKPTR(JS_TAG_OBJECT, e->obj);
+    if (js_test_persistent_accessed(obj) || js_is_persistent(obj, NULL, NULL) != JS_PERSISTENT_LOADED)
+      continue;
+    uint32_t size = js_get_persistent_size(obj);
+    JS_DupValue(ctx, obj); // releasing its properties can free the object itself
+    if (js_unload_persistent_object(ctx, obj)) {
+      pst->loaded_size -= size;
+      js_set_persistent_size(obj, 0);
+      pst->unloaded += 1;
+    }
+    JS_FreeValue(ctx, obj);
+  }
+  // objects in use take more than the target: do not search again until more is loaded
+  pst->unload_threshold = pst->loaded_size > target ? pst->loaded_size + pst->memory_limit / 4 : pst->memory_limit;
+}
+
 int db_fetch_entity(JSContext *ctx, JSValue obj) 
 {
   dybase_oid_t oid;
@@ -538,6 +1054,7 @@ int db_fetch_entity(JSContext *ctx, JSValue obj)
   assert(js_is_persitable(obj));
 
   int r = 0;
+  JS_BOOL is_set;
 
   if (JS_IsArray(ctx, obj))
     r = db_fetch_array_data(ctx, obj, pst, oid);
@@ -545,11 +1062,16 @@ int db_fetch_entity(JSContext *ctx, JSValue obj)
     r = 1;
   else if (JS_IsObjectPlain(ctx, obj)) // pure Object
     r = db_fetch_object_data(ctx, obj, pst, oid);
+  else if (js_is_collection(obj, &is_set))
+    r = db_fetch_collection_data(ctx, obj, pst, oid, is_set);
   else {
     assert(0);
     r = -1;
   }
 
+  if (r > 0 && pst->memory_limit && pst->loaded_size > pst->unload_threshold)
+    db_unload_objects(ctx, pst, obj);
+
   return r;
 }
 
@@ -568,7 +1090,9 @@ dybase_oid_t db_persist_entity(JSContext *ctx, JSStorage* pst, JSValue obj) {
     // it is attached to another storage
     if (vps) {
       db_store_entity(ctx, vps, oid, obj);
-      hashtable_remove(vps->oid2obj, &oid, sizeof(oid));
+      vps->loaded_size -= js_get_persistent_size(obj);
+      db_oidmap_remove(&vps->dirty, oid);
+      db_oidmap_remove(&vps->oid2obj, oid);
       js_set_persistent(ctx, obj, NULL, 0, JS_NOT_PERSISTENT);
     }
   }
@@ -581,16 +1105,115 @@ dybase_oid_t db_persist_entity(JSContext *ctx, JSStorage* pst, JSValue obj) {
 
   if (js_set_persistent(ctx, obj, pst, oid, JS_PERSISTENT_MODIFIED /*to force its saving*/))
   {
-    hashtable_put(pst->oid2obj, js_get_persistent_oid_ref(obj), sizeof(oid), JS_VALUE_GET_PTR(obj));
+    db_oidmap_put(ctx, &pst->oid2obj, oid, JS_VALUE_GET_PTR(obj));
+    db_mark_dirty(ctx, pst, obj);
     return oid;
   } else 
     return 0;
 }
 
+#define DB_DEFAULT_PREFETCH 32
+#define DB_MAX_PREFETCH     4096
+
+typedef struct db_open_options {
+  int     flags;        // dybase_open_xxx
+  int     prefetch;
+  int     gc_step;      // work per step of incremental GC, 0 - stop-the-world GC
+  int64_t gc_threshold; // allocated bytes which start GC, 0 - only on open
+  int64_t memory_limit; // estimated memory of loaded objects which starts their unloading, 0 - no limit
+} db_open_options;
+
+// parses options of Storage.open(filename, allowWrite, options)
+static int db_open_options_parse(JSContext *ctx, JSValueConst options, db_open_options* po)
+{
+  po->flags = 0;
+  po->prefetch = DB_DEFAULT_PREFETCH;
+  po->gc_step = 0;
+  po->gc_threshold = 0;
+  po->memory_limit = 0;
+  if (JS_IsUndefined(options) || JS_IsNull(options))
+    return 0;
+  if (!JS_IsObject(options)) {
+    JS_ThrowTypeError(ctx, "options must be an object");
+    return -1;
+  }
+  static const struct { const char* name; int flag; } flags[] = {
+    { "wal", dybase_open_wal },
+    { "mmap", dybase_open_mmap },
+    { "readahead", dybase_open_readahead },
+    { "compress", dybase_open_compress },
+    { "snapshot", dybase_open_snapshot },
+  };
+  for (int i = 0; i < (int)countof(flags); i++) {
+    JSValue val = JS_GetPropertyStr(ctx, options, flags[i].name);
+    int on = JS_ToBool(ctx, val);
+    JS_FreeValue(ctx, val);
+    if (on < 0)
+      return -1;
+    if (on)
+      po->flags |= flags[i].flag;
+  }
+  JSValue val = JS_GetPropertyStr(ctx, options, "cache");
+  if (!JS_IsUndefined(val)) {
+    const char* policy = JS_ToCString(ctx, val);
+    JS_FreeValue(ctx, val);
+    if (!policy)
+      return -1;
+    int known = 1;
+    if (strcmp(policy, "2q") == 0)
+      po->flags |= dybase_open_2q;
+    else if (strcmp(policy, "lru") != 0)
+      known = 0;
+    JS_FreeCString(ctx, policy);
+    if (!known) {
+      JS_ThrowRangeError(ctx, "unknown cache policy, expected \"lru\" or \"2q\"");
+      return -1;
+    }
+  }
+  val = JS_GetPropertyStr(ctx, options, "prefetch");
+  if (!JS_IsUndefined(val)) {
+    int32_t prefetch;
+    int rc = JS_ToInt32(ctx, &prefetch, val);
+    JS_FreeValue(ctx, val);
+    if (rc)
+      return -1;
+    po->prefetch = prefetch < 0 ? 0 : prefetch > DB_MAX_PREFETCH ? DB_MAX_PREFETCH : prefetch;
+  }
+  val = JS_GetPropertyStr(ctx, options, "gcStep");
+  if (!JS_IsUndefined(val)) {
+    int32_t step;
+    int rc = JS_ToInt32(ctx, &step, val);
+    JS_FreeValue(ctx, val);
+    if (rc)
+      return -1;
+    po->gc_step = step < 0 ? 0 : step;
+  }
+  val = JS_GetPropertyStr(ctx, options, "gcThreshold");
+  if (!JS_IsUndefined(val)) {
+    int64_t threshold;
+    int rc = JS_ToInt64(ctx, &threshold, val);
+    JS_FreeValue(ctx, val);
+    if (rc)
+      return -1;
+    po->gc_threshold = threshold < 0 ? 0 : threshold;
+  }
+  val = JS_GetPropertyStr(ctx, options, "memoryLimit");
+  if (!JS_IsUndefined(val)) {
+    int64_t limit;
+    int rc = JS_ToInt64(ctx, &limit, val);
+    JS_FreeValue(ctx, val);
+    if (rc)
+      return -1;
+    po->memory_limit = limit < 0 ? 0 : limit;
+  }
+  return 0;
+}
+
 static JSValue db_storage_open(JSContext *ctx, JSValueConst this_val,  int argc, JSValueConst *argv)
 {
   const char *filename = NULL;
   int mode;
+  db_open_options opts;
 
   filename = JS_ToCString(ctx, argv[0]);
   if (!filename)
@@ -599,21 +1222,40 @@ static JSValue db_storage_open(JSContext *ctx, JSValueConst this_val,  int argc,
   mode = argv[1] == JS_UNDEFINED ? 1 : JS_ToBool(ctx, argv[1]);
   if (!mode < 0)
     goto fail;
+
+  if (db_open_options_parse(ctx, argv[2], &opts))
+    goto fail;
+  if (opts.flags & dybase_open_snapshot)
+    mode = 0;
   
-  dybase_storage_t hs = dybase_open(filename, 4 * 1024 * 1024, errHandler, mode != 0);
+  dybase_storage_t hs = dybase_open(filename, 4 * 1024 * 1024, errHandler, mode != 0, opts.flags);
 
   if(!hs)
     goto fail;
 
-  if (mode) dybase_gc(hs);
+  if (mode) {
+    dybase_set_gc_threshold(hs, (long)opts.gc_threshold);
+    if (opts.gc_step) {
+      // collection started here proceeds by steps made at each commit
+      dybase_set_gc_step(hs, opts.gc_step);
+      dybase_gc_step(hs, opts.gc_step);
+    } else
+      dybase_gc(hs);
+  }
 
   JSStorage* pst = js_mallocz(ctx, sizeof(JSStorage));
 
   pst->hs = hs;
-  pst->oid2obj = hashtable_create();
+  db_oidmap_init(&pst->oid2obj);
+  db_oidmap_init(&pst->dirty);
   pst->root = JS_NULL;
   pst->classname2proto = JS_UNINITIALIZED;
   pst->ctx = JS_DupContext(ctx);
+  pst->prefetch = opts.prefetch;
+  pst->memory_limit = (size_t)opts.memory_limit;
+  pst->unload_threshold = pst->memory_limit;
+  db_oidmap_init(&pst->shapes);
+  db_oidmap_init(&pst->shape_counts);
 
   JSValue obj = JS_NewObjectClass(ctx, js_storage_class_id);
 
@@ -626,7 +1268,7 @@ static JSValue db_storage_open(JSContext *ctx, JSValueConst this_val,  int argc,
     JSValue root = JS_NewObject(ctx);
     if (js_set_persistent(ctx, root, pst, root_oid, JS_PERSISTENT_DORMANT))
     {
-      hashtable_put(pst->oid2obj, js_get_persistent_oid_ref(root), sizeof(dybase_oid_t), JS_VALUE_GET_PTR(root));
+      db_oidmap_put(ctx, &pst->oid2obj, root_oid, JS_VALUE_GET_PTR(root));
       pst->root = root;
     } else 
       JS_FreeValue(ctx, root);
@@ -646,42 +1288,39 @@ JSStorage* get_storage(JSValueConst obj) {
 typedef struct commit_ctx {
   JSContext *ctx;
   JSStorage *pst;
-  int        forget;
   int        count;
 } commit_ctx;
 
-static int commit_value(void* key, unsigned int key_length, void* data, void* opaque) {
+static int commit_value(dybase_oid_t oid, void* data, void* opaque) {
   JSValue obj = JS_MKPTR(JS_TAG_OBJECT, data);
   commit_ctx *cc = (commit_ctx *)opaque;
-  dybase_oid_t *poid = (dybase_oid_t *)key;
-  db_store_entity(cc->ctx, cc->pst, *poid, obj);
+  db_oidmap_remove(&cc->pst->dirty, oid); // even if it is not modified any more
+  cc->count += db_store_entity(cc->ctx, cc->pst, oid, obj);
   return 0;
 }
 
-static int final_commit_value(void* key, unsigned int key_length, void* data, void* opaque) {
+static int detach_value(dybase_oid_t oid, void* data, void* opaque) {
   JSValue obj = JS_MKPTR(JS_TAG_OBJECT, data);
   commit_ctx *cc = (commit_ctx *)opaque;
-  dybase_oid_t *poid = (dybase_oid_t *)key;
-  db_store_entity(cc->ctx, cc->pst, *poid, obj);
   js_set_persistent(cc->ctx, obj, NULL, 0, JS_NOT_PERSISTENT);
-  ++cc->count;
   return 0;
 }
 
-static void commit_storage(JSContext *ctx, JSStorage* pst) {
-  commit_ctx cc = { ctx,pst,1};
-  hashtable_each(pst->oid2obj, &commit_value, &cc);
+// writes objects of the dirty set, returns number of objects written
+static int commit_storage(JSContext *ctx, JSStorage* pst) {
+  commit_ctx cc = { ctx, pst, 0 };
+  // each stored object is removed from the set; storing an object may persist
+  // new ones, they are added to the set and written by this or the next pass
+  while (pst->dirty.count)
+    db_oidmap_each(&pst->dirty, &commit_value, &cc);
+  return cc.count;
 }
 
 static void final_commit_storage(JSContext *ctx, JSStorage* pst) {
-  commit_ctx cc = { ctx,pst,1, 0 };
-  do {
-    cc.count = 0;
-    hashtable_t ht = pst->oid2obj;
-    pst->oid2obj = hashtable_create();
-    hashtable_each(ht, &final_commit_value, &cc);
-    hashtable_free(ht);
-  } while (cc.count);
+  commit_ctx cc = { ctx, pst, 0 };
+  commit_storage(ctx, pst);
+  db_oidmap_each(&pst->oid2obj, &detach_value, &cc);
+  db_oidmap_clear(&pst->oid2obj);
 }
 
 void free_storage(JSValue st) 
@@ -689,14 +1328,17 @@ void free_storage(JSValue st)
   JSStorage* ps = storage_of(st);
   if (!ps) return;
   JSContext *ctx = ps->ctx;
-  js_set_persistent(ctx, ps->root, NULL, 0, JS_NOT_PERSISTENT);
-  JS_FreeValue(ctx, ps->root);
-  JS_FreeValue(ctx, ps->classname2proto);
   final_commit_storage(ctx, ps);
   dybase_commit(ps->hs);
+  JS_FreeValue(ctx, ps->root);
+  JS_FreeValue(ctx, ps->classname2proto);
   dybase_close(ps->hs);
   ps->hs = 0;
-  hashtable_free(ps->oid2obj);
+  db_oidmap_free(ctx, &ps->oid2obj);
+  db_oidmap_free(ctx, &ps->dirty);
+  db_oidmap_each(&ps->shapes, &free_shape, ctx);
+  db_oidmap_free(ctx, &ps->shapes);
+  db_oidmap_free(ctx, &ps->shape_counts);
   JS_FreeContext(ctx);
   js_free(ctx, ps);
   JS_SetOpaque(st, NULL);
@@ -705,9 +1347,11 @@ void free_storage(JSValue st)
 static JSValue db_storage_commit(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
   JSStorage* ps = storage_of(this_val);
   if (!ps) return JS_EXCEPTION;
-  commit_storage(ctx, ps);
+  int written = commit_storage(ctx, ps);
   dybase_commit(ps->hs);
-  return JS_UNDEFINED;
+  if (ps->memory_limit && ps->loaded_size > ps->memory_limit) // committed objects can be unloaded now
+    db_unload_objects(ctx, ps, JS_UNDEFINED);
+  return JS_NewInt32(ctx, written);
 }
 
 static JSValue db_storage_create_index(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
@@ -745,6 +1389,20 @@ int js_load_persistent_object(JSContext *ctx, JSValueConst obj) {
   return db_fetch_entity(ctx, obj);
 }
 
+// called on first modification of LOADED or DORMANT object
+int js_modify_persistent_object(JSContext *ctx, JSValueConst obj) {
+  JSStorage* pst = NULL;
+  dybase_oid_t oid;
+  JS_PERSISTENT_STATUS status = js_is_persistent(obj, &pst, &oid);
+  if (!pst || status == JS_PERSISTENT_MODIFIED)
+    return 0;
+  if (status == JS_PERSISTENT_DORMANT)
+    db_fetch_entity(ctx, obj); // otherwise commit would write only the new fields
+  js_set_persistent_status(obj, JS_PERSISTENT_MODIFIED);
+  db_mark_dirty(ctx, pst, obj);
+  return 1;
+}
+
 int js_free_persistent_object(JSRuntime *rt, JSValueConst obj) {
   JSStorage* pst;
   dybase_oid_t oid;
@@ -752,7 +1410,9 @@ int js_free_persistent_object(JSRuntime *rt, JSValueConst obj) {
   if (pst) {
     if(status == JS_PERSISTENT_MODIFIED)
        db_store_entity(pst->ctx, pst, oid, obj);
-    hashtable_remove(pst->oid2obj, &oid, sizeof(oid));
+    pst->loaded_size -= js_get_persistent_size(obj);
+    db_oidmap_remove(&pst->dirty, oid);
+    db_oidmap_remove(&pst->oid2obj, oid);
     js_set_persistent_rt(rt, obj, pst, 0, JS_NOT_PERSISTENT);
   }
   return 0;
@@ -774,8 +1434,113 @@ static void js_storage_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_f
 }
 
 
+static JSValue db_storage_get_cache_stats(JSContext *ctx, JSValueConst this_val)
+{
+  JSStorage* pst = get_storage(this_val);
+  if (!pst)
+    return JS_NULL;
+  dybase_cache_stats_t stats;
+  dybase_get_cache_stats(pst->hs, &stats);
+  JSValue obj = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, obj, "hits", JS_NewInt64(ctx, stats.hits));
+  JS_SetPropertyStr(ctx, obj, "misses", JS_NewInt64(ctx, stats.misses));
+  JS_SetPropertyStr(ctx, obj, "evictions", JS_NewInt64(ctx, stats.evictions));
+  JS_SetPropertyStr(ctx, obj, "writes", JS_NewInt64(ctx, stats.writes));
+  JS_SetPropertyStr(ctx, obj, "bytesWritten", JS_NewInt64(ctx, stats.bytes_written));
+  JS_SetPropertyStr(ctx, obj, "commitWrites", JS_NewInt64(ctx, stats.commit_writes));
+  JS_SetPropertyStr(ctx, obj, "commitBytes", JS_NewInt64(ctx, stats.commit_bytes));
+  return obj;
+}
+
+static JSValue db_storage_gc(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+  JSStorage* pst = storage_of(this_val);
+  if (!pst) return JS_EXCEPTION;
+  if (argc == 0 || JS_IsUndefined(argv[0])) {
+    dybase_gc(pst->hs);
+    return JS_TRUE;
+  }
+  int32_t max_work;
+  if (JS_ToInt32(ctx, &max_work, argv[0]))
+    return JS_EXCEPTION;
+  // stored state should be consistent: objects modified in JS are not written yet
+  return JS_NewBool(ctx, dybase_gc_step(pst->hs, max_work < 1 ? 1 : max_work));
+}
+
+typedef enum StorageCopyKind {
+  STORAGE_COPY_BACKUP,
+  STORAGE_COPY_COMPACT,
+  STORAGE_COPY_EXPORT,
+} StorageCopyKind;
+
+static JSValue db_storage_copy(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int kind)
+{
+  JSStorage* pst = storage_of(this_val);
+  if (!pst) return JS_EXCEPTION;
+  const char *path = JS_ToCString(ctx, argv[0]);
+  if (!path)
+    return JS_EXCEPTION;
+  // only committed state is copied: objects modified in JS are not written yet
+  int done;
+  switch (kind) {
+    case STORAGE_COPY_BACKUP: done = dybase_backup(pst->hs, path); break;
+    case STORAGE_COPY_COMPACT: done = dybase_compact(pst->hs, path); break;
+    default: done = dybase_export(pst->hs, path); break;
+  }
+  JS_FreeCString(ctx, path);
+  return JS_NewBool(ctx, done);
+}
+
+static JSValue db_storage_import(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+  const char *dump_path = JS_ToCString(ctx, argv[0]);
+  if (!dump_path)
+    return JS_EXCEPTION;
+  const char *path = JS_ToCString(ctx, argv[1]);
+  if (!path) {
+    JS_FreeCString(ctx, dump_path);
+    return JS_EXCEPTION;
+  }
+  int done = dybase_import(dump_path, path, errHandler);
+  JS_FreeCString(ctx, dump_path);
+  JS_FreeCString(ctx, path);
+  return JS_NewBool(ctx, done);
+}
+
+static JSValue db_storage_get_gc_stats(JSContext *ctx, JSValueConst this_val)
+{
+  JSStorage* pst = get_storage(this_val);
+  if (!pst)
+    return JS_NULL;
+  static const char* phases[] = { "idle", "mark", "sweep" };
+  dybase_gc_stats_t stats;
+  dybase_get_gc_stats(pst->hs, &stats);
+  JSValue obj = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, obj, "phase", JS_NewString(ctx, phases[stats.phase]));
+  JS_SetPropertyStr(ctx, obj, "cycles", JS_NewInt64(ctx, stats.cycles));
+  JS_SetPropertyStr(ctx, obj, "steps", JS_NewInt64(ctx, stats.steps));
+  JS_SetPropertyStr(ctx, obj, "marked", JS_NewInt64(ctx, stats.marked));
+  JS_SetPropertyStr(ctx, obj, "freed", JS_NewInt64(ctx, stats.freed));
+  JS_SetPropertyStr(ctx, obj, "pending", JS_NewInt64(ctx, stats.pending));
+  return obj;
+}
+
+static JSValue db_storage_get_memory_stats(JSContext *ctx, JSValueConst this_val)
+{
+  JSStorage* pst = get_storage(this_val);
+  if (!pst)
+    return JS_NULL;
+  JSValue obj = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, obj, "loaded", JS_NewInt64(ctx, (int64_t)pst->loaded_size));
+  JS_SetPropertyStr(ctx, obj, "limit", JS_NewInt64(ctx, (int64_t)pst->memory_limit));
+  JS_SetPropertyStr(ctx, obj, "objects", JS_NewInt64(ctx, (int64_t)pst->oid2obj.count));
+  JS_SetPropertyStr(ctx, obj, "unloaded", JS_NewInt64(ctx, pst->unloaded));
+  return obj;
+}
+
 static const JSCFunctionListEntry js_storage_funcs[] = {
-  JS_CFUNC_DEF("open", 2, db_storage_open),
+  JS_CFUNC_DEF("open", 3, db_storage_open),
+  JS_CFUNC_DEF("import", 2, db_storage_import),
   //JS_PROP_INT32_DEF("SEEK_SET", SEEK_SET, JS_PROP_CONFIGURABLE),
   //JS_PROP_INT32_DEF("SEEK_CUR", SEEK_CUR, JS_PROP_CONFIGURABLE),
   //JS_PROP_INT32_DEF("SEEK_END", SEEK_END, JS_PROP_CONFIGURABLE),
@@ -787,7 +1552,14 @@ static const JSCFunctionListEntry js_storage_proto_funcs[] = {
   JS_CFUNC_DEF("close", 0, db_storage_close),
   JS_CFUNC_DEF("commit", 0, db_storage_commit),
   JS_CFUNC_DEF("createIndex", 0, db_storage_create_index),
+  JS_CFUNC_DEF("gc", 1, db_storage_gc),
+  JS_CFUNC_MAGIC_DEF("backup", 1, db_storage_copy, STORAGE_COPY_BACKUP),
+  JS_CFUNC_MAGIC_DEF("compact", 1, db_storage_copy, STORAGE_COPY_COMPACT),
+  JS_CFUNC_MAGIC_DEF("export", 1, db_storage_copy, STORAGE_COPY_EXPORT),
   JS_CGETSET_DEF("root", db_storage_get_root, db_storage_set_root),
+  JS_CGETSET_DEF("cacheStats", db_storage_get_cache_stats, NULL),
+  JS_CGETSET_DEF("gcStats", db_storage_get_gc_stats, NULL),
+  JS_CGETSET_DEF("memoryStats", db_storage_get_memory_stats, NULL),
 };
 
 static JSClassDef js_storage_class = {
@@ -816,7 +1588,7 @@ static JSValue db_load_index(JSContext *ctx, JSStorage* pst, dybase_oid_t index_
 
   js_set_persistent(ctx, obj, pst, index_oid, JS_PERSISTENT_LOADED);
 
-  hashtable_put(pst->oid2obj, js_get_persistent_oid_ref(obj), sizeof(index_oid), JS_VALUE_GET_PTR(obj));
+  db_oidmap_put(ctx, &pst->oid2obj, index_oid, JS_VALUE_GET_PTR(obj));
 
   return obj;
 }
@@ -832,12 +1604,17 @@ static JSValue db_storage_create_index(JSContext *ctx, JSValueConst this_val, in
   const char* type = JS_ToCString(ctx, argv[0]);
 
   int key_type = 0;
+  int flags = 0;
 
   if (strcmp(type, "string") == 0) key_type = dybase_chars_type;
   else if (strcmp(type, "integer") == 0) key_type = dybase_int_type;
   else if (strcmp(type, "long") == 0) key_type = dybase_long_type;
   else if (strcmp(type, "float") == 0) key_type = dybase_real_type;
   else if (strcmp(type, "date") == 0) key_type = dybase_date_type;
+  else if (strcmp(type, "composite") == 0) {
+    key_type = dybase_bytes_type;
+    flags = dybase_index_composite_keys;
+  }
   else {
     JS_FreeCString(ctx, type);
     return JS_ThrowTypeError(ctx, "invalid Index type");
@@ -849,11 +1626,27 @@ static JSValue db_storage_create_index(JSContext *ctx, JSValueConst this_val, in
   if (argc > 1)
     unique = JS_ToBool(ctx, argv[1]);
 
-  dybase_oid_t oid = dybase_create_index(pst->hs, key_type, unique);
+  if (argc > 2 && !JS_IsUndefined(argv[2]) && !JS_IsNull(argv[2])) {
+    if (!JS_IsObject(argv[2]))
+      return JS_ThrowTypeError(ctx, "options must be an object");
+    JSValue val = JS_GetPropertyStr(ctx, argv[2], "prefixCompression");
+    int on = JS_ToBool(ctx, val);
+    JS_FreeValue(ctx, val);
+    if (on < 0)
+      return JS_EXCEPTION;
+    if (on)
+      flags |= dybase_index_prefix_keys;
+  }
+
+  dybase_oid_t oid = dybase_create_index(pst->hs, key_type, unique, flags);
 
   return db_load_index(ctx, pst, oid, TRUE);
 }
 
+static int db_index_is_composite(JSStorage* pst, dybase_oid_t index_oid) {
+  return (dybase_get_index_flags(pst->hs, index_oid) & dybase_index_composite_keys) != 0;
+}
+
 // for unique indexes: either object or undefined 
 // for non-unique indexes: [object1,... objectN] or [] 
 
@@ -866,7 +1659,8 @@ static JSValue db_index_get(JSContext *ctx, JSValueConst this_val, int argc, JSV
     return JS_EXCEPTION;
 
   db_triplet db_key;
-  db_transform(ctx,pst,argv[0],&db_key);
+  if (db_transform_key(ctx, pst, db_index_is_composite(pst, index_oid), argv[0], &db_key, 0))
+    return JS_EXCEPTION;
 
   dybase_oid_t *selected_objects = NULL;
 
@@ -889,6 +1683,7 @@ static JSValue db_index_get(JSContext *ctx, JSValueConst this_val, int argc, JSV
   }
   // free selected array
   dybase_free_selection(pst->hs, selected_objects, num_selected);
+  db_free_transform(ctx, &db_key);
   return val;
 }
 
@@ -906,11 +1701,12 @@ static JSValue db_index_set(JSContext *ctx, JSValueConst this_val, int argc, JSV
   dybase_oid_t oid = db_persist_entity(ctx, pst, argv[1]);
   db_store_entity(ctx, pst, oid, argv[1]);
 
-  int replace = JS_ToBool(ctx, argv[2]) > 0;
+  int replace = argc > 2 && JS_ToBool(ctx, argv[2]) > 0;
 
   // transform 'key' into triplet
   db_triplet db_key;
-  db_transform(ctx,pst, argv[0], &db_key);
+  if (db_transform_key(ctx, pst, db_index_is_composite(pst, index_oid), argv[0], &db_key, 0))
+    return JS_EXCEPTION;
       
   int ret = dybase_insert_in_index(pst->hs, index_oid, keyptr(&db_key), db_key.type, db_key.len, oid, replace);
 
@@ -919,12 +1715,178 @@ static JSValue db_index_set(JSContext *ctx, JSValueConst this_val, int argc, JSV
   return JS_NewBool(ctx, ret);
 }
 
-static JSValue db_index_delete(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
-  return JS_UNDEFINED;
+// index.bulkLoad(iterable of [key, object] [, fillFactor]) : integer
+static JSValue db_index_bulk_load(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+  JSStorage*   pst;
+  dybase_oid_t index_oid;
+
+  if (!js_is_persistent(this_val, &pst, &index_oid))
+    return JS_EXCEPTION;
+
+  int fill_factor = 100;
+  if (argc > 1 && !JS_IsUndefined(argv[1])) {
+    if (JS_ToInt32(ctx, &fill_factor, argv[1]))
+      return JS_EXCEPTION;
+    if (fill_factor < 1 || fill_factor > 100)
+      return JS_ThrowRangeError(ctx, "fill factor should be in 1..100");
+  }
+
+  int index_type = dybase_get_index_type(pst->hs, index_oid);
+  int composite = db_index_is_composite(pst, index_oid);
+  db_triplet* keys = NULL;
+  JSValue*    objs = NULL;
+  int n = 0, allocated = 0;
+  JSValue ret = JS_EXCEPTION;
+
+  // well-known symbol atoms are not usable here: the atom enum of this unit
+  // may differ from the one of quickjs.c (CONFIG_BIGNUM, CONFIG_ATOMICS)
+  JSValue global = JS_GetGlobalObject(ctx);
+  JSValue symbol = JS_GetPropertyStr(ctx, global, "Symbol");
+  JSValue sym_iterator = JS_GetPropertyStr(ctx, symbol, "iterator");
+  JS_FreeValue(ctx, symbol);
+  JS_FreeValue(ctx, global);
+  JSAtom iterator_atom = JS_ValueToAtom(ctx, sym_iterator);
+  JS_FreeValue(ctx, sym_iterator);
+  if (iterator_atom == JS_ATOM_NULL)
+    return JS_EXCEPTION;
+  JSValue method = JS_GetProperty(ctx, argv[0], iterator_atom);
+  JS_FreeAtom(ctx, iterator_atom);
+  if (JS_IsException(method))
+    return JS_EXCEPTION;
+  if (!JS_IsFunction(ctx, method)) {
+    JS_FreeValue(ctx, method);
+    return JS_ThrowTypeError(ctx, "entries are not iterable");
+  }
+  JSValue iter = JS_Call(ctx, method, argv[0], 0, NULL);
+  JS_FreeValue(ctx, method);
+  if (JS_IsException(iter))
+    return JS_EXCEPTION;
+  JSValue next = JS_GetProperty(ctx, iter, JS_ATOM_next);
+  if (JS_IsException(next))
+    goto done;
+
+  for (;;) {
+    JSValue res = JS_Call(ctx, next, iter, 0, NULL);
+    if (JS_IsException(res))
+      goto done;
+    JSValue done_val = JS_GetProperty(ctx, res, JS_ATOM_done);
+    int is_done = JS_ToBool(ctx, done_val);
+    JS_FreeValue(ctx, done_val);
+    JSValue entry = JS_GetPropertyStr(ctx, res, "value");
+    JS_FreeValue(ctx, res);
+    if (is_done) {
+      JS_FreeValue(ctx, entry);
+      break;
+    }
+    JSValue key = JS_GetPropertyUint32(ctx, entry, 0);
+    JSValue obj = JS_GetPropertyUint32(ctx, entry, 1);
+    JS_FreeValue(ctx, entry);
+    if (!JS_IsObjectPlain(ctx, obj)) {
+      JS_FreeValue(ctx, key);
+      JS_FreeValue(ctx, obj);
+      JS_ThrowTypeError(ctx, "index can contain only plain objects");
+      goto done;
+    }
+    if (n == allocated) {
+      int new_allocated = allocated ? allocated * 2 : 256;
+      db_triplet* new_keys = js_realloc(ctx, keys, new_allocated * sizeof(db_triplet));
+      if (new_keys)
+        keys = new_keys;
+      JSValue* new_objs = new_keys ? js_realloc(ctx, objs, new_allocated * sizeof(JSValue)) : NULL;
+      if (!new_objs) {
+        JS_FreeValue(ctx, key);
+        JS_FreeValue(ctx, obj);
+        goto done;
+      }
+      objs = new_objs;
+      allocated = new_allocated;
+    }
+    if (db_transform_key(ctx, pst, composite, key, &keys[n], 0)) {
+      JS_FreeValue(ctx, key);
+      JS_FreeValue(ctx, obj);
+      goto done;
+    }
+    JS_FreeValue(ctx, key);
+    if (keys[n].type == dybase_int_type && index_type == dybase_real_type) {
+      keys[n].data.d = keys[n].data.i;
+      keys[n].type = dybase_real_type;
+    }
+    if (keys[n].type != index_type) {
+      db_free_transform(ctx, &keys[n]);
+      JS_FreeValue(ctx, obj);
+      JS_ThrowTypeError(ctx, "type of the key doesn't match index type");
+      goto done;
+    }
+    objs[n++] = obj;
+  }
+
+  // objects are stored only when all the entries are valid
+  {
+    dybase_key_t* bulk = js_malloc(ctx, (n ? n : 1) * sizeof(dybase_key_t));
+    if (!bulk)
+      goto done;
+    for (int i = 0; i < n; i++) {
+      bulk[i].key = keyptr(&keys[i]);
+      bulk[i].key_size = keys[i].len;
+      bulk[i].obj = db_persist_entity(ctx, pst, objs[i]);
+      db_store_entity(ctx, pst, bulk[i].obj, objs[i]);
+    }
+    int inserted = dybase_bulk_load_index(pst->hs, index_oid, index_type, bulk, n, fill_factor);
+    js_free(ctx, bulk);
+    ret = JS_NewInt32(ctx, inserted);
+  }
+
+done:
+  for (int i = 0; i < n; i++) {
+    db_free_transform(ctx, &keys[i]);
+    JS_FreeValue(ctx, objs[i]);
+  }
+  js_free(ctx, keys);
+  js_free(ctx, objs);
+  JS_FreeValue(ctx, next);
+  JS_FreeValue(ctx, iter);
+  return ret;
+}
+
+// index.delete(key [, obj]) : bool
+static JSValue db_index_delete(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+  JSStorage*   pst;
+  dybase_oid_t index_oid;
+
+  if (!js_is_persistent(this_val, &pst, &index_oid))
+    return JS_EXCEPTION;
+
+  dybase_oid_t oid = 0;
+  if (argc > 1 && !JS_IsUndefined(argv[1])) {
+    JSStorage* opst;
+    // an object which is not stored in this storage can not be in the index
+    if (!js_is_persistent(argv[1], &opst, &oid) || opst != pst)
+      return JS_FALSE;
+  } else if (!dybase_is_index_unique(pst->hs, index_oid))
+    return JS_ThrowTypeError(ctx, "object should be specified to delete it from non-unique index");
+
+  db_triplet db_key;
+  if (db_transform_key(ctx, pst, db_index_is_composite(pst, index_oid), argv[0], &db_key, 0))
+    return JS_EXCEPTION;
+
+  int ret = dybase_remove_from_index(pst->hs, index_oid, keyptr(&db_key), db_key.type, db_key.len, oid);
+
+  db_free_transform(ctx, &db_key);
+
+  return JS_NewBool(ctx, ret);
 }
 
+typedef enum IndexIteratorKind {
+  INDEX_ITERATOR_VALUES,  // objects
+  INDEX_ITERATOR_KEYS,    // keys stored in the index
+  INDEX_ITERATOR_ENTRIES, // [key, object] pairs
+} IndexIteratorKind;
+
 static JSValue db_create_index_iterator(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
-static JSValue db_index_select(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
+static JSValue db_index_select(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic);
+static JSValue db_index_count(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 
 static JSValue db_index_clear(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) {
   JSStorage*   pst;
@@ -945,17 +1907,13 @@ static JSValue db_index_get_length(JSContext *ctx, JSValueConst this_val) {
   if (!js_is_persistent(this_val, &pst, &index_oid))
     return JS_EXCEPTION;
 
-  dybase_oid_t *selected_objects = NULL;
-
   int key_type = dybase_get_index_type(pst->hs, index_oid);
 
-  int num_selected = dybase_index_search(pst->hs, index_oid, key_type,
+  long count = dybase_index_count(pst->hs, index_oid, key_type,
     NULL, 0, 1,
-    NULL, 0, 1, &selected_objects);
-
-  dybase_free_selection(pst->hs, selected_objects, num_selected);
+    NULL, 0, 1);
 
-  return JS_NewInt32(ctx, num_selected);
+  return JS_NewInt64(ctx, count);
 }
 
 static JSValue db_index_get_type(JSContext *ctx, JSValueConst this_val) {
@@ -972,6 +1930,10 @@ static JSValue db_index_get_type(JSContext *ctx, JSValueConst this_val) {
     case dybase_long_type: return JS_NewString(ctx, "long");
     case dybase_real_type: return JS_NewString(ctx, "float");
     case dybase_date_type: return JS_NewString(ctx, "date");
+    case dybase_bytes_type:
+      if (db_index_is_composite(pst, index_oid))
+        return JS_NewString(ctx, "composite");
+      break;
     default: break;
   }
   return JS_NULL;
@@ -1001,7 +1963,11 @@ static const JSCFunctionListEntry js_index_proto_funcs[] = {
   JS_CFUNC_DEF("clear", 0, db_index_clear),
   JS_CFUNC_DEF("get", 1, db_index_get),
   JS_CFUNC_DEF("set", 2, db_index_set),
-  JS_CFUNC_DEF("select", 5, db_index_select),
+  JS_CFUNC_DEF("bulkLoad", 2, db_index_bulk_load),
+  JS_CFUNC_MAGIC_DEF("select", 5, db_index_select, INDEX_ITERATOR_VALUES),
+  JS_CFUNC_MAGIC_DEF("keys", 5, db_index_select, INDEX_ITERATOR_KEYS),
+  JS_CFUNC_MAGIC_DEF("entries", 5, db_index_select, INDEX_ITERATOR_ENTRIES),
+  JS_CFUNC_DEF("count", 4, db_index_count),
   JS_CGETSET_DEF("length", db_index_get_length, NULL),
   JS_CGETSET_DEF("unique", db_index_get_unique, NULL),
   JS_CGETSET_DEF("type", db_index_get_type, NULL),
@@ -1016,8 +1982,99 @@ static JSClassDef js_index_class = {
 typedef struct IndexIterator {
   JSStorage* pst;
   dybase_iterator_t iterator;
+  IndexIteratorKind kind;
+  int key_type;
+  int composite; // keys are packed tuples
+  // next part of the selection, pages of its objects are prefetched
+  dybase_oid_t *batch_oids;
+  JSValue *batch_keys; // keys of the entries iterator
+  int batch_pos;
+  int batch_len;
 } IndexIterator;
 
+// converts key stored in the index back to JS value
+static JSValue db_index_key_value(JSContext *ctx, JSStorage* pst, int key_type, void *key, int key_size)
+{
+  switch (key_type) {
+  case dybase_object_ref_type:
+  case dybase_array_ref_type:
+    return db_load_object(ctx, pst, *(dybase_oid_t *)key);
+  case dybase_index_ref_type:
+    return db_load_index(ctx, pst, *(dybase_oid_t *)key, FALSE);
+  case dybase_bool_type:
+    return JS_NewBool(ctx, *(char *)key);
+  case dybase_int_type:
+    return JS_NewInt32(ctx, *(int32_t *)key);
+  case dybase_date_type: {
+    int64_t ft = *(int64_t *)key;
+    return JS_NewDate(ctx, (ft - 116444736000000LL /*SEC_TO_UNIX_EPOCH*/) / 10000.0);
+  }
+  case dybase_long_type:
+    return JS_NewBigInt64(ctx, *(int64_t *)key);
+  case dybase_real_type:
+    return JS_NewFloat64(ctx, *(double *)key);
+  case dybase_chars_type:
+    if (!key_size)
+      return JS_NULL;
+    return JS_NewStringLen(ctx, (const char *)key, key_size);
+  case dybase_bytes_type:
+    return JS_NewArrayBufferCopy(ctx, (const byte *)key, key_size);
+  default:
+    return JS_UNDEFINED;
+  }
+}
+
+static JSValue db_iterator_key(JSContext *ctx, IndexIterator *it, void *key, int key_size)
+{
+  if (it->composite)
+    return db_unpack_key(ctx, key, key_size);
+  return db_index_key_value(ctx, it->pst, it->key_type, key, key_size);
+}
+
+// reads next pst->prefetch items of the selection and prefetches their objects
+static void db_index_iterator_fill(JSContext *ctx, IndexIterator *it)
+{
+  int size = it->pst->prefetch;
+  int n = 0;
+  while (n < size) {
+    dybase_oid_t oid;
+    if (it->kind == INDEX_ITERATOR_ENTRIES) {
+      void *key;
+      int   key_size;
+      oid = dybase_index_iterator_next_key(it->iterator, &key, &key_size);
+      if (!oid)
+        break;
+      it->batch_keys[n] = db_iterator_key(ctx, it, key, key_size);
+    } else {
+      oid = dybase_index_iterator_next(it->iterator);
+      if (!oid)
+        break;
+    }
+    it->batch_oids[n++] = oid;
+  }
+  it->batch_pos = 0;
+  it->batch_len = n;
+  if (n)
+    dybase_prefetch(it->pst->hs, it->batch_oids, n);
+}
+
+// allocates batch buffers, keys iterator does not touch objects and needs no prefetch
+static int db_index_iterator_init_batch(JSContext *ctx, IndexIterator *it)
+{
+  int size = it->pst->prefetch;
+  if (it->kind == INDEX_ITERATOR_KEYS || size == 0)
+    return 0;
+  it->batch_oids = js_malloc(ctx, size * sizeof(dybase_oid_t));
+  if (!it->batch_oids)
+    return -1;
+  if (it->kind == INDEX_ITERATOR_ENTRIES) {
+    it->batch_keys = js_malloc(ctx, size * sizeof(JSValue));
+    if (!it->batch_keys)
+      return -1;
+  }
+  return 0;
+}
+
 static JSValue js_index_iterator_next(JSContext *ctx, JSValueConst this_val,
   int argc, JSValueConst *argv,
   BOOL *pdone, int magic) 
@@ -1026,19 +2083,74 @@ static JSValue js_index_iterator_next(JSContext *ctx, JSValueConst this_val,
   if (!it)
     return JS_EXCEPTION;
 
-  dybase_oid_t oid = dybase_index_iterator_next( it->iterator );
+  dybase_oid_t oid;
+  JSValue key_val;
+
+  if (it->batch_oids) {
+    if (it->batch_pos == it->batch_len) {
+      db_index_iterator_fill(ctx, it);
+      if (it->batch_len == 0) {
+        *pdone = TRUE;
+        return JS_UNDEFINED;
+      }
+    }
+    oid = it->batch_oids[it->batch_pos];
+    key_val = it->kind == INDEX_ITERATOR_ENTRIES ? it->batch_keys[it->batch_pos] : JS_UNDEFINED;
+    it->batch_pos += 1;
+  } else if (it->kind == INDEX_ITERATOR_VALUES) {
+    oid = dybase_index_iterator_next(it->iterator);
+    key_val = JS_UNDEFINED;
+  } else {
+    void *key;
+    int   key_size;
+    oid = dybase_index_iterator_next_key(it->iterator, &key, &key_size);
+    key_val = oid ? db_iterator_key(ctx, it, key, key_size) : JS_UNDEFINED;
+  }
 
   if (!oid) {
     *pdone = TRUE;
     return JS_UNDEFINED;
   }
-
   *pdone = FALSE;
-  JSValue item = db_load_object(ctx, it->pst, oid);
-  return item;
+
+  if (it->kind == INDEX_ITERATOR_VALUES)
+    return db_load_object(ctx, it->pst, oid);
+  if (it->kind == INDEX_ITERATOR_KEYS)
+    return key_val;
+
+  // object is returned in dormant state: its data is not fetched until accessed
+  JSValue pair = JS_NewArray(ctx);
+  JS_SetPropertyUint32(ctx, pair, 0, key_val);
+  JS_SetPropertyUint32(ctx, pair, 1, db_load_object(ctx, it->pst, oid));
+  return pair;
+}
+
+// type of the range keys; missing boundary is passed as null
+static int db_range_key_type(JSStorage *pst, dybase_oid_t index_oid, db_triplet *start, db_triplet *end)
+{
+  if (keyptr(start))
+    return start->type;
+  if (keyptr(end))
+    return end->type;
+  return dybase_get_index_type(pst->hs, index_oid);
+}
+
+// transforms boundaries of the range. Tuple boundary of composite index
+// stands for all keys starting with it.
+static int db_transform_range(JSContext *ctx, JSStorage *pst, int composite, JSValueConst from, JSValueConst to,
+                              int start_inclusive, int end_inclusive, db_triplet *start, db_triplet *end)
+{
+  if (db_transform_key(ctx, pst, composite, from, start, !start_inclusive))
+    return -1;
+  if (db_transform_key(ctx, pst, composite, to, end, end_inclusive)) {
+    db_free_transform(ctx, start);
+    return -1;
+  }
+  return 0;
 }
 
-static JSValue db_index_select(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv) 
+// select(from, to, ascending, startInclusive, endInclusive), keys(...) and entries(...)
+static JSValue db_index_select(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic)
 {
   JSValue enum_obj;
   IndexIterator *it;
@@ -1052,25 +2164,30 @@ static JSValue db_index_select(JSContext *ctx, JSValueConst this_val, int argc,
   enum_obj = JS_NewObjectClass(ctx, js_index_iterator_class_id);
   if (JS_IsException(enum_obj))
     goto fail;
-  it = js_malloc(ctx, sizeof(*it));
+  it = js_mallocz(ctx, sizeof(*it));
   if (!it)
     goto fail1;
   JS_SetOpaque(enum_obj, it);
 
   it->pst = pst;
+  it->kind = magic;
+  it->key_type = dybase_get_index_type(pst->hs, index_oid);
+  it->composite = db_index_is_composite(pst, index_oid);
+  if (db_index_iterator_init_batch(ctx, it))
+    goto fail1;
 
   db_triplet start;
   db_triplet end;
 
-  db_transform(ctx, pst, argv[0], &start);
-  db_transform(ctx, pst, argv[1], &end);
-
   int ascending = 1; if (argc >= 3) ascending = JS_ToBool(ctx, argv[2]) > 0;
   int start_inclusive = 1; if (argc >= 4) start_inclusive = JS_ToBool(ctx, argv[3]) > 0;
   int end_inclusive = 1; if (argc >= 5) end_inclusive = JS_ToBool(ctx, argv[4]) > 0;
+
+  if (db_transform_range(ctx, pst, it->composite, argv[0], argv[1], start_inclusive, end_inclusive, &start, &end))
+    goto fail1;
   
   it->iterator = dybase_create_index_iterator(
-    pst->hs, index_oid, start.type,
+    pst->hs, index_oid, db_range_key_type(pst, index_oid, &start, &end),
     keyptr(&start), start.len, start_inclusive,
     keyptr(&end), end.len, end_inclusive,
     ascending);
@@ -1086,6 +2203,36 @@ fail:
   return JS_EXCEPTION;
 }
 
+// count(from, to, startInclusive, endInclusive), objects are not loaded
+static JSValue db_index_count(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+{
+  JSStorage   *pst;
+  dybase_oid_t index_oid;
+
+  if (!js_is_persistent(this_val, &pst, &index_oid))
+    return JS_EXCEPTION;
+
+  db_triplet start;
+  db_triplet end;
+
+  int start_inclusive = 1; if (argc >= 3) start_inclusive = JS_ToBool(ctx, argv[2]) > 0;
+  int end_inclusive = 1; if (argc >= 4) end_inclusive = JS_ToBool(ctx, argv[3]) > 0;
+
+  if (db_transform_range(ctx, pst, db_index_is_composite(pst, index_oid), argv[0], argv[1],
+                         start_inclusive, end_inclusive, &start, &end))
+    return JS_EXCEPTION;
+
+  long count = dybase_index_count(
+    pst->hs, index_oid, db_range_key_type(pst, index_oid, &start, &end),
+    keyptr(&start), start.len, start_inclusive,
+    keyptr(&end), end.len, end_inclusive);
+
+  db_free_transform(ctx, &start);
+  db_free_transform(ctx, &end);
+
+  return JS_NewInt64(ctx, count);
+}
+
 static JSValue db_create_index_iterator(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
 {
   JSValue enum_obj;
@@ -1100,14 +2247,19 @@ static JSValue db_create_index_iterator(JSContext *ctx, JSValueConst this_val, i
   enum_obj = JS_NewObjectClass(ctx, js_index_iterator_class_id);
   if (JS_IsException(enum_obj))
     goto fail;
-  it = js_malloc(ctx, sizeof(*it));
+  it = js_mallocz(ctx, sizeof(*it));
   if (!it)
     goto fail1;
   JS_SetOpaque(enum_obj, it);
 
   it->pst = pst;
+  it->kind = INDEX_ITERATOR_VALUES;
+  it->composite = db_index_is_composite(pst, index_oid);
+  if (db_index_iterator_init_batch(ctx, it))
+    goto fail1;
 
   int index_type = dybase_get_index_type(pst->hs, index_oid);
+  it->key_type = index_type;
 
   it->iterator = dybase_create_index_iterator(
     pst->hs, index_oid, index_type,
@@ -1138,6 +2290,12 @@ static void js_index_iterator_finalizer(JSRuntime *rt, JSValue val) {
   IndexIterator *it = JS_GetOpaque(val, js_index_iterator_class_id);
   if (it) {
     dybase_free_index_iterator(it->iterator);
+    if (it->batch_keys) {
+      for (int i = it->batch_pos; i < it->batch_len; i++)
+        JS_FreeValueRT(rt, it->batch_keys[i]);
+      js_free_rt(rt, it->batch_keys);
+    }
+    js_free_rt(rt, it->batch_oids);
     js_free_rt(rt, it);
   }
 }
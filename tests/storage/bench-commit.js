@@ -0,0 +1,43 @@
+import * as storage from "storage";
+import * as std from "std";
+import * as os from "os";
+
+// Commits per second: many small transactions, each modifying one object.
+// Compares default (shadow root) commit with write-ahead log mode.
+
+const path = __DIR__ + "bench-commit.db";
+const n = Number(scriptArgs[1] || 1000);
+
+function bench(name, options) {
+  os.remove(path);
+  os.remove(path + ".wal");
+  let db = storage.open(path, true, options);
+  db.root = { counter: 0, items: [] };
+  for (let i = 0; i < 100; i++)
+    db.root.items.push({ id: i, value: 0 });
+  db.commit();
+
+  let items = db.root.items;
+  let start = Date.now();
+  for (let i = 0; i < n; i++) {
+    items[i % 100].value = i;
+    db.root.counter = i;
+    db.commit();
+  }
+  let elapsed = Date.now() - start;
+  db.close();
+
+  db = storage.open(path, false);
+  if (db.root.counter != n - 1)
+    throw Error(name + ": lost commit, counter = " + db.root.counter);
+  db.close();
+
+  print(name + ": " + n + " commits in " + elapsed + " ms, " +
+        Math.round(n * 1000 / Math.max(elapsed, 1)) + " commits/sec");
+}
+
+bench("shadow", undefined);
+bench("wal", { wal: true });
+
+os.remove(path);
+os.remove(path + ".wal");
@@ -0,0 +1,76 @@
+import * as storage from "storage";
+import * as os from "os";
+
+// File size and random read latency of a fragmented storage before and after
+// compaction. The file is fragmented by repeated updates of random records
+// (each update places the new version of the object at the new position) and
+// by dropping half of the records.
+
+const path = __DIR__ + "bench-compact.db";
+const copyPath = path + ".compact";
+const n = Number(scriptArgs[1] || 20000);
+const updates = Number(scriptArgs[2] || 5);
+
+let seed = 1;
+function random(limit) {
+  seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+  return seed % limit;
+}
+
+function fragment() {
+  os.remove(path);
+  let db = storage.open(path);
+  db.root = { records: [] };
+  let records = db.root.records;
+  for (let i = 0; i < n; i++)
+    records.push({ id: i, name: "record-" + i, value: 0 });
+  db.commit();
+  for (let u = 0; u < updates; u++) {
+    for (let i = 0; i < n; i++) {
+      let r = records[random(n)];
+      r.value += 1;
+      r.name += ".";
+    }
+    db.commit();
+  }
+  db.root.records = records.filter((r) => r.id % 2);
+  db.commit();
+  db.gc();
+  db.close();
+}
+
+function randomReads(file) {
+  let db = storage.open(file, false);
+  let records = db.root.records;
+  let m = records.length;
+  seed = 2;
+  let start = Date.now();
+  let sum = 0;
+  for (let i = 0; i < m; i++)
+    sum += records[random(m)].value;
+  let time = Date.now() - start;
+  db.close();
+  return [time, m, sum];
+}
+
+function report(name, file) {
+  let size = os.stat(file)[0].size;
+  let [time, m, sum] = randomReads(file);
+  print(name + ": file " + Math.round(size / 1024) + " KB, " + m + " random reads " + time + " ms, " +
+        Math.round(time * 1000000 / Math.max(m, 1)) + " ns/read (checksum " + sum + ")");
+  return size;
+}
+
+fragment();
+let before = report("fragmented", path);
+
+let db = storage.open(path, false);
+let start = Date.now();
+db.compact(copyPath);
+let compactTime = Date.now() - start;
+db.close();
+let after = report("compacted", copyPath);
+print("compaction " + compactTime + " ms, size ratio " + (before / after).toFixed(2));
+
+os.remove(path);
+os.remove(copyPath);
@@ -0,0 +1,76 @@
+import * as storage from "storage";
+import * as std from "std";
+import * as os from "os";
+
+// Storage file size and scan throughput of objects stored raw and with
+// compress option. Objects are compressed one by one, so small records
+// (where nested objects are stored separately) gain little, while documents
+// with text and long arrays compress well.
+
+const path = __DIR__ + "bench-compress.db";
+const n = Number(scriptArgs[1] || 20000);
+
+const statuses = ["active", "pending", "archived", "deleted"];
+const countries = ["Canada", "Germany", "Japan", "Brazil", "Kenya"];
+
+function makeRecord(i) {
+  return {
+    id: i,
+    name: "customer-" + i,
+    email: "customer" + i + "@example.com",
+    status: statuses[i % statuses.length],
+    address: { street: (i % 300) + " Main Street", city: "Springfield", country: countries[i % countries.length] },
+    tags: ["customer", "newsletter", statuses[(i >> 2) % statuses.length]],
+    orders: [ { sku: "SKU-" + (i % 97), quantity: 1 + i % 5, status: "shipped" },
+              { sku: "SKU-" + (i % 89), quantity: 1 + i % 3, status: "delivered" } ],
+    notes: "regular customer, prefers email contact, no special requirements",
+  };
+}
+
+const words = ["order", "customer", "shipped", "delivered", "payment", "invoice",
+               "address", "status", "pending", "refund", "product", "quantity"];
+
+function makeDocument(i) {
+  let text = [];
+  for (let j = 0; j < 200; j++)
+    text.push(words[(i * 31 + j * 7 + (j >> 3)) % words.length]);
+  let history = [];
+  for (let j = 0; j < 50; j++)
+    history.push("2024-01-" + (10 + j % 20) + " " + words[(i + j) % words.length]);
+  return { id: i, title: "document " + i, text: text.join(" "), history: history };
+}
+
+function bench(name, makeRecord, options) {
+  os.remove(path);
+  let db = storage.open(path, true, options);
+  db.root = { records: [] };
+  let records = db.root.records;
+  let start = Date.now();
+  for (let i = 0; i < n; i++)
+    records.push(makeRecord(i));
+  db.commit();
+  let writeTime = Date.now() - start;
+  db.close();
+  let size = os.stat(path)[0].size;
+
+  db = storage.open(path, false);
+  start = Date.now();
+  let sum = 0;
+  for (let r of db.root.records)
+    sum += r.id + (r.title || r.name).length;
+  let scanTime = Date.now() - start;
+  db.close();
+
+  print(name + ": file " + Math.round(size / 1024) + " KB, write " + writeTime + " ms, scan " +
+        scanTime + " ms, " + Math.round(n * 1000 / Math.max(scanTime, 1)) + " records/sec" +
+        " (checksum " + sum + ")");
+  return size;
+}
+
+for (let [kind, make] of [["records", makeRecord], ["documents", makeDocument]]) {
+  let raw = bench(kind + " raw", make, undefined);
+  let compressed = bench(kind + " compress", make, { compress: true });
+  print(kind + " compression ratio " + (raw / compressed).toFixed(2));
+}
+
+os.remove(path);
@@ -0,0 +1,58 @@
+import * as storage from "storage";
+import * as std from "std";
+import * as os from "os";
+
+// Index population: bulkLoad() of unsorted keys compared with set() per key,
+// and string index with long common key prefixes with and without
+// prefixCompression.
+
+const path = __DIR__ + "bench-index.db";
+const n = Number(scriptArgs[1] || 100000);
+
+function bench(name, type, makeKey, load, options) {
+  os.remove(path);
+  let db = storage.open(path);
+  let index = db.createIndex(type, true, options);
+  db.root = { index: index };
+  let entries = [];
+  for (let i = 0; i < n; i++) {
+    let k = makeKey((i * 7919) % n);
+    entries.push([k, { key: k }]);
+  }
+  let start = Date.now();
+  load(index, entries);
+  db.commit();
+  let elapsed = Date.now() - start;
+  db.close();
+
+  db = storage.open(path, false);
+  index = db.root.index;
+  if (index.length != n)
+    throw Error(name + ": index length = " + index.length);
+  start = Date.now();
+  for (let i = 0; i < n; i++)
+    if (index.get(makeKey(i)).key != makeKey(i))
+      throw Error(name + ": key " + makeKey(i) + " is not found");
+  let lookup = Date.now() - start;
+  db.close();
+
+  let [st] = os.stat(path);
+  print(name + ": " + n + " keys in " + elapsed + " ms, " +
+        Math.round(n * 1000 / Math.max(elapsed, 1)) + " keys/sec, lookups " +
+        lookup + " ms, file " + Math.round(st.size / 1024) + " KB");
+}
+
+const setEach = (index, entries) => { for (let [k, v] of entries) index.set(k, v); };
+const bulkLoad = (index, entries) => index.bulkLoad(entries);
+
+bench("integer set", "integer", k => k, setEach);
+bench("integer bulkLoad", "integer", k => k, bulkLoad);
+bench("string set", "string", k => "key" + k, setEach);
+bench("string bulkLoad", "string", k => "key" + k, bulkLoad);
+
+const url = k => "https://example.com/catalog/products/category-" + (k % 100) + "/item-" + k;
+bench("url set", "string", url, setEach);
+bench("url set prefixed", "string", url, setEach, { prefixCompression: true });
+bench("url bulkLoad prefixed", "string", url, bulkLoad, { prefixCompression: true });
+
+os.remove(path);
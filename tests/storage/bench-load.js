@@ -0,0 +1,60 @@
+import * as storage from "storage";
+import * as os from "os";
+
+// Paths which go through the table of loaded objects (oid -> object) and the
+// set of modified objects: persisting and committing of new objects, loading
+// of all objects of the storage, modification and commit of all of them.
+// The second argument sets memoryLimit of the storage opened for loading.
+
+const path = __DIR__ + "bench-load.db";
+const n = Number(scriptArgs[1] || 1000000);
+const limit = Number(scriptArgs[2] || 0);
+
+function time(name, f) {
+  let start = Date.now();
+  let result = f();
+  let ms = Date.now() - start;
+  print(name + ": " + ms + " ms, " + Math.round(ms * 1000000 / n) + " ns/object");
+  return result;
+}
+
+os.remove(path);
+let db = storage.open(path);
+let items = [];
+for (let i = 0; i < n; i++)
+  items.push({ id: i, value: 0 });
+db.root = { items: items };
+time("persist and commit", () => db.commit());
+db.close();
+items = null;
+
+db = storage.open(path, true, { memoryLimit: limit });
+items = db.root.items;
+let sum = time("load", () => {
+  let sum = 0;
+  for (let i = 0; i < n; i++)
+    sum += items[i].id;
+  return sum;
+});
+time("modify", () => {
+  for (let i = 0; i < n; i++)
+    items[i].value = i;
+});
+let written = time("commit modified", () => db.commit());
+let stats = db.memoryStats;
+print("loaded " + Math.round(stats.loaded / 1024) + " KB, " + stats.objects + " objects in memory, " +
+      stats.unloaded + " unloaded");
+db.close();
+
+// objects modified and then released by unloading of their owners are
+// written before the commit, check the data rather than the count
+db = storage.open(path, false);
+items = db.root.items;
+let values = 0;
+for (let i = 0; i < n; i++)
+  values += items[i].value;
+db.close();
+if (sum != n * (n - 1) / 2 || values != sum || written > n)
+  throw new Error("storage is corrupted");
+
+os.remove(path);
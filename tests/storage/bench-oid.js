@@ -0,0 +1,58 @@
+import * as storage from "storage";
+import * as os from "os";
+
+// B-tree paths which depend on the size of object identifiers: insertion of
+// random keys, point lookups, ordered scan and loading of the referenced
+// objects. Run it with the default build and with the build with DYBASE_OID64
+// to compare 32-bit and 64-bit identifiers: leaf pages of the indexes hold
+// key and identifier pairs, so wider identifiers mean fewer keys per page.
+
+const path = __DIR__ + "bench-oid.db";
+const n = Number(scriptArgs[1] || 100000);
+
+function bench(name, type, makeKey) {
+  os.remove(path);
+  let db = storage.open(path);
+  let index = db.createIndex(type);
+  db.root = { index: index };
+  let start = Date.now();
+  for (let i = 0; i < n; i++) {
+    let k = makeKey((i * 7919) % n);
+    index.set(k, { key: k });
+  }
+  db.commit();
+  let insertTime = Date.now() - start;
+  db.close();
+  let size = os.stat(path)[0].size;
+
+  db = storage.open(path, false);
+  index = db.root.index;
+  start = Date.now();
+  let found = 0;
+  for (let i = 0; i < n; i++) {
+    if (index.get(makeKey((i * 7907) % n)) !== undefined)
+      found += 1;
+  }
+  let lookupTime = Date.now() - start;
+  start = Date.now();
+  let scanned = 0;
+  for (let k of index.keys())
+    scanned += 1;
+  let scanTime = Date.now() - start;
+  start = Date.now();
+  let loaded = 0;
+  for (let obj of index)
+    loaded += obj.key !== undefined ? 1 : 0;
+  let loadTime = Date.now() - start;
+  db.close();
+  if (found != n || scanned != n || loaded != n)
+    throw new Error(name + ": index is corrupted");
+
+  print(name + ": file " + Math.round(size / 1024) + " KB, insert " + insertTime + " ms, lookup " +
+        lookupTime + " ms, key scan " + scanTime + " ms, object scan " + loadTime + " ms");
+}
+
+bench("integer", "integer", (i) => i);
+bench("string", "string", (i) => "key-" + i);
+
+os.remove(path);
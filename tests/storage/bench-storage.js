@@ -0,0 +1,316 @@
+import * as storage from "storage";
+import * as std from "std";
+import * as os from "os";
+
+// Storage benchmark suite, modeled on tests/microbench.js. Each test times
+// batches of operations and reports the throughput and the percentiles of
+// the latency of one operation (time of a batch divided by its size).
+// Results are saved to bench-storage-new.txt when all tests are run, and
+// compared with bench-storage.txt in the current directory if it exists:
+// rename the first file to the second one to make the baseline.
+//
+//   qjs bench-storage.js [-n records] [test...]
+//
+// Cold tests open the storage again, so the page cache and the loaded objects
+// are empty, but the storage file is usually in the cache of the OS.
+
+const path = __DIR__ + "bench-storage.db";
+const insert_path = __DIR__ + "bench-storage-insert.db";
+
+let n = 100000;   // records in the index and nodes in the tree
+let populated = false;
+
+const heads  = [ "TEST", "OPS", "OPS/S", "P50 (us)", "P95 (us)", "P99 (us)", "REF OPS/S", "SCORE (%)" ];
+const widths = [    16,     8,      10,         9,         9,          9,          10,          9 ];
+const precs  = [     0,     0,       0,         2,         2,          2,           0,          2 ];
+
+let ref_data;
+let log_data;
+let total_score = 0;
+let total_scale = 0;
+
+let get_clock = globalThis.__date_clock;
+let clocks_per_sec = 1000000;
+if (typeof get_clock != "function") {
+  print("using fallback millisecond clock");
+  get_clock = Date.now;
+  clocks_per_sec = 1000;
+}
+
+function pad_left(str, n) {
+  str += "";
+  while (str.length < n)
+    str = " " + str;
+  return str;
+}
+
+function log_line() {
+  let s = "";
+  for (let i = 0; i < arguments.length; i++) {
+    let a = arguments[i];
+    if (i > 0)
+      s += " ";
+    if (typeof a == "number")
+      a = a.toFixed(precs[i]);
+    s += pad_left(a, widths[i]);
+  }
+  print(s);
+}
+
+function load_result(filename) {
+  let f = std.open(filename, "r");
+  if (!f)
+    return null;
+  let res = JSON.parse(f.readAsString());
+  f.close();
+  return res;
+}
+
+function save_result(filename, obj) {
+  let f = std.open(filename, "w");
+  f.puts(JSON.stringify(obj, null, 2));
+  f.puts("\n");
+  f.close();
+}
+
+// deterministic pseudo random sequence, runs are comparable
+let seed = 1;
+function random(limit) {
+  seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+  return seed % limit;
+}
+
+// Collects the times of batches of operations
+class Timer {
+  constructor(batch) {
+    this.batch = batch;
+    this.samples = [];
+    this.ops = 0;
+    this.time = 0;
+  }
+  // runs f(i) for i in [from, to) as one batch
+  run(f, from, to) {
+    let t = get_clock();
+    for (let i = from; i < to; i++)
+      f(i);
+    t = get_clock() - t;
+    this.samples.push(t / (to - from));
+    this.ops += to - from;
+    this.time += t;
+  }
+  // runs f(i) for i in [0, count) in batches
+  loop(count, f) {
+    for (let i = 0; i < count; i += this.batch)
+      this.run(f, i, Math.min(i + this.batch, count));
+    return this;
+  }
+}
+
+function percentile(sorted, q) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * q))];
+}
+
+function log_one(name, timer) {
+  let sorted = timer.samples.slice().sort((a, b) => a - b);
+  let ops_per_sec = timer.time ? timer.ops * clocks_per_sec / timer.time : 0;
+  let scale = 1000000 / clocks_per_sec; // clocks to microseconds
+  let res = {
+    ops_per_sec: Math.round(ops_per_sec),
+    p50: percentile(sorted, 0.5) * scale,
+    p95: percentile(sorted, 0.95) * scale,
+    p99: percentile(sorted, 0.99) * scale,
+  };
+  log_data[name] = res;
+  let ref = ref_data && ref_data[name];
+  if (ref && ref.ops_per_sec) {
+    let score = res.ops_per_sec * 100 / ref.ops_per_sec;
+    log_line(name, timer.ops, res.ops_per_sec, res.p50, res.p95, res.p99, ref.ops_per_sec, score);
+    total_score += score;
+  } else {
+    log_line(name, timer.ops, res.ops_per_sec, res.p50, res.p95, res.p99);
+    total_score += 100;
+  }
+  total_scale += 100;
+}
+
+// The storage used by all tests except insert: an integer index of n
+// records and a complete binary tree of n nodes.
+function populate() {
+  if (populated)
+    return;
+  os.remove(path);
+  let db = storage.open(path);
+  let index = db.createIndex("integer");
+  let list = [];
+  for (let i = 0; i < n; i++)
+    list.push([i, { id: i, value: i & 0xFF, name: "record-" + i }]);
+  index.bulkLoad(list);
+  let nodes = [];
+  for (let i = 0; i < n; i++)
+    nodes.push({ value: i & 0xFF, left: null, right: null });
+  for (let i = 1; i < n; i++) {
+    if (i & 1)
+      nodes[(i - 1) >> 1].left = nodes[i];
+    else
+      nodes[(i - 1) >> 1].right = nodes[i];
+  }
+  db.root = { index: index, tree: nodes[0] };
+  db.close();
+  populated = true;
+}
+
+function open() {
+  populate();
+  return storage.open(path);
+}
+
+// new records put in the index, each one is written by index.set()
+function insert() {
+  os.remove(insert_path);
+  let db = storage.open(insert_path);
+  let index = db.createIndex("integer");
+  db.root = { index: index };
+  let timer = new Timer(100).loop(n, (i) => {
+    index.set(random(n * 16), { id: i, value: i & 0xFF, name: "record-" + i });
+  });
+  db.close();
+  os.remove(insert_path);
+  return timer;
+}
+
+// commit of 100 modified records
+function commit() {
+  let db = open();
+  let index = db.root.index;
+  let records = [];
+  for (let i = 0; i < n; i++)
+    records.push(index.get(i));
+  let count = Math.max(100, n / 500);
+  let timer = new Timer(1);
+  for (let k = 0; k < count; k++) {
+    for (let j = 0; j < 100; j++)
+      records[random(n)].value += 1;
+    timer.run(() => db.commit(), 0, 1);
+  }
+  db.close();
+  return timer;
+}
+
+function lookup(index, count) {
+  return new Timer(10).loop(count, () => {
+    let r = index.get(random(n));
+    return r.value;
+  });
+}
+
+// random index.get() of a storage just opened
+function lookup_cold() {
+  let db = open();
+  let timer = lookup(db.root.index, n / 10);
+  db.close();
+  return timer;
+}
+
+// random index.get() of loaded records
+function lookup_warm() {
+  let db = open();
+  let index = db.root.index;
+  for (let i = 0; i < n; i++)
+    index.get(i).value;
+  let timer = lookup(index, n);
+  db.close();
+  return timer;
+}
+
+// index.select() of 100 consecutive keys, with access to each record
+function range_scan() {
+  let db = open();
+  let index = db.root.index;
+  let count = Math.max(100, n / 100);
+  let sum = 0;
+  let timer = new Timer(1).loop(count, () => {
+    let from = random(n - 100);
+    for (let r of index.select(from, from + 99))
+      sum += r.value;
+  });
+  db.close();
+  return timer;
+}
+
+// depth first walk over the tree, batches of 100 visited nodes
+function traverse(tree) {
+  let timer = new Timer(100);
+  let stack = [tree];
+  let sum = 0;
+  while (stack.length) {
+    timer.run(() => {
+      let node = stack.pop();
+      sum += node.value;
+      if (node.right)
+        stack.push(node.right);
+      if (node.left)
+        stack.push(node.left);
+    }, 0, Math.min(100, stack.length));
+  }
+  return timer;
+}
+
+// walk through dormant nodes: each one is loaded on first access
+function traverse_cold() {
+  let db = open();
+  let timer = traverse(db.root.tree);
+  db.close();
+  return timer;
+}
+
+// the same walk when all nodes are loaded
+function traverse_warm() {
+  let db = open();
+  let tree = db.root.tree;
+  traverse(tree);
+  let timer = traverse(tree);
+  db.close();
+  return timer;
+}
+
+function main(argv) {
+  const test_list = [
+    insert,
+    commit,
+    lookup_cold,
+    lookup_warm,
+    range_scan,
+    traverse_cold,
+    traverse_warm,
+  ];
+  let tests = [];
+  for (let i = 1; i < argv.length;) {
+    let name = argv[i++];
+    if (name == "-n") {
+      n = Math.max(1000, +argv[i++]);
+      continue;
+    }
+    let f = test_list.find((f) => f.name === name);
+    if (!f) {
+      print("unknown benchmark: " + name);
+      return 1;
+    }
+    tests.push(f);
+  }
+  if (tests.length == 0)
+    tests = test_list;
+
+  ref_data = load_result("bench-storage.txt");
+  log_data = {};
+  log_line.apply(null, heads);
+  for (let f of tests)
+    log_one(f.name, f());
+  if (ref_data)
+    log_line("total", "", "", "", "", "", "", total_score * 100 / total_scale);
+  if (tests == test_list)
+    save_result("bench-storage-new.txt", log_data);
+  os.remove(path);
+  return 0;
+}
+
+main(scriptArgs);
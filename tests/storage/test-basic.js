@@ -38,8 +38,595 @@ function test() {
   db.close();
 }
 
-init();
-test();
+function testCommit() {
+  let db = storage.open(path);
+  let r = db.root;
+  assert(r.bar, 42);
+  assert(db.commit(), 0, "nothing is modified");
+  r.bar = 43;
+  r.arr.push(4);
+  assert(db.commit(), 2, "only modified objects are written");
+  assert(r.foo, "foofoo", "committed object stays loaded");
+  assert(db.commit(), 0);
+  db.close();
+
+  db = storage.open(path);
+  db.root.foo = "bar"; // modification of dormant object
+  db.close();
+
+  db = storage.open(path);
+  r = db.root;
+  assert(r.foo, "bar");
+  assert(r.bar, 43);
+  assert(r.arr.length, 4);
+  db.close();
+}
+
+function testOpenOptions(options) {
+  const big = "x".repeat(10000); // object spanning several pages
+  os.remove(path);
+  let db = storage.open(path, true, options);
+  db.root = { list: [], big: big };
+  for (let i = 0; i < 1000; i++)
+    db.root.list.push({ i: i, s: "item" + i });
+  db.commit();
+  db.root.list[500].s = "changed";
+  db.close();
+
+  db = storage.open(path, true, options);
+  let r = db.root;
+  assert(r.big, big);
+  assert(r.list.length, 1000);
+  assert(r.list[500].s, "changed");
+  assert(r.list[999].s, "item999");
+  r.list[0].s = "first";
+  db.commit();
+  db.close();
+
+  db = storage.open(path, false, options);
+  assert(db.root.list[0].s, "first", JSON.stringify(options));
+  db.close();
+}
+
+/* copy the file as it is on the disk, keeping 'len' bytes of it */
+function copyFile(from, to, len) {
+  let f = std.open(from, "rb");
+  f.seek(0, std.SEEK_END);
+  let size = f.tell();
+  let buf = new ArrayBuffer(size);
+  f.seek(0, std.SEEK_SET);
+  f.read(buf, 0, size);
+  f.close();
+  if (len === undefined)
+    len = size;
+  f = std.open(to, "wb");
+  f.write(buf, 0, len);
+  f.close();
+  return buf;
+}
+
+function testWalGrowth() {
+  // each commit assembles its log record in one buffer, which grows when
+  // a record is larger than all the previous ones
+  os.remove(path);
+  os.remove(path + ".wal");
+  let db = storage.open(path, true, { wal: true });
+  db.root = { v: 1 };
+  db.commit();
+  let list = [];
+  for (let i = 0; i < 300; i++)
+    list.push({ i: i, s: String(i).repeat(2000) });
+  db.root.list = list;
+  db.commit();
+  db.root.v = 2;
+  db.commit();
+  db.close();
+
+  db = storage.open(path, false);
+  assert(db.root.v, 2);
+  assert(db.root.list.length, 300);
+  assert(db.root.list[299].s, "299".repeat(2000));
+  db.close();
+}
+
+function testWalRecovery() {
+  const crashPath = path + ".crash";
+  const big = "x".repeat(5000);
+  // a crash during a commit leaves a torn record at the end of the log
+  function crash(tear) {
+    os.remove(path);
+    os.remove(path + ".wal");
+    let db = storage.open(path, true, { wal: true });
+    db.root = { v: 1 };
+    db.commit();
+    let logSize = os.stat(path + ".wal")[0].size;
+    // the next record is larger than the previous one
+    db.root.list = [];
+    for (let i = 0; i < 200; i++)
+      db.root.list.push({ i: i, s: big });
+    db.root.v = 2;
+    db.commit();
+    os.remove(crashPath);
+    copyFile(path, crashPath);
+    let log = copyFile(path + ".wal", crashPath + ".wal");
+    tear(log, logSize);
+    db.close();
 
+    db = storage.open(crashPath, true, { wal: true });
+    assert(db.root.v, 1, "torn record is not replayed");
+    assert(db.root.list, undefined);
+    db.root.v = 3;
+    db.close();
+    db = storage.open(crashPath, false);
+    assert(db.root.v, 3);
+    db.close();
+    os.remove(crashPath);
+  }
+  crash((log, logSize) => {
+    copyFile(path + ".wal", crashPath + ".wal", logSize + (log.byteLength - logSize) / 2);
+  });
+  crash((log, logSize) => {
+    let bytes = new Uint8Array(log);
+    bytes[log.byteLength - 100] ^= 0xff; // bad checksum
+    let f = std.open(crashPath + ".wal", "wb");
+    f.write(log, 0, log.byteLength);
+    f.close();
+  });
+}
+
+function testCacheStats() {
+  let db = storage.open(path, true, { cache: "2q" });
+  let before = db.cacheStats;
+  for (let item of db.root.list)
+    assert(item.i >= 0);
+  let after = db.cacheStats;
+  assert(after.hits + after.misses > before.hits + before.misses, true, "pages are accessed");
+  assert(after.evictions >= before.evictions);
+  db.close();
+  assert(db.cacheStats, null, "closed storage");
+}
+
+function testWriteStats(options) {
+  os.remove(path);
+  let db = storage.open(path, true, options);
+  db.root = { list: [] };
+  for (let i = 0; i < 5000; i++)
+    db.root.list.push({ i: i, s: "item" + i });
+  db.commit();
+  let stats = db.cacheStats;
+  assert(stats.commitWrites > 0, true, "commit writes");
+  assert(stats.writes >= stats.commitWrites, true);
+  assert(stats.bytesWritten >= stats.commitBytes, true);
+  // adjacent pages are written by one request
+  assert(stats.commitWrites * 4096 < stats.commitBytes, true, "coalesced writes");
+  db.close();
+}
+
+function testCompression() {
+  function fill(options) {
+    os.remove(path);
+    let db = storage.open(path, true, options);
+    let items = [];
+    for (let i = 0; i < 2000; i++)
+      items.push({ name: "item" + i, description: "description of the item number " + i,
+                   tags: ["red", "green", "blue"], price: i * 1.5 });
+    let referenced = { id: 1 };
+    db.root = { items: items, text: "lorem ipsum dolor ".repeat(1000), referenced: referenced };
+    db.commit();
+    db.close();
+    return os.stat(path)[0].size;
+  }
+  let rawSize = fill({});
+  let compressedSize = fill({ compress: true });
+  assert(compressedSize < rawSize, true, "compressed storage is smaller");
+
+  let db = storage.open(path, true); // collects garbage by scanning compressed objects
+  let r = db.root;
+  assert(r.items.length, 2000);
+  assert(r.items[1234].description, "description of the item number 1234");
+  assert(r.items[7].tags[2], "blue");
+  assert(r.text.length, 18000);
+  assert(r.referenced.id, 1, "object referenced only by compressed object survives GC");
+  r.items[0].name = "changed"; // raw object in storage with compressed ones
+  db.close();
+
+  db = storage.open(path, false, { compress: true });
+  assert(db.root.items[0].name, "changed");
+  assert(db.root.items[1999].price, 1999 * 1.5);
+  db.close();
+}
+
+function testShapes() {
+  os.remove(path);
+  let db = storage.open(path);
+  let items = [];
+  for (let i = 0; i < 1000; i++)
+    items.push(i & 1 ? { id: i, name: "item" + i, price: i / 2 } : { name: "item" + i, id: i });
+  let big = {};
+  for (let i = 0; i < 100; i++)
+    big["key" + i] = i;
+  db.root = { items: items, empty: {}, dict: { 10: "ten", 2: "two" }, big: big,
+              odd: { ".": 1, "": 2, "long key with spaces": [3] } };
+  db.close();
+
+  db = storage.open(path);
+  let r = db.root;
+  assert(r.items.length, 1000);
+  assert(r.items[7].price, 3.5);
+  assert(Object.keys(r.items[7]).join(), "id,name,price");
+  assert(Object.keys(r.items[8]).join(), "name,id", "key order is kept");
+  assert(r.items[8].name, "item8");
+  assert(Object.keys(r.empty).length, 0);
+  assert(r.dict[10], "ten");
+  assert(r.big.key99, 99);
+  assert(r.odd["."], 1);
+  assert(r.odd[""], 2);
+  assert(r.odd["long key with spaces"][0], 3);
+  r.items[9].extra = true; // new shape of the modified object
+  // dictionaries with varying keys do not create classes
+  r.dicts = [];
+  for (let i = 0; i < 200; i++)
+    r.dicts.push({ ["k" + i]: i, common: "c" + i });
+  db.close();
 
+  db = storage.open(path);
+  assert(db.root.items[9].extra, true);
+  assert(db.root.items[9].price, 4.5);
+  assert(db.root.items[11].id, 11);
+  assert(db.root.dicts[150].k150, 150);
+  assert(Object.keys(db.root.dicts[150]).join(), "k150,common");
+  db.root.items[13].name = "modified"; // loaded shape is reused at once
+  db.close();
+
+  db = storage.open(path);
+  assert(db.root.items[13].name, "modified");
+  assert(Object.keys(db.root.items[13]).join(), "id,name,price");
+  db.close();
+}
+
+function testIncrementalGC() {
+  os.remove(path);
+  let db = storage.open(path, true);
+  let index = db.createIndex("string", false);
+  let tags = db.createIndex("string", false);
+  db.root = { list: [], index: index, tags: tags };
+  let tagged = [];
+  for (let i = 0; i < 500; i++) {
+    let item = { i: i, s: "item" + i };
+    db.root.list.push(item);
+    index.set(item.s, item);
+    tagged.push(["tag" + (i % 7), { i: i }]); // reachable only through the index
+  }
+  tags.bulkLoad(tagged);
+  db.commit();
+  db.root.list.splice(0, 250);
+  db.root.index = null;
+  db.commit();
+  db.close();
 
+  db = storage.open(path, true, { gcStep: 20 });
+  assert(db.gcStats.phase, "mark", "cycle is started on open");
+  db.root.list.push({ i: 500, s: "item500" }); // stored while cycle is active
+  let steps = 0;
+  do {
+    db.commit();
+    steps++;
+  } while (db.gcStats.phase != "idle");
+  let stats = db.gcStats;
+  assert(stats.cycles, 1);
+  assert(stats.steps >= steps, true, "bounded steps");
+  assert(steps > 10, true, "collected by steps");
+  assert(stats.freed >= 251, true, "detached objects and index are freed");
+  assert(db.root.list.length, 251);
+  let sum = 0;
+  for (let obj of db.root.tags)
+    sum += obj.i;
+  assert(sum, 499 * 500 / 2, "objects referenced by index survive");
+  db.close();
+
+  db = storage.open(path, true);
+  assert(db.root.list[0].s, "item250");
+  assert(db.root.list[250].s, "item500");
+  db.root.list.pop();
+  db.commit();
+  while (!db.gc(100));
+  assert(db.gcStats.freed >= 1, true, "explicit steps");
+  db.close();
+}
+
+function testFullGC() {
+  // one pass collection on open: the mark and sweep bitmaps are indexed by
+  // file offset, which is 64-bit in the build with DYBASE_OID64
+  os.remove(path);
+  let db = storage.open(path, true);
+  db.root = { list: [], index: db.createIndex("integer") };
+  db.close();
+  let sizes = [];
+  for (let round = 0; round < 6; round++) {
+    db = storage.open(path, true);
+    assert(db.root.list.length, round ? 2000 : 0);
+    assert(db.root.index.get(1999) === undefined, !round);
+    let list = [];
+    for (let i = 0; i < 2000; i++)
+      list.push({ i: i, s: "item" + round + "." + i });
+    db.root.list = list;
+    db.root.index = db.createIndex("integer");
+    db.root.index.set(1999, list[1999]);
+    db.commit();
+    db.close();
+    sizes.push(os.stat(path)[0].size);
+  }
+  assert(sizes[5], sizes[3], "space of the previous rounds is reused");
+  db = storage.open(path, false);
+  assert(db.root.list[1999].s, "item5.1999");
+  assert(db.root.index.get(1999).s, "item5.1999");
+  db.close();
+}
+
+function testBackupAndCompact() {
+  const copyPath = path + ".copy";
+  os.remove(path);
+  let db = storage.open(path);
+  let index = db.createIndex("string");
+  let list = [];
+  for (let i = 0; i < 2000; i++) {
+    let item = { i: i, s: "item" + i };
+    list.push(item);
+    index.set("k" + i, item);
+  }
+  db.root = { list: list, index: index, ints: db.createIndex("integer", false) };
+  db.root.ints.set(7, list[7]);
+  db.commit();
+  // garbage and holes: half of the objects are dropped, others replaced
+  let odd = db.createIndex("string");
+  db.root.list = list.filter((item) => item.i % 2);
+  for (let item of db.root.list)
+    odd.set("k" + item.i, item);
+  db.root.index = odd;
+  for (let item of db.root.list)
+    item.s += "!";
+  db.commit();
+  db.gc();
+
+  db.root.list[0].s = "committed later";
+  assert(db.backup(copyPath), true);
+  db.root.list[0].s = "not committed";
+  db.commit();
+  let copy = storage.open(copyPath, false);
+  assert(copy.root.list.length, 1000);
+  assert(copy.root.list[0].s, "item1!", "backup has the last committed state");
+  assert(copy.root.index.get("k1999").s, "item1999!");
+  copy.close();
+  assert(db.backup(path), false, "database file is not overwritten");
+
+  let size = os.stat(path)[0].size;
+  assert(db.compact(copyPath), true);
+  db.close();
+  assert(os.stat(copyPath)[0].size < size, true, "compacted file is smaller");
+
+  db = storage.open(copyPath);
+  let r = db.root;
+  assert(r.list.length, 1000);
+  assert(r.list[0].s, "not committed");
+  assert(r.list[999].s, "item1999!");
+  assert(r.index.length, 1000);
+  assert(r.index.get("k0"), undefined);
+  assert(r.index.get("k1001"), r.list[500], "objects keep their identity");
+  assert(r.ints.get(7)[0], r.list[3]);
+  r.index.set("k0", { i: 0, s: "new" }); // handles of dropped objects are reused
+  r.list.push(r.index.get("k0"));
+  db.close();
+  db = storage.open(copyPath, false);
+  assert(db.root.list[1000].s, "new");
+  assert(db.root.index.get("k0").s, "new");
+  db.close();
+  os.remove(copyPath);
+}
+
+function testExportImport() {
+  const dumpPath = path + ".dump";
+  const copyPath = path + ".copy";
+  os.remove(path);
+  let db = storage.open(path, true, { compress: true });
+  let list = [];
+  let index = db.createIndex("string");
+  for (let i = 0; i < 500; i++) {
+    let item = { i: i, s: "item" + i, text: "long text ".repeat(20), tags: ["a", i] };
+    list.push(item);
+    index.set("k" + i, item);
+  }
+  db.root = { list: list, index: index, dates: db.createIndex("date", false) };
+  db.root.dates.set(new Date(2020, 1, 1), list[1]);
+  db.root.self = db.root;
+  db.commit();
+  db.root.list[0].s = "not committed";
+  assert(db.export(dumpPath), true);
+  assert(db.export(path), false, "database file is not overwritten");
+  db.close();
+
+  assert(storage.import(dumpPath, copyPath), true);
+  assert(storage.import(path, copyPath + "2"), false, "not a dump");
+  db = storage.open(copyPath);
+  let r = db.root;
+  assert(r.self, r);
+  assert(r.list.length, 500);
+  assert(r.list[0].s, "item0", "dump has the last committed state");
+  assert(r.list[499].tags[1], 499);
+  assert(r.index.length, 500);
+  assert(r.index.get("k250"), r.list[250]);
+  assert(r.dates.get(new Date(2020, 1, 1))[0], r.list[1]);
+  r.list.push({ s: "new" });
+  db.close();
+  db = storage.open(copyPath, false);
+  assert(db.root.list[500].s, "new");
+  db.close();
+  os.remove(dumpPath);
+  os.remove(copyPath);
+  os.remove(copyPath + "2");
+}
+
+function testMemoryLimit() {
+  const n = 5000;
+  const limit = 100000;
+  os.remove(path);
+  let db = storage.open(path);
+  let list = [];
+  let index = db.createIndex("integer");
+  for (let i = 0; i < n; i++) {
+    let item = { id: i, name: "record-" + i + "x".repeat(100), tags: [i, "t"] };
+    list.push(item);
+    index.set(i, item);
+  }
+  db.root = { list: list, index: index };
+  db.commit();
+  db.close();
+  list = index = null;
+
+  db = storage.open(path, true, { memoryLimit: limit });
+  let r = db.root;
+  let first = r.list[0];
+  first.name;
+  let sum = 0;
+  for (let i = 0; i < n; i++)
+    sum += r.list[i].id + r.list[i].tags[0];
+  assert(sum, n * (n - 1));
+  let stats = db.memoryStats;
+  assert(stats.limit, limit);
+  assert(stats.unloaded > 0, true, "objects are unloaded");
+  assert(stats.loaded <= limit, true, "memory of loaded objects is within the limit");
+  assert(r.list[0], first, "identity of unloaded object is preserved");
+  assert(first.name, "record-0" + "x".repeat(100), "unloaded object is loaded again");
+  assert(r.index.get(4321), r.list[4321]);
+
+  r.list[10].name = "modified";  // modified objects are kept until commit
+  let detached = r.list[20];
+  detached.tags.push("more");
+  detached = null;
+  for (let i = 0; i < n; i++)
+    sum += r.list[i].tags.length;
+  assert(r.list[10].name, "modified");
+  db.commit();
+  assert(db.memoryStats.loaded <= limit, true);
+  db.close();
+
+  db = storage.open(path, false);
+  r = db.root;
+  assert(r.list[10].name, "modified");
+  assert(r.list[20].tags.length, 3);
+  sum = 0;
+  for (let i = 0; i < n; i++)
+    sum += r.list[i].id;
+  assert(sum, n * (n - 1) / 2);
+  assert(db.memoryStats.unloaded, 0, "no limit by default");
+  db.close();
+}
+
+function testCollections() {
+  os.remove(path);
+  let db = storage.open(path);
+  let shared = { name: "shared" };
+  let map = new Map([["a", 1], [2, "two"], [shared, [1, 2]], ["nested", new Map([["x", new Set([1])]])]]);
+  let set = new Set(["a", 2, shared, 3.5]);
+  db.root = {
+    map: map, set: set, shared: shared, empty: new Map(),
+    u8: new Uint8Array([1, 2, 255]),
+    f64: new Float64Array([0.5, -1e300]),
+    i16: new Int16Array([0, 1, 2, 3, -4]).subarray(2),
+    big: new BigInt64Array([-1n, 1n << 62n]),
+    list: [new Int32Array(0), new Set()],
+  };
+  db.close();
+
+  db = storage.open(path);
+  let r = db.root;
+  assert(r.map instanceof Map, true);
+  assert(r.map.size, 4);
+  assert([...r.map.keys()].toString(), ["a", 2, r.shared, "nested"].toString(), "insertion order is kept");
+  assert(r.map.get("a"), 1);
+  assert(r.map.get(2), "two");
+  assert(r.map.get(r.shared)[1], 2, "object keys keep identity");
+  assert(r.map.get("nested").get("x").has(1), true);
+  assert(r.set instanceof Set, true);
+  assert(r.set.size, 4);
+  assert(r.set.has(r.shared), true);
+  assert(r.set.has(3.5), true);
+  assert(r.empty.size, 0);
+  assert(r.u8 instanceof Uint8Array, true);
+  assert(r.u8.toString(), "1,2,255");
+  assert(r.f64[1], -1e300);
+  assert(r.i16 instanceof Int16Array, true);
+  assert(r.i16.toString(), "2,3,-4", "only the elements of the view are stored");
+  assert(r.big[1], 1n << 62n);
+  assert(r.list[0].length, 0);
+  assert(r.list[1] instanceof Set, true);
+
+  r.map.set("b", { v: 10 });
+  r.map.delete(2);
+  r.set.add("new");
+  r.set.delete("a");
+  r.list[1].add(r.map);
+  db.close();
+
+  db = storage.open(path, false);
+  r = db.root;
+  assert(r.map.get("b").v, 10);
+  assert(r.map.has(2), false);
+  assert(r.set.has("new"), true);
+  assert(r.set.has("a"), false);
+  let iterated = 0;
+  r.map.forEach(() => iterated++);
+  assert(iterated, 4);
+  assert(r.list[1].has(r.map), true, "identity of Map is kept");
+  db.close();
+
+  // Map and Set are unloaded over the memory limit, but not while they are iterated
+  os.remove(path);
+  db = storage.open(path);
+  let sets = [];
+  for (let i = 0; i < 500; i++)
+    sets.push(new Set(Array.from({ length: 50 }, (v, j) => i * 100 + j)));
+  db.root = { sets: sets };
+  db.close();
+  db = storage.open(path, false, { memoryLimit: 100000 });
+  sets = db.root.sets;
+  let first = sets[0];
+  let it = first.values();
+  it.next();
+  let sum = 0;
+  for (let i = 0; i < sets.length; i++)
+    for (let v of sets[i])
+      sum += v;
+  assert(sum, 500 * (50 * 49 / 2) + 100 * 50 * (500 * 499 / 2));
+  assert(db.memoryStats.unloaded > 0, true);
+  let rest = 0;
+  for (let v of it)
+    rest++;
+  assert(rest, 49, "iterator is not broken by unloading");
+  assert(db.root.sets[0], first);
+  assert(first.has(49), true);
+  db.close();
+}
+
+init();
+test();
+testCommit();
+testOpenOptions({ wal: true });
+testOpenOptions({ mmap: true });
+testOpenOptions({ wal: true, mmap: true });
+testWalGrowth();
+testWalRecovery();
+testOpenOptions({ cache: "2q" });
+testOpenOptions({ prefetch: 0 });
+testOpenOptions({ prefetch: 5, readahead: true });
+testOpenOptions({ compress: true });
+testCacheStats();
+testWriteStats();
+testWriteStats({ mmap: true });
+testIncrementalGC();
+testFullGC();
+testCompression();
+testShapes();
+testBackupAndCompact();
+testExportImport();
+testMemoryLimit();
+testCollections();
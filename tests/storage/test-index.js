@@ -51,8 +51,344 @@ function test() {
   db.close();
 }
 
+function testBulkLoad() {
+  os.remove(path);
+  let db = storage.open(path);
+
+  let ints = db.createIndex("integer");
+  let entries = [];
+  for (let i = 0; i < 5000; i++) {
+    let k = (i * 7919) % 5000; // unsorted input
+    entries.push([k, { key: k }]);
+  }
+  entries.push([42, { key: 42, duplicate: true }]);
+  assert(ints.bulkLoad(entries), 5000, "unique index drops duplicate keys");
+
+  let strs = db.createIndex("string", false);
+  let map = new Map();
+  for (let i = 0; i < 3000; i++)
+    map.set("key" + (i * 31 % 3000), { n: i });
+  assert(strs.bulkLoad(map, 70), 3000);
+  assert(strs.bulkLoad([["key7", { n: -1 }]]), 1, "load into non-empty index");
+
+  db.root = { ints: ints, strs: strs };
+  db.close();
+
+  db = storage.open(path);
+  ints = db.root.ints;
+  strs = db.root.strs;
+  assert(ints.length, 5000);
+  assert(ints.get(42).duplicate, undefined);
+  let prev = -1;
+  for (let item of ints) {
+    assert(item.key, prev + 1, "keys are ordered");
+    prev = item.key;
+  }
+  assert(prev, 4999);
+  assert(strs.length, 3001);
+  assert(strs.get("key7").length, 2);
+  assert(strs.get("key2999").length, 1);
+  let selected = 0;
+  for (let item of strs.select("key100", "key199"))
+    selected++;
+  let expected = 0;
+  for (let i = 0; i < 3000; i++) {
+    let k = "key" + i;
+    if (k >= "key100" && k <= "key199") expected++;
+  }
+  assert(selected, expected);
+
+  let failed = false;
+  try { ints.bulkLoad([["string", {}]]); } catch (e) { failed = e instanceof TypeError; }
+  assert(failed, true, "key type mismatch");
+  failed = false;
+  try { ints.bulkLoad([[10000, { key: 10000 }], [10001, "string"]]); } catch (e) { failed = e instanceof TypeError; }
+  assert(failed, true, "not an object");
+  assert(ints.length, 5000, "index is not changed by the failed load");
+  assert(ints.get(10000), undefined);
+  db.close();
+}
+
+function testPrefixCompression() {
+  os.remove(path);
+  let db = storage.open(path);
+  const url = i => "https://example.com/catalog/products/category-" + (i % 17) + "/item-" + i;
+
+  let plain = db.createIndex("string", false);
+  let prefixed = db.createIndex("string", false, { prefixCompression: true });
+  let loaded = db.createIndex("string", true, { prefixCompression: true });
+  let entries = [];
+  for (let i = 0; i < 5000; i++) {
+    let obj = { n: i };
+    plain.set(url(i), obj);
+    prefixed.set(url(i), obj);
+    entries.push([url(i), obj]);
+  }
+  assert(loaded.bulkLoad(entries), 5000);
+  db.root = { plain: plain, prefixed: prefixed, loaded: loaded };
+  db.close();
+
+  db = storage.open(path);
+  let expected = [];
+  for (let item of db.root.plain)
+    expected.push(item.n);
+  for (let index of [db.root.prefixed, db.root.loaded]) {
+    let actual = [];
+    for (let item of index)
+      actual.push(item.n);
+    assert(actual.join(), expected.join(), "same order as uncompressed index");
+    let selected = [];
+    for (let item of index.select(url(100), url(199)))
+      selected.push(item.n);
+    let plainSelected = [];
+    for (let item of db.root.plain.select(url(100), url(199)))
+      plainSelected.push(item.n);
+    assert(selected.join(), plainSelected.join());
+  }
+  assert(db.root.prefixed.get(url(4321))[0].n, 4321);
+  assert(db.root.loaded.get(url(17)).n, 17);
+  assert(db.root.loaded.get(url(5000)), undefined);
+  db.close();
+}
+
+function testDelete() {
+  os.remove(path);
+  let db = storage.open(path);
+  const url = i => "https://example.com/catalog/products/category-" + (i % 17) + "/item-" + i;
+  let plain = db.createIndex("string", false);
+  let prefixed = db.createIndex("string", false, { prefixCompression: true });
+  let loaded = db.createIndex("string", true, { prefixCompression: true });
+  let objs = [], entries = [];
+  for (let i = 0; i < 5000; i++) {
+    objs.push({ n: i });
+    plain.set(url(i), objs[i]);
+    prefixed.set(url(i), objs[i]);
+    entries.push([url(i), objs[i]]);
+  }
+  loaded.bulkLoad(entries); // full pages: the first removals underflow
+  db.root = { plain: plain, prefixed: prefixed, loaded: loaded, objs: objs };
+  db.commit();
+
+  let failed = false;
+  try { prefixed.delete(url(0)); } catch (e) { failed = e instanceof TypeError; }
+  assert(failed, true, "object is required for non-unique index");
+  assert(prefixed.delete(url(0), { n: 0 }), false, "object is not in the index");
+  assert(prefixed.delete(url(0), objs[1]), false, "other object under the key");
+  assert(loaded.delete("https://example.com/none"), false);
+
+  // most of the keys are removed, so that the leaf and inner pages are
+  // merged and the tree gets lower
+  for (let i = 0; i < 5000; i++) {
+    if (i % 10 == 0)
+      continue;
+    assert(plain.delete(url(i), objs[i]), true);
+    assert(prefixed.delete(url(i), objs[i]), true);
+    assert(loaded.delete(url(i)), true);
+  }
+  assert(loaded.delete(url(1)), false, "already deleted");
+  db.commit();
+  db.close();
+
+  db = storage.open(path);
+  let expected = [];
+  for (let item of db.root.plain)
+    expected.push(item.n);
+  assert(expected.length, 500);
+  for (let index of [db.root.prefixed, db.root.loaded]) {
+    assert(index.length, 500);
+    let actual = [];
+    for (let item of index)
+      actual.push(item.n);
+    assert(actual.join(), expected.join(), "same order as uncompressed index");
+    let selected = [];
+    for (let item of index.select(url(100), url(199)))
+      selected.push(item.n);
+    let plainSelected = [];
+    for (let item of db.root.plain.select(url(100), url(199)))
+      plainSelected.push(item.n);
+    assert(selected.join(), plainSelected.join());
+  }
+  assert(db.root.prefixed.get(url(4320))[0].n, 4320);
+  assert(db.root.prefixed.get(url(4321)).length, 0);
+  assert(db.root.loaded.get(url(4321)), undefined);
+
+  // the tree is emptied and filled again
+  objs = db.root.objs;
+  for (let i = 0; i < 5000; i += 10)
+    assert(db.root.loaded.delete(url(i)), true);
+  assert(db.root.loaded.length, 0);
+  for (let i = 0; i < 300; i++)
+    db.root.loaded.set(url(i), objs[i]);
+  db.close();
+
+  db = storage.open(path);
+  assert(db.root.loaded.length, 300);
+  assert(db.root.loaded.get(url(299)).n, 299);
+
+  // long keys make a higher tree, where inner pages are merged as well
+  const long = i => String(i).padStart(5, "0") + "-" + "x".repeat(250);
+  let tall = db.createIndex("string", true, { prefixCompression: true });
+  db.root.tall = tall;
+  for (let i = 0; i < 3000; i++)
+    tall.set(long(i), { n: i });
+  for (let i = 0; i < 3000; i++) {
+    if (i % 20)
+      assert(tall.delete(long(i)), true);
+  }
+  db.close();
+
+  db = storage.open(path);
+  let n = 0;
+  for (let item of db.root.tall) {
+    assert(item.n, n);
+    n += 20;
+  }
+  assert(n, 3000);
+  assert(db.root.tall.get(long(2980)).n, 2980);
+  db.close();
+}
+
+function testKeys() {
+  os.remove(path);
+  let db = storage.open(path);
+  let ints = db.createIndex("integer");
+  let names = db.createIndex("string", true, { prefixCompression: true });
+  let dates = db.createIndex("date");
+  for (let i = 0; i < 1000; i++) {
+    let obj = { n: i };
+    ints.set(i * 2, obj);
+    names.set("name-" + (1000 + i), obj);
+  }
+  dates.set(new Date(2020, 1, 2), { n: 0 });
+  db.root = { ints: ints, names: names, dates: dates };
+  db.close();
+
+  db = storage.open(path);
+  ints = db.root.ints;
+  names = db.root.names;
+
+  assert(ints.length, 1000);
+  assert(ints.count(), 1000);
+  assert(ints.count(10, 20), 6);
+  assert(ints.count(10, 20, false, false), 4);
+  assert(ints.count(undefined, 9), 5);
+  assert(ints.count(1990), 5);
+  assert(ints.count(5000), 0);
+  assert(names.count("name-1100", "name-1199"), 100);
+
+  assert([...ints.keys(10, 20)].join(), "10,12,14,16,18,20");
+  assert([...ints.keys(10, 20, false)].join(), "20,18,16,14,12,10");
+  assert([...ints.keys(10, 20, true, false, false)].join(), "12,14,16,18");
+  assert([...names.keys("name-1997")].join(), "name-1997,name-1998,name-1999");
+  assert([...names.keys()].length, 1000);
+  assert(db.root.dates.keys().next().value.getTime(), new Date(2020, 1, 2).getTime());
+
+  let n = 0;
+  for (let [key, obj] of names.entries("name-1500", "name-1509")) {
+    assert(key, "name-" + (1500 + n));
+    assert(obj.n, 500 + n);
+    n++;
+  }
+  assert(n, 10);
+  db.close();
+}
+
+function testPrefetch() {
+  os.remove(path);
+  let db = storage.open(path);
+  let index = db.createIndex("integer");
+  // objects are stored in the order different from the order of keys
+  for (let i = 0; i < 2000; i++) {
+    let k = (i * 7919) % 2000;
+    index.set(k, { k: k, s: "item" + k });
+  }
+  db.root = { index: index };
+  db.close();
+
+  for (let prefetch of [0, 1, 7, 64]) {
+    db = storage.open(path, true, { prefetch: prefetch, readahead: prefetch > 1 });
+    index = db.root.index;
+    let n = 0;
+    for (let obj of index.select(100, 1099)) {
+      assert(obj.k, 100 + n, "prefetch " + prefetch);
+      n++;
+    }
+    assert(n, 1000);
+    n = 0;
+    for (let [key, obj] of index.entries(null, null, false)) {
+      assert(key, 1999 - n);
+      assert(obj.s, "item" + key);
+      n++;
+    }
+    assert(n, 2000);
+    let partial = index.entries(10, 20);
+    assert(partial.next().value[0], 10); // rest of the batch is released by finalizer
+    db.close();
+  }
+}
+
+function testCompositeKeys() {
+  os.remove(path);
+  let db = storage.open(path);
+  let events = db.createIndex("composite", true);
+  let mixed = db.createIndex("composite", false, { prefixCompression: true });
+  const day = 24 * 3600 * 1000;
+  for (let tenant of ["beta", "alpha", "alpha2", "gamma"])
+    for (let i = 9; i >= 0; i--)
+      events.set([tenant, new Date(Date.UTC(2024, 0, 1) + i * day)], { tenant: tenant, i: i });
+  for (let n of [10, -2.5, 2, 0, -100, 1e10, 3])
+    mixed.set([n, "x\0" + n], { n: n });
+  mixed.set(["str"], { n: "str" });
+  mixed.set([null, 1], { n: null });
+  db.root = { events: events, mixed: mixed };
+  db.close();
+
+  db = storage.open(path);
+  events = db.root.events;
+  mixed = db.root.mixed;
+  assert(events.type, "composite");
+  assert(events.length, 40);
+
+  let first = events.get(["beta", new Date(Date.UTC(2024, 0, 3))]);
+  assert(first.tenant + first.i, "beta2");
+  assert(events.get(["beta"]), undefined, "get is exact");
+
+  // prefix of the tuple selects all its extensions
+  assert(events.count("alpha", "alpha"), 10);
+  assert(events.count(["alpha"], ["alpha"]), 10);
+  assert(events.count("alpha", "beta"), 30);
+  assert(events.count("alpha", "beta", false, true), 20, "exclusive prefix boundary");
+  assert(events.count("alpha", "beta", true, false), 20);
+  let items = [...events.select(["gamma", new Date(Date.UTC(2024, 0, 3))], ["gamma", new Date(Date.UTC(2024, 0, 5))])];
+  assert(items.map(o => o.i).join(), "2,3,4");
+  items = [...events.select("alpha", "alpha", false)];
+  assert(items.map(o => o.i).join(), "9,8,7,6,5,4,3,2,1,0");
+
+  let key = events.keys("alpha2").next().value;
+  assert(key[0], "alpha2");
+  assert(key[1].getTime(), Date.UTC(2024, 0, 1));
+
+  // numbers are ordered numerically, types are ordered: null, number, string
+  let keys = [...mixed.keys()];
+  assert(keys.map(k => k[0]).join(), ",-100,-2.5,0,2,3,10,10000000000,str");
+  assert(keys[2][1], "x\0-2.5");
+  assert(mixed.count(2.5, 1e9), 2);
+  assert([...mixed.entries(-2.5, -2.5)][0][1].n, -2.5);
+
+  let failed = false;
+  try { events.set([{}], {}); } catch (e) { failed = e instanceof TypeError; }
+  assert(failed, true, "object can not be element of the key");
+  db.close();
+}
+
 init();
 test();
+testBulkLoad();
+testPrefixCompression();
+testDelete();
+testKeys();
+testPrefetch();
+testCompositeKeys();
 
 
 
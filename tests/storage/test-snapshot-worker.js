@@ -0,0 +1,29 @@
+/* Worker code for test-snapshot.js */
+import * as storage from "storage";
+import * as os from "os";
+
+var parent = os.Worker.parent;
+
+function readSnapshots(path, n) {
+  let count = 0;
+  for (let i = 0; i < 20; i++) {
+    let db = storage.open(path, false, { snapshot: true });
+    let version = db.root.version;
+    let items = db.root.items;
+    if (items.length != n)
+      return { error: "snapshot has " + items.length + " items" };
+    for (let item of items) {
+      if (item.version !== version)
+        return { error: "item " + item.i + " of version " + item.version +
+                        " in snapshot of version " + version };
+    }
+    db.close();
+    count++;
+  }
+  return { snapshots: count };
+}
+
+parent.onmessage = function (e) {
+  parent.onmessage = null;
+  parent.postMessage(readSnapshots(e.data.path, e.data.items));
+};
@@ -0,0 +1,109 @@
+import * as storage from "storage";
+import * as std from "std";
+import * as os from "os";
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+
+    if (actual !== null && expected !== null
+    &&  typeof actual == 'object' && typeof expected == 'object'
+    &&  actual.toString() === expected.toString())
+        return;
+
+    throw Error("assertion failed: got |" + actual + "|" +
+                ", expected |" + expected + "|" +
+                (message ? " (" + message + ")" : ""));
+}
+
+const path = __DIR__ + "snapshot.db";
+const N = 1000;
+
+function update(db, version) {
+  for (let item of db.root.items) {
+    item.version = version;
+    item.data = "v" + version + "-" + "x".repeat(version % 7 * 10);
+  }
+  db.root.version = version;
+  db.commit();
+}
+
+function check(db, version, message) {
+  assert(db.root.version, version, message);
+  let items = db.root.items;
+  assert(items.length, N, message);
+  for (let item of items)
+    assert(item.version, version, message);
+}
+
+function testIsolation() {
+  os.remove(path);
+  let db = storage.open(path);
+  db.root = { version: 0, items: [] };
+  for (let i = 0; i < N; i++)
+    db.root.items.push({ i: i, version: 0 });
+  db.commit();
+
+  let s0 = storage.open(path, false, { snapshot: true });
+  assert(s0.root.version, 0);
+  // space of replaced objects is reused only after the snapshot is closed
+  for (let v = 1; v <= 5; v++)
+    update(db, v);
+  check(s0, 0, "snapshot does not see later commits");
+
+  let s5 = storage.open(path, false, { snapshot: true });
+  check(s5, 5, "new snapshot sees the last commit");
+  s0.close();
+  update(db, 6);
+  update(db, 7);
+  check(s5, 5);
+
+  // writer can be closed before its snapshots
+  db.close();
+  check(s5, 5, "snapshot outlives the writer");
+  s5.close();
+
+  db = storage.open(path);
+  check(db, 7, "storage is consistent after snapshots are closed");
+  db.close();
+
+  // without the writer the snapshot is a normal read-only storage
+  let ro = storage.open(path, true, { snapshot: true });
+  check(ro, 7);
+  ro.close();
+}
+
+function testWorker() {
+  os.remove(path);
+  let db = storage.open(path);
+  db.root = { version: 0, items: [] };
+  for (let i = 0; i < N; i++)
+    db.root.items.push({ i: i, version: 0 });
+  db.commit();
+
+  let version = 0;
+  let done = false;
+  let worker = new os.Worker("./test-snapshot-worker.js");
+  worker.onmessage = function (e) {
+    let ev = e.data;
+    worker.onmessage = null;
+    done = true;
+    assert(ev.error, undefined, ev.error);
+    assert(ev.snapshots, 20);
+    db.close();
+  };
+  function writer() {
+    if (done)
+      return;
+    update(db, ++version);
+    os.setTimeout(writer, 1);
+  }
+  worker.postMessage({ path: path, items: N });
+  writer();
+}
+
+testIsolation();
+testWorker();
@@ -0,0 +1,209 @@
+/* paths of the compiled code: run with 'qjs --jit 1' (the results must
+   be the same with the interpreter) */
+
+function assert(actual, expected, message) {
+    if (arguments.length == 1)
+        expected = true;
+
+    if (actual === expected)
+        return;
+
+    if (actual !== null && expected !== null
+    &&  typeof actual == 'object' && typeof expected == 'object'
+    &&  actual.toString() === expected.toString())
+        return;
+
+    throw Error("assertion failed: got |" + actual + "|" +
+                ", expected |" + expected + "|" +
+                (message ? " (" + message + ")" : ""));
+}
+
+function assert_throws(expected_error, func)
+{
+    var err = false;
+    try {
+        func();
+    } catch(e) {
+        err = true;
+        if (!(e instanceof expected_error)) {
+            throw Error("unexpected exception type");
+        }
+    }
+    if (!err) {
+        throw Error("expected exception");
+    }
+}
+
+function add(a, b) { return a + b; }
+function sub(a, b) { return a - b; }
+function mul(a, b) { return a * b; }
+function neg(a) { return -a; }
+function inc(a) { a++; return a; }
+function dec(a) { a--; return a; }
+function shl(a, b) { return a << b; }
+function shr(a, b) { return a >>> b; }
+function lt(a, b) { return a < b; }
+
+function test_int_overflow()
+{
+    var i;
+    /* the same functions see int, float and overflowing operands */
+    for(i = 0; i < 3; i++) {
+        assert(add(1, 2), 3);
+        assert(add(0x7fffffff, 1), 2147483648);
+        assert(add(-0x80000000, -1), -2147483649);
+        assert(add(1.5, 1), 2.5);
+        assert(add("a", 1), "a1");
+        assert(sub(-0x80000000, 1), -2147483649);
+        assert(sub(0x7fffffff, -1), 2147483648);
+        assert(mul(0x10000, 0x10000), 4294967296);
+        assert(mul(-0x80000000, -1), 2147483648);
+        assert(Object.is(mul(0, -1), -0), true);
+        assert(Object.is(mul(-5, 0), -0), true);
+        assert(Object.is(neg(0), -0), true);
+        assert(neg(-0x80000000), 2147483648);
+        assert(inc(0x7fffffff), 2147483648);
+        assert(dec(-0x80000000), -2147483649);
+        assert(inc(1.5), 2.5);
+        assert(shl(1, 31), -2147483648);
+        assert(shr(-1, 0), 4294967295);
+        assert(lt(1, 2), true);
+        assert(lt(2, 1.5), false);
+        assert(lt("10", "9"), true);
+        assert(lt(NaN, 1), false);
+    }
+}
+
+function test_loop_overflow()
+{
+    var i, s;
+    s = 0x7ffffff0;
+    for(i = 0; i < 100; i++)
+        s += i;
+    assert(s, 0x7ffffff0 + 4950);
+    s = 0;
+    for(i = 0x7ffffffd; i < 0x80000002; i++)
+        s++;
+    assert(s, 5);
+    assert(i, 0x80000002);
+}
+
+function thrower(x)
+{
+    if (x > 2)
+        throw new RangeError("x = " + x);
+    return x;
+}
+
+function test_exception()
+{
+    var i, s, log;
+    /* exception raised by a helper called from compiled code */
+    for(i = 0; i < 3; i++) {
+        assert_throws(TypeError, function () { var o; return o.x; });
+        assert_throws(ReferenceError, function () { return not_defined_var; });
+    }
+    /* caught in the same function */
+    s = 0;
+    for(i = 0; i < 5; i++) {
+        try {
+            s += thrower(i);
+        } catch(e) {
+            assert(e instanceof RangeError, true);
+            s += 100;
+        }
+    }
+    assert(s, 0 + 1 + 2 + 100 + 100);
+    /* unwound through several compiled frames */
+    function f(n) { return n == 0 ? thrower(3) : f(n - 1) + 1; }
+    for(i = 0; i < 3; i++)
+        assert_throws(RangeError, function () { f(10); });
+    /* the values on the stack are freed on unwinding */
+    log = [];
+    for(i = 0; i < 3; i++) {
+        try {
+            log.push([i, { a: i }, "s" + i, thrower(i + 2)]);
+        } catch(e) {
+            log.push(e.message);
+        }
+    }
+    assert(log.length, 3);
+    assert(log[0][3], 2);
+    assert(log[1], "x = 3");
+    assert(log[2], "x = 4");
+}
+
+function test_bailout()
+{
+    var i, s, o;
+    /* finally (gosub/ret) exits to the interpreter with live locals */
+    function f(n) {
+        var a = n * 2, b = "v" + n;
+        try {
+            if (n > 1)
+                return a;
+        } finally {
+            a++;
+        }
+        return b + a;
+    }
+    for(i = 0; i < 4; i++)
+        assert(f(i), i > 1 ? i * 2 : "v" + i + (i * 2 + 1));
+    /* with */
+    function g(obj, n) {
+        var k = n + 1;
+        with (obj) {
+            return x + k;
+        }
+    }
+    o = { x: 10 };
+    for(i = 0; i < 3; i++)
+        assert(g(o, i), 11 + i);
+    /* direct eval sees the locals */
+    function h(n) {
+        var m = n * 3;
+        return eval("m + 1");
+    }
+    for(i = 0; i < 3; i++)
+        assert(h(i), i * 3 + 1);
+    /* generators stay in the interpreter */
+    function *gen(n) { for (var j = 0; j < n; j++) yield j; }
+    for(i = 0; i < 3; i++) {
+        s = 0;
+        for (var v of gen(5))
+            s += v;
+        assert(s, 10);
+    }
+}
+
+function test_closure_vars()
+{
+    var i, counter, fns;
+    function make() {
+        var c = 0;
+        return { inc: function () { return ++c; }, get: function () { return c; } };
+    }
+    counter = make();
+    for(i = 0; i < 10; i++)
+        counter.inc();
+    assert(counter.get(), 10);
+    fns = [];
+    for(let j = 0; j < 3; j++)
+        fns.push(function () { return j; });
+    assert(fns[0]() + fns[1]() + fns[2](), 3);
+}
+
+function test_recursion()
+{
+    function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+    assert(fib(20), 6765);
+    function depth(n) { return depth(n + 1); }
+    assert_throws(InternalError, function () { depth(0); });
+}
+
+test_int_overflow();
+test_loop_overflow();
+test_exception();
+test_bailout();
+test_closure_vars();
+test_recursion();
@@ -258,6 +258,175 @@ function test_prototype()
     assert(g.prototype.constructor, g, "prototype");
 }
 
+function test_inline_cache()
+{
+    var i, proto, o, other, p, log;
+    /* each access site is run several times so that the cache is filled
+       before the object, its shape or its prototype is changed */
+    function get_x(o) { return o.x; }
+    function get_x_loc(a) { var o = a; return o.x; }
+    function set_x(o, v) { o.x = v; }
+    function set_x_strict(o, v) { "use strict"; o.x = v; }
+    function call_m(o) { return o.m(); }
+
+    proto = { x: 1, m: function () { return "proto"; } };
+    o = Object.create(proto);
+    for(i = 0; i < 3; i++) {
+        assert(get_x(o), 1);
+        assert(get_x_loc(o), 1);
+        assert(call_m(o), "proto");
+    }
+    /* value of the prototype property */
+    proto.x = 2;
+    proto.m = function () { return "proto2"; };
+    assert(get_x(o), 2);
+    assert(get_x_loc(o), 2);
+    assert(call_m(o), "proto2");
+    /* prototype property replaced by an accessor */
+    Object.defineProperty(proto, "x", { get: function () { return 3; },
+                                        configurable: true });
+    assert(get_x(o), 3);
+    assert(get_x_loc(o), 3);
+    /* own property shadowing the prototype (o.x = 4 would call the
+       accessor of the prototype) */
+    Object.defineProperty(o, "x", { value: 4, writable: true,
+                                    configurable: true });
+    o.m = function () { return "own"; };
+    assert(get_x(o), 4);
+    assert(call_m(o), "own");
+    delete o.x;
+    delete o.m;
+    assert(get_x(o), 3);
+    assert(call_m(o), "proto2");
+    /* prototype changed */
+    other = { x: 5, m: function () { return "other"; } };
+    Object.setPrototypeOf(o, other);
+    assert(get_x(o), 5);
+    assert(get_x_loc(o), 5);
+    assert(call_m(o), "other");
+    /* property of a farther prototype shadowed by the direct prototype */
+    o = Object.create(Object.create(proto));
+    for(i = 0; i < 3; i++)
+        assert(get_x(o), 3);
+    Object.defineProperty(Object.getPrototypeOf(o), "x", { value: 6 });
+    assert(get_x(o), 6);
+
+    /* writes to a property which becomes read-only */
+    o = { x: 0 };
+    for(i = 0; i < 3; i++) {
+        set_x(o, i);
+        set_x_strict(o, i);
+    }
+    assert(o.x, 2);
+    Object.defineProperty(o, "x", { writable: false });
+    set_x(o, 10);
+    assert(o.x, 2);
+    assert_throws(TypeError, function () { set_x_strict(o, 10); });
+    assert(o.x, 2);
+    o = { x: 0 };
+    for(i = 0; i < 3; i++)
+        set_x_strict(o, i);
+    Object.freeze(o);
+    set_x(o, 10);
+    assert_throws(TypeError, function () { set_x_strict(o, 10); });
+    assert(o.x, 2);
+    /* setter on the prototype installed after the writes are cached */
+    log = [];
+    proto = {};
+    o = Object.create(proto);
+    o.x = 0;
+    for(i = 0; i < 3; i++)
+        set_x(o, i);
+    delete o.x;
+    Object.defineProperty(proto, "x", { set: function (v) { log.push(v); } });
+    set_x(o, 7);
+    assert(log.join(), "7");
+    assert(Object.hasOwn(o, "x"), false);
+
+    /* objects without a cacheable shape at the same sites */
+    log = [];
+    p = new Proxy({ x: 8 }, {
+        get: function (t, k) { log.push("get " + String(k)); return t[k]; },
+        set: function (t, k, v) { log.push("set " + String(k)); t[k] = v; return true; }
+    });
+    for(i = 0; i < 3; i++) {
+        assert(get_x(p), 8);
+        set_x(p, 8);
+    }
+    assert(log.length, 6);
+    assert(log[0], "get x");
+    assert(log[1], "set x");
+    function get_length(s) { return s.length; }
+    for(i = 0; i < 3; i++) {
+        assert(get_length(new String("abc")), 3);
+        assert(get_length("abcd"), 4);
+        assert(get_length([1, 2]), 2);
+    }
+    o = new String("ab");
+    o.x = 9;
+    assert(get_x(o), 9);
+    assert(get_x("ab"), undefined);
+    String.prototype.x = 10;
+    assert(get_x("ab"), 10);
+    delete String.prototype.x;
+    assert(get_x("ab"), undefined);
+
+    /* many shapes at one site */
+    for(i = 0; i < 200; i++) {
+        o = { x: i };
+        o["p" + i] = i;
+        assert(get_x(o), i);
+    }
+}
+
+function test_global_cache()
+{
+    var i, log;
+    function get_g() { return cached_global; }
+    function set_g(v) { cached_global = v; }
+    function set_g_strict(v) { "use strict"; cached_global = v; }
+
+    globalThis.cached_global = 1;
+    for(i = 0; i < 3; i++) {
+        assert(get_g(), 1);
+        set_g(1);
+        set_g_strict(1);
+    }
+    /* deleted */
+    delete globalThis.cached_global;
+    assert_throws(ReferenceError, get_g);
+    assert_throws(ReferenceError, function () { set_g_strict(2); });
+    assert(typeof cached_global, "undefined");
+    /* added again */
+    set_g(2);
+    assert(get_g(), 2);
+    set_g_strict(3);
+    assert(globalThis.cached_global, 3);
+    /* turned into an accessor */
+    log = [];
+    Object.defineProperty(globalThis, "cached_global", {
+        get: function () { return 4; },
+        set: function (v) { log.push(v); },
+        configurable: true
+    });
+    assert(get_g(), 4);
+    set_g(5);
+    set_g_strict(6);
+    assert(log.join(), "5,6");
+    /* back to a data property, then read-only */
+    Object.defineProperty(globalThis, "cached_global", {
+        value: 7, writable: true, configurable: true
+    });
+    for(i = 0; i < 3; i++)
+        assert(get_g(), 7);
+    Object.defineProperty(globalThis, "cached_global", { writable: false });
+    set_g(8);
+    assert(get_g(), 7);
+    assert_throws(TypeError, function () { set_g_strict(8); });
+    assert(get_g(), 7);
+    delete globalThis.cached_global;
+}
+
 function test_arguments()
 {
     function f2() {
@@ -533,6 +702,8 @@ test_inc_dec();
 test_op2();
 test_delete();
 test_prototype();
+test_inline_cache();
+test_global_cache();
 test_arguments();
 test_class();
 test_template();
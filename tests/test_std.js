@@ -139,6 +139,22 @@ function test_ext_json()
     assert(JSON.stringify(obj), expected);
 }
 
+function test_eval_script_global()
+{
+    var i, get_shadowed;
+    /* a global object property read by a script function is shadowed
+       by a top-level 'let' of a later script */
+    globalThis.shadowed_global = 1;
+    get_shadowed = std.evalScript("(function () { return shadowed_global; })");
+    for(i = 0; i < 3; i++)
+        assert(get_shadowed(), 1);
+    std.evalScript("let shadowed_global = 2;");
+    assert(get_shadowed(), 2);
+    assert(globalThis.shadowed_global, 1);
+    delete globalThis.shadowed_global;
+    assert(get_shadowed(), 2);
+}
+
 function test_os()
 {
     var fd, fpath, fname, fdir, buf, buf2, i, files, err, fdate, st, link_path;
@@ -279,3 +295,4 @@ test_os();
 test_os_exec();
 test_timer();
 test_ext_json();
+test_eval_script_global();